@@ -0,0 +1,4 @@
+#ifndef AOT_H
+#define AOT_H
+bool in_and_out_to_c(char *file_in, char *file_out);
+#endif
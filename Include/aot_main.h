@@ -0,0 +1,6 @@
+#ifndef AOT_MAIN_H
+#define AOT_MAIN_H
+constexpr int ARG_NUM = 3;
+constexpr int FILE_IN = 1;
+constexpr int FILE_OUT = 2;
+#endif
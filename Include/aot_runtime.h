@@ -0,0 +1,107 @@
+// Runtime for programs translated by aot. It is included only into the
+// generated translation unit and behaves like cpu: the same stacks growth,
+// the same checks and messages.
+#ifndef AOT_RUNTIME_H
+#define AOT_RUNTIME_H
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include "cpu.h"
+#include "memory.h"
+
+//! \brief Cpu of translated program
+struct Aot_Cpu
+{
+    double *stack;
+    int size;
+    int capacity;
+    int *ret_addr;
+    int ret_size;
+    int ret_capacity;
+    double regs[REG_NUMBER];
+    long long iregs[IREG_NUMBER];
+    struct Memory mem1;
+    struct Memory mem2;
+    struct Memory_Controller mc;
+};
+
+//! \brief Init cpu and its memory like cpu does
+static inline void
+aot_init(struct Aot_Cpu *cpu)
+{
+    cpu->stack = NULL;
+    cpu->size = 0;
+    cpu->capacity = 0;
+    cpu->ret_addr = NULL;
+    cpu->ret_size = 0;
+    cpu->ret_capacity = 0;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        cpu->regs[i] = 0;
+    }
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        cpu->iregs[i] = 0;
+    }
+    init_memory(&cpu->mem1, 10);
+    init_memory(&cpu->mem2, 5);
+    init_memory_controller(&cpu->mc);
+    add_memory(&cpu->mc, &cpu->mem1);
+    add_memory(&cpu->mc, &cpu->mem2);
+}
+
+static inline void
+aot_destroy(struct Aot_Cpu *cpu)
+{
+    free(cpu->stack);
+    free(cpu->ret_addr);
+}
+
+static inline void
+aot_push(struct Aot_Cpu *cpu, double value)
+{
+    if (cpu->size == cpu->capacity) {
+        cpu->capacity = cpu->capacity * 2 + 1;
+        cpu->stack = (double *)realloc(cpu->stack, cpu->capacity * sizeof(double));
+        if (!cpu->stack) {
+            fprintf(stderr, "CPU error: can not allocate memory for stack\n");
+            exit(1);
+        }
+    }
+    cpu->stack[cpu->size++] = value;
+}
+
+static inline void
+aot_push_ret(struct Aot_Cpu *cpu, int index)
+{
+    if (cpu->ret_size == cpu->ret_capacity) {
+        cpu->ret_capacity = cpu->ret_capacity * 2 + 1;
+        cpu->ret_addr = (int *)realloc(cpu->ret_addr, cpu->ret_capacity * sizeof(int));
+        if (!cpu->ret_addr) {
+            fprintf(stderr, "CPU error: can not allocate memory for stack\n");
+            exit(1);
+        }
+    }
+    cpu->ret_addr[cpu->ret_size++] = index;
+}
+
+//! \brief Check, if cpu stack has enough arguments
+static inline bool
+aot_check_arg_num(struct Aot_Cpu *cpu, int argn)
+{
+    if (cpu->size < argn) {
+        fprintf(stderr, "CPU error: not enough arguments on stack\n");
+        return false;
+    }
+    return true;
+}
+
+//! \brief Take one or two top values from cpu stack
+static inline void
+aot_take(struct Aot_Cpu *cpu, double *tmp1, double *tmp2)
+{
+    *tmp1 = cpu->stack[--cpu->size];
+    if (tmp2) {
+        *tmp2 = cpu->stack[--cpu->size];
+    }
+}
+#endif
@@ -43,6 +43,36 @@ const char RBX_STR[] = "rbx";
 //! Command string for rcx
 const char RCX_STR[] = "rcx";
 
+//! Command string for iax
+const char IAX_STR[] = "iax";
+
+//! Command string for ibx
+const char IBX_STR[] = "ibx";
+
+//! Command string for icx
+const char ICX_STR[] = "icx";
+
+//! Command string for integer move
+const char IMOV_STR[] = "imov";
+
+//! Command string for integer add
+const char IADD_STR[] = "iadd";
+
+//! Command string for integer sub
+const char ISUB_STR[] = "isub";
+
+//! Command string for integer mul
+const char IMUL_STR[] = "imul";
+
+//! Command string for integer jmpl
+const char IJMPL_STR[] = "ijmpl";
+
+//! Command string for integer jmpg
+const char IJMPG_STR[] = "ijmpg";
+
+//! Command string for integer jmpe
+const char IJMPE_STR[] = "ijmpe";
+
 //! Commands string for jmp
 const char JMP_STR[] = "jmp";
 
@@ -64,8 +94,32 @@ const char READ_STR[] = "read";
 //! Commands string for write
 const char WRITE_STR[] = "write";
 
+//! Command string for compare and swap
+const char CAS_STR[] = "cas";
+
+//! Command string for fetch and add
+const char XADD_STR[] = "xadd";
+
+//! Command string for memory fence
+const char FENCE_STR[] = "fence";
+
+//! Command string for cpu number
+const char CPUID_STR[] = "cpuid";
+
+//! Command string for number of cpus
+const char CPUNUM_STR[] = "cpunum";
+
+//! Command string for checkpoint
+const char SNAP_STR[] = "snap";
+
+//! Command string for subroutine on child cpu
+const char SPAWN_STR[] = "spawn";
+
+//! Command string for waiting for child cpus
+const char JOIN_STR[] = "join";
+
 constexpr mode_t out_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
-bool in_and_out_from_asm(char *file_in, char *file_out);
+bool in_and_out_from_asm(char *file_in, char *file_out, bool wide);
 void skip_nonimportant_symbols(char **commands, char *command);
 
 #endif
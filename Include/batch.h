@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+//! Maximum number of lanes, which execute program together
+constexpr int BATCH_MAX_LANES = 8;
+
+//! \brief Cpu state of one lane: one run of the program on one input line.
+//! Registers and cpu stack values are kept in vectors by batch engine.
+struct Batch_Lane
+{
+    int ip;             // index of the instruction to execute next
+    int size;           // cpu stack depth
+    int *ret_addr;      // return stack
+    int ret_size;
+    int ret_capacity;
+    char *input;        // input line of the run
+    size_t input_capacity;
+    char *input_pos;    // next value to read by in command
+    FILE *out;          // stdout of the run, printed when batch is finished
+    char *out_data;
+    size_t out_size;
+    FILE *err;          // stderr of the run
+    char *err_data;
+    size_t err_size;
+    struct Memory mem1;
+    struct Memory mem2;
+    struct Memory_Controller mc;
+};
+
+//! \brief Lanes and statistics of batch mode
+struct Batch
+{
+    struct Batch_Lane lanes[BATCH_MAX_LANES];
+    int lanes_num;      // lanes with input in the current batch
+    void *stack;        // cpu stack, one vector of lane values per slot
+    size_t stack_bytes;
+    long long executed;
+    long long dispatched;
+};
+
+bool work_batch(struct Program *program, int lanes, struct Batch *batch);
+bool init_batch(struct Batch *batch);
+void destroy_batch(struct Batch *batch);
+#endif
@@ -0,0 +1,326 @@
+// "Template" for batch engines, like cpu_engine.h for cpu engines.
+// Before including define:
+//   BATCH_NAME  - name of the function to generate
+//   BATCH_LANES - number of lanes in register and stack vectors
+// The file has no include guard on purpose: it is included once per width.
+
+//! Loop over lanes, which execute the current command
+#define FOR_LANES(l) \
+    for (int l = 0; l < BATCH_LANES; l++) \
+        if (group & (1u << l))
+
+//! Report error of the lane into its stderr and stop it
+#define LANE_ERROR(l, ...) \
+    do {\
+        fprintf(lanes[l].err, __VA_ARGS__);\
+        stopped |= 1u << l;\
+    } while (0)
+
+//! Go to the next command, changing stack depth by delta
+#define LANES_NEXT(delta) \
+    FOR_LANES(l) {\
+        lanes[l].ip = index + 1;\
+        lanes[l].size = depth + (delta);\
+    }
+
+//! Stop all lanes of the command, if they have less than argn stack
+//! values, with the messages of check_arg_num() and the command
+#define LANES_CHECK_ARG_NUM(argn, ...) \
+    if (depth < (argn)) {\
+        FOR_LANES(l) {\
+            fprintf(lanes[l].err, "CPU error: not enough arguments on stack\n");\
+            LANE_ERROR(l, __VA_ARGS__);\
+        }\
+        break;\
+    }
+
+//! \brief Execute decoded program on all lanes of the batch. Lanes are
+//! executed together while they are at the same instruction with the same
+//! stack depth. If they diverge, the lane with the least instruction goes
+//! first and the others wait for it, so they join again after branches.
+//! \param[in] program Decoded program without superinstructions and regions
+//! \param[in] batch Batch with started lanes
+static void
+BATCH_NAME(struct Program *program, struct Batch *batch)
+{
+    assert(program);
+    assert(batch);
+    assert(batch->lanes_num <= BATCH_LANES);
+
+    typedef double Lanes __attribute__((vector_size(BATCH_LANES * sizeof(double))));
+    typedef long long Lanes_Mask __attribute__((vector_size(BATCH_LANES * sizeof(long long))));
+    // integer registers are kept in Lanes_Mask, arithmetic wraps around in unsigned vectors
+    typedef unsigned long long Lanes_Unsigned __attribute__((vector_size(BATCH_LANES * sizeof(long long))));
+
+    struct Batch_Lane *lanes = batch->lanes;
+    Lanes regs[REG_NUMBER];
+    for (int i = 0; i < REG_NUMBER; i++) {
+        regs[i] = (Lanes){};
+    }
+    Lanes_Mask iregs[IREG_NUMBER];
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        iregs[i] = (Lanes_Mask){};
+    }
+    double lane_regs[REG_NUMBER] = {};
+    long long lane_iregs[IREG_NUMBER] = {};
+    double flag = 0;
+    unsigned running = (1u << batch->lanes_num) - 1;
+    unsigned group = 0;
+    Lanes_Mask mask = {};
+    bool together = false; // all running lanes are at the same instruction
+    while (running) {
+        int first = -1;
+        for (int l = 0; l < BATCH_LANES && (first < 0 || !together); l++) {
+            if ((running & (1u << l)) && (first < 0 || lanes[l].ip < lanes[first].ip)) {
+                first = l;
+            }
+        }
+        int index = lanes[first].ip;
+        int depth = lanes[first].size;
+        if (!together) {
+            group = 0;
+            for (int l = 0; l < BATCH_LANES; l++) {
+                mask[l] = 0;
+                if ((running & (1u << l)) && lanes[l].ip == index && lanes[l].size == depth) {
+                    group |= 1u << l;
+                    mask[l] = -1;
+                }
+            }
+        }
+        unsigned stopped = 0;
+        struct Instruction *instr = program->code + index;
+        batch->dispatched++;
+        if (instr->code != END_OF_PROGRAM) {
+            batch->executed += __builtin_popcount(group);
+        }
+        if (!batch_reserve(batch, (depth + 1) * sizeof(Lanes))) {
+            FOR_LANES(l) LANE_ERROR(l, "CPU error: can not allocate memory for stack\n");
+            running &= ~stopped;
+            together = false;
+            continue;
+        }
+        Lanes *stack = (Lanes *)batch->stack;
+
+        switch (instr->code) {
+            case HLT:
+            case END_OF_PROGRAM:
+                stopped = group;
+                break;
+            case ADD:
+                LANES_CHECK_ARG_NUM(2, "Not enough stack arguments in add commands\n");
+                stack[depth - 2] = mask ? stack[depth - 1] + stack[depth - 2] : stack[depth - 2];
+                LANES_NEXT(-1);
+                break;
+            case SUB:
+                LANES_CHECK_ARG_NUM(2, "Not enough stack arguments in sub commands\n");
+                stack[depth - 2] = mask ? stack[depth - 2] - stack[depth - 1] : stack[depth - 2];
+                LANES_NEXT(-1);
+                break;
+            case MUL:
+                LANES_CHECK_ARG_NUM(2, "Not enough stack arguments in mul commands\n");
+                stack[depth - 2] = mask ? stack[depth - 1] * stack[depth - 2] : stack[depth - 2];
+                LANES_NEXT(-1);
+                break;
+            case DIV: {
+                LANES_CHECK_ARG_NUM(2, "Not enough stack arguments in div commands\n");
+                // cpu checks the dividend, see work()
+                Lanes_Mask zero = (stack[depth - 2] < ZERO_EPS) & (stack[depth - 2] > -ZERO_EPS);
+                FOR_LANES(l) {
+                    if (zero[l]) {
+                        LANE_ERROR(l, "CPU error: zero division\n");
+                    }
+                }
+                stack[depth - 2] = (mask & ~zero) ? stack[depth - 2] / stack[depth - 1] : stack[depth - 2];
+                LANES_NEXT(-1);
+                break;
+            }
+            case SQRT:
+                LANES_CHECK_ARG_NUM(1, "Not enough stack arguments in sqrt command\n");
+                FOR_LANES(l) {
+                    if (stack[depth - 1][l] < 0) {
+                        LANE_ERROR(l, "CPU error: sqrt from negative value\n");
+                    } else {
+                        stack[depth - 1][l] = sqrt(stack[depth - 1][l]);
+                    }
+                }
+                LANES_NEXT(0);
+                break;
+            case PUSH_REG:
+                stack[depth] = mask ? regs[instr->reg1] : stack[depth];
+                LANES_NEXT(1);
+                break;
+            case PUSH_VAL:
+                stack[depth] = mask ? (Lanes){} + instr->value : stack[depth];
+                LANES_NEXT(1);
+                break;
+            case POP_REG:
+                LANES_CHECK_ARG_NUM(1, "CPU error: pop from empty stack\n");
+                regs[instr->reg1] = mask ? stack[depth - 1] : regs[instr->reg1];
+                LANES_NEXT(-1);
+                break;
+            case POP_VAL:
+                LANES_CHECK_ARG_NUM(1, "CPU error: pop from empty stack\n");
+                LANES_NEXT(-1);
+                break;
+            case IN:
+            case IN_REG:
+                FOR_LANES(l) {
+                    if (!lane_read(&lanes[l], &flag)) {
+                        LANE_ERROR(l, "Input error: can not get value\n");
+                    } else if (instr->code == IN) {
+                        stack[depth][l] = flag;
+                    } else {
+                        regs[instr->reg1][l] = flag;
+                    }
+                }
+                LANES_NEXT(instr->code == IN ? 1 : 0);
+                break;
+            case OUT:
+                LANES_CHECK_ARG_NUM(1, "CPU error: empty stack\n");
+                FOR_LANES(l) lane_write(&lanes[l], stack[depth - 1][l]);
+                LANES_NEXT(0);
+                break;
+            case OUT_REG:
+                FOR_LANES(l) lane_write(&lanes[l], regs[instr->reg1][l]);
+                LANES_NEXT(0);
+                break;
+            case JMP:
+                FOR_LANES(l) lanes[l].ip = instr->arg;
+                break;
+            case JMPL:
+            case JMPG: {
+                if (instr->code == JMPL) {
+                    LANES_CHECK_ARG_NUM(2, "jmpl command when less then 2 elements in stack!");
+                } else {
+                    LANES_CHECK_ARG_NUM(2, "jmpg command when less then 2 elements in stack!\n");
+                }
+                Lanes_Mask jump = instr->code == JMPL ? stack[depth - 2] < stack[depth - 1] :
+                                                        stack[depth - 2] > stack[depth - 1];
+                FOR_LANES(l) {
+                    lanes[l].ip = jump[l] ? instr->arg : index + 1;
+                    lanes[l].size = depth - 2;
+                }
+                break;
+            }
+            case CALL:
+                FOR_LANES(l) {
+                    if (!lane_ret_push(&lanes[l], index + 1)) {
+                        LANE_ERROR(l, "CPU error: can not allocate memory for stack\n");
+                    }
+                    lanes[l].ip = instr->arg;
+                }
+                break;
+            case RET:
+                FOR_LANES(l) {
+                    if (!lanes[l].ret_size) {
+                        LANE_ERROR(l, "Ret from no function! \n");
+                    } else {
+                        lanes[l].ip = lanes[l].ret_addr[--lanes[l].ret_size];
+                    }
+                }
+                break;
+            case PUSH_IREG:
+                FOR_LANES(l) stack[depth][l] = (double)iregs[instr->reg1][l];
+                LANES_NEXT(1);
+                break;
+            case POP_IREG:
+                LANES_CHECK_ARG_NUM(1, "CPU error: pop from empty stack\n");
+                FOR_LANES(l) {
+                    long long value = 0;
+                    if (!integer_value(stack[depth - 1][l], &value)) {
+                        LANE_ERROR(l, "CPU error: value %lf does not fit into integer register\n", stack[depth - 1][l]);
+                    } else {
+                        iregs[instr->reg1][l] = value;
+                    }
+                }
+                LANES_NEXT(-1);
+                break;
+            case IMOV_REG:
+                iregs[instr->reg1] = mask ? iregs[instr->reg2] : iregs[instr->reg1];
+                LANES_NEXT(0);
+                break;
+            case IMOV_VAL:
+                iregs[instr->reg1] = mask ? (Lanes_Mask){} + instr->ivalue : iregs[instr->reg1];
+                LANES_NEXT(0);
+                break;
+            case IADD_REG:
+            case IADD_VAL:
+            case ISUB_REG:
+            case ISUB_VAL:
+            case IMUL_REG:
+            case IMUL_VAL: {
+                Lanes_Unsigned a = (Lanes_Unsigned)iregs[instr->reg1];
+                Lanes_Unsigned b = (Lanes_Unsigned)iregs[instr->reg2];
+                if (instr->code == IADD_VAL || instr->code == ISUB_VAL || instr->code == IMUL_VAL) {
+                    b = (Lanes_Unsigned){} + (unsigned long long)instr->ivalue;
+                }
+                Lanes_Unsigned result = instr->code == IADD_REG || instr->code == IADD_VAL ? a + b :
+                                        instr->code == ISUB_REG || instr->code == ISUB_VAL ? a - b : a * b;
+                iregs[instr->reg1] = mask ? (Lanes_Mask)result : iregs[instr->reg1];
+                LANES_NEXT(0);
+                break;
+            }
+            case IJMPL:
+            case IJMPG:
+            case IJMPE: {
+                Lanes_Mask jump = instr->code == IJMPL ? iregs[instr->reg1] < iregs[instr->reg2] :
+                                  instr->code == IJMPG ? iregs[instr->reg1] > iregs[instr->reg2] :
+                                                         iregs[instr->reg1] == iregs[instr->reg2];
+                FOR_LANES(l) lanes[l].ip = jump[l] ? instr->arg : index + 1;
+                break;
+            }
+            case READ_IREG:
+            case WRITE_IREG:
+            case READ_REG:
+            case READ_ADDR:
+            case WRITE_REG:
+            case WRITE_ADDR:
+            case CAS:
+            case XADD:
+            case FENCE:
+            case CPUID:
+            case CPUNUM:
+                // memory is different for each lane, so lanes go one by one
+                FOR_LANES(l) {
+                    for (int i = 0; i < REG_NUMBER; i++) {
+                        lane_regs[i] = regs[i][l];
+                    }
+                    for (int i = 0; i < IREG_NUMBER; i++) {
+                        lane_iregs[i] = iregs[i][l];
+                    }
+                    if (!lane_command(&lanes[l], instr, lane_regs, lane_iregs, &flag)) {
+                        stopped |= 1u << l;
+                        continue;
+                    }
+                    for (int i = 0; i < REG_NUMBER; i++) {
+                        regs[i][l] = lane_regs[i];
+                    }
+                    if (instr->code == CAS) {
+                        stack[depth][l] = flag;
+                    }
+                }
+                LANES_NEXT(instr->code == CAS ? 1 : 0);
+                break;
+            case SNAP:
+                // batch mode has no checkpoints
+                LANES_NEXT(0);
+                break;
+            case SPAWN:
+            case JOIN:
+                FOR_LANES(l) LANE_ERROR(l, "CPU error: child cpus can not be used in batch mode\n");
+                break;
+            default:
+                FOR_LANES(l) LANE_ERROR(l, "CPU error: wrong commands\n");
+                break;
+        }
+        // lanes stay together after commands, which do not depend on values
+        together = group == running && !stopped && instr->code != JMPL && instr->code != JMPG &&
+                   instr->code != RET && instr->code != IJMPL && instr->code != IJMPG && instr->code != IJMPE;
+        running &= ~stopped;
+    }
+}
+
+#undef FOR_LANES
+#undef LANE_ERROR
+#undef LANES_NEXT
+#undef LANES_CHECK_ARG_NUM
@@ -0,0 +1,36 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+#include <cstdint>
+
+//! Number of values in channel, must be a power of two
+constexpr int CHANNEL_SIZE = 1 << 12;
+
+//! Failed attempts of blocked side, which only spin, then it yields host thread
+constexpr int CHANNEL_SPINS = 256;
+
+//! Failed attempts, after which blocked side sleeps between attempts
+constexpr int CHANNEL_YIELDS = 1024;
+
+//! Sleep of blocked side in nanoseconds
+constexpr long CHANNEL_SLEEP_NS = 50000;
+
+//! \brief Lock-free ring of values from one producer to one consumer.
+//! Every side writes only its own counter and keeps a copy of the other
+//! one, which is read again only when ring looks full or empty.
+struct Channel
+{
+    double values[CHANNEL_SIZE];
+    alignas(64) int64_t head;   // values taken by consumer
+    int64_t tail_seen;          // consumer copy of tail
+    alignas(64) int64_t tail;   // values put by producer
+    int64_t head_seen;          // producer copy of head
+    alignas(64) bool closed;    // producer will put no more values
+    bool detached;              // consumer will take no more values
+};
+
+void init_channel(struct Channel *channel);
+bool channel_push(struct Channel *channel, double value);
+bool channel_pop(struct Channel *channel, double *value);
+void close_channel(struct Channel *channel);
+void detach_channel(struct Channel *channel);
+#endif
@@ -0,0 +1,36 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <cstdint>
+
+//! The first bytes of checkpoint file
+const char CHECKPOINT_MAGIC[8] = "CPUSNAP";
+
+//! Version of checkpoint file format
+constexpr int32_t CHECKPOINT_VERSION = 3;
+
+//! Memory bars in checkpoint file start at this boundary, so they can be
+//! mapped right from the file
+constexpr int CHECKPOINT_ALIGN = 4096;
+
+//! \brief Beginning of checkpoint file. It is followed by cpu stack values,
+//! return addresses and 64-bit sizes of memory bars, then memory bars go,
+//! each from CHECKPOINT_ALIGN boundary.
+struct Checkpoint_Header
+{
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    int32_t version;
+    int32_t state;
+    int32_t ip;
+    int32_t stack_size;
+    int32_t ret_size;
+    int32_t memories_num;
+    uint64_t program_hash;      // hash of binary program, see program_hash()
+    double regs[REG_NUMBER];
+    int64_t iregs[IREG_NUMBER];
+};
+
+uint64_t program_hash(const char *bytecode, long bytecode_size);
+bool save_checkpoint(const char *file, struct Cpu *cpu, struct Memory_Controller *mc, uint64_t hash);
+bool load_checkpoint(const char *file, struct Cpu *cpu, struct Memory_Controller *mc, struct Program *program,
+                     uint64_t hash);
+#endif
@@ -1,21 +1,78 @@
 #ifndef CPU_H
 #define CPU_H
+constexpr int REG_NUMBER = 3;
+
+//! Number of integer registers, they keep counters and memory addresses
+//! without conversions from double
+constexpr int IREG_NUMBER = 3;
+
+//! \brief The first bytes of wide bytecode, the first one is not a command.
+//! Bytecode without them is compact: memory address operands have
+//! COMPACT_OPERAND_SIZE bytes. Wide bytecode is made by asm -w, its memory
+//! address operands have WIDE_OPERAND_SIZE bytes. Jump operands are the same
+//! in both, in wide bytecode they are offsets after the header.
+const char WIDE_MAGIC[7] = "\377CPU64";
+
+//! Version of wide bytecode, it is the byte after WIDE_MAGIC
+constexpr int WIDE_VERSION = 2;
+
+//! Size of magic and version of wide bytecode
+constexpr int WIDE_HEADER_SIZE = sizeof(WIDE_MAGIC) + 1;
+
+//! Size of memory address operands of compact bytecode
+constexpr int COMPACT_OPERAND_SIZE = 4;
+
+//! Size of memory address operands of wide bytecode
+constexpr int WIDE_OPERAND_SIZE = 8;
+
+//! Size of jump operands: decoded program has 32-bit offsets and indexes,
+//! so commands of any bytecode take less than 2 GB
+constexpr int JUMP_OPERAND_SIZE = 4;
+
 struct Cpu
 {
     int state;
     struct Stack_double *cpu_stack;
     struct Stack_int *ret_addr;
-    double rax;
-    double rbx;
-    double rcx;
+    double regs[REG_NUMBER]; // rax, rbx, rcx
+    long long iregs[IREG_NUMBER]; // iax, ibx, icx
+    int ip;                  // index of the instruction to execute next
+    int id;                  // cpu number in smp mode, see cpuid command
+    int cpus_num;            // number of cpus sharing memory controller
+    long long executed;
+    long long dispatched;
+    long long *pairs; // executed pairs of commands for statistics, or NULL
+    struct Profile *profile; // profile of execution, see -P option of cpu, or NULL
+    struct Trace *trace;     // last executed commands, see -t option of cpu, or NULL
+    struct Memo *memo;       // cache of pure calls, see -m option of cpu, or NULL
+    struct Fork_Pool *pool;  // worker threads for children, or NULL to run them at join
+    struct Fork_Task *children; // spawned and not joined children, the last spawned first
+    long long pause_at; // engine pauses at jumps, when executed reaches it
+    bool checkpoint;    // snap command pauses cpu to save checkpoint
+    int max_calls;      // engine pauses after call, which makes return stack deeper
 };
 
-constexpr int REG_NUMBER = 3;
 constexpr double ZERO_EPS = 1e-6;
 enum CPU_STATES {
     OFF = 0,
     ON,
-    WAIT
+    WAIT,
+    PAUSED, // engine returned to save checkpoint, it can go on from cpu->ip
+    BLOCKED // in command has no value yet, engine goes on from it, see --listen
+};
+
+//! Interpreter loops, which can execute commands
+enum CPU_ENGINES {
+    SWITCH_ENGINE = 0,
+    THREADED_ENGINE,
+    REGIR_ENGINE,    // threaded engine, which executes register IR regions
+    TOS_ENGINE,      // threaded engine, which keeps stack top in a local
+    VERIFIED_ENGINE, // threaded engine without stack checks for verified programs
+    JIT_ENGINE,      // native x86-64 code, interpreter executes commands it leaves
+    PAIRS_ENGINE,    // switch engine, which counts pairs of commands
+    PROFILE_ENGINE,  // switch engine, which profiles commands and memory
+    TRACE_ENGINE,    // switch engine, which records the last commands
+    MEMO_ENGINE      // threaded (if possible) engine, which memoizes pure calls
 };
 
 enum CPU_COMMANDS {
@@ -29,10 +86,30 @@ enum CPU_COMMANDS {
     READ_ADDR,
     WRITE_REG,
     WRITE_ADDR,
+    CAS,        // compare and swap memory value
+    XADD,       // add to memory value and get the old one
+    FENCE,      // full memory barrier
+    READ_IREG,  // read from memory pointed by integer register
+    WRITE_IREG, // write into memory pointed by integer register
+    CPUID = 20,
+    CPUNUM,
+    SNAP,       // save checkpoint, see -k option of cpu
     PUSH_REG = 30,
     PUSH_VAL,
     POP_REG,
     POP_VAL,
+    PUSH_IREG,  // push integer register as double
+    POP_IREG,   // pop double into integer register, fraction is dropped
+    // integer commands, the first operand is integer register, the second
+    // one is integer register or 64-bit value, arithmetic wraps around
+    IMOV_REG = 40,
+    IMOV_VAL,
+    IADD_REG,
+    IADD_VAL,
+    ISUB_REG,
+    ISUB_VAL,
+    IMUL_REG,
+    IMUL_VAL,
     IN = 60,
     IN_REG,
     OUT,
@@ -44,9 +121,24 @@ enum CPU_COMMANDS {
     JMPL,
     JMPG,
     CALL,
-    RET
+    RET,
+    SPAWN,      // call subroutine on child cpu, see Include/fork.h
+    JOIN,       // wait for child cpus and push their rax values
+    // jump, if the first integer register is less, greater or equal to the second one
+    IJMPL,
+    IJMPG,
+    IJMPE,
+    IAX = 120,
+    IBX,
+    ICX
 };
 
 bool turn_cpu_on(Cpu *cpu);
 void init(Cpu *cpu);
+void destroy_cpu(Cpu *cpu);
+void reset_cpu(Cpu *cpu);
+bool reserve_cpu_stacks(Cpu *cpu, int stack_size, int ret_size);
+int get_cpu_stack(Cpu *cpu, double **values);
+int get_ret_stack(Cpu *cpu, int **values);
+bool set_cpu_stacks(Cpu *cpu, const double *stack, int stack_size, const int *ret, int ret_size);
 #endif
@@ -0,0 +1,942 @@
+// "Template" for cpu interpreter loops, like Stack.h for stacks.
+// Before including define:
+//   ENGINE_NAME     - name of the function to generate
+//   ENGINE_THREADED - 1 for direct threaded dispatch (GCC labels as values),
+//                     0 for portable switch dispatch
+//   ENGINE_PAIRS    - 1 to count executed pairs of commands into cpu->pairs
+//                     (switch dispatch only)
+//   ENGINE_PROFILE  - 1 to count commands, host cycles, calls and memory
+//                     accesses into cpu->profile (switch dispatch only)
+//   ENGINE_TRACE    - 1 to record every command into ring buffer cpu->trace
+//                     (switch dispatch only)
+//   ENGINE_MEMO     - 1 to take results of pure calls from cache cpu->memo
+//                     (program must have pure functions found)
+//   ENGINE_REGIONS  - 1 to execute register IR regions (threaded dispatch only)
+//   ENGINE_TOS      - 1 to keep the stack top in a local (threaded dispatch only)
+//   ENGINE_UNCHECKED - 1 to skip stack size and capacity checks, only for
+//                     verified programs with preallocated stacks
+// The file has no include guard on purpose: it is included once per engine.
+
+#if ENGINE_PAIRS || ENGINE_PROFILE || ENGINE_TRACE || ENGINE_MEMO || ENGINE_UNCHECKED
+// children of spawn command have neither statistics nor preallocated stacks
+#define ENGINE_CHILD work
+#else
+#define ENGINE_CHILD ENGINE_NAME
+#endif
+
+#if ENGINE_THREADED
+
+//! Jump right into the handler of the current instruction
+#define NEXT_COMMAND \
+    dispatched++;\
+    goto *dispatch[ip->code]
+
+#define COMMAND(name) engine_##name
+#define WRONG_COMMAND engine_wrong_command
+
+//! Handler, which starts caching stack top (cpu stack was without cache)
+#define COMMAND_LOAD(name) engine_load_##name
+//! Handler for the state, when stack top is cached
+#define CACHED(name) engine_cached_##name
+
+//! Jump to the handler of the current instruction with cached stack top
+#define NEXT_CACHED \
+    dispatched++;\
+    goto *dispatch_tos[ip->code]
+
+// Dispatch tables are static: label addresses are constants, so the
+// compiler builds the tables and engine entry does not fill them. Every
+// table element is a chain of comparisons of its index with command codes.
+static_assert(DECODED_COMMANDS_NUM == 256, "dispatch tables are made of 256 elements");
+#define ENGINE_TABLE4(h, n) h(n), h((n) + 1), h((n) + 2), h((n) + 3)
+#define ENGINE_TABLE16(h, n) \
+    ENGINE_TABLE4(h, n), ENGINE_TABLE4(h, (n) + 4), ENGINE_TABLE4(h, (n) + 8), ENGINE_TABLE4(h, (n) + 12)
+#define ENGINE_TABLE64(h, n) \
+    ENGINE_TABLE16(h, n), ENGINE_TABLE16(h, (n) + 16), ENGINE_TABLE16(h, (n) + 32), ENGINE_TABLE16(h, (n) + 48)
+#define ENGINE_TABLE(h) \
+    ENGINE_TABLE64(h, 0), ENGINE_TABLE64(h, 64), ENGINE_TABLE64(h, 128), ENGINE_TABLE64(h, 192)
+
+#define ENGINE_ENTRY(n, name) (n) == (name) ? &&COMMAND(name) :
+#define ENGINE_CACHED_ENTRY(n, name) (n) == (name) ? &&CACHED(name) :
+#if ENGINE_TOS
+// pushes start caching stack top
+#define ENGINE_PUSH_ENTRY(n, name) (n) == (name) ? &&COMMAND_LOAD(name) :
+#else
+#define ENGINE_PUSH_ENTRY(n, name) ENGINE_ENTRY(n, name)
+#endif
+#if ENGINE_REGIONS
+#define ENGINE_REGION_ENTRY(n) ENGINE_ENTRY(n, REGION)
+#else
+#define ENGINE_REGION_ENTRY(n)
+#endif
+
+//! Handler of command n without cached stack top
+#define ENGINE_HANDLER(n) ( \
+    ENGINE_ENTRY(n, HLT) ENGINE_ENTRY(n, ADD) ENGINE_ENTRY(n, SUB) ENGINE_ENTRY(n, MUL) ENGINE_ENTRY(n, DIV) \
+    ENGINE_ENTRY(n, SQRT) ENGINE_ENTRY(n, RET) ENGINE_PUSH_ENTRY(n, PUSH_REG) ENGINE_PUSH_ENTRY(n, PUSH_VAL) \
+    ENGINE_ENTRY(n, POP_VAL) ENGINE_ENTRY(n, POP_REG) ENGINE_ENTRY(n, IN) ENGINE_ENTRY(n, IN_REG) \
+    ENGINE_ENTRY(n, OUT) ENGINE_ENTRY(n, OUT_REG) ENGINE_ENTRY(n, JMP) ENGINE_ENTRY(n, JMPL) ENGINE_ENTRY(n, JMPG) \
+    ENGINE_ENTRY(n, CALL) ENGINE_ENTRY(n, WRITE_REG) ENGINE_ENTRY(n, WRITE_ADDR) ENGINE_ENTRY(n, READ_ADDR) \
+    ENGINE_ENTRY(n, READ_REG) ENGINE_ENTRY(n, CAS) ENGINE_ENTRY(n, XADD) ENGINE_ENTRY(n, FENCE) \
+    ENGINE_ENTRY(n, CPUID) ENGINE_ENTRY(n, CPUNUM) ENGINE_ENTRY(n, SNAP) ENGINE_ENTRY(n, SPAWN) \
+    ENGINE_ENTRY(n, JOIN) ENGINE_ENTRY(n, PUSH_IREG) ENGINE_ENTRY(n, POP_IREG) ENGINE_ENTRY(n, IMOV_REG) \
+    ENGINE_ENTRY(n, IMOV_VAL) ENGINE_ENTRY(n, IADD_REG) ENGINE_ENTRY(n, IADD_VAL) ENGINE_ENTRY(n, ISUB_REG) \
+    ENGINE_ENTRY(n, ISUB_VAL) ENGINE_ENTRY(n, IMUL_REG) ENGINE_ENTRY(n, IMUL_VAL) ENGINE_ENTRY(n, IJMPL) \
+    ENGINE_ENTRY(n, IJMPG) ENGINE_ENTRY(n, IJMPE) ENGINE_ENTRY(n, READ_IREG) ENGINE_ENTRY(n, WRITE_IREG) \
+    ENGINE_ENTRY(n, END_OF_PROGRAM) ENGINE_ENTRY(n, PUSH_REG_PUSH_REG) ENGINE_ENTRY(n, PUSH_REG_PUSH_VAL) \
+    ENGINE_ENTRY(n, PUSH_REG_REG_JMPL) ENGINE_ENTRY(n, PUSH_REG_REG_JMPG) ENGINE_ENTRY(n, PUSH_REG_VAL_JMPL) \
+    ENGINE_ENTRY(n, PUSH_REG_VAL_JMPG) ENGINE_ENTRY(n, PUSH_VAL_JMPL) ENGINE_ENTRY(n, PUSH_VAL_JMPG) \
+    ENGINE_ENTRY(n, PUSH_VAL_ADD) ENGINE_ENTRY(n, PUSH_VAL_SUB) ENGINE_ENTRY(n, PUSH_VAL_MUL) \
+    ENGINE_ENTRY(n, PUSH_VAL_DIV) ENGINE_ENTRY(n, POP_REG_PUSH_REG) ENGINE_REGION_ENTRY(n) \
+    &&WRONG_COMMAND)
+
+//! Handler of command n with cached stack top, commands without it spill the cache
+#define ENGINE_CACHED_HANDLER(n) ( \
+    ENGINE_CACHED_ENTRY(n, PUSH_REG) ENGINE_CACHED_ENTRY(n, PUSH_VAL) ENGINE_CACHED_ENTRY(n, POP_REG) \
+    ENGINE_CACHED_ENTRY(n, POP_VAL) ENGINE_CACHED_ENTRY(n, ADD) ENGINE_CACHED_ENTRY(n, SUB) \
+    ENGINE_CACHED_ENTRY(n, MUL) ENGINE_CACHED_ENTRY(n, DIV) ENGINE_CACHED_ENTRY(n, SQRT) \
+    ENGINE_CACHED_ENTRY(n, OUT) ENGINE_CACHED_ENTRY(n, JMP) ENGINE_CACHED_ENTRY(n, JMPL) \
+    ENGINE_CACHED_ENTRY(n, JMPG) &&engine_spill)
+
+#else
+
+#define NEXT_COMMAND break
+#define COMMAND(name) case name
+#define WRONG_COMMAND default
+
+#endif
+
+#if ENGINE_UNCHECKED
+
+// verify_program() proved, that stacks have enough values and capacity
+#define STACK_PUSH(value) (cpu->cpu_stack->data[cpu->cpu_stack->size++] = (value))
+#define STACK_POP() (cpu->cpu_stack->size--)
+#define STACK_TOP() (cpu->cpu_stack->data[cpu->cpu_stack->size - 1])
+#define STACK_DEPTH() (cpu->cpu_stack->size)
+#define STACK_EMPTY() (cpu->cpu_stack->size == 0)
+#define TAKE_FROM_STACK(tmp1, tmp2) \
+    ((tmp1) = cpu->cpu_stack->data[--cpu->cpu_stack->size],\
+     (tmp2) = cpu->cpu_stack->data[--cpu->cpu_stack->size])
+#define TAKE_FROM_STACK_TOP(tmp1) (tmp1) = cpu->cpu_stack->data[--cpu->cpu_stack->size]
+#define CHECK_ARG_NUM(argn) true
+#define RET_PUSH(index) (cpu->ret_addr->data[cpu->ret_addr->size++] = (index))
+#define RET_POP() (cpu->ret_addr->size--)
+#define RET_TOP() (cpu->ret_addr->data[cpu->ret_addr->size - 1])
+#define RET_EMPTY() false
+
+#else
+
+#define STACK_PUSH(value) Stack_Push(cpu->cpu_stack, (value))
+#define STACK_POP() Stack_Pop(cpu->cpu_stack)
+#define STACK_TOP() Stack_Top(cpu->cpu_stack)
+#define STACK_DEPTH() Stack_Size(cpu->cpu_stack)
+#define STACK_EMPTY() Stack_Empty(cpu->cpu_stack)
+#define TAKE_FROM_STACK(tmp1, tmp2) take_from_cpu_stack(cpu, &(tmp1), &(tmp2))
+#define TAKE_FROM_STACK_TOP(tmp1) take_from_cpu_stack(cpu, &(tmp1), NULL)
+#define CHECK_ARG_NUM(argn) check_arg_num(cpu, (argn))
+#define RET_PUSH(index) Stack_Push(cpu->ret_addr, (index))
+#define RET_POP() Stack_Pop(cpu->ret_addr)
+#define RET_TOP() Stack_Top(cpu->ret_addr)
+#define RET_EMPTY() Stack_Empty(cpu->ret_addr)
+
+#endif
+
+#if ENGINE_PROFILE
+
+#define PROFILE_STOP() stop_profile(cpu->profile)
+#define PROFILE_MEMORY(address, write) profile_memory(cpu->profile, (address), (write))
+#define PROFILE_CALL(index) (cpu->profile->calls[(index)]++)
+
+#else
+
+#define PROFILE_STOP()
+#define PROFILE_MEMORY(address, write)
+#define PROFILE_CALL(index)
+
+#endif
+
+#if ENGINE_TRACE
+#define TRACE_MEMORY(address) trace_memory(cpu->trace, (address))
+#else
+#define TRACE_MEMORY(address)
+#endif
+
+//! Command uses memory cell
+#define MEMORY_ACCESS(address, write) \
+    PROFILE_MEMORY((address), (write));\
+    TRACE_MEMORY((address))
+
+//! Commands executed by cpu till now
+#define EXECUTED() (cpu->executed + dispatched + merged)
+
+//! Leave engine, saving execution statistics into cpu
+#define ENGINE_RETURN(result) \
+    PROFILE_STOP();\
+    cpu->ip = ip - code;\
+    cpu->dispatched += dispatched;\
+    cpu->executed += dispatched + merged;\
+    return (result)
+
+//! Cpu must be paused: it executed cpu->pause_at commands. Pause_at can be
+//! changed by signal handler, so it is read every time.
+#define PAUSE_NEEDED() \
+    (EXECUTED() >= __atomic_load_n(&cpu->pause_at, __ATOMIC_RELAXED))
+
+//! Leave engine after jumps, if cpu must be paused
+#define PAUSE_POINT \
+    if (PAUSE_NEEDED()) {\
+        cpu->state = PAUSED;\
+        ENGINE_RETURN(true);\
+    }
+
+//! Leave engine at once, cpu must be paused whatever executed is
+#define PAUSE_NOW \
+    __atomic_store_n(&cpu->pause_at, 0, __ATOMIC_RELAXED);\
+    cpu->state = PAUSED;\
+    ENGINE_RETURN(true)
+
+//! Leave engine at in command without value, it is executed again, when
+//! cpu goes on, so it is not counted now
+#define IN_BLOCKED \
+    dispatched--;\
+    cpu->state = BLOCKED;\
+    ENGINE_RETURN(true)
+
+//! \brief Execute decoded program from the instruction cpu->ip
+//! \param[in] program Decoded program
+//! \param[in] cpu Pointer to cpu which will process commands
+//! \param[in] mc Memory controller for read and write commands
+//! \return Return true, if no errors during execution
+bool
+ENGINE_NAME(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc)
+{
+    assert(program);
+    assert(cpu);
+    assert(mc);
+
+    if (cpu->state != ON) {
+        turn_cpu_on(cpu);
+    }
+    struct Instruction *code = program->code;
+    struct Instruction *ip = code + cpu->ip;
+    double *regs = cpu->regs;
+    long long *iregs = cpu->iregs;
+    double tmp_double1 = 0, tmp_double2 = 0;
+    bool swapped = false;
+    int in_result = CPU_IN_NONE;
+    long long dispatched = 0;
+    long long merged = 0; // commands executed inside of superinstructions
+#if ENGINE_PAIRS
+    int prev_code = END_OF_PROGRAM;
+#endif
+
+#if ENGINE_THREADED
+    static void *const dispatch[DECODED_COMMANDS_NUM] = {ENGINE_TABLE(ENGINE_HANDLER)};
+#if ENGINE_REGIONS
+    int next_index = 0;
+#endif
+#if ENGINE_TOS
+    // Stack top is either on cpu stack (dispatch) or in tos (dispatch_tos).
+    // Commands without cached handler spill tos and go to usual handlers.
+    double tos = 0;
+    static void *const dispatch_tos[DECODED_COMMANDS_NUM] = {ENGINE_TABLE(ENGINE_CACHED_HANDLER)};
+#endif
+    NEXT_COMMAND;
+    {
+        {
+#else
+    while (true) {
+        dispatched++;
+#if ENGINE_PAIRS
+        cpu->pairs[prev_code * DECODED_COMMANDS_NUM + ip->code]++;
+        prev_code = ip->code;
+#endif
+#if ENGINE_PROFILE
+        profile_command(cpu->profile, ip - code);
+#endif
+#if ENGINE_TRACE
+        trace_command(cpu->trace, ip->offset, ip->code, cpu->cpu_stack->size, cpu->cpu_stack->data);
+#endif
+        switch (ip->code) {
+#endif
+            COMMAND(HLT):
+                ip++;
+                cpu->state = OFF;
+                empty_cpu_stacks(cpu);
+                //CPU was stopped. Just stop working on commands
+                ENGINE_RETURN(true);
+            COMMAND(ADD):
+                if (!CHECK_ARG_NUM(2)) {
+                    fprintf(stderr, "Not enough stack arguments in add commands\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                TAKE_FROM_STACK(tmp_double1, tmp_double2);
+                STACK_PUSH(tmp_double1 + tmp_double2);
+                NEXT_COMMAND;
+            COMMAND(SUB):
+                if (!CHECK_ARG_NUM(2)) {
+                    fprintf(stderr, "Not enough stack arguments in sub commands\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                TAKE_FROM_STACK(tmp_double1, tmp_double2);
+                STACK_PUSH(tmp_double2 - tmp_double1);
+                NEXT_COMMAND;
+            COMMAND(MUL):
+                if (!CHECK_ARG_NUM(2)) {
+                    fprintf(stderr, "Not enough stack arguments in mul commands\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                TAKE_FROM_STACK(tmp_double1, tmp_double2);
+                STACK_PUSH(tmp_double1 * tmp_double2);
+                NEXT_COMMAND;
+            COMMAND(DIV):
+                if (!CHECK_ARG_NUM(2)) {
+                    fprintf(stderr, "Not enough stack arguments in div commands\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                TAKE_FROM_STACK(tmp_double1, tmp_double2);
+                if (fabs(tmp_double2) < ZERO_EPS) {
+                    fprintf(stderr, "CPU error: zero division\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                STACK_PUSH(tmp_double2 / tmp_double1);
+                NEXT_COMMAND;
+            COMMAND(SQRT):
+                if (!CHECK_ARG_NUM(1)) {
+                    fprintf(stderr, "Not enough stack arguments in sqrt command\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                TAKE_FROM_STACK_TOP(tmp_double1);
+                if (tmp_double1 < 0) {
+                    fprintf(stderr, "CPU error: sqrt from negative value\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                STACK_PUSH(sqrt(tmp_double1));
+                NEXT_COMMAND;
+            COMMAND(RET):
+                if (RET_EMPTY()) {
+                    fprintf(stderr, "Ret from no function! \n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+#if ENGINE_MEMO
+                if (cpu->memo->frames_num) {
+                    memo_ret(cpu->memo, program, cpu, EXECUTED());
+                }
+#endif
+                ip = code + RET_TOP(); //to begin from the NEXT command afrer CALL command
+                RET_POP();
+                PAUSE_POINT;
+                NEXT_COMMAND;
+#if !ENGINE_TOS
+            // with cached stack top pushes always start with COMMAND_LOAD
+            COMMAND(PUSH_REG):
+                STACK_PUSH(regs[ip->reg1]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL):
+#endif
+            unfused_PUSH_VAL:
+                STACK_PUSH(ip->value);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(POP_VAL):
+                if (!CHECK_ARG_NUM(1)) {
+                    cpu->state = WAIT;
+                    fprintf(stderr, "CPU error: pop from empty stack\n");
+                    ENGINE_RETURN(false);
+                }
+                STACK_POP();
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(POP_REG):
+            unfused_POP_REG:
+                if (!CHECK_ARG_NUM(1)) {
+                    cpu->state = WAIT;
+                    fprintf(stderr, "CPU error: pop from empty stack\n");
+                    ENGINE_RETURN(false);
+                }
+                TAKE_FROM_STACK_TOP(regs[ip->reg1]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IN):
+                in_result = cpu_in(&tmp_double1);
+                if (in_result == CPU_IN_BLOCKED) {
+                    IN_BLOCKED;
+                }
+                if (in_result != CPU_IN_VALUE) {
+                    fprintf(stderr, "Input error: can not get value\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                STACK_PUSH(tmp_double1);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IN_REG):
+                in_result = cpu_in(&tmp_double1);
+                if (in_result == CPU_IN_BLOCKED) {
+                    IN_BLOCKED;
+                }
+                if (in_result != CPU_IN_VALUE) {
+                    fprintf(stderr, "Input error: can not get value\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                regs[ip->reg1] = tmp_double1;
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(OUT):
+                if (!CHECK_ARG_NUM(1)) {
+                    fprintf(stderr, "CPU error: empty stack\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                cpu_out(STACK_TOP());
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(OUT_REG):
+                cpu_out(regs[ip->reg1]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(JMP):
+                ip = code + ip->arg;
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(JMPL):
+                if (!CHECK_ARG_NUM(2)) {
+                    fprintf(stderr, "jmpl command when less then 2 elements in stack!");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                TAKE_FROM_STACK(tmp_double1, tmp_double2);
+                if (tmp_double2 < tmp_double1) { //jmp
+                    ip = code + ip->arg;
+                } else {
+                    ip++;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(JMPG):
+                if (!CHECK_ARG_NUM(2)) {
+                    fprintf(stderr, "jmpg command when less then 2 elements in stack!\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                TAKE_FROM_STACK(tmp_double1, tmp_double2);
+                if (tmp_double2 > tmp_double1) { //jmp
+                    ip = code + ip->arg;
+                } else {
+                    ip++;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(CALL):
+                PROFILE_CALL(ip->arg);
+#if ENGINE_MEMO
+                if (program->pure_index[ip->arg] >= 0) {
+                    const struct Memo_Entry *entry =
+                        memo_call(cpu->memo, program, cpu, program->pure_index[ip->arg], EXECUTED());
+                    if (entry) {
+                        // cpu gets state, which the call would leave
+                        const struct Pure_Function *pure = &program->pure[entry->function];
+                        for (int i = 0; i < pure->args; i++) {
+                            STACK_POP();
+                        }
+                        for (int i = 0; i < pure->results; i++) {
+                            STACK_PUSH(entry->values[i]);
+                        }
+                        for (int i = 0, value = pure->results; i < REG_NUMBER; i++) {
+                            if (pure->outputs & (1u << i)) {
+                                regs[i] = entry->values[value++];
+                            }
+                        }
+                        ip++;
+                        PAUSE_POINT;
+                        NEXT_COMMAND;
+                    }
+                }
+#endif
+                RET_PUSH(ip - code + 1); // remember ret address
+                ip = code + ip->arg;
+                // caller of engine stops cpu, see run_quantum() and run_vm()
+                if (cpu->ret_addr->size > cpu->max_calls) {
+                    PAUSE_NOW;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(WRITE_REG):
+                MEMORY_ACCESS(memory_address(regs[ip->reg2]), true);
+                if (write_into_memory(mc, memory_address(regs[ip->reg2]), regs[ip->reg1])) {
+                    fprintf(stderr, "Memory request error: can not write into address %lf\n", regs[ip->reg2]);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(WRITE_ADDR):
+                MEMORY_ACCESS(ip->address, true);
+                write_into_memory(mc, ip->address, regs[ip->reg1]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(READ_ADDR):
+                MEMORY_ACCESS(ip->address, false);
+                get_from_memory(mc, ip->address, &regs[ip->reg1]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(READ_REG):
+                MEMORY_ACCESS(memory_address(regs[ip->reg1]), false);
+                // value, which is not an address, stops cpu like for write
+                if (get_from_memory(mc, memory_address(regs[ip->reg1]), &regs[ip->reg2]) == NEGATIVE_MEM) {
+                    fprintf(stderr, "Memory request error: can not read from address %lf\n", regs[ip->reg1]);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            // Atomic commands for cpus sharing memory controller
+            COMMAND(CAS):
+                MEMORY_ACCESS(memory_address(regs[ip->reg3]), true);
+                if (compare_exchange_memory(mc, memory_address(regs[ip->reg3]), &regs[ip->reg1], regs[ip->reg2],
+                                            &swapped)) {
+                    fprintf(stderr, "Memory request error: can not write into address %lf\n", regs[ip->reg3]);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                STACK_PUSH(swapped ? 1 : 0);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(XADD):
+                MEMORY_ACCESS(memory_address(regs[ip->reg2]), true);
+                if (exchange_add_memory(mc, memory_address(regs[ip->reg2]), regs[ip->reg1], &regs[ip->reg1])) {
+                    fprintf(stderr, "Memory request error: can not write into address %lf\n", regs[ip->reg2]);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(FENCE):
+                memory_fence(mc);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(CPUID):
+                regs[ip->reg1] = cpu->id;
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(CPUNUM):
+                regs[ip->reg1] = cpu->cpus_num;
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(SNAP):
+                ip++;
+                if (cpu->checkpoint) {
+                    PAUSE_NOW;
+                }
+                NEXT_COMMAND;
+            // Children share memory controller and work in fork pool
+            COMMAND(SPAWN):
+                if (!fork_spawn(cpu, program, mc, ENGINE_CHILD, ip->arg)) {
+                    fprintf(stderr, "CPU error: can not start child cpu\n");
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(JOIN):
+                ip++;
+                if (!join_children(cpu)) {
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                NEXT_COMMAND;
+            // Integer registers, arithmetic wraps around as in two's complement
+            COMMAND(PUSH_IREG):
+                STACK_PUSH((double)iregs[ip->reg1]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(POP_IREG):
+                if (!CHECK_ARG_NUM(1)) {
+                    cpu->state = WAIT;
+                    fprintf(stderr, "CPU error: pop from empty stack\n");
+                    ENGINE_RETURN(false);
+                }
+                TAKE_FROM_STACK_TOP(tmp_double1);
+                if (!integer_value(tmp_double1, &iregs[ip->reg1])) {
+                    fprintf(stderr, "CPU error: value %lf does not fit into integer register\n", tmp_double1);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IMOV_REG):
+                iregs[ip->reg1] = iregs[ip->reg2];
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IMOV_VAL):
+                iregs[ip->reg1] = ip->ivalue;
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IADD_REG):
+                iregs[ip->reg1] = (long long)((unsigned long long)iregs[ip->reg1] + iregs[ip->reg2]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IADD_VAL):
+                iregs[ip->reg1] = (long long)((unsigned long long)iregs[ip->reg1] + ip->ivalue);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(ISUB_REG):
+                iregs[ip->reg1] = (long long)((unsigned long long)iregs[ip->reg1] - iregs[ip->reg2]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(ISUB_VAL):
+                iregs[ip->reg1] = (long long)((unsigned long long)iregs[ip->reg1] - ip->ivalue);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IMUL_REG):
+                iregs[ip->reg1] = (long long)((unsigned long long)iregs[ip->reg1] * iregs[ip->reg2]);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IMUL_VAL):
+                iregs[ip->reg1] = (long long)((unsigned long long)iregs[ip->reg1] * ip->ivalue);
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(IJMPL):
+                ip = iregs[ip->reg1] < iregs[ip->reg2] ? code + ip->arg : ip + 1;
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(IJMPG):
+                ip = iregs[ip->reg1] > iregs[ip->reg2] ? code + ip->arg : ip + 1;
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(IJMPE):
+                ip = iregs[ip->reg1] == iregs[ip->reg2] ? code + ip->arg : ip + 1;
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(READ_IREG):
+                MEMORY_ACCESS(iregs[ip->reg1], false);
+                if (get_from_memory(mc, iregs[ip->reg1], &regs[ip->reg2]) == NEGATIVE_MEM) {
+                    fprintf(stderr, "Memory request error: can not read from address %lld\n", iregs[ip->reg1]);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            COMMAND(WRITE_IREG):
+                MEMORY_ACCESS(iregs[ip->reg2], true);
+                if (write_into_memory(mc, iregs[ip->reg2], regs[ip->reg1])) {
+                    fprintf(stderr, "Memory request error: can not write into address %lld\n", iregs[ip->reg2]);
+                    cpu->state = WAIT;
+                    ENGINE_RETURN(false);
+                }
+                ip++;
+                NEXT_COMMAND;
+            // Superinstructions. If something can go wrong, they execute
+            // the first command as usual and the others one by one.
+            COMMAND(PUSH_REG_PUSH_REG):
+                STACK_PUSH(regs[ip->reg1]);
+                STACK_PUSH(regs[ip[1].reg1]);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+            COMMAND(PUSH_REG_PUSH_VAL):
+                STACK_PUSH(regs[ip->reg1]);
+                STACK_PUSH(ip[1].value);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+            COMMAND(PUSH_REG_REG_JMPL):
+                merged += 2;
+                if (regs[ip->reg1] < regs[ip[1].reg1]) {
+                    ip = code + ip[2].arg;
+                } else {
+                    ip += 3;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(PUSH_REG_REG_JMPG):
+                merged += 2;
+                if (regs[ip->reg1] > regs[ip[1].reg1]) {
+                    ip = code + ip[2].arg;
+                } else {
+                    ip += 3;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(PUSH_REG_VAL_JMPL):
+                merged += 2;
+                if (regs[ip->reg1] < ip[1].value) {
+                    ip = code + ip[2].arg;
+                } else {
+                    ip += 3;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(PUSH_REG_VAL_JMPG):
+                merged += 2;
+                if (regs[ip->reg1] > ip[1].value) {
+                    ip = code + ip[2].arg;
+                } else {
+                    ip += 3;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL_JMPL):
+                if (STACK_DEPTH() < 1) {
+                    goto unfused_PUSH_VAL;
+                }
+                TAKE_FROM_STACK_TOP(tmp_double2);
+                merged++;
+                if (tmp_double2 < ip->value) {
+                    ip = code + ip[1].arg;
+                } else {
+                    ip += 2;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL_JMPG):
+                if (STACK_DEPTH() < 1) {
+                    goto unfused_PUSH_VAL;
+                }
+                TAKE_FROM_STACK_TOP(tmp_double2);
+                merged++;
+                if (tmp_double2 > ip->value) {
+                    ip = code + ip[1].arg;
+                } else {
+                    ip += 2;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL_ADD):
+                if (STACK_DEPTH() < 1) {
+                    goto unfused_PUSH_VAL;
+                }
+                TAKE_FROM_STACK_TOP(tmp_double2);
+                STACK_PUSH(ip->value + tmp_double2);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL_SUB):
+                if (STACK_DEPTH() < 1) {
+                    goto unfused_PUSH_VAL;
+                }
+                TAKE_FROM_STACK_TOP(tmp_double2);
+                STACK_PUSH(tmp_double2 - ip->value);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL_MUL):
+                if (STACK_DEPTH() < 1) {
+                    goto unfused_PUSH_VAL;
+                }
+                TAKE_FROM_STACK_TOP(tmp_double2);
+                STACK_PUSH(ip->value * tmp_double2);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+            COMMAND(PUSH_VAL_DIV):
+                if (STACK_DEPTH() < 1 || fabs(STACK_TOP()) < ZERO_EPS) {
+                    goto unfused_PUSH_VAL;
+                }
+                TAKE_FROM_STACK_TOP(tmp_double2);
+                STACK_PUSH(tmp_double2 / ip->value);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+            COMMAND(POP_REG_PUSH_REG):
+                if (STACK_DEPTH() < 1) {
+                    goto unfused_POP_REG;
+                }
+                TAKE_FROM_STACK_TOP(regs[ip->reg1]);
+                STACK_PUSH(regs[ip[1].reg1]);
+                ip += 2;
+                merged++;
+                NEXT_COMMAND;
+#if ENGINE_REGIONS
+            COMMAND(REGION):
+                next_index = run_region(program, ip->arg, cpu);
+                if (next_index < 0) {
+                    // region can not be finished, its commands will say why
+                    goto *dispatch[program->regions[ip->arg].code];
+                }
+                merged += program->regions[ip->arg].len - 1;
+                if (next_index == program->regions[ip->arg].next) {
+                    ip = code + next_index;
+                    NEXT_COMMAND;
+                }
+                // only jump targets start commands in every engine
+                ip = code + next_index;
+                PAUSE_POINT;
+                NEXT_COMMAND;
+#endif
+#if ENGINE_TOS
+            // Errors are reported by usual handlers, so cached ones spill tos
+            // and go there, if something is wrong
+            engine_spill:
+                STACK_PUSH(tos);
+                goto *dispatch[ip->code];
+            COMMAND_LOAD(PUSH_REG):
+                tos = regs[ip->reg1];
+                ip++;
+                NEXT_CACHED;
+            COMMAND_LOAD(PUSH_VAL):
+                tos = ip->value;
+                ip++;
+                NEXT_CACHED;
+            CACHED(PUSH_REG):
+                STACK_PUSH(tos);
+                tos = regs[ip->reg1];
+                ip++;
+                NEXT_CACHED;
+            CACHED(PUSH_VAL):
+                STACK_PUSH(tos);
+                tos = ip->value;
+                ip++;
+                NEXT_CACHED;
+            CACHED(POP_REG):
+                regs[ip->reg1] = tos;
+                ip++;
+                NEXT_COMMAND;
+            CACHED(POP_VAL):
+                ip++;
+                NEXT_COMMAND;
+            CACHED(ADD):
+                if (STACK_EMPTY()) {
+                    goto engine_spill;
+                }
+                tos = tos + STACK_TOP();
+                STACK_POP();
+                ip++;
+                NEXT_CACHED;
+            CACHED(SUB):
+                if (STACK_EMPTY()) {
+                    goto engine_spill;
+                }
+                tos = STACK_TOP() - tos;
+                STACK_POP();
+                ip++;
+                NEXT_CACHED;
+            CACHED(MUL):
+                if (STACK_EMPTY()) {
+                    goto engine_spill;
+                }
+                tos = tos * STACK_TOP();
+                STACK_POP();
+                ip++;
+                NEXT_CACHED;
+            CACHED(DIV):
+                if (STACK_EMPTY() || fabs(STACK_TOP()) < ZERO_EPS) {
+                    goto engine_spill;
+                }
+                tos = STACK_TOP() / tos;
+                STACK_POP();
+                ip++;
+                NEXT_CACHED;
+            CACHED(SQRT):
+                if (tos < 0) {
+                    goto engine_spill;
+                }
+                tos = sqrt(tos);
+                ip++;
+                NEXT_CACHED;
+            CACHED(OUT):
+                cpu_out(tos);
+                ip++;
+                NEXT_CACHED;
+            CACHED(JMP):
+                ip = code + ip->arg;
+                if (PAUSE_NEEDED()) {
+                    STACK_PUSH(tos);
+                    cpu->state = PAUSED;
+                    ENGINE_RETURN(true);
+                }
+                NEXT_CACHED;
+            CACHED(JMPL):
+                if (STACK_EMPTY()) {
+                    goto engine_spill;
+                }
+                tmp_double2 = STACK_TOP();
+                STACK_POP();
+                if (tmp_double2 < tos) {
+                    ip = code + ip->arg;
+                } else {
+                    ip++;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+            CACHED(JMPG):
+                if (STACK_EMPTY()) {
+                    goto engine_spill;
+                }
+                tmp_double2 = STACK_TOP();
+                STACK_POP();
+                if (tmp_double2 > tos) {
+                    ip = code + ip->arg;
+                } else {
+                    ip++;
+                }
+                PAUSE_POINT;
+                NEXT_COMMAND;
+#endif
+            COMMAND(END_OF_PROGRAM):
+                dispatched--; // end marker is not a command
+                ENGINE_RETURN(true);
+            WRONG_COMMAND:
+                fprintf(stderr, "CPU error: wrong commands\n");
+                cpu->state = WAIT;
+                ENGINE_RETURN(false);
+        }
+    }
+    ENGINE_RETURN(true);
+}
+
+#undef ENGINE_CHILD
+#undef ENGINE_TABLE4
+#undef ENGINE_TABLE16
+#undef ENGINE_TABLE64
+#undef ENGINE_TABLE
+#undef ENGINE_ENTRY
+#undef ENGINE_CACHED_ENTRY
+#undef ENGINE_PUSH_ENTRY
+#undef ENGINE_REGION_ENTRY
+#undef ENGINE_HANDLER
+#undef ENGINE_CACHED_HANDLER
+#undef NEXT_COMMAND
+#undef NEXT_CACHED
+#undef COMMAND
+#undef COMMAND_LOAD
+#undef CACHED
+#undef WRONG_COMMAND
+#undef EXECUTED
+#undef ENGINE_RETURN
+#undef PROFILE_STOP
+#undef PROFILE_MEMORY
+#undef PROFILE_CALL
+#undef TRACE_MEMORY
+#undef MEMORY_ACCESS
+#undef PAUSE_NEEDED
+#undef PAUSE_POINT
+#undef PAUSE_NOW
+#undef IN_BLOCKED
+#undef STACK_PUSH
+#undef STACK_POP
+#undef STACK_TOP
+#undef STACK_DEPTH
+#undef STACK_EMPTY
+#undef TAKE_FROM_STACK
+#undef TAKE_FROM_STACK_TOP
+#undef CHECK_ARG_NUM
+#undef RET_PUSH
+#undef RET_POP
+#undef RET_TOP
+#undef RET_EMPTY
@@ -0,0 +1,30 @@
+#ifndef CPU_IO_H
+#define CPU_IO_H
+//! Size of cpu input and output buffers
+constexpr int CPU_IO_BUFFER_SIZE = 1 << 16;
+
+//! Maximum length of value formatted by format_double()
+constexpr int CPU_IO_VALUE_SIZE = 512;
+
+//! Results of cpu_in()
+enum CPU_IN_RESULTS {
+    CPU_IN_NONE = 0,    // there is no value, in command fails
+    CPU_IN_VALUE,
+    CPU_IN_BLOCKED      // value is not ready yet, cpu is suspended at in command
+};
+
+//! Function for in command, it returns result from CPU_IN_RESULTS
+typedef int (*Cpu_In_Function)(void *context, double *value);
+
+//! Function for out command
+typedef void (*Cpu_Out_Function)(void *context, double value);
+
+void cpu_io_init(bool raw, bool shared);
+int cpu_in(double *value);
+void cpu_out(double value);
+void cpu_io_flush();
+void cpu_io_set_channels(struct Channel *in, struct Channel *out);
+void cpu_io_set_functions(Cpu_In_Function in, Cpu_Out_Function out, void *context);
+const char *parse_double(const char *str, double *value);
+int format_double(char *str, double value);
+#endif
@@ -1,6 +1,54 @@
 #ifndef CPU_MAIN_H
 #define CPU_MAIN_H
 constexpr int ARG_NUM = 2;
-constexpr int FILE_IN = 1;
-bool work(char *commands, int commands_size, Cpu *cpu, Memory_Controller *mc);
+
+//! Number of printed pairs for pairs statistics
+constexpr int PAIRS_TOP_NUM = 20;
+
+//! Maximum number of cpus in smp mode
+constexpr int SMP_MAX_CPUS = 64;
+
+//! Value of getopt_long() for --pipeline option, which has no short form
+constexpr int PIPELINE_OPTION = 256;
+
+//! Value of getopt_long() for --batch option, which has no short form
+constexpr int MANIFEST_OPTION = 257;
+
+//! Value of getopt_long() for --listen option, which has no short form
+constexpr int LISTEN_OPTION = 258;
+
+//! Memory cells of virtual machine of --batch job, as in memory bars of usual cpu
+constexpr int MANIFEST_MEMORY_SIZE = 15;
+
+//! Engine name for switch based interpreter loop
+const char SWITCH_ENGINE_STR[] = "switch";
+
+//! Engine name for direct threaded interpreter loop
+const char THREADED_ENGINE_STR[] = "threaded";
+
+//! Engine name for threaded interpreter loop with register IR regions
+const char REGIR_ENGINE_STR[] = "regir";
+
+//! Engine name for threaded interpreter loop with cached stack top
+const char TOS_ENGINE_STR[] = "tos";
+
+//! Engine name for unchecked interpreter loop, if program is verified
+const char VERIFIED_ENGINE_STR[] = "verified";
+
+//! Engine name for native code
+const char JIT_ENGINE_STR[] = "jit";
+
+//! Interpreter loop, which executes program on cpu
+typedef bool (*Engine_Function)(Program *program, Cpu *cpu, Memory_Controller *mc);
+
+bool work(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_threaded(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_regir(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_tos(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_verified(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_jit(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_pairs(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_profile(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_trace(Program *program, Cpu *cpu, Memory_Controller *mc);
+bool work_memo(Program *program, Cpu *cpu, Memory_Controller *mc);
 #endif
@@ -1,4 +1,5 @@
 #ifndef DISASM_H
 #define DISASM_H
 bool in_and_out_from_binary(char * file_in, char * file_out);
+bool trace_from_binary(char *file_trace, char *file_in, char *file_out);
 #endif
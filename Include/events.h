@@ -0,0 +1,39 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+//! Events taken by one epoll_wait()
+constexpr int EVENTS_MAX = 64;
+
+//! Bytes read from connection at once
+constexpr int EVENTS_READ_SIZE = 4096;
+
+//! Pending output of session, after which its machine waits for the client
+constexpr int EVENTS_OUT_LIMIT = 1 << 16;
+
+//! \brief Connection to Unix socket with its own virtual machine. In command
+//! takes values sent by client, machine is suspended (BLOCKED), while the
+//! next value is not received; out command sends value back.
+struct Session
+{
+    struct Tenant vm;
+    int fd;
+    int id;
+    char *in;           // received text, in_start is the next value
+    int in_start;
+    int in_end;
+    int in_capacity;
+    bool in_closed;     // client will not send more
+    char *out;          // text for client, out_start is not sent yet
+    int out_start;
+    int out_end;
+    int out_capacity;
+    bool finished;      // machine stopped, session is closed after output
+    bool queued;        // session is in run queue
+    unsigned events;    // epoll events of connection
+    struct Session *next;   // the next session in run queue
+    int slot;           // index in sessions of server
+};
+
+bool serve_sessions(const char *socket_path, struct Program *program, Tenant_Engine run,
+                    const struct Tenant_Limits *limits, bool print_stat);
+#endif
@@ -0,0 +1,69 @@
+#ifndef FORK_H
+#define FORK_H
+#include <pthread.h>
+
+//! Maximum number of worker threads of fork pool
+constexpr int FORK_MAX_WORKERS = 64;
+
+//! Failed attempts of waiting thread, which only spin, then it yields host thread
+constexpr int FORK_SPINS = 256;
+
+//! Failed attempts, after which waiting thread sleeps between attempts
+constexpr int FORK_YIELDS = 1024;
+
+//! Sleep of waiting thread in nanoseconds
+constexpr long FORK_SLEEP_NS = 50000;
+
+//! Interpreter loop for child cpus, see Engine_Function in cpu_main.h
+typedef bool (*Fork_Engine)(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc);
+
+//! \brief Child cpu started by SPAWN command. It executes subroutine till
+//! its RET, then JOIN of the parent takes rax of the child.
+struct Fork_Task
+{
+    struct Cpu cpu;
+    struct Program *program;
+    struct Memory_Controller *mc;   // memory controller of the parent
+    Fork_Engine run;
+    struct Fork_Task *next;         // child spawned by the parent before this one
+    bool done;                      // cpu finished, parent can free the task
+    bool ok;                        // cpu finished without errors
+};
+
+//! \brief Tasks of one thread. Owner takes the last task, other threads
+//! steal the first one, which is the oldest and usually the biggest.
+struct Fork_Deque
+{
+    struct Fork_Task **tasks;       // ring of tasks
+    int capacity;
+    int head;
+    int size;
+    pthread_mutex_t lock;
+};
+
+//! \brief Worker threads, which run child cpus. Every worker has its deque,
+//! the last deque is shared by threads outside of pool (cpus of smp mode).
+//! Thread, which waits for a child, runs other tasks meanwhile, so the
+//! number of host threads is bounded by the number of workers.
+struct Fork_Pool
+{
+    struct Fork_Deque *deques;      // workers_num + 1 deques
+    pthread_t *threads;
+    int threads_num;                // started worker threads
+    int workers_num;
+    int started;                    // workers, which took their deque index
+    int pending;                    // tasks in deques
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+bool start_fork_pool(struct Fork_Pool *pool, int workers_num);
+void stop_fork_pool(struct Fork_Pool *pool);
+bool fork_spawn(struct Cpu *cpu, struct Program *program, struct Memory_Controller *mc, Fork_Engine run,
+                int entry);
+bool fork_wait(struct Fork_Task *task);
+bool fork_join_rest(struct Cpu *cpu);
+void fork_release(struct Fork_Task *task);
+bool has_spawn(struct Program *program);
+#endif
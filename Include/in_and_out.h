@@ -1,4 +1,5 @@
 #ifndef IN_AND_OUT_H
 #define IN_AND_OUT_H
-char *mmap_file(char *file_in, int *file_in_size);
+char *mmap_file(char *file_in, long *file_in_size);
+int bytecode_operand_size(const char *bytecode, long bytecode_size, long *header_size);
 #endif
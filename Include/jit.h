@@ -0,0 +1,42 @@
+#ifndef JIT_H
+#define JIT_H
+#include <cstddef>
+
+//! \brief What jit code needs to know about cpu stacks and runtime.
+//! Stack structures are known only in cpu.cpp, so it fills this.
+struct Jit_Layout
+{
+    // offsets in Stack_double
+    size_t stack_size;
+    size_t stack_capacity;
+    size_t stack_data;
+    // offsets in Stack_int
+    size_t ret_size;
+    size_t ret_capacity;
+    size_t ret_data;
+    // make place for one more value in cpu stack
+    void (*stack_grow)(struct Cpu *cpu);
+    // push return address into cpu->ret_addr
+    void (*ret_push)(struct Cpu *cpu, int index);
+    // execute IN, OUT, READ, WRITE and POP_IREG commands, false if cpu must stop
+    bool (*command)(struct Cpu *cpu, struct Memory_Controller *mc, struct Instruction *instr);
+};
+
+//! Bytes of native code reserved for one command
+constexpr int JIT_COMMAND_MAX_SIZE = 256;
+
+//! \brief Compiled program
+struct Jit_Code
+{
+    unsigned char *code;    // executable memory
+    size_t code_size;
+    void **native;          // native address of each instruction
+    int (*entry)(struct Cpu *cpu);
+    struct Memory_Controller *mc; // memory controller, which addresses are in the code
+};
+
+struct Jit_Code *jit_compile(struct Program *program, struct Memory_Controller *mc,
+                             const struct Jit_Layout *layout);
+int jit_run(struct Jit_Code *jit, struct Cpu *cpu);
+void jit_destroy(struct Jit_Code *jit);
+#endif
@@ -0,0 +1,55 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <pthread.h>
+
+//! Maximum length of path in manifest
+constexpr int MANIFEST_PATH_SIZE = 4096;
+
+//! States of manifest job
+enum MANIFEST_STATES {
+    JOB_WAITING = 0,
+    JOB_PASSED,         // output is equal to expected one
+    JOB_FAILED,         // output differs from expected one
+    JOB_BROKEN          // program, input or expected output can not be read
+};
+
+//! \brief Program with its input and expected output, paths are relative to
+//! the directory of manifest
+struct Manifest_Job
+{
+    char *program;
+    char *input;
+    char *expected;
+    const char *name;       // program as it is written in manifest
+    int state;
+    int result;             // result of run_vm(), see VM_RESULTS
+    long long executed;
+    double seconds;         // wall time of job: load, run and comparison
+};
+
+//! \brief Jobs of one worker thread. Owner takes the first job, other
+//! threads steal the last one, when they have nothing to do.
+struct Manifest_Queue
+{
+    int first;
+    int last;           // after the last job
+    pthread_mutex_t lock;
+};
+
+//! \brief Jobs from manifest file and queues of worker threads
+struct Manifest
+{
+    struct Manifest_Job *jobs;
+    int jobs_num;
+    struct Manifest_Queue *queues;
+    int queues_num;
+    char *text;         // manifest file, paths point into it
+};
+
+bool read_manifest(const char *file, struct Manifest *manifest);
+bool split_manifest(struct Manifest *manifest, int threads_num);
+int take_job(struct Manifest *manifest, int thread);
+char *read_text_file(const char *file, int *size);
+void print_manifest(struct Manifest *manifest, double duration);
+void destroy_manifest(struct Manifest *manifest);
+#endif
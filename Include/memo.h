@@ -0,0 +1,73 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+//! Maximum number of values in key or results of one memoized call
+constexpr int MEMO_MAX_VALUES = 8;
+
+//! Number of cached calls of every cpu, must be a power of two
+constexpr int MEMO_CACHE_SIZE = 1 << 14;
+
+//! Maximum number of passes over functions, while their summaries change
+constexpr int MEMO_MAX_PASSES = 64;
+
+//! \brief Pure function: it starts at CALL target, reaches RET with the same
+//! cpu stack depth on every path and uses only stack commands, registers,
+//! jumps and calls of other pure functions. Its results depend only on the
+//! key: args from cpu stack and input registers.
+struct Pure_Function
+{
+    int entry;          // instruction index of the first command
+    int args;           // values, which it takes from cpu stack
+    int results;        // values, which it leaves in cpu stack instead of args
+    unsigned inputs;    // bit mask of registers, which are read before write
+    unsigned outputs;   // bit mask of registers, which are written and read after return
+    int keys;           // args and input registers
+    int values;         // results and output registers
+};
+
+//! \brief Memoized call: key is args from the stack top (the deepest first)
+//! and input registers, values are results and output registers
+struct Memo_Entry
+{
+    int function;       // index in program->pure or -1 for free entry
+    long long commands; // commands, which the call would execute without cache
+    double key[MEMO_MAX_VALUES];
+    double values[MEMO_MAX_VALUES];
+};
+
+//! \brief Call of pure function, which was not in cache, its results are
+//! saved by the RET, which returns to its caller
+struct Memo_Frame
+{
+    int function;
+    int ret_depth;      // return stack depth with return address of the call
+    unsigned hash;
+    long long executed; // commands executed by cpu before the call
+    long long skipped;  // commands skipped by cpu before the call
+    double key[MEMO_MAX_VALUES];
+};
+
+//! \brief Cache of pure calls of one cpu, entry is chosen by key hash and
+//! the new call replaces the old one
+struct Memo
+{
+    struct Memo_Entry *entries;
+    struct Memo_Frame *frames;
+    int frames_num;
+    int frames_capacity;
+    int functions_num;
+    long long *calls;       // counters for every pure function
+    long long *hits;
+    long long *skipped;     // commands, which hits did not execute
+    long long skipped_total;
+};
+
+int find_pure_functions(struct Program *program);
+bool init_memo(struct Memo *memo, int functions_num);
+void destroy_memo(struct Memo *memo);
+void merge_memo(struct Memo *memo, const struct Memo *other);
+void print_memo(const struct Memo *memo, struct Program *program, long long executed, double duration);
+const struct Memo_Entry *memo_call(struct Memo *memo, struct Program *program, struct Cpu *cpu, int function,
+                                   long long executed);
+void memo_ret(struct Memo *memo, struct Program *program, struct Cpu *cpu, long long executed);
+#endif
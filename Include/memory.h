@@ -1,23 +1,36 @@
 #ifndef MEMORY_H
 #define MEMORY_H
+#include <cstdio>
+
+//! \brief Memory bar. Sizes and addresses of memory are 64-bit, so a bar
+//! can have more than 2^31 cells.
 struct Memory
 {
-    int size;
+    long long size;
     double *memory;
 };
 
+//! \brief Memory controller can be shared by several cpus: memory bars must
+//! be added before cpus start, after that every access is atomic
 struct Memory_Controller
 {
     int memory_pieces_num;
     struct Memory **memory;
+    FILE *err;      // stream for messages about wrong requests, stderr if NULL
 };
 
-int init_memory(struct Memory*, int size);
+int init_memory(struct Memory*, long long size);
 int init_memory_controller(struct Memory_Controller*);
 int add_memory(struct Memory_Controller*, struct Memory*);
-int write_into_memory(struct Memory_Controller*, int address, double value);
-int get_from_memory(struct Memory_Controller*, int address, double*); 
-int get_memory_size(struct Memory_Controller*);
+int write_into_memory(struct Memory_Controller*, long long address, double value);
+int get_from_memory(struct Memory_Controller*, long long address, double*); 
+long long get_memory_size(struct Memory_Controller*);
+int compare_exchange_memory(struct Memory_Controller*, long long address, double *expected, double desired,
+                            bool *swapped);
+int exchange_add_memory(struct Memory_Controller*, long long address, double value, double *old);
+void memory_fence(struct Memory_Controller*);
+long long memory_address(double value);
+bool integer_value(double value, long long *result);
 
 enum Memory_Errors {
     NULL_MEM = 1,
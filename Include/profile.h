@@ -0,0 +1,84 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <ctime>
+#endif
+
+//! Number of lines in each part of profile report
+constexpr int PROFILE_TOP_NUM = 20;
+
+//! \brief Execution profile of cpu, counters are indexed by instruction
+//! index or memory address. Counters per command are summed from the
+//! instruction ones by print_profile().
+struct Profile
+{
+    int size;                   // instructions in program, with end of program
+    long long memory_size;      // memory cells of memory controller
+    long long *executed;
+    unsigned long long *cycles; // host cycles from the start of the instruction till the next one
+    long long *calls;           // calls of functions, which start at instruction
+    long long *reads;
+    long long *writes;
+    unsigned long long last_clock;
+    int last_index;             // instruction, which gets cycles till the next clock, or -1
+};
+
+//! \brief Host cycles counter (nanoseconds, if there is no rdtsc)
+static inline unsigned long long
+profile_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+//! \brief Count instruction, which starts now, and give cycles since the
+//! previous clock to the previous one
+static inline void
+profile_command(struct Profile *profile, int index)
+{
+    unsigned long long now = profile_clock();
+    if (profile->last_index >= 0) {
+        profile->cycles[profile->last_index] += now - profile->last_clock;
+    }
+    profile->executed[index]++;
+    profile->last_index = index;
+    profile->last_clock = now;
+}
+
+//! \brief Count memory access, wrong addresses are not counted
+static inline void
+profile_memory(struct Profile *profile, long long address, bool write)
+{
+    if (address < 0 || address >= profile->memory_size) {
+        return;
+    }
+    if (write) {
+        profile->writes[address]++;
+    } else {
+        profile->reads[address]++;
+    }
+}
+
+//! \brief Give cycles since the last clock to the last instruction, it is
+//! called when engine leaves, so time out of engine is not counted
+static inline void
+stop_profile(struct Profile *profile)
+{
+    if (profile->last_index >= 0) {
+        profile->cycles[profile->last_index] += profile_clock() - profile->last_clock;
+    }
+    profile->last_index = -1;
+}
+
+bool init_profile(struct Profile *profile, int size, long long memory_size);
+void destroy_profile(struct Profile *profile);
+void merge_profile(struct Profile *to, struct Profile *from);
+void print_profile(struct Profile *profile, struct Program *program);
+#endif
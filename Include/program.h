@@ -0,0 +1,77 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+//! Commands, which exist only in decoded programs (bytecode commands are less)
+enum DECODED_COMMANDS {
+    END_OF_PROGRAM = 128,
+    // superinstructions, see fuse_program()
+    PUSH_REG_PUSH_REG,
+    PUSH_REG_PUSH_VAL,
+    PUSH_REG_REG_JMPL,
+    PUSH_REG_REG_JMPG,
+    PUSH_REG_VAL_JMPL,
+    PUSH_REG_VAL_JMPG,
+    PUSH_VAL_JMPL,
+    PUSH_VAL_JMPG,
+    PUSH_VAL_ADD,
+    PUSH_VAL_SUB,
+    PUSH_VAL_MUL,
+    PUSH_VAL_DIV,
+    POP_REG_PUSH_REG,
+    // register IR region, see build_regions()
+    REGION
+};
+
+//! Size for tables indexed by decoded command code
+constexpr int DECODED_COMMANDS_NUM = 256;
+
+//! \brief Decoded command. All commands have the same size, operands are
+//! checked and prepared during decoding. Superinstruction replaces only the
+//! first command of the sequence and takes operands of the others from the
+//! next instructions, which stay in place.
+struct Instruction
+{
+    int code;       // command from CPU_COMMANDS or DECODED_COMMANDS
+    int reg1;       // first register index in cpu->regs or cpu->iregs for integer registers
+    int reg2;       // second register index in cpu->regs or cpu->iregs
+    int reg3;       // third register index in cpu->regs (address of cas)
+    int arg;        // jump target (instruction index)
+    int offset;     // offset of the command in bytecode
+    union {
+        double value;       // value for push command
+        long long address;  // memory address of read and write commands
+        long long ivalue;   // value for integer commands
+    };
+};
+
+//! \brief Decoded program. After the last instruction there is always
+//! END_OF_PROGRAM instruction, so program->code[program->size] is valid.
+//! Offsets are counted from the first command, after header of wide bytecode.
+struct Program
+{
+    struct Instruction *code;
+    int size;
+    int bytecode_size;
+    struct Region *regions;     // register IR regions, REGION instruction arg is an index here
+    int regions_num;
+    struct Ir_Op *ir;           // operations of all regions
+    int ir_num;
+    int max_stack;              // proved cpu stack depth or -1, see verify_program()
+    int max_calls;              // proved return stack depth or -1
+    struct Pure_Function *pure; // functions, which calls can be memoized, see find_pure_functions()
+    int pure_num;
+    int *pure_index;            // index in pure for the first instruction of function or -1
+    char *mapped;               // cache file, which arrays point into, or NULL, see map_program_cache()
+    long mapped_size;
+    struct Jit_Code *jit;       // native code, which work_jit() compiled for the program, or NULL
+};
+
+bool decode_program(char *bytecode, long bytecode_size, struct Program *program);
+void destroy_program(struct Program *program);
+int fuse_program(struct Program *program);
+bool *find_jump_targets(struct Program *program);
+int find_instruction(struct Program *program, int offset);
+int register_index(char reg);
+int iregister_index(char reg);
+const char *command_name(int code);
+#endif
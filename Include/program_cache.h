@@ -0,0 +1,65 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+#include <cstdint>
+
+//! The first bytes of program cache file
+const char PROGRAM_CACHE_MAGIC[8] = "CPUPROG";
+
+//! Version of program cache file format
+constexpr int32_t PROGRAM_CACHE_VERSION = 4;
+
+//! Arrays in program cache file start at this boundary, so they can be used
+//! right from the mapped file
+constexpr int PROGRAM_CACHE_ALIGN = 8;
+
+//! Maximum length of path of program cache file
+constexpr int PROGRAM_CACHE_PATH_SIZE = 4096;
+
+//! What was done with decoded program before it was saved, see prepare_program()
+enum PROGRAM_CACHE_FLAGS {
+    PREPARED_VERIFIED = 1,      // verify_program()
+    PREPARED_REGIONS = 2,       // build_regions()
+    PREPARED_PURE = 4,          // find_pure_functions()
+    PREPARED_FUSED = 8          // fuse_program()
+};
+
+//! Arrays of program in cache file, in file order
+enum PROGRAM_CACHE_SECTIONS {
+    CACHE_CODE = 0,
+    CACHE_REGIONS,
+    CACHE_IR,
+    CACHE_PURE,
+    CACHE_PURE_INDEX,
+    CACHE_SECTIONS_NUM
+};
+
+//! \brief Beginning of program cache file. It is followed by arrays of
+//! prepared program, each from PROGRAM_CACHE_ALIGN boundary. File name is
+//! made of program hash, size of binary file and flags, so every binary program has
+//! its own file for every way of preparation. Sizes of structures are kept
+//! to find files of other builds. Engines trust arrays (verified one runs
+//! without stack checks), so header and arrays are hashed apart: damaged
+//! header is found before arrays are read.
+struct Program_Cache_Header
+{
+    char magic[sizeof(PROGRAM_CACHE_MAGIC)];
+    int32_t version;
+    int32_t flags;              // PROGRAM_CACHE_FLAGS
+    int32_t struct_sizes[CACHE_SECTIONS_NUM];
+    uint64_t program_hash;      // hash of binary program, see program_hash()
+    uint64_t header_hash;       // hash of header with header_hash 0, see cache_header_hash()
+    uint64_t data_hash;         // hash of everything after header, see cache_data_hash()
+    int64_t file_size;          // size of binary file with header of wide bytecode
+    int32_t bytecode_size;      // size of commands
+    int32_t size;               // instructions without END_OF_PROGRAM
+    int32_t regions_num;
+    int32_t ir_num;
+    int32_t pure_num;
+    int32_t pure_index_num;     // size + 1 or 0, if there is no pure_index
+    int32_t max_stack;
+    int32_t max_calls;
+};
+
+bool map_program_cache(const char *dir, uint64_t hash, long file_size, int flags, struct Program *program);
+bool save_program_cache(const char *dir, uint64_t hash, long file_size, int flags, struct Program *program);
+#endif
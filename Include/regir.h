@@ -0,0 +1,53 @@
+#ifndef REGIR_H
+#define REGIR_H
+
+//! Maximum number of commands in one region
+constexpr int REGION_MAX_LEN = 32;
+
+//! Maximum number of virtual registers in one region: every command makes
+//! a value and takes up to two values from cpu stack, final jump takes two more
+constexpr int REGION_MAX_VREGS = 3 * REGION_MAX_LEN + 2;
+
+//! Operations of register IR
+enum IR_OPS {
+    // computing part, reads cpu state, but does not change it
+    IR_LOAD_STACK = 0,  // v[dst] = value number a from the cpu stack top
+    IR_LOAD_REG,        // v[dst] = regs[a]
+    IR_CONST,           // v[dst] = value
+    IR_ADD,             // v[dst] = v[a] + v[b]
+    IR_SUB,             // v[dst] = v[b] - v[a]
+    IR_MUL,             // v[dst] = v[a] * v[b]
+    IR_DIV,             // v[dst] = v[b] / v[a]
+    IR_SQRT,            // v[dst] = sqrt(v[a])
+    // commit part, changes cpu state after all region values are ready
+    IR_PUSH,            // push v[a] into cpu stack
+    IR_SET_REG,         // regs[dst] = v[a]
+    IR_JMPL,            // jump to dst if v[b] < v[a]
+    IR_JMPG             // jump to dst if v[b] > v[a]
+};
+
+//! \brief One operation of register IR
+struct Ir_Op
+{
+    int op;
+    int dst;
+    int a;
+    int b;
+    double value;
+};
+
+//! \brief Straight sequence of stack commands translated into register IR.
+//! Region replaces its first instruction with REGION command.
+struct Region
+{
+    int code;           // original command of the first instruction
+    int len;            // number of commands in region
+    int need;           // number of values region takes from cpu stack
+    int next;           // instruction after region
+    int ops_begin;      // first operation in program->ir
+    int compute_num;    // number of computing operations
+    int commit_num;     // number of commit operations
+};
+
+int build_regions(struct Program *program);
+#endif
@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+//! Default number of commands, which virtual machine executes before it yields
+constexpr long long SCHEDULER_QUANTUM = 10000;
+
+//! \brief Limits of every virtual machine, 0 means no limit
+struct Tenant_Limits
+{
+    long long quantum;          // commands between yields
+    long long max_commands;     // executed commands
+    int max_calls;              // depth of return stack
+    long long memory_size;      // memory cells, 0 for memory bars of usual cpu
+};
+
+//! \brief Virtual machine, which shares host threads with other ones
+struct Tenant
+{
+    struct Cpu cpu;
+    struct Program *program;    // decoded program, it can be shared by machines
+    const char *name;           // name for report
+    struct Memory mem1;
+    struct Memory mem2;
+    struct Memory_Controller mc;
+    long long quanta;           // times machine got host thread
+    double seconds;             // host thread time of the machine
+    const char *limit;          // exceeded limit, which stopped machine, or NULL
+    bool failed;                // machine stopped on error
+};
+
+//! Interpreter loop for virtual machines, see Engine_Function in cpu_main.h
+typedef bool (*Tenant_Engine)(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc);
+
+bool init_tenant(struct Tenant *tenant, struct Program *program, const char *name, long long memory_size);
+void destroy_tenant(struct Tenant *tenant);
+bool run_quantum(struct Tenant *tenant, Tenant_Engine run, const struct Tenant_Limits *limits);
+bool run_scheduler(struct Tenant *tenants, int tenants_num, int threads_num, Tenant_Engine run,
+                   const struct Tenant_Limits *limits);
+void print_tenants(struct Tenant *tenants, int tenants_num);
+#endif
@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <cstdint>
+
+//! The first bytes of trace file
+const char TRACE_MAGIC[8] = "CPUTRAC";
+
+//! Version of trace file format
+constexpr int32_t TRACE_VERSION = 2;
+
+//! Number of the last executed commands, which are kept for every cpu,
+//! must be a power of two
+constexpr int TRACE_RECORDS_NUM = 1 << 16;
+
+//! \brief Executed command, it is recorded before execution
+struct Trace_Record
+{
+    int64_t address;    // memory address used by the command or -1
+    int32_t offset;     // offset of the command in bytecode
+    int16_t code;       // command from CPU_COMMANDS or DECODED_COMMANDS
+    int16_t cpu;        // cpu number in smp mode
+    int32_t depth;      // cpu stack depth, tos is valid if it is not zero
+    double tos;         // cpu stack top
+};
+
+//! \brief Beginning of trace file, records of all cpus follow it, the
+//! oldest first for every cpu
+struct Trace_Header
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    int32_t version;
+    int32_t bytecode_size;      // size of binary program, it must be the same for decoding
+    int64_t records_num;
+};
+
+//! \brief Ring buffer of the last executed commands of one cpu. Only its cpu
+//! writes records, readers take head with acquire order and copy records
+//! without locks (a record, which is being overwritten, may be torn).
+struct Trace
+{
+    struct Trace_Record records[TRACE_RECORDS_NUM];
+    int64_t head;               // number of records ever written
+    int16_t cpu;
+};
+
+//! \brief Append record of the command, which is executed now
+static inline void
+trace_command(struct Trace *trace, int offset, int code, int depth, const double *stack)
+{
+    struct Trace_Record *record = &trace->records[trace->head & (TRACE_RECORDS_NUM - 1)];
+    record->offset = offset;
+    record->code = code;
+    record->cpu = trace->cpu;
+    record->address = -1;
+    record->depth = depth;
+    record->tos = depth > 0 ? stack[depth - 1] : 0;
+    __atomic_store_n(&trace->head, trace->head + 1, __ATOMIC_RELEASE);
+}
+
+//! \brief Save memory address into the record of the current command
+static inline void
+trace_memory(struct Trace *trace, long long address)
+{
+    trace->records[(trace->head - 1) & (TRACE_RECORDS_NUM - 1)].address = address;
+}
+
+bool dump_traces(const char *file, struct Trace **traces, int traces_num, int bytecode_size);
+#endif
@@ -0,0 +1,17 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+//! Maximum cpu stack depth, which verifier can prove
+constexpr int VERIFY_MAX_DEPTH = 1 << 16;
+
+//! Maximum depth of nested calls, recursion deeper than this is not verified
+constexpr int VERIFY_MAX_CALL_DEPTH = 256;
+
+//! Maximum number of different call chains
+constexpr int VERIFY_MAX_CALLS = 4096;
+
+//! Maximum number of abstract states (instruction, stack depth, call chain)
+constexpr int VERIFY_MAX_STATES = 1 << 20;
+
+bool verify_program(struct Program *program);
+#endif
@@ -0,0 +1,71 @@
+#ifndef VM_H
+#define VM_H
+#include <pthread.h>
+
+//! Results of run_vm()
+enum VM_RESULTS {
+    VM_FINISHED = 0,    // program finished by hlt or at its end
+    VM_ERROR,           // program stopped on error, it is printed into stderr
+    VM_COMMAND_LIMIT,   // program executed more commands than allowed
+    VM_CALL_LIMIT       // program has more nested calls than allowed
+};
+
+//! \brief In and out commands of virtual machine call these functions in
+//! the thread, which runs it. Without in function in command fails, without
+//! out function values are dropped.
+struct Vm_Io
+{
+    bool (*in)(void *context, double *value);  // returns false, if there is no value
+    void (*out)(void *context, double value);
+    void *context;
+};
+
+//! Interpreter loop of virtual machine, see Engine_Function in cpu_main.h
+typedef bool (*Vm_Engine)(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc);
+
+//! \brief Limits of one run, 0 means no limit
+struct Vm_Limits
+{
+    long long max_commands;
+    int max_calls;
+};
+
+//! \brief Embedded virtual machine: cpu with its own memory, which executes
+//! decoded program. Functions of different machines can be called from
+//! different threads at once.
+struct Vm
+{
+    struct Cpu cpu;
+    struct Program *program;    // executed program, own or shared
+    struct Program own;         // program decoded by load_vm()
+    bool loaded;                // own program is decoded
+    struct Memory memory;
+    struct Memory_Controller mc;
+    struct Vm_Io io;
+    Vm_Engine run;              // threaded engine after init_vm()
+};
+
+//! \brief Machines allocated beforehand: service takes a free one for a
+//! request and gives it back after that
+struct Vm_Pool
+{
+    struct Vm *vms;
+    int *free;          // indexes of free machines
+    int free_num;
+    int size;
+    pthread_mutex_t lock;
+};
+
+bool init_vm(struct Vm *vm, long long memory_size, int stack_size, int ret_size);
+bool load_vm(struct Vm *vm, const char *bytecode, long bytecode_size);
+void attach_vm(struct Vm *vm, struct Program *program);
+void set_vm_io(struct Vm *vm, const struct Vm_Io *io);
+int run_vm(struct Vm *vm, const struct Vm_Limits *limits);
+void reset_vm(struct Vm *vm);
+void destroy_vm(struct Vm *vm);
+
+bool init_vm_pool(struct Vm_Pool *pool, int size, long long memory_size, int stack_size, int ret_size);
+struct Vm *take_vm(struct Vm_Pool *pool);
+void give_vm(struct Vm_Pool *pool, struct Vm *vm);
+void destroy_vm_pool(struct Vm_Pool *pool);
+#endif
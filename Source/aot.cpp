@@ -0,0 +1,387 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <cmath>
+#include <climits>
+#include <sys/mman.h>
+
+#include "cpu.h"
+#include "program.h"
+#include "in_and_out.h"
+#include "aot.h"
+
+//! \brief Write C++ expression with exactly the same double value
+static void
+write_double(FILE *out, double value)
+{
+    if (std::isnan(value)) {
+        fprintf(out, "NAN");
+    } else if (std::isinf(value)) {
+        fprintf(out, value > 0 ? "HUGE_VAL" : "-HUGE_VAL");
+    } else {
+        fprintf(out, "%.17g", value);
+    }
+}
+
+//! \brief Write check of cpu stack size with the message of cpu
+static void
+write_check(FILE *out, int argn, const char *message)
+{
+    fprintf(out, "    if (!aot_check_arg_num(&cpu, %d)) {\n", argn);
+    fprintf(out, "        fprintf(stderr, \"%s\");\n", message);
+    fprintf(out, "        goto stop;\n");
+    fprintf(out, "    }\n");
+}
+
+//! \brief Write arithmetic command, result is expression of tmp1 and tmp2
+static void
+write_binary(FILE *out, const char *name, const char *result)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "Not enough stack arguments in %s commands\\n", name);
+    write_check(out, 2, message);
+    fprintf(out, "    aot_take(&cpu, &tmp1, &tmp2);\n");
+    fprintf(out, "    aot_push(&cpu, %s);\n", result);
+}
+
+//! \brief Write conditional jump: take top and second, jump if
+//! second cmp top
+static void
+write_conditional(FILE *out, struct Instruction *instr, const char *cmp, const char *message)
+{
+    write_check(out, 2, message);
+    fprintf(out, "    aot_take(&cpu, &tmp1, &tmp2);\n");
+    fprintf(out, "    if (tmp2 %s tmp1) goto L%d;\n", cmp, instr->arg);
+}
+
+//! \brief Write second operand of integer command: register or value
+static void
+write_integer_operand(FILE *out, struct Instruction *instr, bool value)
+{
+    if (!value) {
+        fprintf(out, "iregs[%d]", instr->reg2);
+    } else if (instr->ivalue == LLONG_MIN) {
+        // the least value has no literal
+        fprintf(out, "(-%lldLL - 1)", LLONG_MAX);
+    } else {
+        fprintf(out, "%lldLL", instr->ivalue);
+    }
+}
+
+//! \brief Write integer command, arithmetic wraps around like in cpu
+//! \param [in] op C++ operator or NULL for move
+static void
+write_integer(FILE *out, struct Instruction *instr, const char *op, bool value)
+{
+    if (op) {
+        fprintf(out, "    iregs[%d] = (long long)((unsigned long long)iregs[%d] %s ", instr->reg1, instr->reg1, op);
+        write_integer_operand(out, instr, value);
+        fprintf(out, ");\n");
+    } else {
+        fprintf(out, "    iregs[%d] = ", instr->reg1);
+        write_integer_operand(out, instr, value);
+        fprintf(out, ";\n");
+    }
+}
+
+//! \brief Translate one command into C++ statements
+//! \param [in] program Decoded program
+//! \param [in] i Instruction index
+//! \param [in] out File to write into
+//! \return Returns false, if command is unknown
+static bool
+write_command(struct Program *program, int i, FILE *out)
+{
+    struct Instruction *instr = program->code + i;
+    switch (instr->code) {
+        case HLT:
+        case END_OF_PROGRAM:
+            fprintf(out, "    goto stop;\n");
+            return true;
+        case ADD:
+            write_binary(out, "add", "tmp1 + tmp2");
+            return true;
+        case SUB:
+            write_binary(out, "sub", "tmp2 - tmp1");
+            return true;
+        case MUL:
+            write_binary(out, "mul", "tmp1 * tmp2");
+            return true;
+        case DIV:
+            write_check(out, 2, "Not enough stack arguments in div commands\\n");
+            fprintf(out, "    aot_take(&cpu, &tmp1, &tmp2);\n");
+            fprintf(out, "    if (fabs(tmp2) < ZERO_EPS) {\n");
+            fprintf(out, "        fprintf(stderr, \"CPU error: zero division\\n\");\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    aot_push(&cpu, tmp2 / tmp1);\n");
+            return true;
+        case SQRT:
+            write_check(out, 1, "Not enough stack arguments in sqrt command\\n");
+            fprintf(out, "    aot_take(&cpu, &tmp1, NULL);\n");
+            fprintf(out, "    if (tmp1 < 0) {\n");
+            fprintf(out, "        fprintf(stderr, \"CPU error: sqrt from negative value\\n\");\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    aot_push(&cpu, sqrt(tmp1));\n");
+            return true;
+        case RET:
+            fprintf(out, "    if (!cpu.ret_size) {\n");
+            fprintf(out, "        fprintf(stderr, \"Ret from no function! \\n\");\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    switch (cpu.ret_addr[--cpu.ret_size]) {\n");
+            for (int j = 0; j < program->size; j++) {
+                if (program->code[j].code == CALL) {
+                    fprintf(out, "        case %d: goto L%d;\n", j + 1, j + 1);
+                }
+            }
+            fprintf(out, "        default: goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case PUSH_REG:
+            fprintf(out, "    aot_push(&cpu, regs[%d]);\n", instr->reg1);
+            return true;
+        case PUSH_VAL:
+            fprintf(out, "    aot_push(&cpu, ");
+            write_double(out, instr->value);
+            fprintf(out, ");\n");
+            return true;
+        case POP_VAL:
+        case POP_REG:
+            fprintf(out, "    if (!aot_check_arg_num(&cpu, 1)) {\n");
+            fprintf(out, "        fprintf(stderr, \"CPU error: pop from empty stack\\n\");\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            if (instr->code == POP_REG) {
+                fprintf(out, "    aot_take(&cpu, &regs[%d], NULL);\n", instr->reg1);
+            } else {
+                fprintf(out, "    cpu.size--;\n");
+            }
+            return true;
+        case IN:
+        case IN_REG:
+            fprintf(out, "    if (fscanf(stdin, \"%%lf\", &tmp1) != 1) {\n");
+            fprintf(out, "        fprintf(stderr, \"Input error: can not get value\\n\");\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            if (instr->code == IN) {
+                fprintf(out, "    aot_push(&cpu, tmp1);\n");
+            } else {
+                fprintf(out, "    regs[%d] = tmp1;\n", instr->reg1);
+            }
+            return true;
+        case OUT:
+            write_check(out, 1, "CPU error: empty stack\\n");
+            fprintf(out, "    fprintf(stdout, \"%%lf\\n\", cpu.stack[cpu.size - 1]);\n");
+            return true;
+        case OUT_REG:
+            fprintf(out, "    fprintf(stdout, \"%%lf\\n\", regs[%d]);\n", instr->reg1);
+            return true;
+        case JMP:
+            fprintf(out, "    goto L%d;\n", instr->arg);
+            return true;
+        case JMPL:
+            write_conditional(out, instr, "<", "jmpl command when less then 2 elements in stack!");
+            return true;
+        case JMPG:
+            write_conditional(out, instr, ">", "jmpg command when less then 2 elements in stack!\\n");
+            return true;
+        case CALL:
+            fprintf(out, "    aot_push_ret(&cpu, %d);\n", i + 1);
+            fprintf(out, "    goto L%d;\n", instr->arg);
+            return true;
+        case WRITE_REG:
+            fprintf(out, "    if (write_into_memory(&cpu.mc, memory_address(regs[%d]), regs[%d])) {\n",
+                    instr->reg2, instr->reg1);
+            fprintf(out, "        fprintf(stderr, \"Memory request error: can not write into address %%lf\\n\", "
+                         "regs[%d]);\n", instr->reg2);
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case WRITE_ADDR:
+            fprintf(out, "    write_into_memory(&cpu.mc, %lld, regs[%d]);\n", instr->address, instr->reg1);
+            return true;
+        case READ_ADDR:
+            fprintf(out, "    get_from_memory(&cpu.mc, %lld, &regs[%d]);\n", instr->address, instr->reg1);
+            return true;
+        case READ_REG:
+            fprintf(out, "    if (get_from_memory(&cpu.mc, memory_address(regs[%d]), &regs[%d]) == NEGATIVE_MEM) {\n",
+                    instr->reg1, instr->reg2);
+            fprintf(out, "        fprintf(stderr, \"Memory request error: can not read from address %%lf\\n\", "
+                         "regs[%d]);\n", instr->reg1);
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case CAS:
+            fprintf(out, "    if (compare_exchange_memory(&cpu.mc, memory_address(regs[%d]), &regs[%d], regs[%d], "
+                         "&swapped)) {\n", instr->reg3, instr->reg1, instr->reg2);
+            fprintf(out, "        fprintf(stderr, \"Memory request error: can not write into address %%lf\\n\", "
+                         "regs[%d]);\n", instr->reg3);
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    aot_push(&cpu, swapped ? 1 : 0);\n");
+            return true;
+        case XADD:
+            fprintf(out, "    if (exchange_add_memory(&cpu.mc, memory_address(regs[%d]), regs[%d], &regs[%d])) {\n",
+                    instr->reg2, instr->reg1, instr->reg1);
+            fprintf(out, "        fprintf(stderr, \"Memory request error: can not write into address %%lf\\n\", "
+                         "regs[%d]);\n", instr->reg2);
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case FENCE:
+            fprintf(out, "    memory_fence(&cpu.mc);\n");
+            return true;
+        // translated program always runs on the only cpu
+        case CPUID:
+            fprintf(out, "    regs[%d] = 0;\n", instr->reg1);
+            return true;
+        case CPUNUM:
+            fprintf(out, "    regs[%d] = 1;\n", instr->reg1);
+            return true;
+        // translated program has no checkpoints
+        case SNAP:
+            return true;
+        case PUSH_IREG:
+            fprintf(out, "    aot_push(&cpu, (double)iregs[%d]);\n", instr->reg1);
+            return true;
+        case POP_IREG:
+            fprintf(out, "    if (!aot_check_arg_num(&cpu, 1)) {\n");
+            fprintf(out, "        fprintf(stderr, \"CPU error: pop from empty stack\\n\");\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            fprintf(out, "    aot_take(&cpu, &tmp1, NULL);\n");
+            fprintf(out, "    if (!integer_value(tmp1, &iregs[%d])) {\n", instr->reg1);
+            fprintf(out, "        fprintf(stderr, \"CPU error: value %%lf does not fit into integer register\\n\", "
+                         "tmp1);\n");
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case IMOV_REG:
+        case IMOV_VAL:
+            write_integer(out, instr, NULL, instr->code == IMOV_VAL);
+            return true;
+        case IADD_REG:
+        case IADD_VAL:
+            write_integer(out, instr, "+", instr->code == IADD_VAL);
+            return true;
+        case ISUB_REG:
+        case ISUB_VAL:
+            write_integer(out, instr, "-", instr->code == ISUB_VAL);
+            return true;
+        case IMUL_REG:
+        case IMUL_VAL:
+            write_integer(out, instr, "*", instr->code == IMUL_VAL);
+            return true;
+        case IJMPL:
+            fprintf(out, "    if (iregs[%d] < iregs[%d]) goto L%d;\n", instr->reg1, instr->reg2, instr->arg);
+            return true;
+        case IJMPG:
+            fprintf(out, "    if (iregs[%d] > iregs[%d]) goto L%d;\n", instr->reg1, instr->reg2, instr->arg);
+            return true;
+        case IJMPE:
+            fprintf(out, "    if (iregs[%d] == iregs[%d]) goto L%d;\n", instr->reg1, instr->reg2, instr->arg);
+            return true;
+        case WRITE_IREG:
+            fprintf(out, "    if (write_into_memory(&cpu.mc, iregs[%d], regs[%d])) {\n", instr->reg2, instr->reg1);
+            fprintf(out, "        fprintf(stderr, \"Memory request error: can not write into address %%lld\\n\", "
+                         "iregs[%d]);\n", instr->reg2);
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        case READ_IREG:
+            fprintf(out, "    if (get_from_memory(&cpu.mc, iregs[%d], &regs[%d]) == NEGATIVE_MEM) {\n",
+                    instr->reg1, instr->reg2);
+            fprintf(out, "        fprintf(stderr, \"Memory request error: can not read from address %%lld\\n\", "
+                         "iregs[%d]);\n", instr->reg1);
+            fprintf(out, "        goto stop;\n");
+            fprintf(out, "    }\n");
+            return true;
+        default:
+            return false;
+    }
+    return false;
+}
+
+//! \brief Translate decoded program into C++ translation unit with main()
+//! \param [in] program Decoded program
+//! \param [in] out File to write into
+//! \return Returns true if success
+static bool
+translate_to_c(struct Program *program, FILE *out)
+{
+    bool *is_target = find_jump_targets(program);
+    if (!is_target) {
+        return false;
+    }
+    fprintf(out, "// Generated by aot, do not edit\n");
+    fprintf(out, "#include \"aot_runtime.h\"\n\n");
+    fprintf(out, "int\nmain()\n{\n");
+    fprintf(out, "    struct Aot_Cpu cpu;\n");
+    fprintf(out, "    aot_init(&cpu);\n");
+    fprintf(out, "    double *regs = cpu.regs;\n");
+    fprintf(out, "    long long *iregs = cpu.iregs;\n");
+    fprintf(out, "    double tmp1 = 0, tmp2 = 0;\n");
+    fprintf(out, "    bool swapped = false;\n");
+    fprintf(out, "    (void)regs;\n");
+    fprintf(out, "    (void)iregs;\n");
+    fprintf(out, "    (void)tmp2;\n");
+    fprintf(out, "    (void)swapped;\n\n");
+    for (int i = 0; i <= program->size; i++) {
+        if (is_target[i]) {
+            fprintf(out, "L%d:\n", i);
+        }
+        fprintf(out, "    // %s\n", command_name(program->code[i].code));
+        if (!write_command(program, i, out)) {
+            fprintf(stderr, "Error: can not translate command %d at address %d\n",
+                    program->code[i].code, program->code[i].offset);
+            free(is_target);
+            return false;
+        }
+    }
+    fprintf(out, "stop:\n");
+    fprintf(out, "    aot_destroy(&cpu);\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+    free(is_target);
+    return true;
+}
+
+//! \brief Read 'binary' code and write C++ program with the same behaviour
+//! \param [in] file_in File to read 'binary' code
+//! \param [out] file_out File to write C++ code
+//! \return Returns true if success, false else
+bool
+in_and_out_to_c(char *file_in, char *file_out)
+{
+    assert(file_in);
+    assert(file_out);
+
+    long commands_size = 0;
+    char *commands = mmap_file(file_in, &commands_size);
+    if (!commands) {
+        fprintf(stderr, "Error: Can`t mmap file %s\n", file_in);
+        return false;
+    }
+    struct Program program;
+    if (!decode_program(commands, commands_size, &program)) {
+        fprintf(stderr, "Error: Can`t decode file %s\n", file_in);
+        munmap(commands, commands_size);
+        return false;
+    }
+    munmap(commands, commands_size);
+
+    FILE *out = fopen(file_out, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Can`t open out file %s\n", file_out);
+        destroy_program(&program);
+        return false;
+    }
+    bool result = translate_to_c(&program, out);
+    if (fclose(out)) {
+        result = false;
+    }
+    destroy_program(&program);
+    return result;
+}
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <cassert>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "asm.h"
 #include "cpu.h"
@@ -23,14 +24,16 @@ struct Env
     char *commands;
     char *commands_end;
     int fd;
-    int address;
+    long long address;  // offset of the next command after header of wide bytecode
+    int operand_size;   // size of memory address operands, jump ones are JUMP_OPERAND_SIZE
+    bool error;         // operand does not fit, translation stops
 };
 
 //! \brief Symbol. At the moment only for labels. Name is saved with \0 symbol.
 struct Symbol {
     char *name;
     int name_size;
-    int address;
+    long long address;
     //in future may be more fields;
 };
 
@@ -50,6 +53,30 @@ write_to_file(int fd, int value) {
     return write(fd, &val_char, 1) == 1;
 }
 
+//! \brief Write jump or memory address operand
+//! \param [in] env Translation context
+//! \param [in] value Operand value
+//! \param [in] size env->operand_size for memory address, JUMP_OPERAND_SIZE for jump
+//! \return Returns false, if value does not fit into operand
+static bool
+write_operand(struct Env *env, long long value, int size)
+{
+    if (size == COMPACT_OPERAND_SIZE && (value < INT_MIN || value > INT_MAX)) {
+        if (size < env->operand_size) {
+            fprintf(stderr, "Jump address %lld does not fit into %d bytes\n", value, size);
+        } else {
+            fprintf(stderr, "Operand %lld does not fit into compact bytecode, use asm -w\n", value);
+        }
+        env->error = true;
+        return false;
+    }
+    if (size == COMPACT_OPERAND_SIZE) {
+        int compact = value;
+        return write(env->fd, &compact, sizeof(compact)) == sizeof(compact);
+    }
+    return write(env->fd, &value, sizeof(value)) == sizeof(value);
+}
+
 static int
 write_register_to_file(char *command) {
     assert(command);
@@ -66,6 +93,22 @@ write_register_to_file(char *command) {
     return 0;
 }
 
+static int
+write_iregister_to_file(char *command) {
+    assert(command);
+
+    if (!strncmp(command, IAX_STR, sizeof(IAX_STR) - 1)) {
+        return IAX;
+    }
+    if (!strncmp(command, IBX_STR, sizeof(IBX_STR) - 1)) {
+        return IBX;
+    }
+    if (!strncmp(command, ICX_STR, sizeof(ICX_STR) - 1)) {
+        return ICX;
+    }
+    return 0;
+}
+
 static void
 init_sym_tab(struct Symtab *sym_tab)
 {
@@ -133,7 +176,7 @@ add_symbol(struct Symtab *sym_tab, char *name, int name_size)
 //! \param [in] name_size Symbol name size
 //! \param [in] address Address for symbol
 static bool
-add_symbol_address(struct Symtab *sym_tab, char *name, int name_size, int address)
+add_symbol_address(struct Symtab *sym_tab, char *name, int name_size, long long address)
 {
     assert(sym_tab);
     assert(name);
@@ -283,6 +326,22 @@ process_write_command(struct Env *env) {
     }
     env->commands++;
 
+    int tmp_ireg = write_iregister_to_file(env->commands);
+    if (tmp_ireg) {
+        // integer register
+        env->commands += sizeof(IAX_STR) - 1;
+        skip_nonimportant_symbols(&(env->commands), env->commands_end);
+        if (env->commands >= env->commands_end || *(env->commands) != ']') {
+            env->commands = old_coms;
+            return false;
+        }
+        env->commands++;
+        env->address += 3;
+        write_to_file(env->fd, WRITE_IREG);
+        write_to_file(env->fd, tmp_reg1);
+        write_to_file(env->fd, tmp_ireg);
+        return true;
+    }
     int tmp_reg2 = write_register_to_file(env->commands);
     if (tmp_reg2) {
      //register
@@ -302,7 +361,7 @@ process_write_command(struct Env *env) {
     // address
     char *endptr = NULL;
     errno = 0;
-    int tmp = strtol(env->commands, &endptr, 10);
+    long long tmp = strtoll(env->commands, &endptr, 10);
     if (errno || endptr == env->commands) {
         env->commands = old_coms;
         return false;
@@ -315,8 +374,11 @@ process_write_command(struct Env *env) {
     env->commands++;
     write_to_file(env->fd, WRITE_ADDR);
     write_to_file(env->fd, tmp_reg1);
-    write(env->fd, &tmp, sizeof(int));
-    env->address += 2 + sizeof(int);
+    if (!write_operand(env, tmp, env->operand_size)) {
+        env->commands = old_coms;
+        return false;
+    }
+    env->address += 2 + env->operand_size;
     return true;    
 }
 
@@ -339,6 +401,29 @@ process_read_command(struct Env *env) {
     
     env->commands++;
     skip_nonimportant_symbols(&(env->commands), env->commands_end);
+    int tmp_ireg = write_iregister_to_file(env->commands);
+    if (tmp_ireg) {
+        // integer register
+        env->commands += sizeof(IAX_STR) - 1;
+        skip_nonimportant_symbols(&(env->commands), env->commands_end);
+        if (env->commands >= env->commands_end || *(env->commands) != ']') {
+            env->commands = old_coms;
+            return false;
+        }
+        env->commands++;
+        skip_nonimportant_symbols(&(env->commands), env->commands_end);
+        int tmp_reg1 = write_register_to_file(env->commands);
+        if (!tmp_reg1) {
+            env->commands = old_coms;
+            return false;
+        }
+        env->address += 3;
+        env->commands += sizeof(RAX_STR) - 1;
+        write_to_file(env->fd, READ_IREG);
+        write_to_file(env->fd, tmp_ireg);
+        write_to_file(env->fd, tmp_reg1);
+        return true;
+    }
     int tmp_reg2 = write_register_to_file(env->commands);
     if (tmp_reg2) {
      //register
@@ -365,7 +450,7 @@ process_read_command(struct Env *env) {
     // address
     char *endptr = NULL;
     errno = 0;
-    int tmp = strtol(env->commands, &endptr, 10);
+    long long tmp = strtoll(env->commands, &endptr, 10);
     if (errno || endptr == env->commands) {
         env->commands = old_coms;
         return false;
@@ -383,13 +468,160 @@ process_read_command(struct Env *env) {
         return false;
     }
     write_to_file(env->fd, READ_ADDR);
-    write(env->fd, &tmp, sizeof(tmp));
+    if (!write_operand(env, tmp, env->operand_size)) {
+        env->commands = old_coms;
+        return false;
+    }
     write_to_file(env->fd, tmp_reg1);
-    env->address += 2 + sizeof(int);
+    env->address += 2 + env->operand_size;
     env->commands += sizeof(RAX_STR);
     return true;
 }
 
+//! \brief Read register operand, optionally in square brackets
+//! \param [in] env Translation context, commands are shifted after operand
+//! \param [in] in_brackets True for memory operand [reg]
+//! \param [in] integer True for integer register (iax, ibx or icx)
+//! \return Returns register command or 0, if there is no valid operand
+static int
+read_register_operand(struct Env *env, bool in_brackets, bool integer = false)
+{
+    skip_nonimportant_symbols(&(env->commands), env->commands_end);
+    if (in_brackets) {
+        if (env->commands >= env->commands_end || *(env->commands) != '[') {
+            return 0;
+        }
+        env->commands++;
+        skip_nonimportant_symbols(&(env->commands), env->commands_end);
+    }
+    if (env->commands + sizeof(RAX_STR) - 1 > env->commands_end) {
+        return 0;
+    }
+    int reg = integer ? write_iregister_to_file(env->commands) : write_register_to_file(env->commands);
+    if (!reg) {
+        return 0;
+    }
+    env->commands += sizeof(RAX_STR) - 1;
+    if (in_brackets) {
+        skip_nonimportant_symbols(&(env->commands), env->commands_end);
+        if (env->commands >= env->commands_end || *(env->commands) != ']') {
+            return 0;
+        }
+        env->commands++;
+    }
+    return reg;
+}
+
+//! \brief Recognise atomic command: 'xadd reg [reg]' or 'cas reg reg [reg]'
+//! \param [in] env Translation context
+//! \param [in] com_str Command string
+//! \param [in] com_size Size of the command string without \0
+//! \param [in] com Command to be written
+//! \param [in] regs_num Number of register operands, the last one is address
+//! \return Returns true if the command was recognised
+static bool
+process_atomic_command(struct Env *env, const char *com_str, int com_size, int com, int regs_num)
+{
+    assert(env);
+    assert(com_str);
+
+    if (env->commands + com_size >= env->commands_end ||
+        strncmp(env->commands, com_str, com_size) || !isspace(*(env->commands + com_size))) {
+        return false;
+    }
+    char *old_coms = env->commands;
+    env->commands += com_size;
+    char regs[3] = {};
+    for (int i = 0; i < regs_num; i++) {
+        regs[i] = read_register_operand(env, i == regs_num - 1);
+        if (!regs[i]) {
+            env->commands = old_coms;
+            return false;
+        }
+    }
+    write_to_file(env->fd, com);
+    write(env->fd, regs, regs_num);
+    env->address += 1 + regs_num;
+    return true;
+}
+
+//! \brief Recognise command with integer register: 'push iax' or 'pop iax'
+//! \param [in] env Translation context
+//! \param [in] com_str Command string
+//! \param [in] com_size Size of the command string without \0
+//! \param [in] com Command to be written
+//! \return Returns true if the command was recognised
+static bool
+process_iregister_command(struct Env *env, const char *com_str, int com_size, int com)
+{
+    assert(env);
+    assert(com_str);
+
+    if (env->commands + com_size >= env->commands_end ||
+        strncmp(env->commands, com_str, com_size) || !isspace(*(env->commands + com_size))) {
+        return false;
+    }
+    char *old_coms = env->commands;
+    env->commands += com_size;
+    int reg = read_register_operand(env, false, true);
+    if (!reg) {
+        env->commands = old_coms;
+        return false;
+    }
+    write_to_file(env->fd, com);
+    write_to_file(env->fd, reg);
+    env->address += 2;
+    return true;
+}
+
+//! \brief Recognise integer arithmetic command: 'iadd iax ibx' or 'iadd iax 5'
+//! \param [in] env Translation context
+//! \param [in] com_str Command string
+//! \param [in] com_size Size of the command string without \0
+//! \param [in] com_reg Command with integer register as the second operand
+//! \param [in] com_val Command with 64-bit value as the second operand
+//! \return Returns true if the command was recognised
+static bool
+process_integer_command(struct Env *env, const char *com_str, int com_size, int com_reg, int com_val)
+{
+    assert(env);
+    assert(com_str);
+
+    if (env->commands + com_size >= env->commands_end ||
+        strncmp(env->commands, com_str, com_size) || !isspace(*(env->commands + com_size))) {
+        return false;
+    }
+    char *old_coms = env->commands;
+    env->commands += com_size;
+    int reg1 = read_register_operand(env, false, true);
+    if (!reg1) {
+        env->commands = old_coms;
+        return false;
+    }
+    int reg2 = read_register_operand(env, false, true);
+    if (reg2) {
+        write_to_file(env->fd, com_reg);
+        write_to_file(env->fd, reg1);
+        write_to_file(env->fd, reg2);
+        env->address += 3;
+        return true;
+    }
+    char *endptr = NULL;
+    errno = 0;
+    long long value = strtoll(env->commands, &endptr, 10);
+    if (errno || endptr == env->commands) {
+        env->commands = old_coms;
+        return false;
+    }
+    // value is always 64-bit, even in compact bytecode
+    write_to_file(env->fd, com_val);
+    write_to_file(env->fd, reg1);
+    write(env->fd, &value, sizeof(value));
+    env->address += 2 + sizeof(value);
+    env->commands = endptr;
+    return true;
+}
+
 //! \brief Skip comment and space symbols
 //! \param [in,out] Assembler commands
 //! \param [in] End of assembler commands
@@ -452,19 +684,56 @@ choose_jmp(char **commands, char *commands_end)
         command = CALL;
         command_size = sizeof(CALL_STR);
     }
+    if (tmp_commands + sizeof(SPAWN_STR) - 1 < commands_end &&
+            !strncmp(tmp_commands, SPAWN_STR, sizeof(SPAWN_STR) - 1)) {
+        command = SPAWN;
+        command_size = sizeof(SPAWN_STR);
+    }
     *commands = tmp_commands + command_size;
     return command;
 }
 
 
+//! \brief Find integer jmp command 'ijmpl iax ibx label', if exists
+//! \param [in] env Translation context, commands are shifted to the label, if command is found
+//! \param [out] regs Two integer registers to compare
+//! \return Returns jmp command if integer jmp command founded, zero else
+static int
+choose_ijmp(struct Env *env, char *regs)
+{
+    static const struct {
+        const char *str;
+        int size;
+        int command;
+    } ijmps[] = {{IJMPL_STR, sizeof(IJMPL_STR) - 1, IJMPL},
+                 {IJMPG_STR, sizeof(IJMPG_STR) - 1, IJMPG},
+                 {IJMPE_STR, sizeof(IJMPE_STR) - 1, IJMPE}};
+    for (unsigned i = 0; i < sizeof(ijmps) / sizeof(ijmps[0]); i++) {
+        if (env->commands + ijmps[i].size >= env->commands_end ||
+            strncmp(env->commands, ijmps[i].str, ijmps[i].size) || !isspace(*(env->commands + ijmps[i].size))) {
+            continue;
+        }
+        char *old_coms = env->commands;
+        env->commands += ijmps[i].size;
+        regs[0] = read_register_operand(env, false, true);
+        regs[1] = regs[0] ? read_register_operand(env, false, true) : 0;
+        if (!regs[1]) {
+            env->commands = old_coms;
+            return 0;
+        }
+        return ijmps[i].command;
+    }
+    return 0;
+}
 
 //! \brief Main assembler function. Translates assembler commands to 'binary' code
 //! \param [in] commands Assembler commands to translate
 //! \param [in] commands_size Size of commands in bytes
 //! \param [in] fd File descriptor to write result in
+//! \param [in] wide Write wide bytecode with 64-bit operands
 //! \return Returns true if no problems during translation appeared
 static bool
-translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
+translate_to_machine_code(char *commands, ssize_t commands_size, int fd, bool wide) {
     assert(commands);
     assert(fd >= 0);
     assert(commands_size > 0);
@@ -485,6 +754,13 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
     env->commands_end = commands + commands_size;
     env->fd = fd;
     env->address = 0;
+    env->operand_size = wide ? WIDE_OPERAND_SIZE : COMPACT_OPERAND_SIZE;
+    long header_size = 0;
+    if (wide) {
+        write(env->fd, WIDE_MAGIC, sizeof(WIDE_MAGIC));
+        write_to_file(env->fd, WIDE_VERSION);
+        header_size = WIDE_HEADER_SIZE;
+    }
 
     while (env->commands < env->commands_end) {
         skip_nonimportant_symbols(&(env->commands), env->commands_end);
@@ -499,6 +775,9 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
         if (process_alone_command(env, SQRT_STR, sizeof(SQRT_STR) - 1, SQRT)) continue;
         if (process_alone_command(env, HLT_STR, sizeof(HLT_STR) - 1, HLT)) continue;
         if (process_alone_command(env, RET_STR, sizeof(RET_STR) - 1, RET)) continue;
+        if (process_alone_command(env, FENCE_STR, sizeof(FENCE_STR) - 1, FENCE)) continue;
+        if (process_alone_command(env, SNAP_STR, sizeof(SNAP_STR) - 1, SNAP)) continue;
+        if (process_alone_command(env, JOIN_STR, sizeof(JOIN_STR) - 1, JOIN)) continue;
         //it is not.
         //register commands
         
@@ -506,7 +785,17 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
         if (process_register_command(env, OUT_STR, sizeof(OUT_STR) - 1, OUT_REG)) continue;
         if (process_register_command(env, PUSH_STR, sizeof(PUSH_STR) - 1, PUSH_REG)) continue;
         if (process_register_command(env, POP_STR, sizeof(POP_STR) - 1, POP_REG)) continue;
+        if (process_register_command(env, CPUID_STR, sizeof(CPUID_STR) - 1, CPUID)) continue;
+        if (process_register_command(env, CPUNUM_STR, sizeof(CPUNUM_STR) - 1, CPUNUM)) continue;
         
+        // integer commands, before the same commands with usual registers and alone ones
+        if (process_iregister_command(env, PUSH_STR, sizeof(PUSH_STR) - 1, PUSH_IREG)) continue;
+        if (process_iregister_command(env, POP_STR, sizeof(POP_STR) - 1, POP_IREG)) continue;
+        if (process_integer_command(env, IMOV_STR, sizeof(IMOV_STR) - 1, IMOV_REG, IMOV_VAL)) continue;
+        if (process_integer_command(env, IADD_STR, sizeof(IADD_STR) - 1, IADD_REG, IADD_VAL)) continue;
+        if (process_integer_command(env, ISUB_STR, sizeof(ISUB_STR) - 1, ISUB_REG, ISUB_VAL)) continue;
+        if (process_integer_command(env, IMUL_STR, sizeof(IMUL_STR) - 1, IMUL_REG, IMUL_VAL)) continue;
+
         // alone commands with possible register version (processed above) 
         if (process_alone_command(env, IN_STR, sizeof(IN_STR) - 1, IN)) continue;
         if (process_alone_command(env, OUT_STR, sizeof(OUT_STR) - 1, OUT)) continue; 
@@ -516,10 +805,24 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
         
         if (process_write_command(env)) continue;
         if (process_read_command(env)) continue; 
+        if (env->error) {
+            return false;
+        }
+        if (process_atomic_command(env, CAS_STR, sizeof(CAS_STR) - 1, CAS, 3)) continue;
+        if (process_atomic_command(env, XADD_STR, sizeof(XADD_STR) - 1, XADD, 2)) continue;
         //process jmp command 
-        int jmp_type = choose_jmp(&(env->commands), env->commands_end);
+        char ijmp_regs[2] = {};
+        int jmp_size = 3; // command and two integer registers before label
+        int jmp_type = choose_ijmp(env, ijmp_regs);
+        if (!jmp_type) {
+            jmp_type = choose_jmp(&(env->commands), env->commands_end);
+            jmp_size = 1;
+        }
         if (jmp_type) {
             write_to_file(env->fd, jmp_type);
+            if (jmp_size > 1) {
+                write(env->fd, ijmp_regs, sizeof(ijmp_regs));
+            }
             skip_nonimportant_symbols(&(env->commands), env->commands_end);
             
             if (env->commands >= env->commands_end) {
@@ -530,12 +833,15 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
             if (*label == '$') {
                 char *endptr = NULL;
                 errno = 0;
-                int jmp_address = strtol(label + 1, &endptr, 10);
+                long long jmp_address = strtoll(label + 1, &endptr, 10);
                 if (errno || endptr == env->commands) {
                     fprintf(stderr, "Wrong jmp value: %10s\n", env->commands);
                     return false;
                 }
-                write(env->fd, &jmp_address, sizeof(int));
+                if (!write_operand(env, jmp_address, JUMP_OPERAND_SIZE)) {
+                    return false;
+                }
+                env->address += jmp_size + JUMP_OPERAND_SIZE;
                 env->commands = endptr;
                 continue;
             }
@@ -547,18 +853,18 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
             int ind = find_symbol(&sym_tab, env->commands, label - env->commands);
             if (ind == -1) {
                 add_symbol(&sym_tab, env->commands, label - env->commands);
-                Stack_Push(jmps, env->address + 1);
+                Stack_Push(jmps, env->address + jmp_size);
                 ind = find_symbol(&sym_tab, env->commands, label - env->commands);
-                write(env->fd, &ind, sizeof(ind)); //here must be jmp address
+                write_operand(env, ind, JUMP_OPERAND_SIZE); //here must be jmp address
             } else {
                 if (sym_tab.symbols[ind].address == -1) {
-                    write(env->fd, &ind, sizeof(ind)); //here must be jmp address
-                    Stack_Push(jmps, env->address + 1);
-                } else {
-                    write(env->fd, &(sym_tab.symbols[ind].address), sizeof(ind));
+                    write_operand(env, ind, JUMP_OPERAND_SIZE); //here must be jmp address
+                    Stack_Push(jmps, env->address + jmp_size);
+                } else if (!write_operand(env, sym_tab.symbols[ind].address, JUMP_OPERAND_SIZE)) {
+                    return false;
                 }
             }
-            env->address += 1 + sizeof(ind);
+            env->address += jmp_size + JUMP_OPERAND_SIZE;
             env->commands = label;
             continue;
         }
@@ -579,16 +885,26 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
         add_symbol_address(&sym_tab, env->commands, label - env->commands, env->address);
         env->commands = label + 1;
     }
+    // cpu decodes bytecode of both formats into 32-bit indexes and offsets
+    if (env->address >= INT_MAX) {
+        fprintf(stderr, "Program has %lld bytes of commands, bytecode can have less than %d\n",
+                env->address, INT_MAX);
+        Stack_Destruct(jmps);
+        return false;
+    }
     //now all unsolved jmp labels must be solved
     int jmps_num = Stack_Size(jmps);
     for (int i = 0; i < jmps_num; i++) {
-        int work_address = Stack_Top(jmps);
+        long work_address = header_size + Stack_Top(jmps);
         Stack_Pop(jmps);
         lseek(env->fd, work_address, SEEK_SET);
-        int ind = 0;
-        read(env->fd, &ind, sizeof(ind));
+        // placeholder is the symbol index, it is not negative
+        long long ind = 0;
+        read(env->fd, &ind, JUMP_OPERAND_SIZE);
         lseek(env->fd, work_address, SEEK_SET);
-        write(env->fd, &(sym_tab.symbols[ind].address), sizeof(int));
+        if (!write_operand(env, sym_tab.symbols[ind].address, JUMP_OPERAND_SIZE)) {
+            return false;
+        }
     }
     Stack_Destruct(jmps);
     for (int i = 0; i < sym_tab.size; i++) {
@@ -601,13 +917,14 @@ translate_to_machine_code(char *commands, ssize_t commands_size, int fd) {
 //! \brief Read commands and write result of the translation to files
 //! \param [in] file_in File to read commands
 //! \param [out] file_out File to write asm commands
+//! \param [in] wide Write wide bytecode with 64-bit operands, see WIDE_MAGIC
 //! \return Returns true if success, false else
 bool
-in_and_out_from_asm(char *file_in, char *file_out) {
+in_and_out_from_asm(char *file_in, char *file_out, bool wide) {
     assert(file_in);
     assert(file_out);
     
-    int file_in_size = 0;
+    long file_in_size = 0;
     char *commands = mmap_file(file_in, &file_in_size);
     if (!commands) {
         fprintf(stderr, "Can not mmap file %s\n", file_in);
@@ -619,7 +936,7 @@ in_and_out_from_asm(char *file_in, char *file_out) {
         munmap(commands, file_in_size);
         return false;
     }
-    if (!translate_to_machine_code(commands, file_in_size, fd_out)) {
+    if (!translate_to_machine_code(commands, file_in_size, fd_out, wide)) {
         fprintf(stderr, "Error: Can`t translate to asm from file %s\n", file_out);
         close(fd_out);
         munmap(commands, file_in_size);
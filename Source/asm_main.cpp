@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <unistd.h>
 
 
 #include "asm.h"
@@ -7,13 +8,27 @@
 int
 main(int argc, char **argv)
 {
-    if (argc < ARG_NUM) {
+    bool wide = false;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "w")) != -1) {
+        switch (opt) {
+            case 'w':
+                wide = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-w] in_file out_file\n", argv[0]);
+                return 1;
+        }
+    }
+    // file arguments go after options
+    char **files = argv + optind - 1;
+    if (argc - optind < ARG_NUM - 1) {
         fprintf(stderr, "Please, specify in and out files\n");
         return 1;
     }
-    if (!in_and_out_from_asm(argv[FILE_IN], argv[FILE_OUT])) {
-        fprintf(stderr, "File %s can not be translated to asm", argv[FILE_IN]);
-        fprintf(stderr, " or result can not be written into file %s\n", argv[FILE_OUT]);
+    if (!in_and_out_from_asm(files[FILE_IN], files[FILE_OUT], wide)) {
+        fprintf(stderr, "File %s can not be translated to asm", files[FILE_IN]);
+        fprintf(stderr, " or result can not be written into file %s\n", files[FILE_OUT]);
         return 1;
     }
     return 0;
@@ -0,0 +1,291 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "batch.h"
+#include "cpu_io.h"
+
+//! \brief Make cpu stack of batch at least bytes long
+//! \return Returns false, if there is no memory
+static bool
+batch_reserve(struct Batch *batch, size_t bytes)
+{
+    if (bytes <= batch->stack_bytes) {
+        return true;
+    }
+    size_t new_bytes = batch->stack_bytes ? batch->stack_bytes : BATCH_MAX_LANES * sizeof(double);
+    while (new_bytes < bytes) {
+        new_bytes *= 2;
+    }
+    // vectors must be aligned by their size
+    void *stack = aligned_alloc(BATCH_MAX_LANES * sizeof(double), new_bytes);
+    if (!stack) {
+        return false;
+    }
+    memset(stack, 0, new_bytes);
+    if (batch->stack) {
+        memcpy(stack, batch->stack, batch->stack_bytes);
+    }
+    free(batch->stack);
+    batch->stack = stack;
+    batch->stack_bytes = new_bytes;
+    return true;
+}
+
+//! \brief Read the next value of lane input, like fscanf("%lf") does
+//! \return Returns false, if there is no value
+static bool
+lane_read(struct Batch_Lane *lane, double *value)
+{
+    const char *end = parse_double(lane->input_pos, value);
+    if (!end) {
+        return false;
+    }
+    lane->input_pos = (char *)end;
+    return true;
+}
+
+//! \brief Print value of out command into lane stdout, like cpu_out() does
+static void
+lane_write(struct Batch_Lane *lane, double value)
+{
+    char str[CPU_IO_VALUE_SIZE + 1];
+    int len = format_double(str, value);
+    str[len++] = '\n';
+    fwrite(str, 1, len, lane->out);
+}
+
+//! \brief Push return address of the lane
+//! \return Returns false, if there is no memory
+static bool
+lane_ret_push(struct Batch_Lane *lane, int index)
+{
+    if (lane->ret_size == lane->ret_capacity) {
+        int capacity = lane->ret_capacity * 2 + 1;
+        int *ret_addr = (int *)realloc(lane->ret_addr, capacity * sizeof(int));
+        if (!ret_addr) {
+            return false;
+        }
+        lane->ret_addr = ret_addr;
+        lane->ret_capacity = capacity;
+    }
+    lane->ret_addr[lane->ret_size++] = index;
+    return true;
+}
+
+//! \brief Execute memory or cpu number command for one lane
+//! \param [in] lane Lane, which executes command
+//! \param [in] instr Command to execute
+//! \param [in,out] regs Registers of the lane
+//! \param [in] iregs Integer registers of the lane
+//! \param [out] flag Value to push for cas command
+//! \return Returns false if lane must stop (error was already reported)
+static bool
+lane_command(struct Batch_Lane *lane, struct Instruction *instr, double *regs, const long long *iregs, double *flag)
+{
+    bool swapped = false;
+    switch (instr->code) {
+        case WRITE_REG:
+            if (write_into_memory(&lane->mc, memory_address(regs[instr->reg2]), regs[instr->reg1])) {
+                fprintf(lane->err, "Memory request error: can not write into address %lf\n", regs[instr->reg2]);
+                return false;
+            }
+            return true;
+        case WRITE_ADDR:
+            write_into_memory(&lane->mc, instr->address, regs[instr->reg1]);
+            return true;
+        case READ_ADDR:
+            get_from_memory(&lane->mc, instr->address, &regs[instr->reg1]);
+            return true;
+        case READ_REG:
+            if (get_from_memory(&lane->mc, memory_address(regs[instr->reg1]), &regs[instr->reg2]) == NEGATIVE_MEM) {
+                fprintf(lane->err, "Memory request error: can not read from address %lf\n", regs[instr->reg1]);
+                return false;
+            }
+            return true;
+        case WRITE_IREG:
+            if (write_into_memory(&lane->mc, iregs[instr->reg2], regs[instr->reg1])) {
+                fprintf(lane->err, "Memory request error: can not write into address %lld\n", iregs[instr->reg2]);
+                return false;
+            }
+            return true;
+        case READ_IREG:
+            if (get_from_memory(&lane->mc, iregs[instr->reg1], &regs[instr->reg2]) == NEGATIVE_MEM) {
+                fprintf(lane->err, "Memory request error: can not read from address %lld\n", iregs[instr->reg1]);
+                return false;
+            }
+            return true;
+        case CAS:
+            if (compare_exchange_memory(&lane->mc, memory_address(regs[instr->reg3]), &regs[instr->reg1],
+                                        regs[instr->reg2], &swapped)) {
+                fprintf(lane->err, "Memory request error: can not write into address %lf\n", regs[instr->reg3]);
+                return false;
+            }
+            *flag = swapped ? 1 : 0;
+            return true;
+        case XADD:
+            if (exchange_add_memory(&lane->mc, memory_address(regs[instr->reg2]), regs[instr->reg1],
+                                    &regs[instr->reg1])) {
+                fprintf(lane->err, "Memory request error: can not write into address %lf\n", regs[instr->reg2]);
+                return false;
+            }
+            return true;
+        case FENCE:
+            memory_fence(&lane->mc);
+            return true;
+        // every lane is the only cpu of its run
+        case CPUID:
+            regs[instr->reg1] = 0;
+            return true;
+        case CPUNUM:
+            regs[instr->reg1] = 1;
+            return true;
+        default:
+            fprintf(lane->err, "CPU error: wrong commands\n");
+            return false;
+    }
+    return false;
+}
+
+#define BATCH_NAME work_batch4
+#define BATCH_LANES 4
+#include "batch_engine.h"
+#undef BATCH_NAME
+#undef BATCH_LANES
+
+#define BATCH_NAME work_batch8
+#define BATCH_LANES 8
+#include "batch_engine.h"
+#undef BATCH_NAME
+#undef BATCH_LANES
+
+//! \brief Init batch lanes and their memory like cpu_main does for cpu
+//! \return Returns false, if there is no memory
+bool
+init_batch(struct Batch *batch)
+{
+    assert(batch);
+
+    memset(batch, 0, sizeof(*batch));
+    for (int l = 0; l < BATCH_MAX_LANES; l++) {
+        struct Batch_Lane *lane = batch->lanes + l;
+        if (init_memory(&lane->mem1, 10) || init_memory(&lane->mem2, 5) ||
+            init_memory_controller(&lane->mc) || add_memory(&lane->mc, &lane->mem1) ||
+            add_memory(&lane->mc, &lane->mem2)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+destroy_batch(struct Batch *batch)
+{
+    assert(batch);
+
+    for (int l = 0; l < BATCH_MAX_LANES; l++) {
+        struct Batch_Lane *lane = batch->lanes + l;
+        if (lane->out) {
+            fclose(lane->out);
+            free(lane->out_data);
+        }
+        if (lane->err) {
+            fclose(lane->err);
+            free(lane->err_data);
+        }
+        free(lane->ret_addr);
+        free(lane->input);
+        free(lane->mem1.memory);
+        free(lane->mem2.memory);
+        free(lane->mc.memory);
+    }
+    free(batch->stack);
+    memset(batch, 0, sizeof(*batch));
+}
+
+//! \brief Prepare lane for the run of the program on its input line
+//! \return Returns false, if there is no memory
+static bool
+start_lane(struct Batch_Lane *lane)
+{
+    lane->ip = 0;
+    lane->size = 0;
+    lane->ret_size = 0;
+    lane->input_pos = lane->input;
+    memset(lane->mem1.memory, 0, lane->mem1.size * sizeof(double));
+    memset(lane->mem2.memory, 0, lane->mem2.size * sizeof(double));
+    // output streams are reused by the next runs of the lane
+    if (!lane->out) {
+        lane->out = open_memstream(&lane->out_data, &lane->out_size);
+    }
+    if (!lane->err) {
+        lane->err = open_memstream(&lane->err_data, &lane->err_size);
+    }
+    lane->mc.err = lane->err;
+    return lane->out && lane->err && !fseek(lane->out, 0, SEEK_SET) && !fseek(lane->err, 0, SEEK_SET);
+}
+
+//! \brief Print output of the lane run
+static void
+finish_lane(struct Batch_Lane *lane)
+{
+    if (lane->out && !fflush(lane->out)) {
+        fwrite(lane->out_data, 1, lane->out_size, stdout);
+    }
+    if (lane->err && !fflush(lane->err)) {
+        fwrite(lane->err_data, 1, lane->err_size, stderr);
+    }
+}
+
+//! \brief Run program once for every line of stdin, several lines at once.
+//! Each run has its own registers, stacks and memory and reads values only
+//! from its line. Outputs of the runs are printed in the order of lines,
+//! as if cpu was started for each line.
+//! \param[in] program Decoded program without superinstructions and regions
+//! \param[in] lanes Number of lines executed together, 4 or 8
+//! \param[in] batch Initialized batch, it gets execution statistics
+//! \return Return true, if all lines were processed
+bool
+work_batch(struct Program *program, int lanes, struct Batch *batch)
+{
+    assert(program);
+    assert(batch);
+    assert(lanes == 4 || lanes == 8);
+
+    bool input_end = false;
+    while (!input_end) {
+        batch->lanes_num = 0;
+        while (batch->lanes_num < lanes) {
+            struct Batch_Lane *lane = batch->lanes + batch->lanes_num;
+            if (getline(&lane->input, &lane->input_capacity, stdin) < 0) {
+                input_end = true;
+                break;
+            }
+            batch->lanes_num++;
+            if (!start_lane(lane)) {
+                fprintf(stderr, "CPU error: can not allocate memory for batch\n");
+                for (int l = 0; l < batch->lanes_num; l++) {
+                    finish_lane(batch->lanes + l);
+                }
+                return false;
+            }
+        }
+        if (!batch->lanes_num) {
+            break;
+        }
+        if (lanes == 4) {
+            work_batch4(program, batch);
+        } else {
+            work_batch8(program, batch);
+        }
+        for (int l = 0; l < batch->lanes_num; l++) {
+            finish_lane(batch->lanes + l);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+#include <cassert>
+#include <ctime>
+#include <sched.h>
+
+#include "channel.h"
+
+//! \brief Init empty open channel
+void
+init_channel(struct Channel *channel)
+{
+    assert(channel);
+
+    channel->head = 0;
+    channel->tail_seen = 0;
+    channel->tail = 0;
+    channel->head_seen = 0;
+    channel->closed = false;
+    channel->detached = false;
+}
+
+//! \brief Wait for the other side: spin, then yield host thread, then sleep
+//! \param [in,out] attempts Failed attempts till now
+static void
+channel_wait(int *attempts)
+{
+    if (*attempts < CHANNEL_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if (*attempts < CHANNEL_YIELDS) {
+        sched_yield();
+    } else {
+        struct timespec ts = {0, CHANNEL_SLEEP_NS};
+        nanosleep(&ts, NULL);
+        return;
+    }
+    (*attempts)++;
+}
+
+//! \brief Put value into channel, producer waits, while channel is full
+//! \return Returns false, if consumer is detached and value is dropped
+bool
+channel_push(struct Channel *channel, double value)
+{
+    if (channel->tail - channel->head_seen == CHANNEL_SIZE) {
+        int attempts = 0;
+        while ((channel->head_seen = __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE)) ==
+               channel->tail - CHANNEL_SIZE) {
+            if (__atomic_load_n(&channel->detached, __ATOMIC_ACQUIRE)) {
+                return false;
+            }
+            channel_wait(&attempts);
+        }
+    }
+    channel->values[channel->tail & (CHANNEL_SIZE - 1)] = value;
+    __atomic_store_n(&channel->tail, channel->tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//! \brief Take value from channel, consumer waits, while channel is empty
+//! \param [out] value Taken value
+//! \return Returns false, if channel is closed and all values are taken
+bool
+channel_pop(struct Channel *channel, double *value)
+{
+    assert(value);
+
+    if (channel->head == channel->tail_seen) {
+        int attempts = 0;
+        while ((channel->tail_seen = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE)) == channel->head) {
+            // the last values are put before close, so tail is checked again
+            if (__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE)) {
+                channel->tail_seen = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE);
+                if (channel->tail_seen == channel->head) {
+                    return false;
+                }
+                break;
+            }
+            channel_wait(&attempts);
+        }
+    }
+    *value = channel->values[channel->head & (CHANNEL_SIZE - 1)];
+    __atomic_store_n(&channel->head, channel->head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//! \brief Producer finished: consumer gets the rest and then end of stream
+void
+close_channel(struct Channel *channel)
+{
+    assert(channel);
+    __atomic_store_n(&channel->closed, true, __ATOMIC_RELEASE);
+}
+
+//! \brief Consumer finished: producer drops values instead of waiting
+void
+detach_channel(struct Channel *channel)
+{
+    assert(channel);
+    __atomic_store_n(&channel->detached, true, __ATOMIC_RELEASE);
+}
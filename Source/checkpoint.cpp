@@ -0,0 +1,237 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "checkpoint.h"
+
+//! \brief Round offset up to CHECKPOINT_ALIGN
+static long
+align_offset(long offset)
+{
+    return (offset + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+//! \brief FNV-1a hash of binary program, checkpoint is loaded only for the
+//! program, which saved it
+//! \param [in] bytecode Binary program
+//! \param [in] bytecode_size Size of program
+//! \return Returns hash
+uint64_t
+program_hash(const char *bytecode, long bytecode_size)
+{
+    assert(bytecode);
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (long i = 0; i < bytecode_size; i++) {
+        hash ^= (unsigned char)bytecode[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+//! \brief Write cpu state and memory into file. File is written under
+//! temporary name and renamed, so the previous checkpoint stays whole, if
+//! something goes wrong. Gaps before memory bars are not written.
+//! \param [in] file Checkpoint file
+//! \param [in] cpu Paused cpu
+//! \param [in] mc Memory controller of cpu
+//! \param [in] hash Hash of binary program
+//! \return Returns true if checkpoint is saved
+bool
+save_checkpoint(const char *file, struct Cpu *cpu, struct Memory_Controller *mc, uint64_t hash)
+{
+    assert(file);
+    assert(cpu);
+    assert(mc);
+
+    char tmp_file[PATH_MAX];
+    if (snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", file) >= (int)sizeof(tmp_file)) {
+        fprintf(stderr, "Checkpoint error: too long file name %s\n", file);
+        return false;
+    }
+    FILE *out = fopen(tmp_file, "wb");
+    if (!out) {
+        fprintf(stderr, "Checkpoint error: can not open file %s: %s\n", tmp_file, strerror(errno));
+        return false;
+    }
+
+    struct Checkpoint_Header header = {};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.state = cpu->state;
+    header.ip = cpu->ip;
+    double *stack = NULL;
+    int *ret = NULL;
+    header.stack_size = get_cpu_stack(cpu, &stack);
+    header.ret_size = get_ret_stack(cpu, &ret);
+    header.memories_num = mc->memory_pieces_num;
+    header.program_hash = hash;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        header.regs[i] = cpu->regs[i];
+    }
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        header.iregs[i] = cpu->iregs[i];
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(stack, sizeof(double), header.stack_size, out) == (size_t)header.stack_size &&
+              fwrite(ret, sizeof(int), header.ret_size, out) == (size_t)header.ret_size;
+    for (int i = 0; ok && i < mc->memory_pieces_num; i++) {
+        int64_t size = mc->memory[i]->size;
+        ok = fwrite(&size, sizeof(size), 1, out) == 1;
+    }
+    for (int i = 0; ok && i < mc->memory_pieces_num; i++) {
+        struct Memory *mem = mc->memory[i];
+        ok = !fseek(out, align_offset(ftell(out)), SEEK_SET) &&
+             fwrite(mem->memory, sizeof(double), mem->size, out) == (size_t)mem->size;
+    }
+    ok = !fclose(out) && ok;
+    if (!ok || rename(tmp_file, file)) {
+        fprintf(stderr, "Checkpoint error: can not write file %s: %s\n", file, strerror(errno));
+        unlink(tmp_file);
+        return false;
+    }
+    return true;
+}
+
+//! \brief Map checkpoint file into memory. Pages are private, so memory
+//! bars can be changed right there without copying them.
+//! \param [in] file Checkpoint file
+//! \param [out] file_size Size of file
+//! \return Returns mapped file or NULL
+static char *
+map_checkpoint(const char *file, long *file_size)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Checkpoint error: can not open file %s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || file_stat.st_size < (off_t)sizeof(struct Checkpoint_Header)) {
+        fprintf(stderr, "Checkpoint error: file %s is not a checkpoint\n", file);
+        close(fd);
+        return NULL;
+    }
+    *file_size = file_stat.st_size;
+    void *data = mmap(NULL, *file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Checkpoint error: can not mmap file %s\n", file);
+        return NULL;
+    }
+    return (char *)data;
+}
+
+//! \brief Restore cpu state and memory from file. Memory bars are replaced
+//! with pages of the mapped file, they stay mapped until exit.
+//! \param [in] file Checkpoint file
+//! \param [in] cpu Cpu, which was not started yet
+//! \param [in] mc Memory controller with the same number of memory bars
+//! \param [in] program Decoded program
+//! \param [in] hash Hash of binary program
+//! \return Returns true if checkpoint is loaded
+bool
+load_checkpoint(const char *file, struct Cpu *cpu, struct Memory_Controller *mc, struct Program *program,
+                uint64_t hash)
+{
+    assert(file);
+    assert(cpu);
+    assert(mc);
+    assert(program);
+
+    long file_size = 0;
+    char *data = map_checkpoint(file, &file_size);
+    if (!data) {
+        return false;
+    }
+    struct Checkpoint_Header *header = (struct Checkpoint_Header *)data;
+    const char *error = NULL;
+    long offset = sizeof(*header);
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) ||
+        header->version != CHECKPOINT_VERSION) {
+        error = "not a checkpoint of this cpu version";
+    } else if (header->program_hash != hash) {
+        error = "checkpoint of another program";
+    } else if (header->memories_num != mc->memory_pieces_num) {
+        error = "wrong number of memory bars";
+    } else if (header->ip < 0 || header->ip > program->size || header->stack_size < 0 || header->ret_size < 0 ||
+               header->stack_size > (file_size - offset) / (long)sizeof(double) ||
+               header->ret_size > (file_size - offset - header->stack_size * (long)sizeof(double)) /
+                                  (long)sizeof(int32_t)) {
+        error = "wrong cpu state";
+    }
+
+    double *stack = (double *)(data + offset);
+    offset += header->stack_size * sizeof(double);
+    int32_t *ret = (int32_t *)(data + offset);
+    offset += header->ret_size * sizeof(int32_t);
+    // sizes may be not aligned after odd number of return addresses
+    int64_t *sizes = (int64_t *)calloc(header->memories_num > 0 ? header->memories_num : 1, sizeof(int64_t));
+    if (!error && !sizes) {
+        error = "wrong number of memory bars";
+    } else if (!error && header->memories_num > (file_size - offset) / (long)sizeof(int64_t)) {
+        error = "wrong memory bar";
+    } else if (!error) {
+        memcpy(sizes, data + offset, header->memories_num * sizeof(int64_t));
+    }
+    offset += header->memories_num * sizeof(int64_t);
+    for (int i = 0; !error && i < header->ret_size; i++) {
+        if (ret[i] < 0 || ret[i] > program->size) {
+            error = "wrong return address";
+        }
+    }
+    long memories_offset = offset;
+    if (!error && memories_offset > file_size) {
+        error = "wrong memory bar";
+    }
+    for (int i = 0; !error && i < header->memories_num; i++) {
+        offset = align_offset(offset);
+        if (offset > file_size || sizes[i] <= 0 || sizes[i] > (file_size - offset) / (long)sizeof(double)) {
+            error = "wrong memory bar";
+        }
+        offset += sizes[i] * sizeof(double);
+    }
+    if (error) {
+        fprintf(stderr, "Checkpoint error: %s in file %s\n", error, file);
+        free(sizes);
+        munmap(data, file_size);
+        return false;
+    }
+
+    offset = memories_offset;
+    for (int i = 0; i < header->memories_num; i++) {
+        offset = align_offset(offset);
+        struct Memory *mem = mc->memory[i];
+        free(mem->memory);
+        mem->memory = (double *)(data + offset);
+        mem->size = sizes[i];
+        offset += sizes[i] * sizeof(double);
+    }
+    free(sizes);
+
+    if (!set_cpu_stacks(cpu, stack, header->stack_size, ret, header->ret_size)) {
+        fprintf(stderr, "Checkpoint error: can not allocate memory for stacks\n");
+        return false;
+    }
+    cpu->state = header->state;
+    cpu->ip = header->ip;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        cpu->regs[i] = header->regs[i];
+    }
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        cpu->iregs[i] = header->iregs[i];
+    }
+    return true;
+}
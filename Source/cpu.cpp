@@ -1,5 +1,6 @@
 #include <string.h>
 #include <cstdint>
+#include <climits>
 
 #define TYPE double
 #include "Stack.h"
@@ -10,6 +11,14 @@
 
 #include "cpu.h"
 #include "memory.h"
+#include "program.h"
+#include "regir.h"
+#include "jit.h"
+#include "cpu_io.h"
+#include "profile.h"
+#include "trace.h"
+#include "memo.h"
+#include "fork.h"
 
 //! \brief Init cpu into void state (OFF)
 //! \param [in] cpu CPU to be inited
@@ -20,9 +29,108 @@ init(struct Cpu *cpu)
     cpu->state = OFF;
     cpu->cpu_stack = (Stack_double *)calloc(1, sizeof(*cpu->cpu_stack));
     cpu->ret_addr = (Stack_int *)calloc(1, sizeof(*cpu->ret_addr));
-    cpu->rax = 0;
-    cpu->rbx = 0;
-    cpu->rcx = 0;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        cpu->regs[i] = 0;
+    }
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        cpu->iregs[i] = 0;
+    }
+    cpu->ip = 0;
+    cpu->id = 0;
+    cpu->cpus_num = 1;
+    cpu->executed = 0;
+    cpu->dispatched = 0;
+    cpu->pairs = NULL;
+    cpu->profile = NULL;
+    cpu->trace = NULL;
+    cpu->memo = NULL;
+    cpu->pool = NULL;
+    cpu->children = NULL;
+    cpu->pause_at = LLONG_MAX;
+    cpu->checkpoint = false;
+    cpu->max_calls = INT_MAX;
+}
+
+//! \brief Free stacks of cpu, it can not be used after that
+//! \param [in] cpu CPU to be destroyed
+void
+destroy_cpu(struct Cpu *cpu)
+{
+    assert(cpu);
+    // stacks, which were never used, have no memory
+    if (cpu->cpu_stack && cpu->cpu_stack->data) {
+        Stack_Destruct(cpu->cpu_stack);
+    }
+    if (cpu->ret_addr && cpu->ret_addr->data) {
+        Stack_Destruct(cpu->ret_addr);
+    }
+    free(cpu->cpu_stack);
+    free(cpu->ret_addr);
+    cpu->cpu_stack = NULL;
+    cpu->ret_addr = NULL;
+}
+
+//! \brief Make cpu stacks empty, their memory stays for the next run
+//! \param [in] cpu Cpu
+static void
+empty_cpu_stacks(struct Cpu *cpu)
+{
+    while (Stack_Size(cpu->cpu_stack) > 0) {
+        Stack_Pop(cpu->cpu_stack);
+    }
+    while (Stack_Size(cpu->ret_addr) > 0) {
+        Stack_Pop(cpu->ret_addr);
+    }
+}
+
+//! \brief Turn cpu off and return it into the state after init(), but
+//! stacks keep their memory, so the next run does not allocate it again
+//! \param [in] cpu Cpu without children (see fork_join_rest())
+void
+reset_cpu(struct Cpu *cpu)
+{
+    assert(cpu);
+    assert(!cpu->children);
+
+    empty_cpu_stacks(cpu);
+    cpu->state = OFF;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        cpu->regs[i] = 0;
+    }
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        cpu->iregs[i] = 0;
+    }
+    cpu->ip = 0;
+    cpu->executed = 0;
+    cpu->dispatched = 0;
+    cpu->pause_at = LLONG_MAX;
+    cpu->checkpoint = false;
+    cpu->max_calls = INT_MAX;
+}
+
+//! \brief Allocate memory of cpu stacks beforehand, stacks stay empty
+//! \param [in] cpu Cpu with empty stacks
+//! \param [in] stack_size Values of cpu stack
+//! \param [in] ret_size Return addresses
+//! \return Returns false, if there is no memory
+bool
+reserve_cpu_stacks(struct Cpu *cpu, int stack_size, int ret_size)
+{
+    assert(cpu);
+
+    if (cpu->state == OFF && !turn_cpu_on(cpu)) {
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < stack_size; i++) {
+        ok = !Stack_Push(cpu->cpu_stack, 0);
+    }
+    for (int i = 0; ok && i < ret_size; i++) {
+        ok = !Stack_Push(cpu->ret_addr, 0);
+    }
+    empty_cpu_stacks(cpu);
+    cpu->state = OFF;
+    return ok;
 }
 
 //! \brief Change CPU state and initialize stack, if necessary
@@ -35,9 +143,15 @@ turn_cpu_on(struct Cpu *cpu)
         case WAIT:
         case ON:
             return true;
+        case PAUSED:
+        case BLOCKED:
+            cpu->state = ON;
+            return true;
         case OFF:
-
-            STACK_INIT((*cpu->cpu_stack));
+            // stacks of cpu, which was on before, are empty, but keep memory
+            if (!cpu->cpu_stack->data) {
+                STACK_INIT((*cpu->cpu_stack));
+            }
             cpu->state = ON;
             return true;
 
@@ -50,6 +164,62 @@ turn_cpu_on(struct Cpu *cpu)
 
 
 
+//! \brief Get values of cpu stack, the first one is the bottom
+//! \param [in] cpu Cpu
+//! \param [out] values Stack values
+//! \return Returns number of values
+int
+get_cpu_stack(struct Cpu *cpu, double **values)
+{
+    assert(cpu);
+    assert(values);
+
+    *values = cpu->cpu_stack->data;
+    return Stack_Size(cpu->cpu_stack);
+}
+
+//! \brief Get return addresses, the first one is the bottom
+//! \param [in] cpu Cpu
+//! \param [out] values Return addresses
+//! \return Returns number of addresses
+int
+get_ret_stack(struct Cpu *cpu, int **values)
+{
+    assert(cpu);
+    assert(values);
+
+    *values = cpu->ret_addr->data;
+    return Stack_Size(cpu->ret_addr);
+}
+
+//! \brief Turn cpu on and fill its stacks, cpu stacks must be empty
+//! \param [in] cpu Cpu
+//! \param [in] stack Values of cpu stack from the bottom
+//! \param [in] stack_size Number of cpu stack values
+//! \param [in] ret Return addresses from the bottom
+//! \param [in] ret_size Number of return addresses
+//! \return Returns false, if there is no memory
+bool
+set_cpu_stacks(struct Cpu *cpu, const double *stack, int stack_size, const int *ret, int ret_size)
+{
+    assert(cpu);
+
+    if (cpu->state != ON && !turn_cpu_on(cpu)) {
+        return false;
+    }
+    for (int i = 0; i < stack_size; i++) {
+        if (Stack_Push(cpu->cpu_stack, stack[i])) {
+            return false;
+        }
+    }
+    for (int i = 0; i < ret_size; i++) {
+        if (Stack_Push(cpu->ret_addr, ret[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
 //! \brief Often need to check, if cpu stack has enough arguments
 //! \param[in] cpu Pointer to cpu to check
 //! \param[in] argn Necessary number of arguments on stack
@@ -65,26 +235,6 @@ check_arg_num(struct Cpu *cpu, int argn)
     return true;
 }
 
-//! \brief Function to hide register swicth
-//! \param [in] cpu Cpu to choose register
-//! \param [in] command Command, which specifies register
-//! \return Returns pointer to necessary register or NULL
-static double*
-find_register(struct Cpu *cpu, char *command)
-{
-    switch (*command) {
-        case RAX:
-            return &(cpu->rax);
-        case RBX:
-            return &(cpu->rbx);
-        case RCX:
-            return &(cpu->rcx);
-        default:
-            return NULL;
-    }
-    return NULL;
-}
-
 //! \brief Take one or two top values from cpu stack
 //! \param [in] cpu Cpu to work with
 //! \param [out] tmp1 First value
@@ -101,339 +251,522 @@ take_from_cpu_stack(struct Cpu *cpu, double *tmp1, double *tmp2)
     return;
 }
 
-//! \brief Proccess comands from buffer
-//! \param[in] commands Buffer with commands
-//! \param[in] commands_size Commands buffer size
-//! \param[in] cpu Pointer to cpu which will process commands
-//! \return Return true, if no errors during execution
-bool
-work(char *commands, int commands_size, struct Cpu *cpu, struct Memory_Controller *mc)
+//! \brief JOIN command: wait for children and push their rax values in
+//! the order of spawn commands
+//! \param [in] cpu Parent cpu, executed commands of children are added to it
+//! \return Returns false, if some child stopped on error (all are waited for)
+static bool
+join_children(struct Cpu *cpu)
 {
-    assert(commands);
-    assert(commands_size > 0);
-    assert(cpu);
-    assert(mc);
+    struct Fork_Task *first = NULL;
+    while (cpu->children) {
+        struct Fork_Task *child = cpu->children;
+        cpu->children = child->next;
+        child->next = first;
+        first = child;
+    }
+    bool ok = true;
+    while (first) {
+        struct Fork_Task *child = first;
+        first = child->next;
+        if (fork_wait(child)) {
+            Stack_Push(cpu->cpu_stack, child->cpu.regs[0]);
+        } else {
+            ok = false;
+        }
+        cpu->executed += child->cpu.executed;
+        cpu->dispatched += child->cpu.dispatched;
+        fork_release(child);
+    }
+    if (!ok) {
+        fprintf(stderr, "CPU error: child cpu stopped on error\n");
+    }
+    return ok;
+}
 
-    if (cpu->state != ON) {
-        turn_cpu_on(cpu);
+//! \brief Execute register IR region. Cpu is changed only if the whole
+//! region can be executed.
+//! \param [in] program Program with regions
+//! \param [in] region_index Region to execute
+//! \param [in] cpu Cpu to work with
+//! \return Returns index of the next instruction or -1, if region commands
+//! must be executed one by one (not enough values on stack or errors)
+static int
+run_region(struct Program *program, int region_index, struct Cpu *cpu)
+{
+    struct Region *region = program->regions + region_index;
+    int stack_size = Stack_Size(cpu->cpu_stack);
+    if (stack_size < region->need) {
+        return -1;
     }
-    char *commands_begin = commands;
-    char *commands_end = commands + commands_size;
-    double tmp_double1 = 0, tmp_double2 = 0;
-    double *tmp_register = NULL;
-    double *tmp_register2 = NULL;
-    int address = 0;
-    while (commands < commands_end) {
-        switch(*commands) {
-            case HLT:
-                commands++;
-                cpu->state = OFF;
-                Stack_Destruct(cpu->cpu_stack);
-                Stack_Destruct(cpu->ret_addr);
-                //CPU was stopped. Just stop working on commands
-                return true;
-            case ADD:
-                if (!check_arg_num(cpu, 2)) {
-                    fprintf(stderr, "Not enough stack arguments in add commands\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                take_from_cpu_stack(cpu, &tmp_double1, &tmp_double2);
-                Stack_Push(cpu->cpu_stack, tmp_double1 + tmp_double2);
-                break;
-            case SUB: 
-                if (!check_arg_num(cpu, 2)) {
-                    fprintf(stderr, "Not enough stack arguments in sub commands\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                take_from_cpu_stack(cpu, &tmp_double1, &tmp_double2);
-                Stack_Push(cpu->cpu_stack, tmp_double2 - tmp_double1);
-                break;
-            case MUL:
-                if (!check_arg_num(cpu, 2)) {
-                    fprintf(stderr, "Not enough stack arguments in mul commands\n");
-                    cpu->state = WAIT;    
-                    return false;
-                }
-                commands++;
-                take_from_cpu_stack(cpu, &tmp_double1, &tmp_double2);
-                Stack_Push(cpu->cpu_stack, tmp_double1 * tmp_double2);
-                break;
-            case DIV:
-                if (!check_arg_num(cpu, 2)) {
-                    fprintf(stderr, "Not enough stack arguments in div commands\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                take_from_cpu_stack(cpu, &tmp_double1, &tmp_double2);
-                if (fabs(tmp_double2) < ZERO_EPS) {
-                    fprintf(stderr, "CPU error: zero division\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                Stack_Push(cpu->cpu_stack, tmp_double2 / tmp_double1);
-                break;
-            case SQRT:
-                if (!check_arg_num(cpu, 1)) {
-                    fprintf(stderr, "Not enough stack arguments in sqrt command\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                take_from_cpu_stack(cpu, &tmp_double1, NULL);
-                if (tmp_double1 < 0) {
-                    fprintf(stderr, "CPU error: sqrt from negative value\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                Stack_Push(cpu->cpu_stack, sqrt(tmp_double1));
-                break;
-            case RET:
-                commands++;
-                if (Stack_Empty(cpu->ret_addr)) {
-                    fprintf(stderr, "Ret from no function! \n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                address = Stack_Top(cpu->ret_addr);
-                Stack_Pop(cpu->ret_addr);
-                commands = commands_begin + address; //to begin from the NEXT command afrer CALL command
-                break;
-            case PUSH_REG:
-                commands++;
-                if (commands >= commands_end) {
-                    fprintf(stderr, "CPU error: no register\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    cpu->state = WAIT;
-                    fprintf(stderr, "No valid register in push command\n");
-                    return false;
-                }
-                Stack_Push(cpu->cpu_stack, *tmp_register);
-                commands++;
+    double *stack_top = cpu->cpu_stack->data + stack_size - 1;
+    double v[REGION_MAX_VREGS];
+    struct Ir_Op *op = program->ir + region->ops_begin;
+    struct Ir_Op *compute_end = op + region->compute_num;
+    for (; op < compute_end; op++) {
+        switch (op->op) {
+            case IR_LOAD_STACK:
+                v[op->dst] = stack_top[-op->a];
                 break;
-            case PUSH_VAL:
-                commands++;
-                if (commands + sizeof(double) >= commands_end) {
-                    cpu->state = WAIT;
-                    fprintf(stderr, "CPU error: no valid argument\n");
-                    return false;
-                }
-                memcpy(&tmp_double1, commands, sizeof(double));
-                commands += sizeof(double);
-                Stack_Push(cpu->cpu_stack, tmp_double1);
+            case IR_LOAD_REG:
+                v[op->dst] = cpu->regs[op->a];
                 break;
-            case POP_VAL:
-                commands++;
-                if (!check_arg_num(cpu, 1)) {
-                    cpu->state = WAIT;
-                    fprintf(stderr, "CPU error: pop from empty stack\n");
-                    return false;
-                }
-                Stack_Pop(cpu->cpu_stack);
+            case IR_CONST:
+                v[op->dst] = op->value;
                 break;
-            case POP_REG:
-                commands++;
-                if (!check_arg_num(cpu, 1)) {
-                    cpu->state = WAIT;
-                    fprintf(stderr, "CPU error: pop from empty stack\n");
-                    return false;
-                }
-                take_from_cpu_stack(cpu, &tmp_double1, NULL);
-                if (commands >= commands_end) {
-                    cpu->state = WAIT;
-                    fprintf(stderr, "CPU error: no register name\n");
-                    return false;
-                }
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    cpu->state = WAIT;
-                    fprintf(stderr, "Unknown register\n");
-                    return false;
-                }
-                *tmp_register = tmp_double1;
-                commands++;
+            case IR_ADD:
+                v[op->dst] = v[op->a] + v[op->b];
                 break;
-            case IN:
-                if (fscanf(stdin, "%lf", &tmp_double1) != 1) {
-                    fprintf(stderr, "Input error: can not get value\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                Stack_Push(cpu->cpu_stack, tmp_double1);
-                commands++;
+            case IR_SUB:
+                v[op->dst] = v[op->b] - v[op->a];
                 break;
-            case IN_REG:
-                if (fscanf(stdin, "%lf", &tmp_double1) != 1) {
-                    fprintf(stderr, "Input error: can not get value\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                if (commands >= commands_end) {
-                    fprintf(stderr, "CPU error: no input register\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    fprintf(stderr, "Invalid register name\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                *tmp_register = tmp_double1;
-                commands++;
+            case IR_MUL:
+                v[op->dst] = v[op->a] * v[op->b];
                 break;
-            case OUT:
-                if (!check_arg_num(cpu, 1)) {
-                    fprintf(stderr, "CPU error: empty stack\n");
-                    cpu->state = WAIT;
-                    return false;
+            case IR_DIV:
+                if (fabs(v[op->b]) < ZERO_EPS) {
+                    return -1;
                 }
-                fprintf(stdout, "%lf\n", Stack_Top(cpu->cpu_stack));
-                commands++;
+                v[op->dst] = v[op->b] / v[op->a];
                 break;
-            case OUT_REG:
-                commands++;
-                if (commands >= commands_end) {
-                    fprintf(stderr, "CPU error: no register name\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    fprintf(stderr, "Invalid register name\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                fprintf(stdout, "%lf\n", *tmp_register);
-                commands++;
-                break;
-            case JMP:
-                commands++;
-                if (commands == commands_end) {
-                    cpu->state = WAIT;
-                    return false;
-                }
-                address = *(int *)commands;
-                commands = commands_begin + address;
-                break;
-            case JMPL:
-                commands++;
-                if (!check_arg_num(cpu, 2)) {
-                    fprintf(stderr, "jmpl command when less then 2 elements in stack!");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                take_from_cpu_stack(cpu, &tmp_double1, &tmp_double2);
-                if (tmp_double2 < tmp_double1) { //jmp
-                    address = *(int *)commands;
-                    commands = commands_begin + address;
-                } else {
-                    commands += sizeof(address);
+            case IR_SQRT:
+                if (v[op->a] < 0) {
+                    return -1;
                 }
+                v[op->dst] = sqrt(v[op->a]);
                 break;
+            default:
+                return -1;
+        }
+    }
 
-            case JMPG:
-                commands++;
-                if (!check_arg_num(cpu, 2)) {
-                    fprintf(stderr, "jmpg command when less then 2 elements in stack!\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                take_from_cpu_stack(cpu, &tmp_double1, &tmp_double2);
-                if (tmp_double2 > tmp_double1) { //jmp
-                    address = *(int *)commands;
-                    commands = commands_begin + address;
-                } else {
-                    commands += sizeof(address);
-                }
-                break;
-            case CALL:
-                commands++;
-                address = *(int *)commands;
-                Stack_Push(cpu->ret_addr, commands - commands_begin + sizeof(address)); // remember ret address
-                commands = commands_begin + address;
-                break;
-            case WRITE_REG:
-                commands++;
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    fprintf(stderr, "Wrong first register in write_reg command\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                tmp_register2 = find_register(cpu, commands);
-                if (!tmp_register2) {
-                    fprintf(stderr, "Wrong second register in write_reg command\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                if (write_into_memory(mc, (int)*tmp_register2, *tmp_register)) {
-                    fprintf(stderr, "Memory request error: can not write into address %lf\n", *tmp_register2);
-                    cpu->state = WAIT;
-                    return false;
-                }
+    for (int i = 0; i < region->need; i++) {
+        Stack_Pop(cpu->cpu_stack);
+    }
+    int next = region->next;
+    struct Ir_Op *commit_end = compute_end + region->commit_num;
+    for (; op < commit_end; op++) {
+        switch (op->op) {
+            case IR_PUSH:
+                Stack_Push(cpu->cpu_stack, v[op->a]);
                 break;
-            case WRITE_ADDR:
-                commands++;
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    fprintf(stderr, "Wrong register in write_val command\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                memcpy(&address, commands, sizeof(int));
-                commands += sizeof(int);
-                write_into_memory(mc, address, *tmp_register);       
+            case IR_SET_REG:
+                cpu->regs[op->dst] = v[op->a];
                 break;
-            case READ_ADDR:
-                commands++;
-                memcpy(&address, commands, sizeof(int));
-                commands += sizeof(int);
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    fprintf(stderr, "Wrong register in read_addr command\n");
-                    cpu->state = WAIT;
-                    return false;
+            case IR_JMPL:
+                if (v[op->b] < v[op->a]) {
+                    next = op->dst;
                 }
-                commands++;
-                get_from_memory(mc, address, tmp_register);
                 break;
-            case READ_REG:
-                commands++;
-                tmp_register = find_register(cpu, commands);
-                if (!tmp_register) {
-                    fprintf(stderr, "Wrong first register in read_reg command\n");
-                    cpu->state = WAIT;
-                    return false;
-                }
-                commands++;
-                tmp_register2 = find_register(cpu, commands);
-                if (!tmp_register2) {
-                    fprintf(stderr, "Wrong second register in read_reg command\n");
-                    cpu->state = WAIT;
-                    return false;
+            case IR_JMPG:
+                if (v[op->b] > v[op->a]) {
+                    next = op->dst;
                 }
-                commands++;
-                get_from_memory(mc, (int)*tmp_register, tmp_register2);
                 break;
             default:
-                fprintf(stderr, "CPU error: wrong commands\n");
+                break;
+        }
+    }
+    return next;
+}
+
+#define ENGINE_NAME work
+#define ENGINE_THREADED 0
+#define ENGINE_PAIRS 0
+#define ENGINE_PROFILE 0
+#define ENGINE_TRACE 0
+#define ENGINE_MEMO 0
+#define ENGINE_REGIONS 0
+#define ENGINE_TOS 0
+#define ENGINE_UNCHECKED 0
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_PAIRS
+
+#define ENGINE_NAME work_pairs
+#define ENGINE_PAIRS 1
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_PAIRS
+
+#undef ENGINE_PROFILE
+#define ENGINE_PROFILE 1
+#define ENGINE_PAIRS 0
+#define ENGINE_NAME work_profile
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_PAIRS
+#undef ENGINE_PROFILE
+#define ENGINE_PROFILE 0
+
+#undef ENGINE_TRACE
+#define ENGINE_TRACE 1
+#define ENGINE_PAIRS 0
+#define ENGINE_NAME work_trace
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_PAIRS
+#undef ENGINE_TRACE
+#define ENGINE_TRACE 0
+
+#ifdef __GNUC__
+#undef ENGINE_THREADED
+#define ENGINE_THREADED 1
+#define ENGINE_PAIRS 0
+#define ENGINE_NAME work_threaded
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+
+#undef ENGINE_REGIONS
+#define ENGINE_REGIONS 1
+#define ENGINE_NAME work_regir
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_REGIONS
+#define ENGINE_REGIONS 0
+
+#undef ENGINE_TOS
+#define ENGINE_TOS 1
+#define ENGINE_NAME work_tos
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_TOS
+#define ENGINE_TOS 0
+#endif
+
+#undef ENGINE_MEMO
+#define ENGINE_MEMO 1
+#ifndef __GNUC__
+#define ENGINE_PAIRS 0
+#endif
+#define ENGINE_NAME work_memo
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_MEMO
+#define ENGINE_MEMO 0
+
+// threaded (if possible) engine for verified programs, see work_verified()
+#undef ENGINE_UNCHECKED
+#define ENGINE_UNCHECKED 1
+#define ENGINE_NAME work_unchecked
+#include "cpu_engine.h"
+#undef ENGINE_NAME
+#undef ENGINE_THREADED
+#undef ENGINE_PAIRS
+#undef ENGINE_PROFILE
+#undef ENGINE_TRACE
+#undef ENGINE_MEMO
+#undef ENGINE_REGIONS
+#undef ENGINE_TOS
+#undef ENGINE_UNCHECKED
+
+#ifndef __GNUC__
+//! \brief Without labels as values threaded engine is the same as switch one
+bool
+work_threaded(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc)
+{
+    return work(program, cpu, mc);
+}
+
+//! \brief Without labels as values regions are executed command by command,
+//! see REGION command in cpu_engine.h
+bool
+work_regir(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc)
+{
+    return work(program, cpu, mc);
+}
+
+//! \brief Without labels as values stack top is not cached
+bool
+work_tos(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc)
+{
+    return work(program, cpu, mc);
+}
+#endif
+
+//! \brief Execute program without stack checks on preallocated stacks, if
+//! verify_program() proved that it is safe, or with threaded engine else
+//! (also if there is no memory for stacks)
+//! \param[in] program Decoded program
+//! \param[in] cpu Pointer to cpu which will process commands
+//! \param[in] mc Memory controller for read and write commands
+//! \return Return true, if no errors during execution
+bool
+work_verified(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc)
+{
+    assert(program);
+    assert(cpu);
+
+    if (cpu->state != ON) {
+        turn_cpu_on(cpu);
+    }
+// unchecked engine changes stacks by itself, so it can not keep debug data right
+#if !defined(DEBUG_HASH) && !defined(DEBUG_BIRDS) && !defined(CHECK_CORRECTNESS)
+    // verifier proves, that no command goes deeper than the bounds from
+    // where it is, so paused and resumed cpus go on unchecked too, if the
+    // stacks have place for current values and the bounds
+    if (program->max_stack >= 0) {
+        bool reserved = cpu->cpu_stack->capacity >= cpu->cpu_stack->size + program->max_stack &&
+                        cpu->ret_addr->capacity >= cpu->ret_addr->size + program->max_calls;
+        if (!reserved && Stack_Empty(cpu->cpu_stack) && Stack_Empty(cpu->ret_addr)) {
+            reserved = reserve_cpu_stacks(cpu, program->max_stack, program->max_calls);
+            turn_cpu_on(cpu);
+        }
+        if (reserved) {
+            return work_unchecked(program, cpu, mc);
+        }
+    }
+#endif
+    return work_threaded(program, cpu, mc);
+}
+
+//! \brief Make place for one more value in cpu stack for jit code
+static void
+jit_stack_grow(struct Cpu *cpu)
+{
+    Stack_Push(cpu->cpu_stack, 0);
+    Stack_Pop(cpu->cpu_stack);
+}
+
+//! \brief Push return address for jit code
+static void
+jit_ret_push(struct Cpu *cpu, int index)
+{
+    Stack_Push(cpu->ret_addr, index);
+}
+
+//! \brief Execute atomic or cpu number command for jit code
+//! \param [in] cpu Cpu to work with
+//! \param [in] mc Memory controller
+//! \param [in] instr Command to execute
+//! \return Returns false if cpu must stop (error was already reported)
+static bool
+jit_atomic_command(struct Cpu *cpu, struct Memory_Controller *mc, struct Instruction *instr)
+{
+    double *regs = cpu->regs;
+    bool swapped = false;
+    switch (instr->code) {
+        case CAS:
+            if (compare_exchange_memory(mc, memory_address(regs[instr->reg3]), &regs[instr->reg1], regs[instr->reg2],
+                                        &swapped)) {
+                fprintf(stderr, "Memory request error: can not write into address %lf\n", regs[instr->reg3]);
                 cpu->state = WAIT;
                 return false;
+            }
+            Stack_Push(cpu->cpu_stack, swapped ? 1 : 0);
+            return true;
+        case XADD:
+            if (exchange_add_memory(mc, memory_address(regs[instr->reg2]), regs[instr->reg1], &regs[instr->reg1])) {
+                fprintf(stderr, "Memory request error: can not write into address %lf\n", regs[instr->reg2]);
+                cpu->state = WAIT;
+                return false;
+            }
+            return true;
+        case FENCE:
+            memory_fence(mc);
+            return true;
+        case CPUID:
+            regs[instr->reg1] = cpu->id;
+            return true;
+        case CPUNUM:
+            regs[instr->reg1] = cpu->cpus_num;
+            return true;
+        default:
+            return false;
+    }
+    return false;
+}
+
+//! \brief Execute input, output, memory or integer pop command for jit code
+//! \param [in] cpu Cpu to work with
+//! \param [in] mc Memory controller
+//! \param [in] instr Command to execute
+//! \return Returns false if cpu must stop (error was already reported)
+static bool
+jit_command(struct Cpu *cpu, struct Memory_Controller *mc, struct Instruction *instr)
+{
+    double *regs = cpu->regs;
+    double tmp_double = 0;
+    switch (instr->code) {
+        case IN:
+        case IN_REG:
+            // jit is not used for cpus, which can be suspended at in command
+            if (cpu_in(&tmp_double) != CPU_IN_VALUE) {
+                fprintf(stderr, "Input error: can not get value\n");
+                cpu->state = WAIT;
+                return false;
+            }
+            if (instr->code == IN) {
+                Stack_Push(cpu->cpu_stack, tmp_double);
+            } else {
+                regs[instr->reg1] = tmp_double;
+            }
+            return true;
+        case OUT:
+            if (!check_arg_num(cpu, 1)) {
+                fprintf(stderr, "CPU error: empty stack\n");
+                cpu->state = WAIT;
+                return false;
+            }
+            cpu_out(Stack_Top(cpu->cpu_stack));
+            return true;
+        case OUT_REG:
+            cpu_out(regs[instr->reg1]);
+            return true;
+        case WRITE_REG:
+            if (write_into_memory(mc, memory_address(regs[instr->reg2]), regs[instr->reg1])) {
+                fprintf(stderr, "Memory request error: can not write into address %lf\n", regs[instr->reg2]);
+                cpu->state = WAIT;
+                return false;
+            }
+            return true;
+        case WRITE_ADDR:
+            write_into_memory(mc, instr->address, regs[instr->reg1]);
+            return true;
+        case READ_ADDR:
+            get_from_memory(mc, instr->address, &regs[instr->reg1]);
+            return true;
+        case READ_REG:
+            if (get_from_memory(mc, memory_address(regs[instr->reg1]), &regs[instr->reg2]) == NEGATIVE_MEM) {
+                fprintf(stderr, "Memory request error: can not read from address %lf\n", regs[instr->reg1]);
+                cpu->state = WAIT;
+                return false;
+            }
+            return true;
+        case WRITE_IREG:
+            if (write_into_memory(mc, cpu->iregs[instr->reg2], regs[instr->reg1])) {
+                fprintf(stderr, "Memory request error: can not write into address %lld\n", cpu->iregs[instr->reg2]);
+                cpu->state = WAIT;
+                return false;
+            }
+            return true;
+        case READ_IREG:
+            if (get_from_memory(mc, cpu->iregs[instr->reg1], &regs[instr->reg2]) == NEGATIVE_MEM) {
+                fprintf(stderr, "Memory request error: can not read from address %lld\n", cpu->iregs[instr->reg1]);
+                cpu->state = WAIT;
+                return false;
+            }
+            return true;
+        case POP_IREG:
+            if (!check_arg_num(cpu, 1)) {
+                fprintf(stderr, "CPU error: pop from empty stack\n");
+                return false;
+            }
+            take_from_cpu_stack(cpu, &tmp_double, NULL);
+            if (!integer_value(tmp_double, &cpu->iregs[instr->reg1])) {
+                fprintf(stderr, "CPU error: value %lf does not fit into integer register\n", tmp_double);
+                cpu->state = WAIT;
+                return false;
+            }
+            return true;
+        case CAS:
+        case XADD:
+        case FENCE:
+        case CPUID:
+        case CPUNUM:
+            return jit_atomic_command(cpu, mc, instr);
+        default:
+            return false;
+    }
+    return false;
+}
+
+//! \brief Get native code of the program for memory controller. Code is
+//! compiled once and kept in program, until it is destroyed. Cpus, which
+//! share program, may compile it at the same time, then one code is kept.
+//! \param[in] program Decoded program without superinstructions and regions
+//! \param[in] mc Memory controller for read and write commands
+//! \param[out] own True, if code is not kept in program and caller must destroy it
+//! \return Returns native code or NULL, if program can not be compiled
+static struct Jit_Code *
+get_jit_code(struct Program *program, struct Memory_Controller *mc, bool *own)
+{
+    *own = false;
+    struct Jit_Code *jit = __atomic_load_n(&program->jit, __ATOMIC_ACQUIRE);
+    if (jit && jit->mc == mc) {
+        return jit;
+    }
+    struct Jit_Layout layout;
+    layout.stack_size = offsetof(struct Stack_double, size);
+    layout.stack_capacity = offsetof(struct Stack_double, capacity);
+    layout.stack_data = offsetof(struct Stack_double, data);
+    layout.ret_size = offsetof(struct Stack_int, size);
+    layout.ret_capacity = offsetof(struct Stack_int, capacity);
+    layout.ret_data = offsetof(struct Stack_int, data);
+    layout.stack_grow = jit_stack_grow;
+    layout.ret_push = jit_ret_push;
+    layout.command = jit_command;
+
+    struct Jit_Code *compiled = jit_compile(program, mc, &layout);
+    if (!compiled || jit) {
+        // code of other memory controller is kept, this one is used once
+        *own = compiled != NULL;
+        return compiled;
+    }
+    if (!__atomic_compare_exchange_n(&program->jit, &jit, compiled, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        jit_destroy(compiled);
+        if (jit->mc == mc) {
+            return jit;
         }
+        return get_jit_code(program, mc, own);
     }
-    return true;
+    return compiled;
 }
 
+//! \brief Execute program as native code. Commands, which jit code does
+//! not execute itself (hlt, end of program, spawn, commands with errors),
+//! are executed by interpreter, which goes on up to the next jump, and
+//! native code goes on from there.
+//! \param[in] program Decoded program without superinstructions and regions
+//! \param[in] cpu Pointer to cpu which will process commands
+//! \param[in] mc Memory controller for read and write commands
+//! \return Return true, if no errors during execution
+bool
+work_jit(struct Program *program, struct Cpu *cpu, struct Memory_Controller *mc)
+{
+    assert(program);
+    assert(cpu);
+    assert(mc);
+
+    if (cpu->state != ON) {
+        turn_cpu_on(cpu);
+    }
+// jit code changes stacks by itself, so it can not keep debug data right
+#if !defined(DEBUG_HASH) && !defined(DEBUG_BIRDS) && !defined(CHECK_CORRECTNESS)
+    bool own = false;
+    struct Jit_Code *jit = get_jit_code(program, mc, &own);
+    if (jit) {
+        bool result = true;
+        while (true) {
+            int next = jit_run(jit, cpu);
+            if (next < 0) {
+                result = false;
+                break;
+            }
+            cpu->ip = next;
+            // interpreter pauses at the first jump after the command, unless
+            // pause_at is changed meanwhile (signal handler sets it to 0)
+            long long pause_at = __atomic_load_n(&cpu->pause_at, __ATOMIC_RELAXED);
+            long long step = cpu->executed + 1;
+            bool stepping = step < pause_at &&
+                            __atomic_compare_exchange_n(&cpu->pause_at, &pause_at, step, false,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            result = work(program, cpu, mc);
+            if (stepping) {
+                __atomic_compare_exchange_n(&cpu->pause_at, &step, pause_at, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            }
+            if (!result || cpu->state != PAUSED ||
+                cpu->executed >= __atomic_load_n(&cpu->pause_at, __ATOMIC_RELAXED)) {
+                break;
+            }
+            cpu->state = ON;
+        }
+        if (own) {
+            jit_destroy(jit);
+        }
+        return result;
+    }
+#endif
+    return work(program, cpu, mc);
+}
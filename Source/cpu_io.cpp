@@ -0,0 +1,390 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <cctype>
+#include <cassert>
+#include <cerrno>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cpu_io.h"
+#include "channel.h"
+
+//! \brief Buffers of in and out commands. stdin and stdout are used through
+//! their descriptors, one read or write for many values.
+struct Cpu_Io
+{
+    char in[CPU_IO_BUFFER_SIZE + 1];   // read data, terminated by zero
+    int in_pos;
+    int in_end;
+    bool in_eof;
+    char out[CPU_IO_BUFFER_SIZE];
+    int out_size;
+    bool raw;       // values are native doubles, not text
+    bool shared;    // several cpus use buffers at once
+};
+
+static struct Cpu_Io io = {};
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//! Channels of pipeline stage, which works in this thread, instead of stdin and stdout
+static __thread struct Channel *in_channel = NULL;
+static __thread struct Channel *out_channel = NULL;
+
+//! Functions of embedded virtual machine, which works in this thread, see vm.h
+static __thread Cpu_In_Function in_function = NULL;
+static __thread Cpu_Out_Function out_function = NULL;
+static __thread void *io_context = NULL;
+
+//! Powers of ten, which are exact doubles
+static const double EXACT_POWERS[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//! Maximum number of significant digits, which fit into mantissa accumulator
+constexpr int PARSE_MAX_DIGITS = 19;
+
+//! Values less than it are formatted without snprintf
+constexpr double FORMAT_MAX_FAST = 1e15;
+
+//! \brief Set mode of in and out commands, must be called before cpu starts
+//! \param [in] raw Values are 8 byte native doubles instead of text lines
+//! \param [in] shared Buffers are used by several cpus
+void
+cpu_io_init(bool raw, bool shared)
+{
+    io.in_pos = 0;
+    io.in_end = 0;
+    io.in_eof = false;
+    io.in[0] = '\0';
+    io.out_size = 0;
+    io.raw = raw;
+    io.shared = shared;
+}
+
+//! \brief Connect in and out commands of the calling thread to channels
+//! \param [in] in Channel for in commands or NULL for stdin
+//! \param [in] out Channel for out commands or NULL for stdout
+void
+cpu_io_set_channels(struct Channel *in, struct Channel *out)
+{
+    in_channel = in;
+    out_channel = out;
+}
+
+//! \brief Connect in and out commands of the calling thread to functions,
+//! without functions (both are NULL) stdin and stdout are used again
+//! \param [in] in Function for in commands or NULL
+//! \param [in] out Function for out commands or NULL
+//! \param [in] context Argument for the functions
+void
+cpu_io_set_functions(Cpu_In_Function in, Cpu_Out_Function out, void *context)
+{
+    in_function = in;
+    out_function = out;
+    io_context = context;
+}
+
+//! \brief Write out buffer into stdout
+static void
+flush_out()
+{
+    int written = 0;
+    while (written < io.out_size) {
+        ssize_t res = write(STDOUT_FILENO, io.out + written, io.out_size - written);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            fprintf(stderr, "Output error: can not write values\n");
+            break;
+        }
+        written += res;
+    }
+    io.out_size = 0;
+}
+
+//! \brief Read more data into in buffer, unread data is moved to its start.
+//! Output is flushed before, so interactive user sees it before typing.
+static void
+fill_in()
+{
+    flush_out();
+    int left = io.in_end - io.in_pos;
+    memmove(io.in, io.in + io.in_pos, left);
+    io.in_pos = 0;
+    io.in_end = left;
+    while (io.in_end < CPU_IO_BUFFER_SIZE) {
+        ssize_t res = read(STDIN_FILENO, io.in + io.in_end, CPU_IO_BUFFER_SIZE - io.in_end);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            io.in_eof = true;
+        } else {
+            io.in_end += res;
+        }
+        break;
+    }
+    io.in[io.in_end] = '\0';
+}
+
+//! \brief Check, if more data can be read into in buffer
+static bool
+can_fill_in()
+{
+    return !io.in_eof && (io.in_pos > 0 || io.in_end < CPU_IO_BUFFER_SIZE);
+}
+
+//! \brief Read one value from stdin, like fscanf("%lf") does
+//! \return Returns false, if there is no value
+static bool
+read_text(double *value)
+{
+    while (true) {
+        while (io.in_pos < io.in_end && isspace((unsigned char)io.in[io.in_pos])) {
+            io.in_pos++;
+        }
+        int end = io.in_pos;
+        while (end < io.in_end && !isspace((unsigned char)io.in[end])) {
+            end++;
+        }
+        // the whole value must be in buffer
+        if (end == io.in_end && can_fill_in()) {
+            fill_in();
+            continue;
+        }
+        if (io.in_pos == io.in_end) {
+            return false;
+        }
+        break;
+    }
+    const char *end = parse_double(io.in + io.in_pos, value);
+    if (!end) {
+        return false;
+    }
+    io.in_pos = end - io.in;
+    return true;
+}
+
+//! \brief Read one native double from stdin
+//! \return Returns false, if there is no value
+static bool
+read_raw(double *value)
+{
+    while (io.in_end - io.in_pos < (int)sizeof(double) && can_fill_in()) {
+        fill_in();
+    }
+    if (io.in_end - io.in_pos < (int)sizeof(double)) {
+        return false;
+    }
+    memcpy(value, io.in + io.in_pos, sizeof(double));
+    io.in_pos += sizeof(double);
+    return true;
+}
+
+//! \brief Read value for in command
+//! \param [out] value Read value
+//! \return Returns result from CPU_IN_RESULTS, only in function can block
+int
+cpu_in(double *value)
+{
+    assert(value);
+
+    if (in_function || out_function) {
+        return in_function ? in_function(io_context, value) : CPU_IN_NONE;
+    }
+    if (in_channel) {
+        return channel_pop(in_channel, value) ? CPU_IN_VALUE : CPU_IN_NONE;
+    }
+    if (io.shared) {
+        pthread_mutex_lock(&io_lock);
+    }
+    bool result = io.raw ? read_raw(value) : read_text(value);
+    if (io.shared) {
+        pthread_mutex_unlock(&io_lock);
+    }
+    return result ? CPU_IN_VALUE : CPU_IN_NONE;
+}
+
+//! \brief Print value of out command, it stays in buffer until it is full
+//! or cpu_io_flush() is called
+//! \param [in] value Value to print
+void
+cpu_out(double value)
+{
+    if (in_function || out_function) {
+        if (out_function) {
+            out_function(io_context, value);
+        }
+        return;
+    }
+    // values after the end of the next stage are lost, like in shell pipes
+    if (out_channel) {
+        channel_push(out_channel, value);
+        return;
+    }
+    if (io.shared) {
+        pthread_mutex_lock(&io_lock);
+    }
+    if (io.out_size + CPU_IO_VALUE_SIZE > CPU_IO_BUFFER_SIZE) {
+        flush_out();
+    }
+    if (io.raw) {
+        memcpy(io.out + io.out_size, &value, sizeof(double));
+        io.out_size += sizeof(double);
+    } else {
+        io.out_size += format_double(io.out + io.out_size, value);
+        io.out[io.out_size++] = '\n';
+    }
+    if (io.shared) {
+        pthread_mutex_unlock(&io_lock);
+    }
+}
+
+//! \brief Print buffered values, must be called after cpu stops
+void
+cpu_io_flush()
+{
+    if (io.shared) {
+        pthread_mutex_lock(&io_lock);
+    }
+    flush_out();
+    if (io.shared) {
+        pthread_mutex_unlock(&io_lock);
+    }
+}
+
+//! \brief Parse double like strtod does. Decimal values with up to 19
+//! significant digits and small exponent are converted exactly without
+//! strtod: the mantissa and the power of ten are both exact doubles, so
+//! one multiplication or division rounds correctly.
+//! \param [in] str String with value, leading spaces are skipped
+//! \param [out] value Parsed value
+//! \return Returns pointer after the value or NULL, if there is no value
+const char *
+parse_double(const char *str, double *value)
+{
+    assert(str);
+    assert(value);
+
+    const char *start = str;
+    while (isspace((unsigned char)*start)) {
+        start++;
+    }
+    const char *s = start;
+    bool negative = *s == '-';
+    if (*s == '-' || *s == '+') {
+        s++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;         // significant digits in mantissa
+    int exponent = 0;
+    bool any_digit = false;
+    bool fast = true;
+    for (bool fraction = false; ; s++) {
+        if (*s == '.' && !fraction) {
+            fraction = true;
+            continue;
+        }
+        if (!isdigit((unsigned char)*s)) {
+            break;
+        }
+        any_digit = true;
+        if (mantissa || *s != '0') {
+            fast = fast && digits < PARSE_MAX_DIGITS;
+            mantissa = mantissa * 10 + (*s - '0');
+            digits++;
+        }
+        exponent -= fraction;
+    }
+    if (any_digit && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool negative_exponent = *e == '-';
+        if (*e == '-' || *e == '+') {
+            e++;
+        }
+        if (isdigit((unsigned char)*e)) {
+            int exp_value = 0;
+            for (; isdigit((unsigned char)*e); e++) {
+                if (exp_value < 10000) {
+                    exp_value = exp_value * 10 + (*e - '0');
+                }
+            }
+            exponent += negative_exponent ? -exp_value : exp_value;
+            s = e;
+        }
+    }
+    // hex values, inf, nan and values glued with text are left to strtod
+    fast = fast && any_digit && (!*s || isspace((unsigned char)*s)) && mantissa <= ((uint64_t)1 << 53) &&
+           exponent >= -22 && exponent <= 22;
+    if (fast) {
+        double result = (double)mantissa;
+        if (exponent < 0) {
+            result /= EXACT_POWERS[-exponent];
+        } else {
+            result *= EXACT_POWERS[exponent];
+        }
+        *value = negative ? -result : result;
+        return s;
+    }
+    char *end = NULL;
+    *value = strtod(start, &end);
+    return end == start ? NULL : end;
+}
+
+//! \brief Format double like sprintf("%lf") does. Values less than 1e15
+//! are split into integer part and fraction, fraction * 1e6 is rounded
+//! to nearest even with the exact product error got by fma.
+//! \param [out] str Buffer of at least CPU_IO_VALUE_SIZE bytes
+//! \param [in] value Value to format
+//! \return Returns length of the string
+int
+format_double(char *str, double value)
+{
+    assert(str);
+
+    if (!std::isfinite(value) || fabs(value) >= FORMAT_MAX_FAST) {
+        return snprintf(str, CPU_IO_VALUE_SIZE, "%lf", value);
+    }
+    double absolute = fabs(value);
+    uint64_t integer = (uint64_t)absolute;
+    double fraction = absolute - (double)integer;
+    double scaled = fraction * 1e6;
+    double error = fma(fraction, 1e6, -scaled);
+    double micros = floor(scaled);
+    double rest = scaled - micros;
+    if (rest > 0.5 || (rest == 0.5 && (error > 0 || (error == 0 && fmod(micros, 2) != 0)))) {
+        micros += 1;
+    }
+    if (micros >= 1e6) {
+        integer++;
+        micros -= 1e6;
+    }
+
+    int len = 0;
+    if (std::signbit(value)) {
+        str[len++] = '-';
+    }
+    char digits[24];
+    int digits_num = 0;
+    do {
+        digits[digits_num++] = '0' + integer % 10;
+        integer /= 10;
+    } while (integer);
+    while (digits_num) {
+        str[len++] = digits[--digits_num];
+    }
+    str[len++] = '.';
+    int fraction_digits = (int)micros;
+    for (int i = 5; i >= 0; i--) {
+        str[len + i] = '0' + fraction_digits % 10;
+        fraction_digits /= 10;
+    }
+    len += 6;
+    str[len] = '\0';
+    return len;
+}
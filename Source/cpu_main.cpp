@@ -1,27 +1,1019 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "cpu.h"
 #include "in_and_out.h"
 #include "memory.h"
+#include "program.h"
+#include "regir.h"
+#include "verify.h"
+#include "batch.h"
+#include "cpu_io.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "memo.h"
+#include "channel.h"
+#include "fork.h"
+#include "vm.h"
+#include "manifest.h"
+#include "events.h"
+#include "program_cache.h"
 #include "cpu_main.h"
 
+//! \brief Translate engine name from command line into engine
+//! \param [in] name Engine name
+//! \return Returns engine from CPU_ENGINES or -1, if name is unknown
+static int
+choose_engine(const char *name)
+{
+    if (!strcmp(name, SWITCH_ENGINE_STR)) {
+        return SWITCH_ENGINE;
+    }
+    if (!strcmp(name, THREADED_ENGINE_STR)) {
+        return THREADED_ENGINE;
+    }
+    if (!strcmp(name, REGIR_ENGINE_STR)) {
+        return REGIR_ENGINE;
+    }
+    if (!strcmp(name, TOS_ENGINE_STR)) {
+        return TOS_ENGINE;
+    }
+    if (!strcmp(name, VERIFIED_ENGINE_STR)) {
+        return VERIFIED_ENGINE;
+    }
+    if (!strcmp(name, JIT_ENGINE_STR)) {
+        return JIT_ENGINE;
+    }
+    return -1;
+}
+
+//! \brief Cpu of smp mode, it works in its own host thread
+struct Smp_Cpu
+{
+    struct Cpu cpu;
+    pthread_t thread;
+    Engine_Function run;
+    struct Program *program;
+    struct Memory_Controller *mc;
+    const char *checkpoint_file;    // file for checkpoints or NULL
+    long long checkpoint_every;     // commands between checkpoints, 0 if not periodic
+    uint64_t program_hash;
+};
+
+//! Cpu, which saves checkpoint on SIGUSR1
+static struct Cpu *signal_cpu = NULL;
+
+//! \brief SIGUSR1 handler: pause cpu at the next jump to save checkpoint
+static void
+request_checkpoint(int)
+{
+    __atomic_store_n(&signal_cpu->pause_at, 0, __ATOMIC_RELAXED);
+}
+
+//! Trace buffers of all cpus, which are dumped on SIGUSR2
+static struct Trace **signal_traces = NULL;
+static int signal_traces_num = 0;
+static const char *signal_trace_file = NULL;
+static int signal_bytecode_size = 0;
+
+//! \brief SIGUSR2 handler: dump trace buffers, cpus go on
+static void
+request_trace(int)
+{
+    dump_traces(signal_trace_file, signal_traces, signal_traces_num, signal_bytecode_size);
+}
+
+//! \brief Interpreter loop for engine
+//! \param [in] engine Engine from CPU_ENGINES
+//! \return Returns function, which executes program
+static Engine_Function
+engine_function(int engine)
+{
+    switch (engine) {
+        case PAIRS_ENGINE:
+            return work_pairs;
+        case PROFILE_ENGINE:
+            return work_profile;
+        case TRACE_ENGINE:
+            return work_trace;
+        case MEMO_ENGINE:
+            return work_memo;
+        case THREADED_ENGINE:
+            return work_threaded;
+        case REGIR_ENGINE:
+            return work_regir;
+        case TOS_ENGINE:
+            return work_tos;
+        case VERIFIED_ENGINE:
+            return work_verified;
+        case JIT_ENGINE:
+            return work_jit;
+        default:
+            return work;
+    }
+    return work;
+}
+
+//! \brief Thread function of smp cpu
+//! \param [in] arg Pointer to Smp_Cpu
+static void *
+run_smp_cpu(void *arg)
+{
+    struct Smp_Cpu *smp_cpu = (struct Smp_Cpu *)arg;
+    struct Cpu *cpu = &smp_cpu->cpu;
+    // engine leaves paused cpu to save checkpoint, then it goes on
+    while (smp_cpu->run(smp_cpu->program, cpu, smp_cpu->mc) && cpu->state == PAUSED) {
+        cpu_io_flush();
+        save_checkpoint(smp_cpu->checkpoint_file, cpu, smp_cpu->mc, smp_cpu->program_hash);
+        cpu->pause_at = smp_cpu->checkpoint_every ? cpu->executed + smp_cpu->checkpoint_every : LLONG_MAX;
+    }
+    fork_join_rest(cpu);
+    return NULL;
+}
+
+//! \brief Print the most often executed pairs of commands into stderr
+//! \param [in] pairs Pairs counters, pairs[prev * DECODED_COMMANDS_NUM + next]
+static void
+print_pairs(long long *pairs)
+{
+    long long total = 0;
+    for (int i = 0; i < DECODED_COMMANDS_NUM * DECODED_COMMANDS_NUM; i++) {
+        total += pairs[i];
+    }
+    fprintf(stderr, "Executed pairs of commands (%lld total):\n", total);
+    for (int top = 0; top < PAIRS_TOP_NUM; top++) {
+        int best = 0;
+        for (int i = 0; i < DECODED_COMMANDS_NUM * DECODED_COMMANDS_NUM; i++) {
+            if (pairs[i] > pairs[best]) {
+                best = i;
+            }
+        }
+        if (!pairs[best]) {
+            break;
+        }
+        fprintf(stderr, "%12lld %6.2lf%% %s %s\n", pairs[best], 100.0 * pairs[best] / total,
+                command_name(best / DECODED_COMMANDS_NUM), command_name(best % DECODED_COMMANDS_NUM));
+        pairs[best] = 0;
+    }
+}
+
+//! \brief Time in seconds from some fixed point
+static double
+get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! \brief Print execution statistics and peak memory of cpu process into stderr
+static void
+print_statistics(long long executed, long long dispatched, double duration)
+{
+    fflush(stdout);
+    fprintf(stderr, "Executed %lld commands (%lld dispatches) in %lf s", executed, dispatched, duration);
+    if (duration > 0) {
+        fprintf(stderr, " (%.0lf commands/s)", executed / duration);
+    }
+    fprintf(stderr, "\n");
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage)) {
+        fprintf(stderr, "Peak memory %ld KB\n", usage.ru_maxrss);
+    }
+}
+
+//! \brief Run program once for every line of stdin in batch mode
+//! \param [in] program Decoded program without superinstructions
+//! \param [in] lanes Number of lines executed together
+//! \param [in] print_stat Print statistics into stderr
+//! \return Returns exit code
+static int
+run_batch(struct Program *program, int lanes, bool print_stat)
+{
+    struct Batch *batch = (struct Batch *)calloc(1, sizeof(struct Batch));
+    if (!batch || !init_batch(batch)) {
+        fprintf(stderr, "Can not allocate memory for batch\n");
+        free(batch);
+        return 1;
+    }
+    double start = get_time();
+    bool result = work_batch(program, lanes, batch);
+    double duration = get_time() - start;
+    if (print_stat) {
+        print_statistics(batch->executed, batch->dispatched, duration);
+    }
+    destroy_batch(batch);
+    free(batch);
+    return result ? 0 : 1;
+}
+
+//! \brief Read and decode binary program
+//! \param [in] file Binary program
+//! \param [out] program Decoded program
+//! \param [out] hash Hash of binary program, see program_hash()
+//! \return Returns false, if program can not be read or decoded
+static bool
+load_program(char *file, struct Program *program, uint64_t *hash)
+{
+    long commands_size = 0;
+    char *commands = mmap_file(file, &commands_size);
+    if (!commands) {
+        fprintf(stderr, "Error: Can`t mmap file %s\n", file);
+        return false;
+    }
+    if (!decode_program(commands, commands_size, program)) {
+        fprintf(stderr, "Error: Can`t decode file %s\n", file);
+        munmap(commands, commands_size);
+        return false;
+    }
+    *hash = program_hash(commands, commands_size);
+    // everything cpu needs is in the decoded program now
+    munmap(commands, commands_size);
+    return true;
+}
+
+//! \brief Prepare decoded program for engine
+//! \param [in] program Decoded program
+//! \param [in] engine Engine from CPU_ENGINES
+//! \param [in] fuse Make superinstructions, if engine can execute them
+//! \param [in] regions Build register IR regions for regir engine
+//! \param [in] print_stat Tell, if program is not verified
+//! \return Returns false on error
+static bool
+prepare_program(struct Program *program, int engine, bool fuse, bool regions, bool print_stat)
+{
+    // verifier, regions, pure functions, pairs statistics, profile and trace must see original commands
+    if (engine == VERIFIED_ENGINE && !verify_program(program) && print_stat) {
+        fprintf(stderr, "Program is not verified, stack checks are on\n");
+    }
+    if (engine == REGIR_ENGINE && regions && build_regions(program) < 0) {
+        return false;
+    }
+    if (engine == MEMO_ENGINE && find_pure_functions(program) < 0) {
+        return false;
+    }
+    // jit compiles original commands too, superinstructions work with cpu
+    // stack in memory and would make tos engine spill its cache
+    if (fuse && engine != JIT_ENGINE && engine != TOS_ENGINE && fuse_program(program) < 0) {
+        return false;
+    }
+    return true;
+}
+
+//! \brief What prepare_program() does with program for engine, engines with
+//! the same flags use the same cache file
+//! \return Returns flags from PROGRAM_CACHE_FLAGS
+static int
+prepared_flags(int engine, bool fuse, bool regions)
+{
+    int flags = 0;
+    if (engine == VERIFIED_ENGINE) {
+        flags |= PREPARED_VERIFIED;
+    }
+    if (engine == REGIR_ENGINE && regions) {
+        flags |= PREPARED_REGIONS;
+    }
+    if (engine == MEMO_ENGINE) {
+        flags |= PREPARED_PURE;
+    }
+    if (fuse && engine != JIT_ENGINE && engine != TOS_ENGINE) {
+        flags |= PREPARED_FUSED;
+    }
+    return flags;
+}
+
+//! \brief Read binary program and prepare it for engine, see load_program()
+//! and prepare_program(). With cache directory prepared program is mapped
+//! from there, if binary program was prepared the same way before, else it
+//! is prepared and saved there for the next runs.
+//! \param [in] file Binary program
+//! \param [in] cache_dir Cache directory or NULL
+//! \param [out] program Prepared program
+//! \param [out] hash Hash of binary program, see program_hash()
+//! \param [in] engine Engine from CPU_ENGINES
+//! \param [in] fuse Make superinstructions, if engine can execute them
+//! \param [in] regions Build register IR regions for regir engine
+//! \param [in] print_stat Tell, if program is not verified
+//! \return Returns false on error, program is destroyed then
+static bool
+load_prepared_program(char *file, const char *cache_dir, struct Program *program, uint64_t *hash, int engine,
+                      bool fuse, bool regions, bool print_stat)
+{
+    if (!cache_dir) {
+        if (!load_program(file, program, hash)) {
+            return false;
+        }
+        if (!prepare_program(program, engine, fuse, regions, print_stat)) {
+            destroy_program(program);
+            return false;
+        }
+        return true;
+    }
+    long commands_size = 0;
+    char *commands = mmap_file(file, &commands_size);
+    if (!commands) {
+        fprintf(stderr, "Error: Can`t mmap file %s\n", file);
+        return false;
+    }
+    *hash = program_hash(commands, commands_size);
+    int flags = prepared_flags(engine, fuse, regions);
+    if (map_program_cache(cache_dir, *hash, commands_size, flags, program)) {
+        munmap(commands, commands_size);
+        if ((flags & PREPARED_VERIFIED) && program->max_stack < 0 && print_stat) {
+            fprintf(stderr, "Program is not verified, stack checks are on\n");
+        }
+        return true;
+    }
+    // missing or stale file is replaced
+    bool ok = decode_program(commands, commands_size, program);
+    munmap(commands, commands_size);
+    if (!ok) {
+        fprintf(stderr, "Error: Can`t decode file %s\n", file);
+        return false;
+    }
+    if (!prepare_program(program, engine, fuse, regions, print_stat)) {
+        destroy_program(program);
+        return false;
+    }
+    save_program_cache(cache_dir, *hash, commands_size, flags, program);
+    return true;
+}
+
+//! \brief Run every program in its own virtual machine, machines share host
+//! threads, see run_scheduler()
+//! \param [in] files Binary programs, the same file is decoded once
+//! \param [in] files_num Number of programs
+//! \param [in] threads_num Number of host threads
+//! \param [in] engine Engine from CPU_ENGINES
+//! \param [in] fuse Make superinstructions
+//! \param [in] print_stat Print accounting of every machine into stderr
+//! \param [in] limits Limits of every machine
+//! \param [in] cache_dir Directory of prepared programs or NULL
+//! \return Returns exit code
+static int
+run_tenants(char **files, int files_num, int threads_num, int engine, bool fuse, bool print_stat,
+            const struct Tenant_Limits *limits, const char *cache_dir)
+{
+    struct Program *programs = (struct Program *)calloc(files_num, sizeof(struct Program));
+    int *program_index = (int *)calloc(files_num, sizeof(int));
+    struct Tenant *tenants = (struct Tenant *)calloc(files_num, sizeof(struct Tenant));
+    if (!programs || !program_index || !tenants) {
+        fprintf(stderr, "Can not allocate memory for virtual machines\n");
+        return 1;
+    }
+    int programs_num = 0;
+    int result = 0;
+    for (int i = 0; !result && i < files_num; i++) {
+        program_index[i] = programs_num;
+        for (int j = 0; j < i; j++) {
+            if (!strcmp(files[i], files[j])) {
+                program_index[i] = program_index[j];
+                break;
+            }
+        }
+        uint64_t hash = 0;
+        if (program_index[i] == programs_num) {
+            if (!load_prepared_program(files[i], cache_dir, &programs[programs_num], &hash, engine, fuse, true,
+                                       print_stat)) {
+                result = 1;
+                break;
+            }
+            programs_num++;
+        }
+        if (!init_tenant(&tenants[i], &programs[program_index[i]], files[i], limits->memory_size)) {
+            fprintf(stderr, "Can not allocate memory for virtual machine %d\n", i);
+            result = 1;
+        }
+    }
+    if (!result) {
+        cpu_io_init(false, threads_num > 1);
+        result = run_scheduler(tenants, files_num, threads_num, engine_function(engine), limits) ? 0 : 1;
+        cpu_io_flush();
+        if (print_stat) {
+            print_tenants(tenants, files_num);
+        }
+    }
+    for (int i = 0; i < files_num; i++) {
+        if (tenants[i].program) {
+            destroy_tenant(&tenants[i]);
+        }
+    }
+    for (int i = 0; i < programs_num; i++) {
+        destroy_program(&programs[i]);
+    }
+    free(tenants);
+    free(program_index);
+    free(programs);
+    return result;
+}
+
+//! \brief Stage of pipeline: virtual machine in its own host thread
+struct Pipeline_Stage
+{
+    struct Tenant vm;
+    pthread_t thread;
+    Engine_Function run;
+    struct Channel *in;     // values from the previous stage or NULL for stdin
+    struct Channel *out;    // values for the next stage or NULL for stdout
+    bool ok;
+};
+
+//! \brief Thread function of pipeline stage
+//! \param [in] arg Pointer to Pipeline_Stage
+static void *
+run_pipeline_stage(void *arg)
+{
+    struct Pipeline_Stage *stage = (struct Pipeline_Stage *)arg;
+    cpu_io_set_channels(stage->in, stage->out);
+    stage->ok = stage->run(stage->vm.program, &stage->vm.cpu, &stage->vm.mc);
+    // children without pool run in the stage thread, so they use its channels
+    stage->ok = fork_join_rest(&stage->vm.cpu) && stage->ok;
+    cpu_io_set_channels(NULL, NULL);
+    // the next stage gets end of input, the previous one does not wait for it
+    if (stage->out) {
+        close_channel(stage->out);
+    }
+    if (stage->in) {
+        detach_channel(stage->in);
+    }
+    return NULL;
+}
+
+//! \brief Run programs as pipeline: every one in its own virtual machine
+//! and host thread, out command of a stage gives value to in command of the
+//! next one, the first stage reads stdin and the last one writes stdout
+//! \param [in] files Binary programs in pipeline order
+//! \param [in] files_num Number of programs
+//! \param [in] engine Engine from CPU_ENGINES
+//! \param [in] fuse Make superinstructions
+//! \param [in] raw_io Raw input of the first stage and output of the last one
+//! \param [in] print_stat Print commands of every stage into stderr
+//! \param [in] cache_dir Directory of prepared programs or NULL
+//! \return Returns exit code
+static int
+run_pipeline(char **files, int files_num, int engine, bool fuse, bool raw_io, bool print_stat,
+             const char *cache_dir)
+{
+    struct Program *programs = (struct Program *)calloc(files_num, sizeof(struct Program));
+    struct Pipeline_Stage *stages = (struct Pipeline_Stage *)calloc(files_num, sizeof(struct Pipeline_Stage));
+    struct Channel *channels = (struct Channel *)calloc(files_num, sizeof(struct Channel));
+    if (!programs || !stages || !channels) {
+        fprintf(stderr, "Can not allocate memory for pipeline\n");
+        return 1;
+    }
+    int result = 0;
+    int stages_num = 0;
+    for (; !result && stages_num < files_num; stages_num++) {
+        struct Pipeline_Stage *stage = &stages[stages_num];
+        uint64_t hash = 0;
+        if (!load_prepared_program(files[stages_num], cache_dir, &programs[stages_num], &hash, engine, fuse, true,
+                                   print_stat)) {
+            result = 1;
+            break;
+        }
+        if (!init_tenant(&stage->vm, &programs[stages_num], files[stages_num], 0)) {
+            fprintf(stderr, "Can not prepare stage %d\n", stages_num);
+            result = 1;
+        }
+        stage->run = engine_function(engine);
+        stage->in = stages_num > 0 ? &channels[stages_num - 1] : NULL;
+        stage->out = stages_num < files_num - 1 ? &channels[stages_num] : NULL;
+        init_channel(&channels[stages_num]);
+    }
+    if (!result) {
+        cpu_io_init(raw_io, true);
+        double start = get_time();
+        int started = 1;
+        for (; started < files_num; started++) {
+            if (pthread_create(&stages[started].thread, NULL, run_pipeline_stage, &stages[started])) {
+                fprintf(stderr, "Can not start stage %d\n", started);
+                // the last started stage does not wait for it
+                detach_channel(&channels[started - 1]);
+                result = 1;
+                break;
+            }
+        }
+        // the first stage works in the main thread
+        run_pipeline_stage(&stages[0]);
+        for (int i = 1; i < started; i++) {
+            pthread_join(stages[i].thread, NULL);
+        }
+        cpu_io_flush();
+        double duration = get_time() - start;
+        long long executed = 0;
+        long long dispatched = 0;
+        for (int i = 0; i < started; i++) {
+            if (print_stat) {
+                fprintf(stderr, "Stage %d executed %lld commands (%s)\n", i, stages[i].vm.cpu.executed, files[i]);
+            }
+            executed += stages[i].vm.cpu.executed;
+            dispatched += stages[i].vm.cpu.dispatched;
+            result = result || !stages[i].ok;
+        }
+        if (print_stat) {
+            print_statistics(executed, dispatched, duration);
+        }
+    }
+    for (int i = 0; i < stages_num; i++) {
+        if (stages[i].vm.program) {
+            destroy_tenant(&stages[i].vm);
+        }
+        destroy_program(&programs[i]);
+    }
+    free(channels);
+    free(stages);
+    free(programs);
+    return result;
+}
+
+//! \brief Input and output of manifest job in memory
+struct Job_Io
+{
+    char *input;        // text of input file
+    const char *next;   // the next value in input
+    char *output;
+    int output_size;
+    int output_capacity;
+    bool output_failed; // output can not be allocated
+};
+
+//! \brief Worker thread of manifest, it runs jobs on its own virtual machine
+struct Manifest_Worker
+{
+    struct Manifest *manifest;
+    struct Vm *vm;
+    int index;
+    pthread_t thread;
+    int engine;
+    bool fuse;
+    const char *cache_dir;  // directory of prepared programs or NULL
+    struct Vm_Limits limits;
+    struct Job_Io io;
+};
+
+//! \brief In command of manifest job
+static bool
+job_in(void *context, double *value)
+{
+    struct Job_Io *io = (struct Job_Io *)context;
+    const char *end = parse_double(io->next, value);
+    if (!end) {
+        return false;
+    }
+    io->next = end;
+    return true;
+}
+
+//! \brief Out command of manifest job, values are formatted as in stdout
+static void
+job_out(void *context, double value)
+{
+    struct Job_Io *io = (struct Job_Io *)context;
+    if (io->output_capacity - io->output_size <= CPU_IO_VALUE_SIZE) {
+        int capacity = 2 * io->output_capacity + CPU_IO_VALUE_SIZE + 1;
+        char *output = (char *)realloc(io->output, capacity);
+        if (!output) {
+            io->output_failed = true;
+            return;
+        }
+        io->output = output;
+        io->output_capacity = capacity;
+    }
+    io->output_size += format_double(io->output + io->output_size, value);
+    io->output[io->output_size++] = '\n';
+}
+
+//! \brief Load program of job, run it with its input and compare output
+//! with expected one
+//! \param [in] worker Worker thread
+//! \param [in] job Job
+static void
+run_job(struct Manifest_Worker *worker, struct Manifest_Job *job)
+{
+    struct Program program;
+    uint64_t hash = 0;
+    int expected_size = 0;
+    struct Job_Io *io = &worker->io;
+    io->input = read_text_file(job->input, NULL);
+    char *expected = read_text_file(job->expected, &expected_size);
+    if (!io->input || !expected) {
+        fprintf(stderr, "Can not read input %s or expected output %s\n", job->input, job->expected);
+        job->state = JOB_BROKEN;
+    } else if (!load_prepared_program(job->program, worker->cache_dir, &program, &hash, worker->engine,
+                                      worker->fuse, true, false)) {
+        job->state = JOB_BROKEN;
+    } else {
+        io->next = io->input;
+        io->output_size = 0;
+        io->output_failed = false;
+        struct Vm_Io vm_io = {job_in, job_out, io};
+        set_vm_io(worker->vm, &vm_io);
+        attach_vm(worker->vm, &program);
+        job->result = run_vm(worker->vm, &worker->limits);
+        job->executed = worker->vm->cpu.executed;
+        bool same = !io->output_failed && io->output_size == expected_size &&
+                    !memcmp(io->output, expected, expected_size);
+        job->state = same ? JOB_PASSED : JOB_FAILED;
+        // the next job starts on clean machine
+        reset_vm(worker->vm);
+        destroy_program(&program);
+    }
+    free(io->input);
+    free(expected);
+}
+
+//! \brief Thread function of manifest worker: run own jobs, then steal jobs
+//! of other workers
+//! \param [in] arg Pointer to Manifest_Worker
+static void *
+run_manifest_worker(void *arg)
+{
+    struct Manifest_Worker *worker = (struct Manifest_Worker *)arg;
+    int index = 0;
+    while ((index = take_job(worker->manifest, worker->index)) >= 0) {
+        struct Manifest_Job *job = &worker->manifest->jobs[index];
+        double start = get_time();
+        run_job(worker, job);
+        job->seconds = get_time() - start;
+    }
+    return NULL;
+}
+
+//! \brief Run every job of manifest in its virtual machine, workers take
+//! machines from pool, output is compared in memory
+//! \param [in] file Manifest
+//! \param [in] threads_num Number of worker threads including the main one
+//! \param [in] engine Engine from CPU_ENGINES
+//! \param [in] fuse Make superinstructions
+//! \param [in] limits Limits of every job, memory_size is memory of machine
+//! \param [in] cache_dir Directory of prepared programs or NULL
+//! \return Returns exit code: 0, if all jobs passed
+static int
+run_manifest(const char *file, int threads_num, int engine, bool fuse, const struct Tenant_Limits *limits,
+             const char *cache_dir)
+{
+    struct Manifest manifest;
+    if (!read_manifest(file, &manifest)) {
+        return 1;
+    }
+    if (threads_num > manifest.jobs_num) {
+        threads_num = manifest.jobs_num > 0 ? manifest.jobs_num : 1;
+    }
+    struct Manifest_Worker *workers = (struct Manifest_Worker *)calloc(threads_num, sizeof(struct Manifest_Worker));
+    struct Vm_Pool pool;
+    long long memory_size = limits->memory_size ? limits->memory_size : MANIFEST_MEMORY_SIZE;
+    if (!workers || !split_manifest(&manifest, threads_num) ||
+        !init_vm_pool(&pool, threads_num, memory_size, 0, 0)) {
+        fprintf(stderr, "Can not allocate memory for manifest workers\n");
+        free(workers);
+        destroy_manifest(&manifest);
+        return 1;
+    }
+    for (int i = 0; i < threads_num; i++) {
+        workers[i].manifest = &manifest;
+        workers[i].vm = take_vm(&pool);
+        workers[i].vm->run = engine_function(engine);
+        workers[i].index = i;
+        workers[i].engine = engine;
+        workers[i].fuse = fuse;
+        workers[i].cache_dir = cache_dir;
+        workers[i].limits.max_commands = limits->max_commands;
+        workers[i].limits.max_calls = limits->max_calls;
+    }
+    double start = get_time();
+    // the main thread is the first worker
+    int started = 1;
+    for (; started < threads_num; started++) {
+        if (pthread_create(&workers[started].thread, NULL, run_manifest_worker, &workers[started])) {
+            // jobs of missing workers are stolen by the others
+            fprintf(stderr, "Can not start worker thread %d, %d threads are used\n", started, started);
+            break;
+        }
+    }
+    run_manifest_worker(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double duration = get_time() - start;
+    print_manifest(&manifest, duration);
+    int result = 0;
+    for (int i = 0; i < manifest.jobs_num; i++) {
+        result = result || manifest.jobs[i].state != JOB_PASSED;
+    }
+    for (int i = 0; i < threads_num; i++) {
+        free(workers[i].io.output);
+        give_vm(&pool, workers[i].vm);
+    }
+    destroy_vm_pool(&pool);
+    destroy_manifest(&manifest);
+    free(workers);
+    return result;
+}
+
+//! \brief Serve sessions of Unix socket, every one runs program in its own
+//! virtual machine, see serve_sessions()
+//! \param [in] socket_path Unix socket
+//! \param [in] file Binary program
+//! \param [in] engine Engine from CPU_ENGINES, it must not be jit
+//! \param [in] fuse Make superinstructions
+//! \param [in] print_stat Print commands of every session into stderr
+//! \param [in] limits Limits of every machine
+//! \param [in] cache_dir Directory of prepared programs or NULL
+//! \return Returns exit code
+static int
+run_sessions(const char *socket_path, char *file, int engine, bool fuse, bool print_stat,
+             const struct Tenant_Limits *limits, const char *cache_dir)
+{
+    struct Program program;
+    uint64_t hash = 0;
+    if (!load_prepared_program(file, cache_dir, &program, &hash, engine, fuse, true, print_stat)) {
+        return 1;
+    }
+    // children would block host thread at in command
+    if (has_spawn(&program)) {
+        fprintf(stderr, "Spawn command can not be used with --listen\n");
+        destroy_program(&program);
+        return 1;
+    }
+    int result = serve_sessions(socket_path, &program, engine_function(engine), limits, print_stat) ? 0 : 1;
+    destroy_program(&program);
+    return result;
+}
+
 int
 main(int argc, char **argv)
 {
-    if (argc < ARG_NUM) {
+    int engine = SWITCH_ENGINE;
+    bool print_stat = false;
+    bool count_pairs = false;
+    bool profile = false;
+    const char *trace_file = NULL;
+    bool memo = false;
+    bool fuse = true;
+    int cpus_num = 1;
+    int batch_lanes = 0;
+    bool raw_io = false;
+    const char *checkpoint_file = NULL;
+    const char *resume_file = NULL;
+    long long checkpoint_every = 0;
+    int scheduler_threads = 0;
+    int fork_workers = -1;
+    bool pipeline = false;
+    const char *manifest_file = NULL;
+    const char *socket_path = NULL;
+    const char *cache_dir = NULL;
+    struct Tenant_Limits limits = {SCHEDULER_QUANTUM, 0, 0, 0};
+    long long limit = 0;
+    char *endptr = NULL;
+    int opt = 0;
+    static const struct option long_options[] = {
+        {"pipeline", no_argument, NULL, PIPELINE_OPTION},
+        {"batch", required_argument, NULL, MANIFEST_OPTION},
+        {"listen", required_argument, NULL, LISTEN_OPTION},
+        {NULL, 0, NULL, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "e:sfPt:mnp:b:rk:c:l:g:w:q:L:D:M:C:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case PIPELINE_OPTION:
+                pipeline = true;
+                break;
+            case MANIFEST_OPTION:
+                manifest_file = optarg;
+                break;
+            case LISTEN_OPTION:
+                socket_path = optarg;
+                break;
+            case 'e':
+                engine = choose_engine(optarg);
+                if (engine < 0) {
+                    fprintf(stderr, "Unknown engine %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                print_stat = true;
+                break;
+            case 'f':
+                count_pairs = true;
+                break;
+            case 'P':
+                profile = true;
+                break;
+            case 't':
+                trace_file = optarg;
+                break;
+            case 'm':
+                memo = true;
+                break;
+            case 'n':
+                fuse = false;
+                break;
+            case 'p':
+                cpus_num = strtol(optarg, &endptr, 10);
+                if (*endptr || cpus_num < 1 || cpus_num > SMP_MAX_CPUS) {
+                    fprintf(stderr, "Wrong number of cpus %s, it must be from 1 to %d\n", optarg, SMP_MAX_CPUS);
+                    return 1;
+                }
+                break;
+            case 'b':
+                batch_lanes = strtol(optarg, &endptr, 10);
+                if (*endptr || (batch_lanes != 4 && batch_lanes != 8)) {
+                    fprintf(stderr, "Wrong number of lanes %s, it must be 4 or 8\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                raw_io = true;
+                break;
+            case 'k':
+                checkpoint_file = optarg;
+                break;
+            case 'c':
+                checkpoint_every = strtoll(optarg, &endptr, 10);
+                if (*endptr || checkpoint_every < 1) {
+                    fprintf(stderr, "Wrong number of commands between checkpoints %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                resume_file = optarg;
+                break;
+            case 'g':
+                scheduler_threads = strtol(optarg, &endptr, 10);
+                if (*endptr || scheduler_threads < 1 || scheduler_threads > SMP_MAX_CPUS) {
+                    fprintf(stderr, "Wrong number of host threads %s, it must be from 1 to %d\n", optarg,
+                            SMP_MAX_CPUS);
+                    return 1;
+                }
+                break;
+            case 'w':
+                fork_workers = strtol(optarg, &endptr, 10);
+                if (*endptr || fork_workers < 0 || fork_workers > FORK_MAX_WORKERS) {
+                    fprintf(stderr, "Wrong number of worker threads %s, it must be from 0 to %d\n", optarg,
+                            FORK_MAX_WORKERS);
+                    return 1;
+                }
+                break;
+            case 'C':
+                cache_dir = optarg;
+                break;
+            case 'q':
+            case 'L':
+            case 'D':
+            case 'M':
+                limit = strtoll(optarg, &endptr, 10);
+                if (*endptr || limit < 1 || (opt == 'D' && limit > INT_MAX)) {
+                    fprintf(stderr, "Wrong limit %s of -%c option\n", optarg, opt);
+                    return 1;
+                }
+                if (opt == 'q') {
+                    limits.quantum = limit;
+                } else if (opt == 'L') {
+                    limits.max_commands = limit;
+                } else if (opt == 'D') {
+                    limits.max_calls = limit;
+                } else {
+                    limits.memory_size = limit;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-e switch|threaded|regir|tos|verified|jit] [-s] [-f] [-P] [-t trace] [-m] [-n] [-p cpus] "
+                        "[-b lanes] [-r] [-k checkpoint] [-c commands] [-l checkpoint] [-w workers] [-C cache] file\n"
+                        "       %s [-e engine] [-s] [-n] [-C cache] -g threads [-q quantum] [-L commands] [-D depth] "
+                        "[-M cells] file...\n"
+                        "       %s [-e engine] [-s] [-n] [-r] [-C cache] --pipeline file...\n"
+                        "       %s [-e engine] [-n] [-w workers] [-L commands] [-D depth] [-M cells] [-C cache] "
+                        "--batch manifest\n"
+                        "       %s [-e engine] [-s] [-n] [-q quantum] [-L commands] [-D depth] [-M cells] [-C cache] "
+                        "--listen socket file\n", argv[0], argv[0], argv[0], argv[0], argv[0]);
+                return 1;
+        }
+    }
+    if (manifest_file) {
+        if (optind < argc || socket_path || pipeline || scheduler_threads || cpus_num > 1 || batch_lanes || raw_io ||
+            checkpoint_file || resume_file || count_pairs || profile || trace_file || memo || print_stat ||
+            limits.quantum != SCHEDULER_QUANTUM) {
+            fprintf(stderr, "Manifest of --batch can not be used with binary files, pipeline, -g, smp, batch "
+                    "lanes, raw input and output, checkpoints, pairs statistics, profile, trace, memoization, "
+                    "-s and -q\n");
+            return 1;
+        }
+        if (fork_workers < 0) {
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            fork_workers = online > 1 ? (online > FORK_MAX_WORKERS ? FORK_MAX_WORKERS : online - 1) : 0;
+        }
+        return run_manifest(manifest_file, fork_workers + 1, engine, fuse, &limits, cache_dir);
+    }
+    if (argc - optind < ARG_NUM - 1) {
         fprintf(stderr, "Specify input and output files\n");
         return 1;
     }
-    
-    int commands_size = 0;
-    char *commands = mmap_file(argv[FILE_IN], &commands_size);
-    if (!commands) {
-        fprintf(stderr, "Error: Can`t mmap file %s\n", argv[FILE_IN]);
+    if (raw_io && batch_lanes) {
+        fprintf(stderr, "Raw input and output can not be used in batch mode\n");
+        return 1;
+    }
+    if (cache_dir && batch_lanes) {
+        fprintf(stderr, "Cache of prepared programs can not be used in batch mode\n");
+        return 1;
+    }
+    if (count_pairs + profile + (trace_file != NULL) > 1) {
+        fprintf(stderr, "Only one of pairs statistics, profile and trace can be collected\n");
+        return 1;
+    }
+    if ((profile || trace_file) && batch_lanes) {
+        fprintf(stderr, "Profile and trace can not be collected in batch mode\n");
+        return 1;
+    }
+    if (memo && (count_pairs || profile || trace_file || batch_lanes)) {
+        fprintf(stderr, "Pure calls can not be memoized with pairs statistics, profile, trace and in batch mode\n");
+        return 1;
+    }
+    if (checkpoint_every && !checkpoint_file) {
+        fprintf(stderr, "Specify checkpoint file with -k\n");
+        return 1;
+    }
+    if ((checkpoint_file || resume_file) && (cpus_num > 1 || batch_lanes)) {
+        fprintf(stderr, "Checkpoints can not be used in smp and batch modes\n");
         return 1;
     }
+    if (socket_path) {
+        if (argc - optind != 1 || pipeline || scheduler_threads || cpus_num > 1 || batch_lanes || raw_io ||
+            checkpoint_file || resume_file || count_pairs || profile || trace_file || memo || fork_workers >= 0 ||
+            engine == JIT_ENGINE) {
+            fprintf(stderr, "Sessions of --listen need one binary file and can not be used with pipeline, -g, smp, "
+                    "batch, raw input and output, checkpoints, pairs statistics, profile, trace, memoization, -w "
+                    "and jit engine\n");
+            return 1;
+        }
+        return run_sessions(socket_path, argv[optind], engine, fuse, print_stat, &limits, cache_dir);
+    }
+    bool limited = limits.quantum != SCHEDULER_QUANTUM || limits.max_commands || limits.max_calls ||
+                   limits.memory_size;
+    if (limited && !scheduler_threads) {
+        fprintf(stderr, "Quantum and limits are used only with -g\n");
+        return 1;
+    }
+    if (scheduler_threads && (cpus_num > 1 || batch_lanes || raw_io || checkpoint_file || resume_file ||
+                              count_pairs || profile || trace_file || memo)) {
+        fprintf(stderr, "Virtual machines of -g can not be used with smp, batch, raw input and output, "
+                "checkpoints, pairs statistics, profile, trace and memoization\n");
+        return 1;
+    }
+    if (pipeline && (scheduler_threads || cpus_num > 1 || batch_lanes || checkpoint_file || resume_file ||
+                     count_pairs || profile || trace_file || memo)) {
+        fprintf(stderr, "Pipeline can not be used with -g, smp, batch, checkpoints, pairs statistics, profile, "
+                "trace and memoization\n");
+        return 1;
+    }
+    if (fork_workers >= 0 && (scheduler_threads || pipeline || batch_lanes)) {
+        fprintf(stderr, "Worker threads of -w can not be used with -g, pipeline and batch mode\n");
+        return 1;
+    }
+    if (pipeline) {
+        return run_pipeline(argv + optind, argc - optind, engine, fuse, raw_io, print_stat, cache_dir);
+    }
+    if (scheduler_threads) {
+        return run_tenants(argv + optind, argc - optind, scheduler_threads, engine, fuse, print_stat, &limits,
+                           cache_dir);
+    }
+    char *file_in = argv[optind];
 
-    struct Cpu work_cpu;
-    init(&work_cpu);
+    struct Program program;
+    uint64_t hash = 0;
+    if (batch_lanes) {
+        // batch engine executes commands, which are only decoded
+        if (!load_program(file_in, &program, &hash)) {
+            return 1;
+        }
+        int result = run_batch(&program, batch_lanes, print_stat);
+        destroy_program(&program);
+        return result;
+    }
+    bool instrumented = count_pairs || profile || trace_file;
+    if (memo) {
+        engine = MEMO_ENGINE;
+    }
+    if (!load_prepared_program(file_in, cache_dir, &program, &hash, engine, fuse && !instrumented, !instrumented,
+                               print_stat)) {
+        return 1;
+    }
+    bool spawns = has_spawn(&program);
+    if (spawns && (checkpoint_file || resume_file)) {
+        fprintf(stderr, "Checkpoints can not be used with spawn command\n");
+        destroy_program(&program);
+        return 1;
+    }
 
     Memory mem1;
     Memory mem2;
@@ -34,7 +1026,177 @@ main(int argc, char **argv)
     add_memory(&mc, &mem1);
     add_memory(&mc, &mem2);
 
-    work(commands, commands_size, &work_cpu, &mc);
+    if (count_pairs) {
+        engine = PAIRS_ENGINE;
+    }
+    if (profile) {
+        engine = PROFILE_ENGINE;
+    }
+    if (trace_file) {
+        engine = TRACE_ENGINE;
+    }
+    // all cpus share program and memory controller
+    struct Smp_Cpu *cpus = (struct Smp_Cpu *)calloc(cpus_num, sizeof(struct Smp_Cpu));
+    if (!cpus) {
+        fprintf(stderr, "Can not allocate memory for cpus\n");
+        return 1;
+    }
+    struct Trace **traces = trace_file ? (struct Trace **)calloc(cpus_num, sizeof(struct Trace *)) : NULL;
+    if (trace_file && !traces) {
+        fprintf(stderr, "Can not allocate memory for trace\n");
+        return 1;
+    }
+    for (int i = 0; i < cpus_num; i++) {
+        init(&cpus[i].cpu);
+        cpus[i].cpu.id = i;
+        cpus[i].cpu.cpus_num = cpus_num;
+        cpus[i].run = engine_function(engine);
+        cpus[i].program = &program;
+        cpus[i].mc = &mc;
+        cpus[i].checkpoint_file = checkpoint_file;
+        cpus[i].checkpoint_every = checkpoint_every;
+        cpus[i].program_hash = hash;
+        if (count_pairs) {
+            cpus[i].cpu.pairs = (long long *)calloc(DECODED_COMMANDS_NUM * DECODED_COMMANDS_NUM, sizeof(long long));
+            if (!cpus[i].cpu.pairs) {
+                fprintf(stderr, "Can not allocate memory for pairs statistics\n");
+                return 1;
+            }
+        }
+        if (profile) {
+            cpus[i].cpu.profile = (struct Profile *)calloc(1, sizeof(struct Profile));
+            if (!cpus[i].cpu.profile ||
+                !init_profile(cpus[i].cpu.profile, program.size, get_memory_size(&mc))) {
+                fprintf(stderr, "Can not allocate memory for profile\n");
+                return 1;
+            }
+        }
+        if (memo) {
+            cpus[i].cpu.memo = (struct Memo *)calloc(1, sizeof(struct Memo));
+            if (!cpus[i].cpu.memo || !init_memo(cpus[i].cpu.memo, program.pure_num)) {
+                fprintf(stderr, "Can not allocate memory for memoization\n");
+                return 1;
+            }
+        }
+        if (trace_file) {
+            traces[i] = cpus[i].cpu.trace = (struct Trace *)calloc(1, sizeof(struct Trace));
+            if (!traces[i]) {
+                fprintf(stderr, "Can not allocate memory for trace\n");
+                return 1;
+            }
+            traces[i]->cpu = i;
+        }
+    }
+
+    if (resume_file && !load_checkpoint(resume_file, &cpus[0].cpu, &mc, &program, hash)) {
+        return 1;
+    }
+    if (checkpoint_file) {
+        struct Cpu *cpu = &cpus[0].cpu;
+        cpu->checkpoint = true;
+        cpu->pause_at = checkpoint_every ? cpu->executed + checkpoint_every : LLONG_MAX;
+        signal_cpu = cpu;
+        struct sigaction action = {};
+        action.sa_handler = request_checkpoint;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, NULL);
+    }
+    if (trace_file) {
+        signal_traces = traces;
+        signal_traces_num = cpus_num;
+        signal_trace_file = trace_file;
+        signal_bytecode_size = program.bytecode_size;
+        struct sigaction action = {};
+        action.sa_handler = request_trace;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &action, NULL);
+    }
+    struct Fork_Pool pool;
+    if (spawns) {
+        if (fork_workers < 0) {
+            // the main thread runs children too, while it waits for them
+            long online = sysconf(_SC_NPROCESSORS_ONLN);
+            fork_workers = online > 1 ? (online > FORK_MAX_WORKERS ? FORK_MAX_WORKERS : online - 1) : 0;
+        }
+        if (!start_fork_pool(&pool, fork_workers)) {
+            fprintf(stderr, "Can not allocate memory for fork pool\n");
+            return 1;
+        }
+        for (int i = 0; i < cpus_num; i++) {
+            cpus[i].cpu.pool = &pool;
+        }
+    }
+    cpu_io_init(raw_io, cpus_num > 1 || (spawns && pool.threads_num > 0));
+    double start = get_time();
+    // the first cpu works in the main thread
+    for (int i = 1; i < cpus_num; i++) {
+        if (pthread_create(&cpus[i].thread, NULL, run_smp_cpu, &cpus[i])) {
+            fprintf(stderr, "Can not start cpu %d\n", i);
+            return 1;
+        }
+    }
+    run_smp_cpu(&cpus[0]);
+    for (int i = 1; i < cpus_num; i++) {
+        pthread_join(cpus[i].thread, NULL);
+    }
+    if (spawns) {
+        stop_fork_pool(&pool);
+    }
+    cpu_io_flush();
+    double duration = get_time() - start;
+    if (trace_file) {
+        // program has finished or stopped on error, trace shows how it got there
+        signal(SIGUSR2, SIG_IGN);
+        if (!dump_traces(trace_file, traces, cpus_num, program.bytecode_size)) {
+            fprintf(stderr, "Can not write trace into file %s\n", trace_file);
+        }
+        for (int i = 0; i < cpus_num; i++) {
+            free(traces[i]);
+        }
+        free(traces);
+    }
+
+    struct Cpu *work_cpu = &cpus[0].cpu;
+    for (int i = 1; i < cpus_num; i++) {
+        work_cpu->executed += cpus[i].cpu.executed;
+        work_cpu->dispatched += cpus[i].cpu.dispatched;
+        if (count_pairs) {
+            for (int j = 0; j < DECODED_COMMANDS_NUM * DECODED_COMMANDS_NUM; j++) {
+                work_cpu->pairs[j] += cpus[i].cpu.pairs[j];
+            }
+            free(cpus[i].cpu.pairs);
+        }
+        if (profile) {
+            merge_profile(work_cpu->profile, cpus[i].cpu.profile);
+            destroy_profile(cpus[i].cpu.profile);
+            free(cpus[i].cpu.profile);
+        }
+        if (memo) {
+            merge_memo(work_cpu->memo, cpus[i].cpu.memo);
+            destroy_memo(cpus[i].cpu.memo);
+            free(cpus[i].cpu.memo);
+        }
+    }
+
+    if (print_stat) {
+        print_statistics(work_cpu->executed, work_cpu->dispatched, duration);
+    }
+    if (count_pairs) {
+        print_pairs(work_cpu->pairs);
+        free(work_cpu->pairs);
+    }
+    if (profile) {
+        print_profile(work_cpu->profile, &program);
+        destroy_profile(work_cpu->profile);
+        free(work_cpu->profile);
+    }
+    if (memo) {
+        print_memo(work_cpu->memo, &program, work_cpu->executed, duration);
+        destroy_memo(work_cpu->memo);
+        free(work_cpu->memo);
+    }
+    free(cpus);
 
+    destroy_program(&program);
     return 0;
 }
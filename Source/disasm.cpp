@@ -7,11 +7,14 @@
 #include <stdio.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <stdlib.h>
+#include <cstdint>
 
 #include "asm.h"
 #include "cpu.h"
 #include "disasm.h"
 #include "in_and_out.h"
+#include "trace.h"
 
 
 //! \brief Small func to make code looks better. Write specified register.
@@ -37,33 +40,120 @@ write_register(char command, int fd) {
     return true;
 }
 
+//! \brief Write specified integer register
+//! \param [in] command Command which specifies integer register
+//! \param [in] fd File descriptor to write result (iax, ibx or icx)
+//! \return Returns true if integer register command was valid and successfully written
+static bool
+write_iregister(char command, int fd)
+{
+    switch (command) {
+        case IAX:
+            return write(fd, IAX_STR, sizeof(IAX_STR) - 1) != -1;
+        case IBX:
+            return write(fd, IBX_STR, sizeof(IBX_STR) - 1) != -1;
+        case ICX:
+            return write(fd, ICX_STR, sizeof(ICX_STR) - 1) != -1;
+        default:
+            return false;
+    }
+    return false;
+}
+
+//! \brief Write integer register operands separated by spaces
+//! \param [in] fd File descriptor to write result
+//! \param [in,out] commands Pointer to operands, shifts after them
+//! \param [in] commands_end End of command bytes
+//! \param [in] regs_num Number of integer register operands
+//! \return Returns true if all integer registers are valid
+static bool
+write_iregisters(int fd, char **commands, char *commands_end, int regs_num)
+{
+    if (*commands + regs_num > commands_end) {
+        return false;
+    }
+    for (int i = 0; i < regs_num; i++) {
+        write(fd, " ", 1);
+        if (!write_iregister((*commands)[i], fd)) {
+            return false;
+        }
+    }
+    *commands += regs_num;
+    return true;
+}
+
+//! \brief Read jump or memory address operand
+//! \param [in,out] commands Pointer to operand, shifts after it
+//! \param [in] operand_size COMPACT_OPERAND_SIZE (or JUMP_OPERAND_SIZE) or WIDE_OPERAND_SIZE
+//! \return Returns operand value
+static long long
+read_operand(char **commands, int operand_size)
+{
+    long long address = 0;
+    if (operand_size == COMPACT_OPERAND_SIZE) {
+        int compact = 0;
+        memcpy(&compact, *commands, sizeof(compact));
+        address = compact;
+    } else {
+        memcpy(&address, *commands, sizeof(address));
+    }
+    *commands += operand_size;
+    return address;
+}
+
 void
 write_address(int fd, char**commands)
 {
-    int address = 0;
-    address = *((int*)*commands);
-    dprintf(fd, " $%d\n", address);
-    *commands += sizeof(address);
+    dprintf(fd, " $%lld\n", read_operand(commands, JUMP_OPERAND_SIZE));
     return;
 }
+//! \brief Write register operands of atomic command, the last one is address
+//! \param [in] fd File descriptor to write result
+//! \param [in,out] commands Pointer to command, shifts to the next command
+//! \param [in] commands_end End of command bytes
+//! \param [in] regs_num Number of register operands
+//! \return Returns true if all registers are valid
+static bool
+write_atomic_operands(int fd, char **commands, char *commands_end, int regs_num)
+{
+    (*commands)++;
+    if (*commands + regs_num > commands_end) {
+        return false;
+    }
+    for (int i = 0; i < regs_num; i++) {
+        dprintf(fd, "%s", i == regs_num - 1 ? " [" : " ");
+        if (!write_register((*commands)[i], fd)) {
+            return false;
+        }
+    }
+    dprintf(fd, "]\n");
+    *commands += regs_num;
+    return true;
+}
+
 //! \brief Main disassembler function. Translates command bytes into assembler commands.
 //! \param [in] commands Command bytes
 //! \param [in] commands_size Command bytes len
 //! \param [in] fd File descriptor to write result in
+//! \param [in] operand_size Size of memory address operands, see bytecode_operand_size()
+//! \param [out] line_offsets Offset of the command for every written line or NULL,
+//! it must have commands_size elements
 //! \return Returns true if no problems during execution were.
 static bool
-translate_to_asm(char *commands, int commands_size, int fd)
+translate_to_asm(char *commands, long commands_size, int fd, int operand_size, int *line_offsets = NULL)
 {
     assert(commands);
     assert(fd > 0);
     assert(commands_size > 0);
-#ifdef DEBUG_NUMERATION    
     char *commands_begin = commands;
-#endif
     char *commands_end = commands + commands_size;
     double tmp_double = 0;
-    int address = 0;
+    int lines_num = 0;
     while (commands < commands_end) {
+        if (line_offsets) {
+            line_offsets[lines_num] = commands - commands_begin;
+        }
+        lines_num++;
 #ifdef DEBUG_NUMERATION
         dprintf(fd, "%ld : ", commands - commands_begin);
 #endif
@@ -210,6 +300,11 @@ translate_to_asm(char *commands, int commands_size, int fd)
                 commands++;
                 write_address(fd, &commands);
                 break;
+            case SPAWN:
+                write(fd, SPAWN_STR, sizeof(SPAWN_STR) - 1);
+                commands++;
+                write_address(fd, &commands);
+                break;
             case WRITE_REG:
                 write(fd, WRITE_STR, sizeof(WRITE_STR) - 1);
                 commands++;
@@ -236,16 +331,12 @@ translate_to_asm(char *commands, int commands_size, int fd)
                     return false;
                 }
                 commands++;
-                memcpy(&address, commands, sizeof(int));
-                dprintf(fd, " [%d]\n", address);
-                commands += sizeof(int);
+                dprintf(fd, " [%lld]\n", read_operand(&commands, operand_size));
                 break;
             case READ_ADDR:
                 write(fd, READ_STR, sizeof(READ_STR) - 1);
                 commands++;
-                memcpy(&address, commands, sizeof(int));
-                dprintf(fd, " [%d] ", address);
-                commands += sizeof(int);
+                dprintf(fd, " [%lld] ", read_operand(&commands, operand_size));
                 if (!write_register(*commands, fd)) {
                     fprintf(stderr, "Error: wrong read command\n");
                     return false;
@@ -270,9 +361,149 @@ translate_to_asm(char *commands, int commands_size, int fd)
                 commands++;
                 write(fd, "\n", 1);
                 break;
+            case CAS:
+            case XADD:
+                if (*commands == CAS) {
+                    write(fd, CAS_STR, sizeof(CAS_STR) - 1);
+                } else {
+                    write(fd, XADD_STR, sizeof(XADD_STR) - 1);
+                }
+                if (!write_atomic_operands(fd, &commands, commands_end, *commands == CAS ? 3 : 2)) {
+                    fprintf(stderr, "Error: wrong atomic command\n");
+                    return false;
+                }
+                break;
+            case FENCE:
+                write(fd, FENCE_STR, sizeof(FENCE_STR) - 1);
+                write(fd, "\n", 1);
+                commands++;
+                break;
+            case SNAP:
+                write(fd, SNAP_STR, sizeof(SNAP_STR) - 1);
+                write(fd, "\n", 1);
+                commands++;
+                break;
+            case JOIN:
+                write(fd, JOIN_STR, sizeof(JOIN_STR) - 1);
+                write(fd, "\n", 1);
+                commands++;
+                break;
+            case CPUID:
+            case CPUNUM:
+                if (*commands == CPUID) {
+                    write(fd, CPUID_STR, sizeof(CPUID_STR) - 1);
+                } else {
+                    write(fd, CPUNUM_STR, sizeof(CPUNUM_STR) - 1);
+                }
+                write(fd, " ", 1);
+                commands++;
+                if (commands >= commands_end || !write_register(*commands, fd)) {
+                    fprintf(stderr, "Error: no valid register in cpu number command\n");
+                    return false;
+                }
+                dprintf(fd, "\n");
+                commands++;
+                break;
+            case PUSH_IREG:
+            case POP_IREG:
+                if (*commands == PUSH_IREG) {
+                    write(fd, PUSH_STR, sizeof(PUSH_STR) - 1);
+                } else {
+                    write(fd, POP_STR, sizeof(POP_STR) - 1);
+                }
+                commands++;
+                if (!write_iregisters(fd, &commands, commands_end, 1)) {
+                    fprintf(stderr, "Error: no valid integer register in push or pop command\n");
+                    return false;
+                }
+                write(fd, "\n", 1);
+                break;
+            case IMOV_REG:
+            case IMOV_VAL:
+            case IADD_REG:
+            case IADD_VAL:
+            case ISUB_REG:
+            case ISUB_VAL:
+            case IMUL_REG:
+            case IMUL_VAL: {
+                // commands go in pairs: with register and with value
+                static const char *const names[] = {IMOV_STR, IADD_STR, ISUB_STR, IMUL_STR};
+                int code = *commands;
+                dprintf(fd, "%s", names[(code - IMOV_REG) / 2]);
+                commands++;
+                bool value = (code - IMOV_REG) % 2;
+                if (!write_iregisters(fd, &commands, commands_end, value ? 1 : 2)) {
+                    fprintf(stderr, "Error: no valid integer register in integer command\n");
+                    return false;
+                }
+                if (value) {
+                    if (commands + sizeof(int64_t) > commands_end) {
+                        fprintf(stderr, "Error: no value argument for integer command\n");
+                        return false;
+                    }
+                    int64_t tmp_value = 0;
+                    memcpy(&tmp_value, commands, sizeof(tmp_value));
+                    dprintf(fd, " %lld", (long long)tmp_value);
+                    commands += sizeof(tmp_value);
+                }
+                write(fd, "\n", 1);
+                break;
+            }
+            case IJMPL:
+            case IJMPG:
+            case IJMPE:
+                if (*commands == IJMPL) {
+                    write(fd, IJMPL_STR, sizeof(IJMPL_STR) - 1);
+                } else if (*commands == IJMPG) {
+                    write(fd, IJMPG_STR, sizeof(IJMPG_STR) - 1);
+                } else {
+                    write(fd, IJMPE_STR, sizeof(IJMPE_STR) - 1);
+                }
+                commands++;
+                if (!write_iregisters(fd, &commands, commands_end, 2)) {
+                    fprintf(stderr, "Error: no valid integer register in integer jmp command\n");
+                    return false;
+                }
+                write_address(fd, &commands);
+                break;
+            case WRITE_IREG:
+                write(fd, WRITE_STR, sizeof(WRITE_STR) - 1);
+                commands++;
+                write(fd, " ", 1);
+                if (commands + 2 > commands_end || !write_register(*commands, fd)) {
+                    fprintf(stderr, "Error: wrong write command\n");
+                    return false;
+                }
+                commands++;
+                dprintf(fd, " [");
+                if (!write_iregister(*commands, fd)) {
+                    fprintf(stderr, "Error: wrong write command\n");
+                    return false;
+                }
+                dprintf(fd, "]\n");
+                commands++;
+                break;
+            case READ_IREG:
+                write(fd, READ_STR, sizeof(READ_STR) - 1);
+                commands++;
+                dprintf(fd, " [");
+                if (commands + 2 > commands_end || !write_iregister(*commands, fd)) {
+                    fprintf(stderr, "Error: wrong read command\n");
+                    return false;
+                }
+                dprintf(fd, "] ");
+                commands++;
+                if (!write_register(*commands, fd)) {
+                    fprintf(stderr, "Error: wrong read command\n");
+                    return false;
+                }
+                commands++;
+                write(fd, "\n", 1);
+                break;
             default:
                 fprintf(stderr, "Error: can not recognise command %10s\n", commands);
                 commands++;
+                lines_num--;
                 break;
         }
     }
@@ -289,8 +520,18 @@ in_and_out_from_binary(char *file_in, char *file_out)
     assert(file_in);
     assert(file_out);
 
-    int file_in_size = 0;
+    long file_in_size = 0;
     char *commands = mmap_file(file_in, &file_in_size);
+    if (!commands) {
+        return false;
+    }
+    long header_size = 0;
+    int operand_size = bytecode_operand_size(commands, file_in_size, &header_size);
+    if (!operand_size) {
+        fprintf(stderr, "Error: unknown version of wide bytecode in file %s\n", file_in);
+        munmap(commands, file_in_size);
+        return false;
+    }
     
     int fd_out = open(file_out, O_WRONLY | O_CREAT | O_TRUNC, out_mode);
     if (fd_out < 0) {
@@ -298,7 +539,11 @@ in_and_out_from_binary(char *file_in, char *file_out)
         munmap(commands, file_in_size);
         return false;
     }
-    if (!translate_to_asm(commands, file_in_size, fd_out)) {
+    if (header_size) {
+        dprintf(fd_out, "# wide bytecode, assemble with asm -w #\n");
+    }
+    if (file_in_size > header_size &&
+        !translate_to_asm(commands + header_size, file_in_size - header_size, fd_out, operand_size)) {
         fprintf(stderr, "Error: Can`t translate to asm\n");
         close(fd_out);
         munmap(commands, file_in_size);
@@ -313,4 +558,139 @@ in_and_out_from_binary(char *file_in, char *file_out)
     return true;
 }
 
+//! \brief Make text of every command of binary program
+//! \param [in] commands Command bytes
+//! \param [in] commands_size Command bytes len
+//! \param [in] operand_size Size of memory address operands
+//! \param [out] text Disassembled program, lines are terminated by zeros
+//! \return Returns array, which gives line for every command offset (NULL,
+//! if there is no command at offset), or NULL if program can not be translated
+static char **
+disassemble_lines(char *commands, long commands_size, int operand_size, char **text)
+{
+    FILE *tmp = tmpfile();
+    int *line_offsets = (int *)calloc(commands_size, sizeof(int));
+    char **lines = (char **)calloc(commands_size + 1, sizeof(char *));
+    *text = NULL;
+    if (!tmp || !line_offsets || !lines || !translate_to_asm(commands, commands_size, fileno(tmp), operand_size, line_offsets)) {
+        fprintf(stderr, "Error: Can`t translate to asm\n");
+        if (tmp) {
+            fclose(tmp);
+        }
+        free(line_offsets);
+        free(lines);
+        return NULL;
+    }
+    long text_size = lseek(fileno(tmp), 0, SEEK_END);
+    *text = (char *)calloc(text_size + 1, 1);
+    if (!*text || pread(fileno(tmp), *text, text_size, 0) != text_size) {
+        fprintf(stderr, "Error: Can`t read disassembled program\n");
+        fclose(tmp);
+        free(line_offsets);
+        free(lines);
+        free(*text);
+        return NULL;
+    }
+    fclose(tmp);
+    char *line = *text;
+    for (int i = 0; line < *text + text_size; i++) {
+        char *end = strchr(line, '\n');
+        if (end) {
+            *end = '\0';
+        }
+        lines[line_offsets[i]] = line;
+        line = end ? end + 1 : *text + text_size;
+    }
+    free(line_offsets);
+    return lines;
+}
+
+//! \brief Render trace of cpu (see -t option of cpu) against disassembly
+//! of its program, one executed command per line, the oldest first
+//! \param [in] file_trace Trace file
+//! \param [in] file_in Binary program, which was traced
+//! \param [out] file_out File to write rendered trace
+//! \return Returns true if success, false else
+bool
+trace_from_binary(char *file_trace, char *file_in, char *file_out)
+{
+    assert(file_trace);
+    assert(file_in);
+    assert(file_out);
+
+    long file_in_size = 0;
+    char *commands = mmap_file(file_in, &file_in_size);
+    if (!commands) {
+        return false;
+    }
+    // trace keeps offsets of commands after header of wide bytecode
+    long header_size = 0;
+    int operand_size = bytecode_operand_size(commands, file_in_size, &header_size);
+    long bytecode_size = file_in_size - header_size;
+    if (!operand_size || bytecode_size <= 0) {
+        fprintf(stderr, "Error: unknown version of wide bytecode in file %s\n", file_in);
+        munmap(commands, file_in_size);
+        return false;
+    }
+    char *text = NULL;
+    char **lines = disassemble_lines(commands + header_size, bytecode_size, operand_size, &text);
+    munmap(commands, file_in_size);
+    if (!lines) {
+        return false;
+    }
+    long trace_size = 0;
+    char *trace = mmap_file(file_trace, &trace_size);
+    struct Trace_Header *header = (struct Trace_Header *)trace;
+    const char *error = NULL;
+    if (!trace || trace_size < (int)sizeof(*header) || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) ||
+        header->version != TRACE_VERSION) {
+        error = "not a trace of this cpu version";
+    } else if (header->bytecode_size != bytecode_size) {
+        error = "trace of another program";
+    } else if (header->records_num < 0 ||
+               header->records_num != (trace_size - (long)sizeof(*header)) / (long)sizeof(struct Trace_Record)) {
+        error = "wrong number of records";
+    }
+    int fd_out = error ? -1 : open(file_out, O_WRONLY | O_CREAT | O_TRUNC, out_mode);
+    if (error || fd_out < 0) {
+        if (error) {
+            fprintf(stderr, "Error: %s in file %s\n", error, file_trace);
+        } else {
+            fprintf(stderr, "Error: Can`t open out file %s\n", file_out);
+        }
+        if (trace) {
+            munmap(trace, trace_size);
+        }
+        free(lines);
+        free(text);
+        return false;
+    }
 
+    struct Trace_Record *records = (struct Trace_Record *)(trace + sizeof(*header));
+    dprintf(fd_out, "%3s %8s  %-24s %6s %14s %8s\n", "cpu", "offset", "command", "depth", "top", "address");
+    for (long i = 0; i < header->records_num; i++) {
+        struct Trace_Record *record = records + i;
+        const char *line = "?";
+        if (record->offset == bytecode_size) {
+            line = "end";
+        } else if (record->offset >= 0 && record->offset < bytecode_size && lines[record->offset]) {
+            line = lines[record->offset];
+        }
+        dprintf(fd_out, "%3d %8d  %-24s %6d ", record->cpu, record->offset, line, record->depth);
+        if (record->depth > 0) {
+            dprintf(fd_out, "%14lf ", record->tos);
+        } else {
+            dprintf(fd_out, "%14s ", "-");
+        }
+        if (record->address >= 0) {
+            dprintf(fd_out, "%8lld\n", (long long)record->address);
+        } else {
+            dprintf(fd_out, "%8s\n", "-");
+        }
+    }
+    close(fd_out);
+    munmap(trace, trace_size);
+    free(lines);
+    free(text);
+    return true;
+}
@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <unistd.h>
 
 #include "disasm.h"
 #include "disasm_main.h"
@@ -6,13 +7,35 @@
 int
 main(int argc, char **argv)
 {
-    if (argc < ARG_NUM) {
+    char *file_trace = NULL;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't':
+                file_trace = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t trace] in_file out_file\n", argv[0]);
+                return 1;
+        }
+    }
+    // file arguments go after options
+    char **files = argv + optind - 1;
+    if (argc - optind < ARG_NUM - 1) {
         fprintf(stderr, "Please, specify in and out files\n");
         return 1;
     }
-    if (!in_and_out_from_binary(argv[FILE_IN], argv[FILE_OUT])) {
-        fprintf(stderr, "File %s can not be translated to asm", argv[FILE_IN]);
-        fprintf(stderr, " or result can not be written into file %s\n", argv[FILE_OUT]);
+    if (file_trace) {
+        if (!trace_from_binary(file_trace, files[FILE_IN], files[FILE_OUT])) {
+            fprintf(stderr, "Trace %s of file %s can not be decoded", file_trace, files[FILE_IN]);
+            fprintf(stderr, " or result can not be written into file %s\n", files[FILE_OUT]);
+            return 1;
+        }
+        return 0;
+    }
+    if (!in_and_out_from_binary(files[FILE_IN], files[FILE_OUT])) {
+        fprintf(stderr, "File %s can not be translated to asm", files[FILE_IN]);
+        fprintf(stderr, " or result can not be written into file %s\n", files[FILE_OUT]);
         return 1;
     }
     return 0;
@@ -0,0 +1,438 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cassert>
+#include <csignal>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "cpu_io.h"
+#include "scheduler.h"
+#include "events.h"
+
+//! \brief Sessions of one host thread, see serve_sessions()
+struct Server
+{
+    int epoll_fd;
+    int listen_fd;
+    struct Session **sessions;
+    int sessions_num;
+    int capacity;
+    int accepted;
+    struct Session *head;   // run queue: sessions, which can execute commands
+    struct Session *tail;
+    struct Program *program;
+    Tenant_Engine run;
+    const struct Tenant_Limits *limits;
+    bool print_stat;
+};
+
+//! Server is stopped by SIGINT or SIGTERM
+static volatile sig_atomic_t stop_requested = 0;
+
+static void
+request_stop(int)
+{
+    stop_requested = 1;
+}
+
+//! \brief In command of session: the next value, if it is received whole
+//! \return Returns result from CPU_IN_RESULTS
+static int
+session_in(void *context, double *value)
+{
+    struct Session *session = (struct Session *)context;
+    char *in = session->in;
+    int start = session->in_start;
+    while (start < session->in_end && isspace((unsigned char)in[start])) {
+        start++;
+    }
+    session->in_start = start;
+    int end = start;
+    while (end < session->in_end && !isspace((unsigned char)in[end])) {
+        end++;
+    }
+    if (end == session->in_end && !session->in_closed) {
+        // the rest of value can be in the next packet
+        return end - start > CPU_IO_VALUE_SIZE ? CPU_IN_NONE : CPU_IN_BLOCKED;
+    }
+    if (start == end) {
+        return CPU_IN_NONE;
+    }
+    // there is always place for '\0' after received text
+    char saved = in[end];
+    in[end] = '\0';
+    const char *parsed = parse_double(in + start, value);
+    in[end] = saved;
+    if (!parsed) {
+        return CPU_IN_NONE;
+    }
+    session->in_start = parsed - in;
+    return CPU_IN_VALUE;
+}
+
+//! \brief Out command of session: value waits in buffer for the client
+static void
+session_out(void *context, double value)
+{
+    struct Session *session = (struct Session *)context;
+    if (session->out_capacity - session->out_end <= CPU_IO_VALUE_SIZE) {
+        if (session->out_start > 0) {
+            memmove(session->out, session->out + session->out_start, session->out_end - session->out_start);
+            session->out_end -= session->out_start;
+            session->out_start = 0;
+        }
+        if (session->out_capacity - session->out_end <= CPU_IO_VALUE_SIZE) {
+            int capacity = 2 * session->out_capacity + CPU_IO_VALUE_SIZE + 1;
+            char *out = (char *)realloc(session->out, capacity);
+            if (!out) {
+                fprintf(stderr, "Output error: can not write values\n");
+                return;
+            }
+            session->out = out;
+            session->out_capacity = capacity;
+        }
+    }
+    session->out_end += format_double(session->out + session->out_end, value);
+    session->out[session->out_end++] = '\n';
+}
+
+//! \brief Put session to the end of run queue
+static void
+queue_session(struct Server *server, struct Session *session)
+{
+    if (session->queued) {
+        return;
+    }
+    session->queued = true;
+    session->next = NULL;
+    if (server->tail) {
+        server->tail->next = session;
+    } else {
+        server->head = session;
+    }
+    server->tail = session;
+}
+
+//! \brief Close connection and free virtual machine
+static void
+close_session(struct Server *server, struct Session *session)
+{
+    if (server->print_stat) {
+        const char *state = session->vm.limit ? session->vm.limit : session->vm.failed ? "error" :
+                            session->finished ? "finished" : "stopped";
+        fprintf(stderr, "Session %d executed %lld commands (%s)\n", session->id, session->vm.cpu.executed, state);
+    }
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    server->sessions[session->slot] = server->sessions[--server->sessions_num];
+    server->sessions[session->slot]->slot = session->slot;
+    destroy_tenant(&session->vm);
+    free(session->in);
+    free(session->out);
+    free(session);
+}
+
+//! \brief Send pending output, client, which does not take it, loses it
+static void
+send_output(struct Session *session)
+{
+    while (session->out_start < session->out_end) {
+        ssize_t sent = send(session->fd, session->out + session->out_start, session->out_end - session->out_start,
+                            MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (sent <= 0) {
+            // values after the end of client are lost, like in shell pipes
+            session->out_start = session->out_end;
+            return;
+        }
+        session->out_start += sent;
+    }
+    session->out_start = 0;
+    session->out_end = 0;
+}
+
+//! \brief Receive everything client sent till now
+static void
+receive_input(struct Session *session)
+{
+    if (session->in_start > 0) {
+        memmove(session->in, session->in + session->in_start, session->in_end - session->in_start);
+        session->in_end -= session->in_start;
+        session->in_start = 0;
+    }
+    while (!session->in_closed) {
+        if (session->in_capacity - session->in_end <= EVENTS_READ_SIZE) {
+            int capacity = 2 * session->in_capacity + EVENTS_READ_SIZE + 1;
+            char *in = (char *)realloc(session->in, capacity);
+            if (!in) {
+                fprintf(stderr, "Input error: can not get value\n");
+                session->in_closed = true;
+                return;
+            }
+            session->in = in;
+            session->in_capacity = capacity;
+        }
+        ssize_t got = recv(session->fd, session->in + session->in_end, EVENTS_READ_SIZE, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (got <= 0) {
+            session->in_closed = true;
+            return;
+        }
+        session->in_end += got;
+        // the next value is whole, machine can go on
+        if (got < EVENTS_READ_SIZE) {
+            return;
+        }
+    }
+}
+
+//! \brief Wait for input, if machine is blocked, and for client, if
+//! output is not sent
+static void
+watch_session(struct Server *server, struct Session *session)
+{
+    unsigned events = 0;
+    if (!session->finished && session->vm.cpu.state == BLOCKED) {
+        events |= EPOLLIN;
+    }
+    if (session->out_start < session->out_end) {
+        events |= EPOLLOUT;
+    }
+    if (events != session->events) {
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.ptr = session;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        session->events = events;
+    }
+}
+
+//! \brief Run session for one quantum, then send its output
+//! \return Returns false, if session is closed
+static bool
+run_session(struct Server *server, struct Session *session)
+{
+    cpu_io_set_functions(session_in, session_out, session);
+    bool again = run_quantum(&session->vm, server->run, server->limits);
+    cpu_io_set_functions(NULL, NULL, NULL);
+    if (!again && (session->vm.failed || session->vm.cpu.state != BLOCKED)) {
+        session->finished = true;
+    }
+    send_output(session);
+    if (session->finished && session->out_start == session->out_end) {
+        close_session(server, session);
+        return false;
+    }
+    // machine, which writes faster than client reads, waits for it
+    if (again && session->out_end - session->out_start < EVENTS_OUT_LIMIT) {
+        queue_session(server, session);
+    }
+    watch_session(server, session);
+    return true;
+}
+
+//! \brief Accept new connections, every one gets its own virtual machine
+static void
+accept_sessions(struct Server *server)
+{
+    while (true) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Can not accept connection");
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (server->sessions_num == server->capacity) {
+            int capacity = 2 * server->capacity + 64;
+            struct Session **sessions =
+                (struct Session **)realloc(server->sessions, capacity * sizeof(struct Session *));
+            if (!sessions) {
+                fprintf(stderr, "Can not allocate memory for session\n");
+                close(fd);
+                continue;
+            }
+            server->sessions = sessions;
+            server->capacity = capacity;
+        }
+        struct Session *session = (struct Session *)calloc(1, sizeof(struct Session));
+        if (!session || !init_tenant(&session->vm, server->program, "session", server->limits->memory_size)) {
+            fprintf(stderr, "Can not allocate memory for session\n");
+            if (session) {
+                destroy_tenant(&session->vm);
+            }
+            free(session);
+            close(fd);
+            continue;
+        }
+        session->fd = fd;
+        session->id = server->accepted++;
+        session->slot = server->sessions_num;
+        server->sessions[server->sessions_num++] = session;
+        struct epoll_event event = {};
+        event.data.ptr = session;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        // program starts without input, in command blocks it
+        queue_session(server, session);
+    }
+}
+
+//! \brief Handle events of connection
+static void
+handle_session(struct Server *server, struct Session *session, unsigned events)
+{
+    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        send_output(session);
+        if (session->finished && session->out_start == session->out_end) {
+            close_session(server, session);
+            return;
+        }
+        if (!session->finished && session->vm.cpu.state == PAUSED &&
+            session->out_end - session->out_start < EVENTS_OUT_LIMIT) {
+            queue_session(server, session);
+        }
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && session->vm.cpu.state == BLOCKED && !session->finished) {
+        receive_input(session);
+        queue_session(server, session);
+    }
+    watch_session(server, session);
+}
+
+//! \brief Listen Unix socket
+//! \return Returns socket or -1 on error
+static int
+listen_socket(const char *socket_path)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Can not create socket");
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) || listen(fd, SOMAXCONN)) {
+        fprintf(stderr, "Can not listen socket %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! \brief Serve connections to Unix socket in the calling thread: every
+//! connection gets its own virtual machine, which executes program with
+//! input from connection and output into it. Machine, which has no input,
+//! is suspended at in command, so one thread serves many sessions; ready
+//! machines share the thread by quanta. Server works till SIGINT or SIGTERM.
+//! \param [in] socket_path Path of Unix socket
+//! \param [in] program Decoded program
+//! \param [in] run Interpreter loop
+//! \param [in] limits Limits of every machine
+//! \param [in] print_stat Print commands of every session into stderr
+//! \return Returns false, if socket can not be listened
+bool
+serve_sessions(const char *socket_path, struct Program *program, Tenant_Engine run,
+               const struct Tenant_Limits *limits, bool print_stat)
+{
+    assert(socket_path);
+    assert(program);
+    assert(run);
+    assert(limits);
+
+    struct Server server = {};
+    server.program = program;
+    server.run = run;
+    server.limits = limits;
+    server.print_stat = print_stat;
+    server.listen_fd = listen_socket(socket_path);
+    if (server.listen_fd < 0) {
+        return false;
+    }
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (server.epoll_fd < 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event)) {
+        perror("Can not create epoll");
+        close(server.listen_fd);
+        unlink(socket_path);
+        return false;
+    }
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    struct epoll_event events[EVENTS_MAX];
+    while (!stop_requested) {
+        // ready machines do not let the thread sleep
+        int events_num = epoll_wait(server.epoll_fd, events, EVENTS_MAX, server.head ? 0 : -1);
+        if (events_num < 0 && errno != EINTR) {
+            perror("Epoll error");
+            break;
+        }
+        for (int i = 0; i < events_num; i++) {
+            if (!events[i].data.ptr) {
+                accept_sessions(&server);
+            }
+        }
+        // every connection has at most one event, so closed sessions are not met again
+        for (int i = 0; i < events_num; i++) {
+            if (events[i].data.ptr) {
+                handle_session(&server, (struct Session *)events[i].data.ptr, events[i].events);
+            }
+        }
+        // every session, which is ready now, gets one quantum
+        struct Session *last = server.tail;
+        while (server.head && !stop_requested) {
+            struct Session *session = server.head;
+            server.head = session->next;
+            if (!server.head) {
+                server.tail = NULL;
+            }
+            session->queued = false;
+            // session can be closed by the run
+            bool is_last = session == last;
+            run_session(&server, session);
+            if (is_last) {
+                break;
+            }
+        }
+    }
+    cpu_io_set_functions(NULL, NULL, NULL);
+    while (server.sessions_num) {
+        close_session(&server, server.sessions[0]);
+    }
+    free(server.sessions);
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    unlink(socket_path);
+    return true;
+}
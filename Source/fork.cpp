@@ -0,0 +1,342 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <ctime>
+#include <sched.h>
+
+#include "cpu.h"
+#include "program.h"
+#include "fork.h"
+
+//! Deque index of worker thread, -1 for threads outside of pool
+static __thread int worker_index = -1;
+
+//! \brief Init empty deque
+//! \return Returns false, if memory can not be allocated
+static bool
+init_deque(struct Fork_Deque *deque)
+{
+    deque->capacity = 16;
+    deque->head = 0;
+    deque->size = 0;
+    deque->tasks = (struct Fork_Task **)calloc(deque->capacity, sizeof(struct Fork_Task *));
+    pthread_mutex_init(&deque->lock, NULL);
+    return deque->tasks != NULL;
+}
+
+//! \brief Put task to the end of deque
+//! \return Returns false, if memory can not be allocated
+static bool
+push_task(struct Fork_Deque *deque, struct Fork_Task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size == deque->capacity) {
+        struct Fork_Task **tasks = (struct Fork_Task **)calloc(2 * deque->capacity, sizeof(struct Fork_Task *));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (int i = 0; i < deque->size; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->head = 0;
+        deque->capacity *= 2;
+    }
+    deque->tasks[(deque->head + deque->size) % deque->capacity] = task;
+    deque->size++;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+//! \brief Take task from deque
+//! \param [in] deque Deque
+//! \param [in] last Take the last task (owner) or the first one (thief)
+//! \return Returns task or NULL, if deque is empty
+static struct Fork_Task *
+take_task(struct Fork_Deque *deque, bool last)
+{
+    struct Fork_Task *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size) {
+        deque->size--;
+        if (last) {
+            task = deque->tasks[(deque->head + deque->size) % deque->capacity];
+        } else {
+            task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+//! \brief Find task for current thread: its own newest task or the oldest
+//! task of some other thread
+//! \return Returns task or NULL, if all deques are empty
+static struct Fork_Task *
+find_task(struct Fork_Pool *pool)
+{
+    if (!__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    int own = worker_index >= 0 ? worker_index : pool->workers_num;
+    struct Fork_Task *task = take_task(&pool->deques[own], true);
+    for (int i = 1; !task && i <= pool->workers_num; i++) {
+        task = take_task(&pool->deques[(own + i) % (pool->workers_num + 1)], false);
+    }
+    if (task) {
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+    }
+    return task;
+}
+
+//! \brief Execute child cpu till the end of its subroutine
+static void
+run_task(struct Fork_Task *task)
+{
+    bool ok = task->run(task->program, &task->cpu, task->mc);
+    task->ok = fork_join_rest(&task->cpu) && ok;
+    __atomic_store_n(&task->done, true, __ATOMIC_RELEASE);
+}
+
+//! \brief Worker thread: run tasks, until pool is stopped
+static void *
+run_fork_worker(void *arg)
+{
+    struct Fork_Pool *pool = (struct Fork_Pool *)arg;
+    pthread_mutex_lock(&pool->lock);
+    worker_index = pool->started++;
+    pthread_mutex_unlock(&pool->lock);
+    while (true) {
+        struct Fork_Task *task = find_task(pool);
+        if (task) {
+            run_task(task);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) && !pool->stopping) {
+            pthread_cond_wait(&pool->changed, &pool->lock);
+        }
+        bool stopping = pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+        if (stopping) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+//! \brief Start worker threads for child cpus
+//! \param [in] pool Pool to start
+//! \param [in] workers_num Number of worker threads, 0 means that every
+//! child is executed by the thread, which joins it
+//! \return Returns false, if memory can not be allocated
+bool
+start_fork_pool(struct Fork_Pool *pool, int workers_num)
+{
+    assert(pool);
+    assert(workers_num >= 0);
+
+    pool->workers_num = workers_num;
+    pool->started = 0;
+    pool->pending = 0;
+    pool->stopping = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    pool->deques = (struct Fork_Deque *)calloc(workers_num + 1, sizeof(struct Fork_Deque));
+    pool->threads = (pthread_t *)calloc(workers_num + 1, sizeof(pthread_t));
+    if (!pool->deques || !pool->threads) {
+        free(pool->deques);
+        free(pool->threads);
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; i <= workers_num; i++) {
+        ok = init_deque(&pool->deques[i]) && ok;
+    }
+    pool->threads_num = 0;
+    if (!ok) {
+        stop_fork_pool(pool);
+        return false;
+    }
+    for (int i = 0; i < workers_num; i++) {
+        if (pthread_create(&pool->threads[i], NULL, run_fork_worker, pool)) {
+            // deques of missing workers stay empty, only workers fill them
+            fprintf(stderr, "Can not start worker thread %d, %d workers are used\n", i, i);
+            break;
+        }
+        pool->threads_num++;
+    }
+    return true;
+}
+
+//! \brief Stop worker threads and free pool, all children must be joined
+void
+stop_fork_pool(struct Fork_Pool *pool)
+{
+    assert(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threads_num; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i <= pool->workers_num; i++) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->changed);
+    free(pool->deques);
+    free(pool->threads);
+    pool->deques = NULL;
+    pool->threads = NULL;
+    pool->threads_num = 0;
+}
+
+//! \brief SPAWN command: start child cpu with copy of registers, which
+//! executes subroutine from entry till its RET. Return stack of the child
+//! has the end of program, so that RET finishes it.
+//! \param [in] cpu Parent cpu, child goes to the beginning of cpu->children
+//! \param [in] program Decoded program
+//! \param [in] mc Memory controller, which child shares with parent
+//! \param [in] run Interpreter loop for child
+//! \param [in] entry Instruction index of subroutine
+//! \return Returns false, if memory can not be allocated
+bool
+fork_spawn(struct Cpu *cpu, struct Program *program, struct Memory_Controller *mc, Fork_Engine run, int entry)
+{
+    assert(cpu);
+    assert(program);
+    assert(run);
+
+    struct Fork_Task *task = (struct Fork_Task *)calloc(1, sizeof(struct Fork_Task));
+    if (!task) {
+        return false;
+    }
+    init(&task->cpu);
+    if (!task->cpu.cpu_stack || !task->cpu.ret_addr ||
+        !set_cpu_stacks(&task->cpu, NULL, 0, &program->size, 1)) {
+        destroy_cpu(&task->cpu);
+        free(task);
+        return false;
+    }
+    for (int i = 0; i < REG_NUMBER; i++) {
+        task->cpu.regs[i] = cpu->regs[i];
+    }
+    for (int i = 0; i < IREG_NUMBER; i++) {
+        task->cpu.iregs[i] = cpu->iregs[i];
+    }
+    task->cpu.ip = entry;
+    task->cpu.id = cpu->id;
+    task->cpu.cpus_num = cpu->cpus_num;
+    task->cpu.pool = cpu->pool;
+    task->program = program;
+    task->mc = mc;
+    task->run = run;
+    task->done = false;
+    task->ok = false;
+    struct Fork_Pool *pool = cpu->pool;
+    if (pool) {
+        int own = worker_index >= 0 ? worker_index : pool->workers_num;
+        if (!push_task(&pool->deques[own], task)) {
+            destroy_cpu(&task->cpu);
+            free(task);
+            return false;
+        }
+        // the last task is seen by sleeping workers under the lock
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    task->next = cpu->children;
+    cpu->children = task;
+    return true;
+}
+
+//! \brief Wait for child cpu. Without pool the child is executed right
+//! here, else thread runs other tasks, while the child is not finished.
+//! \param [in] task Child
+//! \return Returns false, if child stopped on error
+bool
+fork_wait(struct Fork_Task *task)
+{
+    assert(task);
+
+    struct Fork_Pool *pool = task->cpu.pool;
+    if (!pool) {
+        if (!task->done) {
+            run_task(task);
+        }
+        return task->ok;
+    }
+    int attempts = 0;
+    while (!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        struct Fork_Task *other = find_task(pool);
+        if (other) {
+            run_task(other);
+            attempts = 0;
+        } else if (attempts < FORK_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            attempts++;
+        } else if (attempts < FORK_YIELDS) {
+            sched_yield();
+            attempts++;
+        } else {
+            struct timespec ts = {0, FORK_SLEEP_NS};
+            nanosleep(&ts, NULL);
+        }
+    }
+    return task->ok;
+}
+
+//! \brief Wait for children, which cpu did not join, their results are lost
+//! \param [in] cpu Finished cpu, executed commands of children are added to it
+//! \return Returns false, if some child stopped on error
+bool
+fork_join_rest(struct Cpu *cpu)
+{
+    assert(cpu);
+
+    bool ok = true;
+    while (cpu->children) {
+        struct Fork_Task *child = cpu->children;
+        cpu->children = child->next;
+        ok = fork_wait(child) && ok;
+        cpu->executed += child->cpu.executed;
+        cpu->dispatched += child->cpu.dispatched;
+        fork_release(child);
+    }
+    return ok;
+}
+
+//! \brief Free finished child cpu
+void
+fork_release(struct Fork_Task *task)
+{
+    assert(task);
+
+    destroy_cpu(&task->cpu);
+    free(task);
+}
+
+//! \brief Check, if program starts child cpus, so it needs fork pool
+bool
+has_spawn(struct Program *program)
+{
+    assert(program);
+
+    for (int i = 0; i < program->size; i++) {
+        if (program->code[i].code == SPAWN) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -8,7 +8,10 @@
 #include <errno.h>
 #include <string.h>
 
-char *mmap_file(char *file_in, int *file_size) 
+#include "cpu.h"
+#include "in_and_out.h"
+
+char *mmap_file(char *file_in, long *file_size)
 {
     assert(file_in);
     struct stat file_stat;
@@ -42,3 +45,27 @@ char *mmap_file(char *file_in, int *file_size)
     }
     return commands;
 }
+
+//! \brief Find encoding of bytecode: compact bytecode starts with command,
+//! wide one starts with WIDE_MAGIC and version
+//! \param [in] bytecode Binary program
+//! \param [in] bytecode_size Size of binary program
+//! \param [out] header_size Bytes before the first command
+//! \return Returns size of memory address operands or 0, if version
+//! of wide bytecode is unknown
+int
+bytecode_operand_size(const char *bytecode, long bytecode_size, long *header_size)
+{
+    assert(bytecode);
+    assert(header_size);
+
+    *header_size = 0;
+    if (bytecode_size < (long)sizeof(WIDE_MAGIC) || memcmp(bytecode, WIDE_MAGIC, sizeof(WIDE_MAGIC))) {
+        return COMPACT_OPERAND_SIZE;
+    }
+    if (bytecode_size < WIDE_HEADER_SIZE || bytecode[sizeof(WIDE_MAGIC)] != WIDE_VERSION) {
+        return 0;
+    }
+    *header_size = WIDE_HEADER_SIZE;
+    return WIDE_OPERAND_SIZE;
+}
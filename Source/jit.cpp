@@ -0,0 +1,772 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+//! x86-64 general purpose registers
+enum X86_REGS {
+    X_RAX = 0,
+    X_RCX,
+    X_RDX,
+    X_RBX,
+    X_RSP,
+    X_RBP,
+    X_RSI,
+    X_RDI,
+    X_R12 = 12,
+    X_R13,
+    X_R14,
+    X_R15
+};
+
+//! Condition codes for jcc
+enum X86_CONDITIONS {
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_G = 0xF
+};
+
+//! Opcodes, two byte ones start with 0x0F
+enum X86_OPCODES {
+    OP_ADD_STORE = 0x01,
+    OP_SUB_STORE = 0x29,
+    OP_XOR_STORE = 0x31,
+    OP_CMP_STORE = 0x39,
+    OP_CMP_LOAD = 0x3B,
+    OP_MOVSXD = 0x63,
+    OP_ARITH8_IMM8 = 0x80,
+    OP_ARITH_IMM8 = 0x83,
+    OP_TEST = 0x85,
+    OP_MOV_STORE = 0x89,
+    OP_MOV_LOAD = 0x8B,
+    OP_LEA = 0x8D,
+    OP_MOV_IMM32 = 0xC7,
+    OP_GROUP_FF = 0xFF,
+    OP_MOVSD_LOAD = 0x0F10,
+    OP_MOVSD_STORE = 0x0F11,
+    OP_CVTSI2SD = 0x0F2A,
+    OP_UCOMISD = 0x0F2E,
+    OP_SQRTSD = 0x0F51,
+    OP_XORPD = 0x0F57,
+    OP_ADDSD = 0x0F58,
+    OP_MULSD = 0x0F59,
+    OP_SUBSD = 0x0F5C,
+    OP_DIVSD = 0x0F5E,
+    OP_MOVQ_TO_XMM = 0x0F6E,
+    OP_IMUL_LOAD = 0x0FAF
+};
+
+//! Prefixes of SSE2 double commands
+constexpr int PREFIX_SD = 0xF2;
+constexpr int PREFIX_PD = 0x66;
+
+//! No index register in memory operand
+constexpr int NO_INDEX = -1;
+
+// Registers of jit code (callee saved ones keep their values over helpers):
+//   rbx         - struct Cpu *
+//   rbp         - cpu->cpu_stack
+//   r12         - cpu stack data
+//   r13         - cpu stack size
+//   r14         - cpu stack capacity
+//   r15         - executed commands counter
+//   xmm8..xmm10 - cpu registers, saved into cpu->regs around helpers
+constexpr int XMM_CPU_REGS = 8;
+
+//! Jump to instruction, which is patched after all instructions are emitted
+struct Fixup
+{
+    size_t pos;
+    int target;
+};
+
+//! \brief Code generation context
+struct Emitter
+{
+    unsigned char *buf;
+    size_t size;
+    size_t pos;
+    bool overflow;
+    size_t *labels;             // offset of native code of each instruction
+    struct Fixup *fixups;
+    int fixups_num;
+    size_t bail;                // leave jit code, command is not executed
+    size_t exit;                // leave jit code
+    void **native;
+    struct Memory_Controller *mc;
+    const struct Jit_Layout *layout;
+};
+
+static void
+emit_byte(struct Emitter *e, int value)
+{
+    if (e->pos >= e->size) {
+        e->overflow = true;
+        return;
+    }
+    e->buf[e->pos++] = (unsigned char)value;
+}
+
+static void
+emit_int32(struct Emitter *e, int32_t value)
+{
+    uint32_t bits = (uint32_t)value;
+    for (int i = 0; i < 4; i++) {
+        emit_byte(e, (bits >> (8 * i)) & 0xff);
+    }
+}
+
+static void
+emit_int64(struct Emitter *e, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        emit_byte(e, (value >> (8 * i)) & 0xff);
+    }
+}
+
+//! \brief Emit prefix, REX (if it is needed) and opcode
+static void
+emit_opcode(struct Emitter *e, int prefix, int wide, int opcode, int reg, int index, int base)
+{
+    if (prefix) {
+        emit_byte(e, prefix);
+    }
+    if (index == NO_INDEX) {
+        index = 0;
+    }
+    int rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+    if (rex != 0x40) {
+        emit_byte(e, rex);
+    }
+    if (opcode > 0xff) {
+        emit_byte(e, opcode >> 8);
+    }
+    emit_byte(e, opcode & 0xff);
+}
+
+//! \brief Emit command with operands reg and [base + index * scale + disp]
+static void
+emit_mem(struct Emitter *e, int prefix, int wide, int opcode, int reg,
+         int base, int index, int scale, int32_t disp)
+{
+    emit_opcode(e, prefix, wide, opcode, reg, index, base);
+    if (index == NO_INDEX && (base & 7) != X_RSP) {
+        emit_byte(e, 0x80 | (reg & 7) << 3 | (base & 7));
+    } else {
+        int scale_bits = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+        emit_byte(e, 0x84 | (reg & 7) << 3);
+        emit_byte(e, scale_bits << 6 | ((index == NO_INDEX ? X_RSP : index) & 7) << 3 | (base & 7));
+    }
+    emit_int32(e, disp);
+}
+
+//! \brief Emit command with two register operands
+static void
+emit_reg(struct Emitter *e, int prefix, int wide, int opcode, int reg, int rm)
+{
+    emit_opcode(e, prefix, wide, opcode, reg, NO_INDEX, rm);
+    emit_byte(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+//! \brief Emit command with cpu stack value [r12 + r13 * 8 + disp]
+static void
+emit_stack(struct Emitter *e, int prefix, int wide, int opcode, int reg, int32_t disp)
+{
+    emit_mem(e, prefix, wide, opcode, reg, X_R12, X_R13, 8, disp);
+}
+
+static void
+emit_mov_imm64(struct Emitter *e, int reg, uint64_t value)
+{
+    emit_opcode(e, 0, 1, 0xB8 + (reg & 7), 0, NO_INDEX, reg);
+    emit_int64(e, value);
+}
+
+static void
+emit_mov_imm32(struct Emitter *e, int reg, int32_t value)
+{
+    emit_byte(e, 0xB8 + reg);
+    emit_int32(e, value);
+}
+
+//! \brief Emit conditional jump
+//! \return Returns position of jump offset for patch()
+static size_t
+emit_jcc(struct Emitter *e, int condition)
+{
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x80 | condition);
+    size_t pos = e->pos;
+    emit_int32(e, 0);
+    return pos;
+}
+
+//! \brief Emit jump
+//! \return Returns position of jump offset for patch()
+static size_t
+emit_jmp(struct Emitter *e)
+{
+    emit_byte(e, 0xE9);
+    size_t pos = e->pos;
+    emit_int32(e, 0);
+    return pos;
+}
+
+//! \brief Set jump offset at pos, so it jumps to target
+static void
+patch(struct Emitter *e, size_t pos, size_t target)
+{
+    if (e->overflow) {
+        return;
+    }
+    int32_t offset = (int32_t)(target - (pos + 4));
+    memcpy(e->buf + pos, &offset, sizeof(offset));
+}
+
+//! \brief Emit jump to instruction (condition < 0 for unconditional jump)
+static void
+emit_jump_to(struct Emitter *e, int condition, int target)
+{
+    struct Fixup *fixup = e->fixups + e->fixups_num++;
+    fixup->pos = condition < 0 ? emit_jmp(e) : emit_jcc(e, condition);
+    fixup->target = target;
+}
+
+//! \brief Leave jit code before instruction index, interpreter will go on
+static void
+emit_bail(struct Emitter *e, int index)
+{
+    emit_mov_imm32(e, X_RAX, index);
+    patch(e, emit_jmp(e), e->bail);
+}
+
+//! \brief Save cpu stack size and registers into cpu
+static void
+emit_save_state(struct Emitter *e)
+{
+    emit_mem(e, 0, 0, OP_MOV_STORE, X_R13, X_RBP, NO_INDEX, 0, e->layout->stack_size);
+    for (int r = 0; r < REG_NUMBER; r++) {
+        emit_mem(e, PREFIX_SD, 0, OP_MOVSD_STORE, XMM_CPU_REGS + r, X_RBX, NO_INDEX, 0,
+                 offsetof(struct Cpu, regs) + r * sizeof(double));
+    }
+}
+
+//! \brief Load cpu stack and registers from cpu
+static void
+emit_load_state(struct Emitter *e)
+{
+    for (int r = 0; r < REG_NUMBER; r++) {
+        emit_mem(e, PREFIX_SD, 0, OP_MOVSD_LOAD, XMM_CPU_REGS + r, X_RBX, NO_INDEX, 0,
+                 offsetof(struct Cpu, regs) + r * sizeof(double));
+    }
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_R12, X_RBP, NO_INDEX, 0, e->layout->stack_data);
+    emit_mem(e, 0, 1, OP_MOVSXD, X_R13, X_RBP, NO_INDEX, 0, e->layout->stack_size);
+    emit_mem(e, 0, 1, OP_MOVSXD, X_R14, X_RBP, NO_INDEX, 0, e->layout->stack_capacity);
+}
+
+//! \brief Call runtime helper with cpu as the first argument, the others
+//! must be already in rsi and rdx
+static void
+emit_call(struct Emitter *e, void *function)
+{
+    emit_save_state(e);
+    emit_reg(e, 0, 1, OP_MOV_STORE, X_RBX, X_RDI);
+    emit_mov_imm64(e, X_RAX, (uint64_t)function);
+    emit_reg(e, 0, 0, OP_GROUP_FF, 2, X_RAX); // call rax
+    emit_load_state(e);
+}
+
+//! \brief Leave jit code, if cpu stack has less than num values: interpreter
+//! will execute the command and report the error
+static void
+emit_check_stack(struct Emitter *e, int num, int index)
+{
+    emit_reg(e, 0, 1, OP_ARITH_IMM8, 7, X_R13); // cmp r13, num
+    emit_byte(e, num);
+    size_t ok = emit_jcc(e, CC_GE);
+    emit_bail(e, index);
+    patch(e, ok, e->pos);
+}
+
+//! \brief Leave jit code before jump command, if cpu must be paused:
+//! interpreter executes it and pauses, see PAUSE_POINT in cpu_engine.h
+static void
+emit_check_pause(struct Emitter *e, int index)
+{
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_RAX, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, executed));
+    emit_reg(e, 0, 1, OP_ADD_STORE, X_R15, X_RAX);
+    emit_mem(e, 0, 1, OP_CMP_LOAD, X_RAX, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, pause_at));
+    size_t ok = emit_jcc(e, CC_L);
+    emit_bail(e, index);
+    patch(e, ok, e->pos);
+}
+
+//! \brief Make place for one more value on cpu stack
+static void
+emit_reserve(struct Emitter *e)
+{
+    emit_reg(e, 0, 1, OP_CMP_STORE, X_R14, X_R13);
+    size_t ok = emit_jcc(e, CC_L);
+    emit_call(e, (void *)e->layout->stack_grow);
+    patch(e, ok, e->pos);
+}
+
+static void
+emit_inc(struct Emitter *e, int reg)
+{
+    emit_reg(e, 0, 1, OP_GROUP_FF, 0, reg);
+}
+
+static void
+emit_dec(struct Emitter *e, int reg)
+{
+    emit_reg(e, 0, 1, OP_GROUP_FF, 1, reg);
+}
+
+//! \brief Leave jit code, if division by value in xmm0 must fail
+static void
+emit_check_divisor(struct Emitter *e, int index)
+{
+    double eps = ZERO_EPS;
+    uint64_t bits = 0;
+    memcpy(&bits, &eps, sizeof(bits));
+    emit_mov_imm64(e, X_RAX, bits);
+    emit_reg(e, PREFIX_PD, 1, OP_MOVQ_TO_XMM, 1, X_RAX);
+    emit_reg(e, PREFIX_PD, 0, OP_UCOMISD, 0, 1);
+    size_t big = emit_jcc(e, CC_AE);
+    eps = -ZERO_EPS;
+    memcpy(&bits, &eps, sizeof(bits));
+    emit_mov_imm64(e, X_RAX, bits);
+    emit_reg(e, PREFIX_PD, 1, OP_MOVQ_TO_XMM, 1, X_RAX);
+    emit_reg(e, PREFIX_PD, 0, OP_UCOMISD, 0, 1);
+    size_t small = emit_jcc(e, CC_BE);
+    emit_bail(e, index);
+    patch(e, big, e->pos);
+    patch(e, small, e->pos);
+}
+
+//! \brief Emit binary arithmetic command: second = second op top
+static void
+emit_binary(struct Emitter *e, int opcode, int index)
+{
+    emit_check_stack(e, 2, index);
+    emit_stack(e, PREFIX_SD, 0, OP_MOVSD_LOAD, 0, -16);
+    if (opcode == OP_DIVSD) {
+        emit_check_divisor(e, index);
+    }
+    emit_stack(e, PREFIX_SD, 0, opcode, 0, -8);
+    emit_stack(e, PREFIX_SD, 0, OP_MOVSD_STORE, 0, -16);
+    emit_dec(e, X_R13);
+}
+
+//! \brief Emit conditional jump command: take top and second, jump if
+//! second < top (JMPL) or second > top (JMPG)
+static void
+emit_conditional(struct Emitter *e, struct Instruction *instr, int index)
+{
+    emit_check_stack(e, 2, index);
+    if (instr->code == JMPL) {
+        emit_stack(e, PREFIX_SD, 0, OP_MOVSD_LOAD, 0, -8);
+        emit_stack(e, PREFIX_PD, 0, OP_UCOMISD, 0, -16);
+    } else {
+        emit_stack(e, PREFIX_SD, 0, OP_MOVSD_LOAD, 0, -16);
+        emit_stack(e, PREFIX_PD, 0, OP_UCOMISD, 0, -8);
+    }
+    emit_mem(e, 0, 1, OP_LEA, X_R13, X_R13, NO_INDEX, 0, -2); // flags stay
+    emit_jump_to(e, CC_A, instr->arg);
+}
+
+//! \brief Push return address into cpu->ret_addr and jump, or leave jit
+//! code, if return stack gets deeper than cpu->max_calls
+static void
+emit_call_command(struct Emitter *e, struct Instruction *instr, int index)
+{
+    const struct Jit_Layout *layout = e->layout;
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_RAX, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, ret_addr));
+    emit_mem(e, 0, 1, OP_MOVSXD, X_RCX, X_RAX, NO_INDEX, 0, layout->ret_size);
+    // interpreter executes call, which goes deeper than limit, and pauses
+    emit_mem(e, 0, 0, OP_CMP_LOAD, X_RCX, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, max_calls));
+    size_t ok = emit_jcc(e, CC_L);
+    emit_bail(e, index);
+    patch(e, ok, e->pos);
+    emit_mem(e, 0, 0, OP_CMP_LOAD, X_RCX, X_RAX, NO_INDEX, 0, layout->ret_capacity);
+    size_t slow = emit_jcc(e, CC_GE);
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_RDX, X_RAX, NO_INDEX, 0, layout->ret_data);
+    emit_mem(e, 0, 0, OP_MOV_IMM32, 0, X_RDX, X_RCX, 4, 0);
+    emit_int32(e, index + 1);
+    emit_mem(e, 0, 0, OP_GROUP_FF, 0, X_RAX, NO_INDEX, 0, layout->ret_size); // inc
+    emit_jump_to(e, -1, instr->arg);
+    patch(e, slow, e->pos);
+    emit_mov_imm32(e, X_RSI, index + 1);
+    emit_call(e, (void *)layout->ret_push);
+    emit_jump_to(e, -1, instr->arg);
+}
+
+//! \brief Pop return address from cpu->ret_addr and jump there
+static void
+emit_ret_command(struct Emitter *e, int index)
+{
+    const struct Jit_Layout *layout = e->layout;
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_RAX, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, ret_addr));
+    emit_mem(e, 0, 1, OP_MOVSXD, X_RCX, X_RAX, NO_INDEX, 0, layout->ret_size);
+    emit_reg(e, 0, 0, OP_TEST, X_RCX, X_RCX);
+    size_t ok = emit_jcc(e, CC_G);
+    emit_bail(e, index);
+    patch(e, ok, e->pos);
+    emit_reg(e, 0, 0, OP_GROUP_FF, 1, X_RCX); // dec
+    emit_mem(e, 0, 0, OP_MOV_STORE, X_RCX, X_RAX, NO_INDEX, 0, layout->ret_size);
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_RDX, X_RAX, NO_INDEX, 0, layout->ret_data);
+    emit_mem(e, 0, 1, OP_MOVSXD, X_RCX, X_RDX, X_RCX, 4, 0);
+    emit_mov_imm64(e, X_RDX, (uint64_t)e->native);
+    emit_mem(e, 0, 0, OP_GROUP_FF, 4, X_RDX, X_RCX, 8, 0); // jmp [rdx + rcx * 8]
+}
+
+//! \brief Emit command with integer register operand [rbx + offset of cpu->iregs[reg]]
+static void
+emit_ireg(struct Emitter *e, int opcode, int reg, int ireg)
+{
+    emit_mem(e, 0, 1, opcode, reg, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, iregs) + ireg * sizeof(long long));
+}
+
+//! \brief Emit integer arithmetic command: the first register = the first op the second operand
+static void
+emit_integer(struct Emitter *e, struct Instruction *instr)
+{
+    bool value = instr->code == IMOV_VAL || instr->code == IADD_VAL || instr->code == ISUB_VAL ||
+                 instr->code == IMUL_VAL;
+    if (value) {
+        emit_mov_imm64(e, X_RAX, (uint64_t)instr->ivalue);
+    } else {
+        emit_ireg(e, OP_MOV_LOAD, X_RAX, instr->reg2);
+    }
+    switch (instr->code) {
+        case IADD_REG:
+        case IADD_VAL:
+            emit_ireg(e, OP_ADD_STORE, X_RAX, instr->reg1);
+            return;
+        case ISUB_REG:
+        case ISUB_VAL:
+            emit_ireg(e, OP_SUB_STORE, X_RAX, instr->reg1);
+            return;
+        case IMUL_REG:
+        case IMUL_VAL:
+            emit_ireg(e, OP_IMUL_LOAD, X_RAX, instr->reg1);
+            emit_ireg(e, OP_MOV_STORE, X_RAX, instr->reg1);
+            return;
+        default:
+            emit_ireg(e, OP_MOV_STORE, X_RAX, instr->reg1);
+            return;
+    }
+}
+
+//! \brief Emit integer conditional jump: compare the first register with the second one
+static void
+emit_integer_conditional(struct Emitter *e, struct Instruction *instr)
+{
+    emit_ireg(e, OP_MOV_LOAD, X_RAX, instr->reg1);
+    emit_ireg(e, OP_CMP_LOAD, X_RAX, instr->reg2);
+    emit_jump_to(e, instr->code == IJMPL ? CC_L : instr->code == IJMPG ? CC_G : CC_E, instr->arg);
+}
+
+//! \brief Execute command in runtime helper, stop if it fails
+static void
+emit_helper_command(struct Emitter *e, struct Instruction *instr)
+{
+    emit_mov_imm64(e, X_RSI, (uint64_t)e->mc);
+    emit_mov_imm64(e, X_RDX, (uint64_t)instr);
+    emit_call(e, (void *)e->layout->command);
+    emit_byte(e, 0x84); // test al, al
+    emit_byte(e, 0xC0);
+    size_t ok = emit_jcc(e, 0x5); // jnz
+    emit_mov_imm32(e, X_RAX, -1);
+    patch(e, emit_jmp(e), e->exit);
+    patch(e, ok, e->pos);
+}
+
+//! \brief Translate one command
+//! \return Returns false, if command can not be compiled
+static bool
+emit_command(struct Emitter *e, struct Instruction *instr, int index)
+{
+    e->labels[index] = e->pos;
+    emit_inc(e, X_R15);
+    switch (instr->code) {
+        case PUSH_VAL: {
+            uint64_t bits = 0;
+            memcpy(&bits, &instr->value, sizeof(bits));
+            emit_reserve(e);
+            emit_mov_imm64(e, X_RAX, bits);
+            emit_stack(e, 0, 1, OP_MOV_STORE, X_RAX, 0);
+            emit_inc(e, X_R13);
+            return true;
+        }
+        case PUSH_REG:
+            emit_reserve(e);
+            emit_stack(e, PREFIX_SD, 0, OP_MOVSD_STORE, XMM_CPU_REGS + instr->reg1, 0);
+            emit_inc(e, X_R13);
+            return true;
+        case POP_VAL:
+            emit_check_stack(e, 1, index);
+            emit_dec(e, X_R13);
+            return true;
+        case POP_REG:
+            emit_check_stack(e, 1, index);
+            emit_stack(e, PREFIX_SD, 0, OP_MOVSD_LOAD, XMM_CPU_REGS + instr->reg1, -8);
+            emit_dec(e, X_R13);
+            return true;
+        case ADD:
+            emit_binary(e, OP_ADDSD, index);
+            return true;
+        case SUB:
+            emit_binary(e, OP_SUBSD, index);
+            return true;
+        case MUL:
+            emit_binary(e, OP_MULSD, index);
+            return true;
+        case DIV:
+            emit_binary(e, OP_DIVSD, index);
+            return true;
+        case SQRT: {
+            emit_check_stack(e, 1, index);
+            emit_stack(e, PREFIX_SD, 0, OP_MOVSD_LOAD, 0, -8);
+            emit_reg(e, PREFIX_PD, 0, OP_XORPD, 1, 1);
+            emit_reg(e, PREFIX_PD, 0, OP_UCOMISD, 1, 0);
+            size_t ok = emit_jcc(e, CC_BE);
+            emit_bail(e, index);
+            patch(e, ok, e->pos);
+            emit_reg(e, PREFIX_SD, 0, OP_SQRTSD, 0, 0);
+            emit_stack(e, PREFIX_SD, 0, OP_MOVSD_STORE, 0, -8);
+            return true;
+        }
+        case JMP:
+            emit_check_pause(e, index);
+            emit_jump_to(e, -1, instr->arg);
+            return true;
+        case JMPL:
+        case JMPG:
+            emit_check_pause(e, index);
+            emit_conditional(e, instr, index);
+            return true;
+        case CALL:
+            emit_check_pause(e, index);
+            emit_call_command(e, instr, index);
+            return true;
+        case RET:
+            emit_check_pause(e, index);
+            emit_ret_command(e, index);
+            return true;
+        case IMOV_REG:
+        case IMOV_VAL:
+        case IADD_REG:
+        case IADD_VAL:
+        case ISUB_REG:
+        case ISUB_VAL:
+        case IMUL_REG:
+        case IMUL_VAL:
+            emit_integer(e, instr);
+            return true;
+        case IJMPL:
+        case IJMPG:
+        case IJMPE:
+            emit_check_pause(e, index);
+            emit_integer_conditional(e, instr);
+            return true;
+        case PUSH_IREG:
+            emit_reserve(e);
+            emit_mem(e, PREFIX_SD, 1, OP_CVTSI2SD, 0, X_RBX, NO_INDEX, 0,
+                     offsetof(struct Cpu, iregs) + instr->reg1 * sizeof(long long));
+            emit_stack(e, PREFIX_SD, 0, OP_MOVSD_STORE, 0, 0);
+            emit_inc(e, X_R13);
+            return true;
+        case POP_IREG:
+            // helper reports values, which do not fit into integer register
+            emit_check_stack(e, 1, index);
+            emit_helper_command(e, instr);
+            return true;
+        case SNAP: {
+            // interpreter pauses cpu, if checkpoints are on
+            emit_mem(e, 0, 0, OP_ARITH8_IMM8, 7, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, checkpoint));
+            emit_byte(e, 0);
+            size_t off = emit_jcc(e, CC_E);
+            emit_bail(e, index);
+            patch(e, off, e->pos);
+            return true;
+        }
+        case IN:
+        case IN_REG:
+        case OUT:
+        case OUT_REG:
+        case READ_REG:
+        case READ_ADDR:
+        case WRITE_REG:
+        case WRITE_ADDR:
+        case CAS:
+        case XADD:
+        case FENCE:
+        case CPUID:
+        case CPUNUM:
+        case READ_IREG:
+        case WRITE_IREG:
+            emit_helper_command(e, instr);
+            return true;
+        case SPAWN:
+        case JOIN:
+            // children are started and joined by interpreter
+            emit_bail(e, index);
+            return true;
+        case HLT:
+        case END_OF_PROGRAM:
+            // cpu is turned off by interpreter
+            emit_bail(e, index);
+            return true;
+        default:
+            return false;
+    }
+    return false;
+}
+
+//! \brief Emit function entry and exits: int code(struct Cpu *cpu)
+//! returns instruction index to continue interpretation from, or -1 if
+//! cpu must stop
+static void
+emit_entry(struct Emitter *e)
+{
+    static const int saved[] = {X_RBX, X_RBP, X_R12, X_R13, X_R14, X_R15};
+    const int saved_num = sizeof(saved) / sizeof(saved[0]);
+    for (int i = 0; i < saved_num; i++) {
+        emit_opcode(e, 0, 0, 0x50 + (saved[i] & 7), 0, NO_INDEX, saved[i]); // push
+    }
+    emit_reg(e, 0, 1, OP_ARITH_IMM8, 5, X_RSP); // sub rsp, 8 - align stack for calls
+    emit_byte(e, 8);
+    emit_reg(e, 0, 1, OP_MOV_STORE, X_RDI, X_RBX);
+    emit_mem(e, 0, 1, OP_MOV_LOAD, X_RBP, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, cpu_stack));
+    emit_load_state(e);
+    emit_reg(e, 0, 0, OP_XOR_STORE, X_R15, X_R15);
+    emit_mem(e, 0, 1, OP_MOVSXD, X_RAX, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, ip));
+    emit_mov_imm64(e, X_RDX, (uint64_t)e->native);
+    emit_mem(e, 0, 0, OP_GROUP_FF, 4, X_RDX, X_RAX, 8, 0); // jmp [rdx + rax * 8]
+
+    // command was not executed, interpreter will count it
+    e->bail = e->pos;
+    emit_dec(e, X_R15);
+    e->exit = e->pos;
+    emit_save_state(e);
+    emit_mem(e, 0, 1, OP_ADD_STORE, X_R15, X_RBX, NO_INDEX, 0, offsetof(struct Cpu, executed));
+    emit_reg(e, 0, 1, OP_ARITH_IMM8, 0, X_RSP); // add rsp, 8
+    emit_byte(e, 8);
+    for (int i = saved_num - 1; i >= 0; i--) {
+        emit_opcode(e, 0, 0, 0x58 + (saved[i] & 7), 0, NO_INDEX, saved[i]); // pop
+    }
+    emit_byte(e, 0xC3); // ret
+}
+
+//! \brief Translate decoded program (without superinstructions and
+//! regions) into native code
+//! \param [in] program Decoded program
+//! \param [in] mc Memory controller for read and write commands
+//! \param [in] layout Cpu stacks layout and runtime helpers
+//! \return Returns compiled program or NULL, if program can not be compiled
+struct Jit_Code *
+jit_compile(struct Program *program, struct Memory_Controller *mc, const struct Jit_Layout *layout)
+{
+    assert(program);
+    assert(mc);
+    assert(layout);
+
+    struct Jit_Code *jit = (struct Jit_Code *)calloc(1, sizeof(*jit));
+    struct Emitter e = {};
+    e.mc = mc;
+    e.layout = layout;
+    e.size = (size_t)(program->size + 1) * JIT_COMMAND_MAX_SIZE + JIT_COMMAND_MAX_SIZE;
+    e.labels = (size_t *)calloc(program->size + 1, sizeof(size_t));
+    e.fixups = (struct Fixup *)calloc(2 * (program->size + 1), sizeof(struct Fixup));
+    e.native = (void **)calloc(program->size + 1, sizeof(void *));
+    void *buf = mmap(NULL, e.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    e.buf = buf == MAP_FAILED ? NULL : (unsigned char *)buf;
+    bool ok = jit && e.labels && e.fixups && e.native && e.buf;
+
+    if (ok) {
+        emit_entry(&e);
+        for (int i = 0; ok && i <= program->size; i++) {
+            ok = emit_command(&e, program->code + i, i);
+        }
+        ok = ok && !e.overflow;
+    }
+    if (ok) {
+        for (int i = 0; i < e.fixups_num; i++) {
+            patch(&e, e.fixups[i].pos, e.labels[e.fixups[i].target]);
+        }
+        for (int i = 0; i <= program->size; i++) {
+            e.native[i] = e.buf + e.labels[i];
+        }
+        ok = !mprotect(e.buf, e.size, PROT_READ | PROT_EXEC);
+    }
+    free(e.labels);
+    free(e.fixups);
+    if (!ok) {
+        if (e.buf) {
+            munmap(e.buf, e.size);
+        }
+        free(e.native);
+        free(jit);
+        return NULL;
+    }
+    jit->code = e.buf;
+    jit->code_size = e.size;
+    jit->native = e.native;
+    jit->entry = (int (*)(struct Cpu *))e.buf;
+    jit->mc = mc;
+    return jit;
+}
+
+//! \brief Free compiled program
+void
+jit_destroy(struct Jit_Code *jit)
+{
+    if (!jit) {
+        return;
+    }
+    munmap(jit->code, jit->code_size);
+    free(jit->native);
+    free(jit);
+}
+#else
+//! \brief Native code is generated only for x86-64, interpreter is used else
+struct Jit_Code *
+jit_compile(struct Program *, struct Memory_Controller *, const struct Jit_Layout *)
+{
+    return NULL;
+}
+
+void
+jit_destroy(struct Jit_Code *)
+{
+}
+#endif
+
+//! \brief Execute compiled program from the instruction cpu->ip
+//! \param [in] jit Compiled program
+//! \param [in] cpu Cpu to work with
+//! \return Returns index of instruction, which must be executed by
+//! interpreter (hlt, end of program or command with error), or -1 if cpu
+//! must stop
+int
+jit_run(struct Jit_Code *jit, struct Cpu *cpu)
+{
+    assert(jit);
+    assert(cpu);
+    return jit->entry(cpu);
+}
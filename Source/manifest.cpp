@@ -0,0 +1,266 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cassert>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "vm.h"
+#include "manifest.h"
+
+//! \brief Read whole file and put '\0' after it
+//! \param [in] file File name
+//! \param [out] size Size of file or NULL
+//! \return Returns contents of file or NULL, if it can not be read
+char *
+read_text_file(const char *file, int *size)
+{
+    assert(file);
+
+    FILE *stream = fopen(file, "rb");
+    if (!stream) {
+        return NULL;
+    }
+    int capacity = 4096;
+    int length = 0;
+    char *text = (char *)malloc(capacity);
+    while (text) {
+        length += fread(text + length, 1, capacity - length - 1, stream);
+        if (length < capacity - 1) {
+            break;
+        }
+        capacity *= 2;
+        char *tmp = (char *)realloc(text, capacity);
+        if (!tmp) {
+            free(text);
+        }
+        text = tmp;
+    }
+    bool ok = text && !ferror(stream);
+    fclose(stream);
+    if (!ok) {
+        free(text);
+        return NULL;
+    }
+    text[length] = '\0';
+    if (size) {
+        *size = length;
+    }
+    return text;
+}
+
+//! \brief Make path of file from manifest: relative paths are relative to
+//! the directory of manifest
+//! \param [in] dir Directory of manifest with '/' at the end or ""
+//! \param [in] path Path from manifest
+//! \return Returns allocated path or NULL
+static char *
+job_path(const char *dir, const char *path)
+{
+    int dir_length = path[0] == '/' ? 0 : strlen(dir);
+    int length = dir_length + strlen(path);
+    if (length >= MANIFEST_PATH_SIZE) {
+        return NULL;
+    }
+    char *result = (char *)malloc(length + 1);
+    if (result) {
+        memcpy(result, dir, dir_length);
+        strcpy(result + dir_length, path);
+    }
+    return result;
+}
+
+//! \brief Read manifest: every line has program, its input and expected
+//! output separated by spaces, empty lines and lines from '#' are skipped
+//! \param [in] file Manifest file
+//! \param [out] manifest Jobs
+//! \return Returns false, if manifest can not be read or has wrong line
+bool
+read_manifest(const char *file, struct Manifest *manifest)
+{
+    assert(file);
+    assert(manifest);
+
+    manifest->jobs = NULL;
+    manifest->jobs_num = 0;
+    manifest->queues = NULL;
+    manifest->queues_num = 0;
+    manifest->text = read_text_file(file, NULL);
+    if (!manifest->text) {
+        fprintf(stderr, "Can not read manifest %s\n", file);
+        return false;
+    }
+    char dir[MANIFEST_PATH_SIZE] = "";
+    const char *slash = strrchr(file, '/');
+    if (slash && slash - file + 1 < MANIFEST_PATH_SIZE) {
+        memcpy(dir, file, slash - file + 1);
+        dir[slash - file + 1] = '\0';
+    }
+    int capacity = 0;
+    int line_num = 0;
+    char *line = manifest->text;
+    while (*line) {
+        line_num++;
+        char *end = strchr(line, '\n');
+        char *next = end ? end + 1 : line + strlen(line);
+        if (end) {
+            *end = '\0';
+        }
+        char *fields[3] = {NULL, NULL, NULL};
+        int fields_num = 0;
+        char *s = line;
+        while (*s && *s != '#') {
+            if (isspace((unsigned char)*s)) {
+                *s++ = '\0';
+                continue;
+            }
+            if (fields_num == 3) {
+                fields_num++;
+                break;
+            }
+            fields[fields_num++] = s;
+            while (*s && !isspace((unsigned char)*s)) {
+                s++;
+            }
+        }
+        *s = '\0';
+        line = next;
+        if (!fields_num) {
+            continue;
+        }
+        if (fields_num != 3) {
+            fprintf(stderr, "Manifest %s, line %d: specify program, input and expected output\n", file, line_num);
+            destroy_manifest(manifest);
+            return false;
+        }
+        if (manifest->jobs_num == capacity) {
+            capacity = 2 * capacity + 64;
+            struct Manifest_Job *jobs =
+                (struct Manifest_Job *)realloc(manifest->jobs, capacity * sizeof(struct Manifest_Job));
+            if (!jobs) {
+                fprintf(stderr, "Can not allocate memory for manifest\n");
+                destroy_manifest(manifest);
+                return false;
+            }
+            manifest->jobs = jobs;
+        }
+        struct Manifest_Job *job = &manifest->jobs[manifest->jobs_num++];
+        job->name = fields[0];
+        job->program = job_path(dir, fields[0]);
+        job->input = job_path(dir, fields[1]);
+        job->expected = job_path(dir, fields[2]);
+        job->state = JOB_WAITING;
+        job->result = VM_FINISHED;
+        job->executed = 0;
+        job->seconds = 0;
+        if (!job->program || !job->input || !job->expected) {
+            fprintf(stderr, "Manifest %s, line %d: path is too long\n", file, line_num);
+            destroy_manifest(manifest);
+            return false;
+        }
+    }
+    return true;
+}
+
+//! \brief Give every worker thread its part of jobs, neighbour jobs go to
+//! the same thread
+//! \param [in] manifest Jobs
+//! \param [in] threads_num Number of worker threads
+//! \return Returns false, if memory can not be allocated
+bool
+split_manifest(struct Manifest *manifest, int threads_num)
+{
+    assert(manifest);
+    assert(threads_num > 0);
+
+    manifest->queues = (struct Manifest_Queue *)calloc(threads_num, sizeof(struct Manifest_Queue));
+    if (!manifest->queues) {
+        return false;
+    }
+    manifest->queues_num = threads_num;
+    for (int i = 0; i < threads_num; i++) {
+        manifest->queues[i].first = (long long)manifest->jobs_num * i / threads_num;
+        manifest->queues[i].last = (long long)manifest->jobs_num * (i + 1) / threads_num;
+        pthread_mutex_init(&manifest->queues[i].lock, NULL);
+    }
+    return true;
+}
+
+//! \brief Take the next job of thread or steal the last job of other one
+//! \param [in] manifest Jobs split by split_manifest()
+//! \param [in] thread Index of worker thread
+//! \return Returns job index or -1, if all jobs are taken
+int
+take_job(struct Manifest *manifest, int thread)
+{
+    assert(manifest);
+    assert(thread >= 0 && thread < manifest->queues_num);
+
+    for (int i = 0; i < manifest->queues_num; i++) {
+        struct Manifest_Queue *queue = &manifest->queues[(thread + i) % manifest->queues_num];
+        int job = -1;
+        pthread_mutex_lock(&queue->lock);
+        if (queue->first < queue->last) {
+            job = i ? --queue->last : queue->first++;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (job >= 0) {
+            return job;
+        }
+    }
+    return -1;
+}
+
+//! \brief Print state, result, commands and wall time of every job and
+//! throughput of all jobs into stdout
+//! \param [in] manifest Finished jobs
+//! \param [in] duration Wall time of all jobs
+void
+print_manifest(struct Manifest *manifest, double duration)
+{
+    assert(manifest);
+
+    static const char *states[] = {"skipped", "passed", "failed", "broken"};
+    static const char *results[] = {"finished", "error", "commands", "call depth"};
+    printf("%6s %-8s %-10s %14s %12s program\n", "job", "state", "result", "commands", "seconds");
+    long long executed = 0;
+    int failed = 0;
+    for (int i = 0; i < manifest->jobs_num; i++) {
+        struct Manifest_Job *job = &manifest->jobs[i];
+        printf("%6d %-8s %-10s %14lld %12.6lf %s\n", i, states[job->state],
+               job->state == JOB_BROKEN ? "-" : results[job->result], job->executed, job->seconds, job->name);
+        executed += job->executed;
+        failed += job->state != JOB_PASSED;
+    }
+    printf("%d jobs, %d failed, %lld commands in %lf s", manifest->jobs_num, failed, executed, duration);
+    if (duration > 0) {
+        printf(" (%.1lf jobs/s, %.0lf commands/s)", manifest->jobs_num / duration, executed / duration);
+    }
+    printf("\n");
+}
+
+//! \brief Free jobs and queues
+void
+destroy_manifest(struct Manifest *manifest)
+{
+    assert(manifest);
+
+    for (int i = 0; i < manifest->jobs_num; i++) {
+        free(manifest->jobs[i].program);
+        free(manifest->jobs[i].input);
+        free(manifest->jobs[i].expected);
+    }
+    for (int i = 0; i < manifest->queues_num; i++) {
+        pthread_mutex_destroy(&manifest->queues[i].lock);
+    }
+    free(manifest->jobs);
+    free(manifest->queues);
+    free(manifest->text);
+    manifest->jobs = NULL;
+    manifest->queues = NULL;
+    manifest->text = NULL;
+    manifest->jobs_num = 0;
+    manifest->queues_num = 0;
+}
@@ -0,0 +1,614 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <climits>
+
+#include "cpu.h"
+#include "program.h"
+#include "memo.h"
+
+//! Bit mask of all registers
+constexpr unsigned ALL_REGS = (1u << REG_NUMBER) - 1;
+
+//! \brief Effect of function on cpu state for its callers
+struct Summary
+{
+    bool pure;
+    bool known;         // some RET is reached, delta and must are valid
+    int low;            // values below stack depth at call, which are used
+    int delta;          // stack depth at RET minus the one at call
+    unsigned inputs;    // registers, which can be read before write
+    unsigned must;      // registers, which are written on every path to RET
+    unsigned may;       // registers, which are written on some path
+};
+
+//! \brief Context of abstract execution of one function
+struct Pure_Analysis
+{
+    struct Program *program;
+    const int *function_of;         // summary index for every CALL target or -1
+    const struct Summary *summaries;
+    int *depth;                     // stack depth before instruction or INT_MIN
+    unsigned *must;                 // registers written on every path to instruction
+    bool *in_work;
+    int *work;
+    int work_num;
+    int *touched;                   // instructions with depth, to clear them after
+    int touched_num;
+    struct Summary result;
+};
+
+//! \brief Count registers in bit mask
+static int
+count_regs(unsigned regs)
+{
+    int num = 0;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        num += (regs >> i) & 1;
+    }
+    return num;
+}
+
+//! \brief Command takes num values from the stack at depth
+static void
+take_args(struct Summary *summary, int depth, int num)
+{
+    if (num - depth > summary->low) {
+        summary->low = num - depth;
+    }
+}
+
+//! \brief Command reads register
+static void
+read_reg(struct Summary *summary, unsigned must, int reg)
+{
+    if (!(must & (1u << reg))) {
+        summary->inputs |= 1u << reg;
+    }
+}
+
+//! \brief Go to instruction with stack depth and written registers
+static void
+reach(struct Pure_Analysis *a, int index, int depth, unsigned must)
+{
+    if (a->depth[index] == INT_MIN) {
+        a->depth[index] = depth;
+        a->must[index] = must;
+        a->touched[a->touched_num++] = index;
+    } else if (a->depth[index] != depth) {
+        // stack depth must not depend on the path
+        a->result.pure = false;
+        return;
+    } else if ((a->must[index] & must) != a->must[index]) {
+        a->must[index] &= must;
+    } else {
+        return;
+    }
+    if (!a->in_work[index]) {
+        a->in_work[index] = true;
+        a->work[a->work_num++] = index;
+    }
+}
+
+//! \brief Execute function abstractly from entry to all its RETs
+//! \return Returns summary of the function
+static struct Summary
+analyze_function(struct Pure_Analysis *a, int entry)
+{
+    struct Summary *s = &a->result;
+    s->pure = true;
+    s->known = false;
+    s->low = 0;
+    s->delta = 0;
+    s->inputs = 0;
+    s->must = ALL_REGS;
+    s->may = 0;
+
+    a->work_num = 0;
+    a->touched_num = 0;
+    reach(a, entry, 0, 0);
+    while (a->work_num && s->pure) {
+        int index = a->work[--a->work_num];
+        a->in_work[index] = false;
+        struct Instruction *instr = a->program->code + index;
+        int depth = a->depth[index];
+        unsigned must = a->must[index];
+        const struct Summary *callee = NULL;
+        switch (instr->code) {
+            case ADD:
+            case SUB:
+            case MUL:
+            case DIV:
+                take_args(s, depth, 2);
+                reach(a, index + 1, depth - 1, must);
+                break;
+            case SQRT:
+                take_args(s, depth, 1);
+                reach(a, index + 1, depth, must);
+                break;
+            case PUSH_REG:
+                read_reg(s, must, instr->reg1);
+                reach(a, index + 1, depth + 1, must);
+                break;
+            case PUSH_VAL:
+                reach(a, index + 1, depth + 1, must);
+                break;
+            case POP_REG:
+                take_args(s, depth, 1);
+                s->may |= 1u << instr->reg1;
+                reach(a, index + 1, depth - 1, must | (1u << instr->reg1));
+                break;
+            case POP_VAL:
+                take_args(s, depth, 1);
+                reach(a, index + 1, depth - 1, must);
+                break;
+            case JMP:
+                reach(a, instr->arg, depth, must);
+                break;
+            case JMPL:
+            case JMPG:
+                take_args(s, depth, 2);
+                reach(a, instr->arg, depth - 2, must);
+                reach(a, index + 1, depth - 2, must);
+                break;
+            case CALL:
+                callee = &a->summaries[a->function_of[instr->arg]];
+                if (!callee->pure) {
+                    s->pure = false;
+                    break;
+                }
+                // path waits, until callee reaches its RET in the next passes
+                if (!callee->known) {
+                    break;
+                }
+                take_args(s, depth, callee->low);
+                s->inputs |= callee->inputs & ~must;
+                s->may |= callee->may;
+                reach(a, index + 1, depth + callee->delta, must | callee->must);
+                break;
+            case RET:
+                if (s->known && s->delta != depth) {
+                    s->pure = false;
+                }
+                s->known = true;
+                s->delta = depth;
+                s->must &= must;
+                break;
+            default:
+                // input, output, memory, cpu number, checkpoint, integer registers and end of program
+                s->pure = false;
+                break;
+        }
+    }
+    for (int i = 0; i < a->touched_num; i++) {
+        a->depth[a->touched[i]] = INT_MIN;
+        a->in_work[a->touched[i]] = false;
+    }
+    if (!s->known) {
+        s->must = ALL_REGS;
+    }
+    return *s;
+}
+
+//! \brief Find registers, which can be read after return from some call,
+//! liveness is computed for the whole program, so it is the same for all
+//! functions and can only be more than the real one
+//! \return Returns bit mask of registers or ALL_REGS, if memory is not enough
+static unsigned
+find_live_after_return(struct Program *program)
+{
+    unsigned *live = (unsigned *)calloc(program->size + 1, sizeof(unsigned));
+    if (!live) {
+        return ALL_REGS;
+    }
+    unsigned after_return = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = program->size - 1; i >= 0; i--) {
+            struct Instruction *instr = program->code + i;
+            unsigned uses = 0;
+            unsigned defs = 0;
+            unsigned out = live[i + 1];
+            switch (instr->code) {
+                case HLT:
+                    out = 0;
+                    break;
+                case PUSH_REG:
+                case OUT_REG:
+                case WRITE_ADDR:
+                    uses = 1u << instr->reg1;
+                    break;
+                case POP_REG:
+                case IN_REG:
+                case READ_ADDR:
+                case CPUID:
+                case CPUNUM:
+                    defs = 1u << instr->reg1;
+                    break;
+                case READ_REG:
+                    uses = 1u << instr->reg1;
+                    defs = 1u << instr->reg2;
+                    break;
+                case READ_IREG:
+                    // address is in integer register
+                    defs = 1u << instr->reg2;
+                    break;
+                case WRITE_IREG:
+                    uses = 1u << instr->reg1;
+                    break;
+                case WRITE_REG:
+                case XADD:
+                    uses = (1u << instr->reg1) | (1u << instr->reg2);
+                    break;
+                case CAS:
+                    uses = ALL_REGS;
+                    break;
+                case SPAWN:
+                    // child gets copy of registers and its rax goes to join
+                    uses = ALL_REGS;
+                    if (!(after_return & 1u)) {
+                        after_return |= 1u;
+                        changed = true;
+                    }
+                    break;
+                case JMP:
+                    out = live[instr->arg];
+                    break;
+                case JMPL:
+                case JMPG:
+                case IJMPL:
+                case IJMPG:
+                case IJMPE:
+                    out |= live[instr->arg];
+                    break;
+                case CALL:
+                    // callee returns to the next instruction
+                    out = live[instr->arg];
+                    if ((after_return | live[i + 1]) != after_return) {
+                        after_return |= live[i + 1];
+                        changed = true;
+                    }
+                    break;
+                case RET:
+                    out = after_return;
+                    break;
+                default:
+                    break;
+            }
+            unsigned in = uses | (out & ~defs);
+            if (in != live[i]) {
+                live[i] = in;
+                changed = true;
+            }
+        }
+    }
+    free(live);
+    return after_return;
+}
+
+//! \brief Find pure functions of program, which results can be memoized,
+//! and mark their first instructions in program->pure_index
+//! \param [in] program Decoded program without superinstructions
+//! \return Returns number of pure functions or -1 on error
+int
+find_pure_functions(struct Program *program)
+{
+    assert(program);
+
+    int size = program->size + 1;
+    int *function_of = (int *)calloc(size, sizeof(int));
+    int *entries = (int *)calloc(size, sizeof(int));
+    struct Summary *summaries = (struct Summary *)calloc(size, sizeof(struct Summary));
+    struct Pure_Analysis a;
+    a.depth = (int *)calloc(size, sizeof(int));
+    a.must = (unsigned *)calloc(size, sizeof(unsigned));
+    a.in_work = (bool *)calloc(size, sizeof(bool));
+    a.work = (int *)calloc(size, sizeof(int));
+    a.touched = (int *)calloc(size, sizeof(int));
+    program->pure_index = (int *)calloc(size, sizeof(int));
+    int functions_num = 0;
+    int pure_num = -1;
+    if (!function_of || !entries || !summaries || !a.depth || !a.must || !a.in_work || !a.work ||
+        !a.touched || !program->pure_index) {
+        fprintf(stderr, "Can not allocate memory for pure functions\n");
+        free(program->pure_index);
+        program->pure_index = NULL;
+        goto finish;
+    }
+
+    for (int i = 0; i < size; i++) {
+        function_of[i] = -1;
+        a.depth[i] = INT_MIN;
+        program->pure_index[i] = -1;
+    }
+    for (int i = 0; i < program->size; i++) {
+        int target = program->code[i].arg;
+        if (program->code[i].code == CALL && function_of[target] < 0) {
+            entries[functions_num] = target;
+            summaries[functions_num].pure = true;
+            summaries[functions_num].known = false;
+            summaries[functions_num].must = ALL_REGS;
+            function_of[target] = functions_num++;
+        }
+    }
+    a.program = program;
+    a.function_of = function_of;
+    a.summaries = summaries;
+
+    // summaries of callees grow, until nothing changes
+    for (int pass = 0; pass < MEMO_MAX_PASSES; pass++) {
+        bool changed = false;
+        for (int f = 0; f < functions_num; f++) {
+            struct Summary s = analyze_function(&a, entries[f]);
+            struct Summary *old = &summaries[f];
+            if (s.pure != old->pure || s.known != old->known || s.low != old->low || s.delta != old->delta ||
+                s.inputs != old->inputs || s.must != old->must || s.may != old->may) {
+                *old = s;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            pure_num = 0;
+            break;
+        }
+    }
+    if (pure_num < 0) {
+        // summaries did not settle, nothing is memoized
+        pure_num = 0;
+        goto finish;
+    }
+
+    program->pure = (struct Pure_Function *)calloc(functions_num + 1, sizeof(struct Pure_Function));
+    if (!program->pure) {
+        fprintf(stderr, "Can not allocate memory for pure functions\n");
+        pure_num = -1;
+        goto finish;
+    }
+    {
+        unsigned live = find_live_after_return(program);
+        for (int f = 0; f < functions_num; f++) {
+            struct Summary *s = &summaries[f];
+            if (!s->pure || !s->known) {
+                continue;
+            }
+            struct Pure_Function *pure = &program->pure[pure_num];
+            pure->entry = entries[f];
+            pure->args = s->low;
+            pure->results = s->low + s->delta;
+            // register, which is written only on some paths, keeps its value on the others
+            pure->inputs = s->inputs | (s->may & ~s->must & live);
+            pure->outputs = s->may & live;
+            pure->keys = pure->args + count_regs(pure->inputs);
+            pure->values = pure->results + count_regs(pure->outputs);
+            if (pure->keys > MEMO_MAX_VALUES || pure->values > MEMO_MAX_VALUES) {
+                continue;
+            }
+            program->pure_index[entries[f]] = pure_num++;
+        }
+    }
+    program->pure_num = pure_num;
+
+finish:
+    free(function_of);
+    free(entries);
+    free(summaries);
+    free(a.depth);
+    free(a.must);
+    free(a.in_work);
+    free(a.work);
+    free(a.touched);
+    return pure_num;
+}
+
+//! \brief Init empty cache of pure calls
+//! \param [in] memo Cache to init
+//! \param [in] functions_num Number of pure functions
+//! \return Returns false, if memory can not be allocated
+bool
+init_memo(struct Memo *memo, int functions_num)
+{
+    assert(memo);
+
+    memo->entries = (struct Memo_Entry *)calloc(MEMO_CACHE_SIZE, sizeof(struct Memo_Entry));
+    memo->frames = NULL;
+    memo->frames_num = 0;
+    memo->frames_capacity = 0;
+    memo->skipped_total = 0;
+    memo->functions_num = functions_num;
+    memo->calls = (long long *)calloc(functions_num + 1, sizeof(long long));
+    memo->hits = (long long *)calloc(functions_num + 1, sizeof(long long));
+    memo->skipped = (long long *)calloc(functions_num + 1, sizeof(long long));
+    if (!memo->entries || !memo->calls || !memo->hits || !memo->skipped) {
+        destroy_memo(memo);
+        return false;
+    }
+    for (int i = 0; i < MEMO_CACHE_SIZE; i++) {
+        memo->entries[i].function = -1;
+    }
+    return true;
+}
+
+//! \brief Free cache of pure calls
+void
+destroy_memo(struct Memo *memo)
+{
+    assert(memo);
+
+    free(memo->entries);
+    free(memo->frames);
+    free(memo->calls);
+    free(memo->hits);
+    free(memo->skipped);
+    memo->entries = NULL;
+    memo->frames = NULL;
+    memo->calls = NULL;
+    memo->hits = NULL;
+    memo->skipped = NULL;
+}
+
+//! \brief Add counters of other cpu
+void
+merge_memo(struct Memo *memo, const struct Memo *other)
+{
+    assert(memo);
+    assert(other);
+
+    for (int i = 0; i < memo->functions_num; i++) {
+        memo->calls[i] += other->calls[i];
+        memo->hits[i] += other->hits[i];
+        memo->skipped[i] += other->skipped[i];
+    }
+}
+
+//! \brief Print hit rate and saved time of every pure function into stderr
+//! \param [in] memo Counters of calls
+//! \param [in] program Decoded program
+//! \param [in] executed Commands executed by cpus
+//! \param [in] duration Time of execution, saved time is estimated with its speed
+void
+print_memo(const struct Memo *memo, struct Program *program, long long executed, double duration)
+{
+    assert(memo);
+    assert(program);
+
+    double speed = duration > 0 ? executed / duration : 0;
+    long long calls = 0;
+    long long hits = 0;
+    long long skipped = 0;
+    fprintf(stderr, "Memoized pure functions (%d):\n", memo->functions_num);
+    fprintf(stderr, "%8s %5s %7s %12s %12s %7s %14s %12s\n", "offset", "args", "results", "calls", "hits", "hits%",
+            "skipped", "saved s");
+    for (int i = 0; i < memo->functions_num; i++) {
+        struct Pure_Function *pure = &program->pure[i];
+        fprintf(stderr, "%8d %5d %7d %12lld %12lld %6.2lf%% %14lld %12.6lf\n", program->code[pure->entry].offset,
+                pure->args, pure->results, memo->calls[i], memo->hits[i],
+                memo->calls[i] ? memo->hits[i] * 100.0 / memo->calls[i] : 0.0, memo->skipped[i],
+                speed > 0 ? memo->skipped[i] / speed : 0.0);
+        calls += memo->calls[i];
+        hits += memo->hits[i];
+        skipped += memo->skipped[i];
+    }
+    fprintf(stderr, "%lld calls, %lld hits (%.2lf%%), %lld commands skipped, about %lf s saved\n", calls, hits,
+            calls ? hits * 100.0 / calls : 0.0, skipped, speed > 0 ? skipped / speed : 0.0);
+}
+
+//! \brief Take key of the call from cpu
+//! \return Returns false, if cpu stack has not enough args
+static bool
+take_key(struct Pure_Function *pure, struct Cpu *cpu, double *key)
+{
+    double *stack = NULL;
+    int depth = get_cpu_stack(cpu, &stack);
+    if (depth < pure->args) {
+        return false;
+    }
+    memcpy(key, stack + depth - pure->args, pure->args * sizeof(double));
+    int num = pure->args;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        if (pure->inputs & (1u << i)) {
+            key[num++] = cpu->regs[i];
+        }
+    }
+    return true;
+}
+
+//! \brief Hash of function and key bits, -0.0 and 0.0 are different keys
+static unsigned
+key_hash(int function, const double *key, int keys)
+{
+    unsigned hash = 2166136261u ^ (unsigned)function;
+    const unsigned char *bytes = (const unsigned char *)key;
+    for (int i = 0; i < keys * (int)sizeof(double); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//! \brief Call of pure function: find its results in cache or remember the
+//! call to save results at its RET
+//! \param [in] memo Cache of cpu
+//! \param [in] program Decoded program
+//! \param [in] cpu Cpu before the call
+//! \param [in] function Index in program->pure
+//! \param [in] executed Commands executed by cpu before the call
+//! \return Returns cached call (cpu must take its values instead of the
+//! call) or NULL (cpu must execute the call)
+const struct Memo_Entry *
+memo_call(struct Memo *memo, struct Program *program, struct Cpu *cpu, int function, long long executed)
+{
+    struct Pure_Function *pure = &program->pure[function];
+    double key[MEMO_MAX_VALUES];
+    // stack error is found by the call itself
+    if (!take_key(pure, cpu, key)) {
+        return NULL;
+    }
+    memo->calls[function]++;
+    unsigned hash = key_hash(function, key, pure->keys);
+    struct Memo_Entry *entry = &memo->entries[hash & (MEMO_CACHE_SIZE - 1)];
+    if (entry->function == function && !memcmp(entry->key, key, pure->keys * sizeof(double))) {
+        memo->hits[function]++;
+        memo->skipped[function] += entry->commands;
+        memo->skipped_total += entry->commands;
+        return entry;
+    }
+
+    if (memo->frames_num == memo->frames_capacity) {
+        int capacity = memo->frames_capacity ? memo->frames_capacity * 2 : 64;
+        struct Memo_Frame *frames = (struct Memo_Frame *)realloc(memo->frames, capacity * sizeof(struct Memo_Frame));
+        // without frame the call is just not cached
+        if (!frames) {
+            return NULL;
+        }
+        memo->frames = frames;
+        memo->frames_capacity = capacity;
+    }
+    int *ret = NULL;
+    struct Memo_Frame *frame = &memo->frames[memo->frames_num++];
+    frame->function = function;
+    frame->ret_depth = get_ret_stack(cpu, &ret) + 1;
+    frame->hash = hash;
+    frame->executed = executed;
+    frame->skipped = memo->skipped_total;
+    memcpy(frame->key, key, pure->keys * sizeof(double));
+    return NULL;
+}
+
+//! \brief RET command: if it returns from the remembered call, save results
+//! of the call into cache
+//! \param [in] memo Cache of cpu with remembered calls
+//! \param [in] program Decoded program
+//! \param [in] cpu Cpu before RET
+//! \param [in] executed Commands executed by cpu before RET
+void
+memo_ret(struct Memo *memo, struct Program *program, struct Cpu *cpu, long long executed)
+{
+    int *ret = NULL;
+    int ret_depth = get_ret_stack(cpu, &ret);
+    // calls, which are left by errors, are forgotten
+    while (memo->frames_num && memo->frames[memo->frames_num - 1].ret_depth > ret_depth) {
+        memo->frames_num--;
+    }
+    if (!memo->frames_num || memo->frames[memo->frames_num - 1].ret_depth != ret_depth) {
+        return;
+    }
+    struct Memo_Frame *frame = &memo->frames[--memo->frames_num];
+    struct Pure_Function *pure = &program->pure[frame->function];
+    double *stack = NULL;
+    int depth = get_cpu_stack(cpu, &stack);
+    assert(depth >= pure->results);
+
+    struct Memo_Entry *entry = &memo->entries[frame->hash & (MEMO_CACHE_SIZE - 1)];
+    entry->function = frame->function;
+    // hits inside of the call are counted too
+    entry->commands = executed - frame->executed + memo->skipped_total - frame->skipped;
+    memcpy(entry->key, frame->key, pure->keys * sizeof(double));
+    memcpy(entry->values, stack + depth - pure->results, pure->results * sizeof(double));
+    int num = pure->results;
+    for (int i = 0; i < REG_NUMBER; i++) {
+        if (pure->outputs & (1u << i)) {
+            entry->values[num++] = cpu->regs[i];
+        }
+    }
+}
@@ -10,7 +10,7 @@
 //! \param [in] size Memory size to allocate
 //! \return Returns 0 if success, ERROR from Memory_Errors else
 int
-init_memory(struct Memory *mem, int size)
+init_memory(struct Memory *mem, long long size)
 {
     assert(mem);
     assert(size > 0);
@@ -21,13 +21,13 @@ init_memory(struct Memory *mem, int size)
     }
 
     if (size <= 0) {
-        fprintf(stderr, "Wrong memory size: %d\n", size);
+        fprintf(stderr, "Wrong memory size: %lld\n", size);
         return NEGATIVE_MEM;
     }
 
     double *tmp = (double *)calloc(size, sizeof(double));
     if (!tmp) {
-        fprintf(stderr, "Can not allocate memory for %d double\n", size);
+        fprintf(stderr, "Can not allocate memory for %lld double\n", size);
         return ALLOCATE_ERROR;
     }
     mem->memory = tmp;
@@ -47,6 +47,7 @@ init_memory_controller(struct Memory_Controller *mc)
     }
     mc->memory_pieces_num = 0;
     mc->memory = NULL;
+    mc->err = NULL;
     return 0;
 }
 //! \brief Add memory into memory controller
@@ -96,9 +97,9 @@ add_memory(struct Memory_Controller *mc, struct Memory *mem)
 //! \param [in,out] address Pointer to address
 //! \return Returns pointer to right memory part or NULL if unsuccess. If success, shifts address to be right value in memory part
 static struct Memory *
-find_address(struct Memory_Controller *mc, int *address)
+find_address(struct Memory_Controller *mc, long long *address)
 {
-  int max_address = 0;
+  long long max_address = 0;
   for (int i = 0; i < mc->memory_pieces_num; i++) {
       if (max_address + mc->memory[i]->size <= *address) {
           max_address += mc->memory[i]->size;
@@ -110,6 +111,13 @@ find_address(struct Memory_Controller *mc, int *address)
   return NULL;
 }
 
+//! \brief Stream for messages about wrong memory requests
+static FILE *
+error_stream(struct Memory_Controller *mc)
+{
+    return mc->err ? mc->err : stderr;
+}
+
 //! \brief Imitate delay during memory operations
 //! \param [in] delay Delay in nanoseconds
 static void
@@ -127,19 +135,24 @@ wait(int delay) {
 //! \param [in] value Value to write
 //! \return Returns 0 in success, ERROR number else
 int
-write_into_memory(struct Memory_Controller *mc, int address, double value)
+write_into_memory(struct Memory_Controller *mc, long long address, double value)
 {
     assert(mc);
-    assert(address >= 0);
-    
+
+    if (address < 0) {
+        fprintf(error_stream(mc), "Write memory on negative address %lld\n", address);
+        return NEGATIVE_MEM;
+    }
+
     wait(WRITE_DELAY);
 
     struct Memory *right_mem = find_address(mc, &address);
     if (!right_mem) {
-        fprintf(stderr, "Can not write into memory %d\n", address);
+        fprintf(error_stream(mc), "Can not write into memory %lld\n", address);
         return TOO_BIG_ADDRESS;
     }
-    right_mem->memory[address] = value;
+    // other cpus may access the same cell, order is given by fence command
+    __atomic_store(&right_mem->memory[address], &value, __ATOMIC_RELAXED);
     return 0;
 }
 //! \brief Get value from memory
@@ -147,14 +160,13 @@ write_into_memory(struct Memory_Controller *mc, int address, double value)
 //! \param [in] address Address
 //! \param [out] value Pointer to place to write value
 int
-get_from_memory(struct Memory_Controller *mc, int address, double *value)
+get_from_memory(struct Memory_Controller *mc, long long address, double *value)
 {
     assert(mc);
     assert(value);
-    assert(address >= 0);
-    
+
     if (address < 0) {
-        fprintf(stderr, "Get memory on negative address %d\n", address);
+        fprintf(error_stream(mc), "Get memory on negative address %lld\n", address);
         return NEGATIVE_MEM;
     }
 
@@ -162,17 +174,17 @@ get_from_memory(struct Memory_Controller *mc, int address, double *value)
 
     struct Memory *right_memory = find_address(mc, &address);
     if (!right_memory) {
-        fprintf(stderr, "Can not get memory on address %d\n", address);
+        fprintf(error_stream(mc), "Can not get memory on address %lld\n", address);
         return TOO_BIG_ADDRESS;
     }
-    *value = right_memory->memory[address];
+    __atomic_load(&right_memory->memory[address], value, __ATOMIC_RELAXED);
     return 0;
 }
 
 //! \brief Get whole available memory
 //! \param [in] mc Memory Controller
 //! \return Returns memory size
-int
+long long
 get_memory_size(struct Memory_Controller *mc)
 {
     assert(mc);
@@ -181,9 +193,121 @@ get_memory_size(struct Memory_Controller *mc)
         fprintf(stderr, "Get memory size from null pointer\n");
         return NULL_MEM;
     }
-    int res = 0;
+    long long res = 0;
     for (int i = 0; i < mc->memory_pieces_num; i++) {
         res += mc->memory[i]->size;
     }
     return res;
 }
+
+//! \brief Find memory cell for atomic command
+//! \param [in] mc Memory Controller
+//! \param [in] address Address
+//! \return Returns pointer to the cell or NULL, if address is wrong
+static double *
+find_cell(struct Memory_Controller *mc, long long address)
+{
+    if (address < 0) {
+        fprintf(error_stream(mc), "Get memory on negative address %lld\n", address);
+        return NULL;
+    }
+    struct Memory *right_memory = find_address(mc, &address);
+    if (!right_memory) {
+        fprintf(error_stream(mc), "Can not get memory on address %lld\n", address);
+        return NULL;
+    }
+    return right_memory->memory + address;
+}
+
+//! \brief Atomically write desired value, if memory has expected value.
+//! Values are compared bitwise, like memcmp() does.
+//! \param [in] mc Memory Controller
+//! \param [in] address Address
+//! \param [in,out] expected Expected value, it gets memory value, if it differs
+//! \param [in] desired Value to write
+//! \param [out] swapped Set to true, if value was written
+//! \return Returns 0 in success, ERROR number else
+int
+compare_exchange_memory(struct Memory_Controller *mc, long long address, double *expected, double desired,
+                        bool *swapped)
+{
+    assert(mc);
+    assert(expected);
+    assert(swapped);
+
+    wait(WRITE_DELAY);
+
+    double *cell = find_cell(mc, address);
+    if (!cell) {
+        return TOO_BIG_ADDRESS;
+    }
+    *swapped = __atomic_compare_exchange(cell, expected, &desired, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+//! \brief Atomically add value to memory
+//! \param [in] mc Memory Controller
+//! \param [in] address Address
+//! \param [in] value Value to add
+//! \param [out] old Memory value before addition
+//! \return Returns 0 in success, ERROR number else
+int
+exchange_add_memory(struct Memory_Controller *mc, long long address, double value, double *old)
+{
+    assert(mc);
+    assert(old);
+
+    wait(WRITE_DELAY);
+
+    double *cell = find_cell(mc, address);
+    if (!cell) {
+        return TOO_BIG_ADDRESS;
+    }
+    // there is no atomic addition for doubles, so repeat until nobody interferes
+    double current = 0;
+    __atomic_load(cell, &current, __ATOMIC_RELAXED);
+    double sum = current + value;
+    while (!__atomic_compare_exchange(cell, &current, &sum, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        sum = current + value;
+    }
+    *old = current;
+    return 0;
+}
+
+//! \brief Translate register value into memory address, fraction is dropped
+//! \param [in] value Register value
+//! \return Returns address or -1, if value is negative or too big for address
+long long
+memory_address(double value)
+{
+    // LLONG_MAX + 1, the first value, which can not be converted
+    if (!(value > -1 && value < 9223372036854775808.0)) {
+        return -1;
+    }
+    return (long long)value;
+}
+
+//! \brief Translate value into integer register value, fraction is dropped
+//! \param [in] value Value from cpu stack
+//! \param [out] result Integer value
+//! \return Returns false, if value is NaN or out of 64-bit range
+bool
+integer_value(double value, long long *result)
+{
+    // -2^63 is the least integer, 2^63 is the first value above the greatest one
+    if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0)) {
+        return false;
+    }
+    *result = (long long)value;
+    return true;
+}
+
+//! \brief Order all memory accesses of the cpu before the fence with all after it
+//! \param [in] mc Memory Controller
+void
+memory_fence(struct Memory_Controller *mc)
+{
+    assert(mc);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include "cpu.h"
+#include "program.h"
+#include "profile.h"
+
+//! \brief Allocate zero counters
+//! \param [in] profile Profile to init
+//! \param [in] size Number of instructions in decoded program
+//! \param [in] memory_size Number of memory cells of memory controller
+//! \return Returns false, if memory can not be allocated
+bool
+init_profile(struct Profile *profile, int size, long long memory_size)
+{
+    assert(profile);
+    assert(size >= 0);
+
+    profile->size = size + 1;
+    profile->memory_size = memory_size > 0 ? memory_size : 0;
+    profile->executed = (long long *)calloc(profile->size, sizeof(long long));
+    profile->cycles = (unsigned long long *)calloc(profile->size, sizeof(unsigned long long));
+    profile->calls = (long long *)calloc(profile->size, sizeof(long long));
+    profile->reads = (long long *)calloc(profile->memory_size + 1, sizeof(long long));
+    profile->writes = (long long *)calloc(profile->memory_size + 1, sizeof(long long));
+    profile->last_clock = 0;
+    profile->last_index = -1;
+    if (!profile->executed || !profile->cycles || !profile->calls || !profile->reads || !profile->writes) {
+        destroy_profile(profile);
+        return false;
+    }
+    return true;
+}
+
+//! \brief Free counters
+void
+destroy_profile(struct Profile *profile)
+{
+    assert(profile);
+
+    free(profile->executed);
+    free(profile->cycles);
+    free(profile->calls);
+    free(profile->reads);
+    free(profile->writes);
+    profile->executed = NULL;
+    profile->cycles = NULL;
+    profile->calls = NULL;
+    profile->reads = NULL;
+    profile->writes = NULL;
+}
+
+//! \brief Add counters of another cpu
+//! \param [in] to Profile, which gets the sum
+//! \param [in] from Profile of the same program and memory
+void
+merge_profile(struct Profile *to, struct Profile *from)
+{
+    assert(to);
+    assert(from);
+    assert(to->size == from->size && to->memory_size == from->memory_size);
+
+    for (int i = 0; i < to->size; i++) {
+        to->executed[i] += from->executed[i];
+        to->cycles[i] += from->cycles[i];
+        to->calls[i] += from->calls[i];
+    }
+    for (long long i = 0; i < to->memory_size; i++) {
+        to->reads[i] += from->reads[i];
+        to->writes[i] += from->writes[i];
+    }
+}
+
+//! \brief Find the hottest not printed entry, it is zeroed to be skipped next time
+//! \param [in] keys Hotness of entries
+//! \param [in] size Number of entries
+//! \return Returns entry index or -1, if all entries are zero
+static long long
+take_hottest(unsigned long long *keys, long long size)
+{
+    long long best = -1;
+    for (long long i = 0; i < size; i++) {
+        if (keys[i] && (best < 0 || keys[i] > keys[best])) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        keys[best] = 0;
+    }
+    return best;
+}
+
+//! \brief Percent of part in total
+static double
+percent(unsigned long long part, unsigned long long total)
+{
+    return total ? 100.0 * part / total : 0;
+}
+
+//! \brief Print commands and instructions sorted by host cycles, then called
+//! functions and memory cells sorted by number of accesses, into stderr
+//! \param [in] profile Profile of program
+//! \param [in] program Decoded program without superinstructions
+void
+print_profile(struct Profile *profile, struct Program *program)
+{
+    assert(profile);
+    assert(program);
+
+    long long keys_size = profile->size > DECODED_COMMANDS_NUM ? profile->size : DECODED_COMMANDS_NUM;
+    if (keys_size < profile->memory_size) {
+        keys_size = profile->memory_size;
+    }
+    unsigned long long *keys = (unsigned long long *)calloc(keys_size, sizeof(unsigned long long));
+    long long command_executed[DECODED_COMMANDS_NUM] = {};
+    unsigned long long command_cycles[DECODED_COMMANDS_NUM] = {};
+    if (!keys) {
+        fprintf(stderr, "Can not allocate memory for profile report\n");
+        return;
+    }
+
+    long long executed = 0;
+    unsigned long long cycles = 0;
+    for (int i = 0; i < profile->size; i++) {
+        int code = program->code[i].code;
+        command_executed[code] += profile->executed[i];
+        command_cycles[code] += profile->cycles[i];
+        executed += profile->executed[i];
+        cycles += profile->cycles[i];
+    }
+
+    fprintf(stderr, "Profile of commands (%lld executed, %llu cycles):\n", executed, cycles);
+    fprintf(stderr, "%12s %14s %7s %10s command\n", "executed", "cycles", "cycles%", "cycles/cmd");
+    for (int i = 0; i < DECODED_COMMANDS_NUM; i++) {
+        keys[i] = command_cycles[i] ? command_cycles[i] : command_executed[i];
+    }
+    int code = 0;
+    while ((code = take_hottest(keys, DECODED_COMMANDS_NUM)) >= 0) {
+        fprintf(stderr, "%12lld %14llu %6.2lf%% %10.1lf %s\n", command_executed[code], command_cycles[code],
+                percent(command_cycles[code], cycles),
+                command_executed[code] ? (double)command_cycles[code] / command_executed[code] : 0.0,
+                command_name(code));
+    }
+
+    fprintf(stderr, "Hottest instructions:\n");
+    fprintf(stderr, "%8s %12s %14s %7s command\n", "offset", "executed", "cycles", "cycles%");
+    for (int i = 0; i < profile->size; i++) {
+        keys[i] = profile->cycles[i] ? profile->cycles[i] : profile->executed[i];
+    }
+    for (int top = 0; top < PROFILE_TOP_NUM; top++) {
+        int index = take_hottest(keys, profile->size);
+        if (index < 0) {
+            break;
+        }
+        fprintf(stderr, "%8d %12lld %14llu %6.2lf%% %s\n", program->code[index].offset, profile->executed[index],
+                profile->cycles[index], percent(profile->cycles[index], cycles),
+                command_name(program->code[index].code));
+    }
+
+    fprintf(stderr, "Called functions:\n");
+    fprintf(stderr, "%8s %12s\n", "offset", "calls");
+    for (int i = 0; i < profile->size; i++) {
+        keys[i] = profile->calls[i];
+    }
+    for (int top = 0; top < PROFILE_TOP_NUM; top++) {
+        int index = take_hottest(keys, profile->size);
+        if (index < 0) {
+            break;
+        }
+        fprintf(stderr, "%8d %12lld\n", program->code[index].offset, profile->calls[index]);
+    }
+
+    fprintf(stderr, "Memory accesses:\n");
+    fprintf(stderr, "%8s %12s %12s\n", "address", "reads", "writes");
+    for (long long i = 0; i < profile->memory_size; i++) {
+        keys[i] = profile->reads[i] + profile->writes[i];
+    }
+    for (int top = 0; top < PROFILE_TOP_NUM; top++) {
+        long long address = take_hottest(keys, profile->memory_size);
+        if (address < 0) {
+            break;
+        }
+        fprintf(stderr, "%8lld %12lld %12lld\n", address, profile->reads[address], profile->writes[address]);
+    }
+    free(keys);
+}
@@ -0,0 +1,571 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <string.h>
+#include <climits>
+#include <cstdint>
+#include <sys/mman.h>
+
+#include "cpu.h"
+#include "program.h"
+#include "jit.h"
+#include "in_and_out.h"
+
+//! \brief Translate register command into register index
+//! \param [in] reg Register command (RAX, RBX or RCX)
+//! \return Returns index in cpu->regs or -1, if it is not a register
+int
+register_index(char reg)
+{
+    switch (reg) {
+        case RAX:
+            return 0;
+        case RBX:
+            return 1;
+        case RCX:
+            return 2;
+        default:
+            return -1;
+    }
+    return -1;
+}
+
+//! \brief Translate integer register command into register index
+//! \param [in] reg Register command (IAX, IBX or ICX)
+//! \return Returns index in cpu->iregs or -1, if it is not an integer register
+int
+iregister_index(char reg)
+{
+    switch (reg) {
+        case IAX:
+            return 0;
+        case IBX:
+            return 1;
+        case ICX:
+            return 2;
+        default:
+            return -1;
+    }
+    return -1;
+}
+
+//! \brief Command name for statistics and dumps
+//! \param [in] code Command code from CPU_COMMANDS or DECODED_COMMANDS
+//! \return Returns command name
+const char *
+command_name(int code)
+{
+    switch (code) {
+        case HLT: return "hlt";
+        case ADD: return "add";
+        case SUB: return "sub";
+        case MUL: return "mul";
+        case DIV: return "div";
+        case SQRT: return "sqrt";
+        case READ_REG: return "read_reg";
+        case READ_ADDR: return "read_addr";
+        case WRITE_REG: return "write_reg";
+        case WRITE_ADDR: return "write_addr";
+        case CAS: return "cas";
+        case XADD: return "xadd";
+        case FENCE: return "fence";
+        case READ_IREG: return "read_ireg";
+        case WRITE_IREG: return "write_ireg";
+        case CPUID: return "cpuid";
+        case CPUNUM: return "cpunum";
+        case SNAP: return "snap";
+        case PUSH_REG: return "push_reg";
+        case PUSH_VAL: return "push_val";
+        case POP_REG: return "pop_reg";
+        case POP_VAL: return "pop_val";
+        case PUSH_IREG: return "push_ireg";
+        case POP_IREG: return "pop_ireg";
+        case IMOV_REG: return "imov_reg";
+        case IMOV_VAL: return "imov_val";
+        case IADD_REG: return "iadd_reg";
+        case IADD_VAL: return "iadd_val";
+        case ISUB_REG: return "isub_reg";
+        case ISUB_VAL: return "isub_val";
+        case IMUL_REG: return "imul_reg";
+        case IMUL_VAL: return "imul_val";
+        case IN: return "in";
+        case IN_REG: return "in_reg";
+        case OUT: return "out";
+        case OUT_REG: return "out_reg";
+        case JMP: return "jmp";
+        case JMPL: return "jmpl";
+        case JMPG: return "jmpg";
+        case CALL: return "call";
+        case RET: return "ret";
+        case SPAWN: return "spawn";
+        case JOIN: return "join";
+        case IJMPL: return "ijmpl";
+        case IJMPG: return "ijmpg";
+        case IJMPE: return "ijmpe";
+        case END_OF_PROGRAM: return "end";
+        case PUSH_REG_PUSH_REG: return "push_reg+push_reg";
+        case PUSH_REG_PUSH_VAL: return "push_reg+push_val";
+        case PUSH_REG_REG_JMPL: return "push_reg+push_reg+jmpl";
+        case PUSH_REG_REG_JMPG: return "push_reg+push_reg+jmpg";
+        case PUSH_REG_VAL_JMPL: return "push_reg+push_val+jmpl";
+        case PUSH_REG_VAL_JMPG: return "push_reg+push_val+jmpg";
+        case PUSH_VAL_JMPL: return "push_val+jmpl";
+        case PUSH_VAL_JMPG: return "push_val+jmpg";
+        case PUSH_VAL_ADD: return "push_val+add";
+        case PUSH_VAL_SUB: return "push_val+sub";
+        case PUSH_VAL_MUL: return "push_val+mul";
+        case PUSH_VAL_DIV: return "push_val+div";
+        case POP_REG_PUSH_REG: return "pop_reg+push_reg";
+        case REGION: return "region";
+        default: return "unknown";
+    }
+    return "unknown";
+}
+
+//! \brief Decode register operand
+//! \param [in,out] commands Pointer to operand, shifts after it
+//! \param [in] commands_end End of bytecode
+//! \param [out] reg Register index
+//! \return Returns true if operand is valid register
+static bool
+decode_register(char **commands, char *commands_end, int *reg)
+{
+    if (*commands >= commands_end) {
+        return false;
+    }
+    *reg = register_index(**commands);
+    if (*reg < 0) {
+        return false;
+    }
+    (*commands)++;
+    return true;
+}
+
+//! \brief Decode integer register operand
+//! \param [in,out] commands Pointer to operand, shifts after it
+//! \param [in] commands_end End of bytecode
+//! \param [out] reg Integer register index
+//! \return Returns true if operand is valid integer register
+static bool
+decode_iregister(char **commands, char *commands_end, int *reg)
+{
+    if (*commands >= commands_end) {
+        return false;
+    }
+    *reg = iregister_index(**commands);
+    if (*reg < 0) {
+        return false;
+    }
+    (*commands)++;
+    return true;
+}
+
+//! \brief Decode jump or memory address operand
+//! \param [in,out] commands Pointer to operand, shifts after it
+//! \param [in] commands_end End of bytecode
+//! \param [in] operand_size COMPACT_OPERAND_SIZE (or JUMP_OPERAND_SIZE) or WIDE_OPERAND_SIZE
+//! \param [out] value Operand value
+//! \return Returns true if there is enough bytes for operand
+static bool
+decode_address(char **commands, char *commands_end, int operand_size, long long *value)
+{
+    if (commands_end - *commands < operand_size) {
+        return false;
+    }
+    if (operand_size == WIDE_OPERAND_SIZE) {
+        int64_t wide = 0;
+        memcpy(&wide, *commands, sizeof(wide));
+        *value = wide;
+    } else {
+        int32_t compact = 0;
+        memcpy(&compact, *commands, sizeof(compact));
+        *value = compact;
+    }
+    *commands += operand_size;
+    return true;
+}
+
+//! \brief Decode one command
+//! \param [in,out] commands Pointer to command, shifts to the next command
+//! \param [in] commands_end End of bytecode
+//! \param [in] operand_size Size of memory address operands
+//! \param [out] instr Decoded command, jump address is put into instr->address
+//! \return Returns NULL if success, error description else
+static const char *
+decode_command(char **commands, char *commands_end, int operand_size, struct Instruction *instr)
+{
+    instr->code = (unsigned char)**commands;
+    instr->reg1 = 0;
+    instr->reg2 = 0;
+    instr->reg3 = 0;
+    instr->arg = 0;
+    instr->value = 0;
+    (*commands)++;
+    switch (instr->code) {
+        case HLT:
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case SQRT:
+        case RET:
+        case POP_VAL:
+        case IN:
+        case OUT:
+        case FENCE:
+        case SNAP:
+        case JOIN:
+            return NULL;
+        case PUSH_REG:
+        case POP_REG:
+        case IN_REG:
+        case OUT_REG:
+        case CPUID:
+        case CPUNUM:
+            if (!decode_register(commands, commands_end, &instr->reg1)) {
+                return "no valid register";
+            }
+            return NULL;
+        case PUSH_VAL:
+            if (*commands + sizeof(double) > commands_end) {
+                return "no valid argument";
+            }
+            memcpy(&instr->value, *commands, sizeof(double));
+            *commands += sizeof(double);
+            return NULL;
+        case JMP:
+        case JMPL:
+        case JMPG:
+        case CALL:
+        case SPAWN:
+            if (!decode_address(commands, commands_end, JUMP_OPERAND_SIZE, &instr->address)) {
+                return "no jump address";
+            }
+            return NULL;
+        case WRITE_REG:
+        case READ_REG:
+        case XADD:
+            if (!decode_register(commands, commands_end, &instr->reg1) ||
+                !decode_register(commands, commands_end, &instr->reg2)) {
+                return "no valid register";
+            }
+            return NULL;
+        case CAS:
+            if (!decode_register(commands, commands_end, &instr->reg1) ||
+                !decode_register(commands, commands_end, &instr->reg2) ||
+                !decode_register(commands, commands_end, &instr->reg3)) {
+                return "no valid register";
+            }
+            return NULL;
+        case WRITE_ADDR:
+            if (!decode_register(commands, commands_end, &instr->reg1)) {
+                return "no valid register";
+            }
+            if (!decode_address(commands, commands_end, operand_size, &instr->address)) {
+                return "no memory address";
+            }
+            return NULL;
+        case READ_ADDR:
+            if (!decode_address(commands, commands_end, operand_size, &instr->address)) {
+                return "no memory address";
+            }
+            if (!decode_register(commands, commands_end, &instr->reg1)) {
+                return "no valid register";
+            }
+            return NULL;
+        case PUSH_IREG:
+        case POP_IREG:
+            if (!decode_iregister(commands, commands_end, &instr->reg1)) {
+                return "no valid integer register";
+            }
+            return NULL;
+        case IMOV_REG:
+        case IADD_REG:
+        case ISUB_REG:
+        case IMUL_REG:
+            if (!decode_iregister(commands, commands_end, &instr->reg1) ||
+                !decode_iregister(commands, commands_end, &instr->reg2)) {
+                return "no valid integer register";
+            }
+            return NULL;
+        case IMOV_VAL:
+        case IADD_VAL:
+        case ISUB_VAL:
+        case IMUL_VAL:
+            if (!decode_iregister(commands, commands_end, &instr->reg1)) {
+                return "no valid integer register";
+            }
+            if (*commands + sizeof(int64_t) > commands_end) {
+                return "no valid argument";
+            }
+            memcpy(&instr->ivalue, *commands, sizeof(int64_t));
+            *commands += sizeof(int64_t);
+            return NULL;
+        case READ_IREG:
+            // integer register with address, then register for value
+            if (!decode_iregister(commands, commands_end, &instr->reg1) ||
+                !decode_register(commands, commands_end, &instr->reg2)) {
+                return "no valid register";
+            }
+            return NULL;
+        case WRITE_IREG:
+            // register with value, then integer register with address
+            if (!decode_register(commands, commands_end, &instr->reg1) ||
+                !decode_iregister(commands, commands_end, &instr->reg2)) {
+                return "no valid register";
+            }
+            return NULL;
+        case IJMPL:
+        case IJMPG:
+        case IJMPE:
+            if (!decode_iregister(commands, commands_end, &instr->reg1) ||
+                !decode_iregister(commands, commands_end, &instr->reg2)) {
+                return "no valid integer register";
+            }
+            if (!decode_address(commands, commands_end, JUMP_OPERAND_SIZE, &instr->address)) {
+                return "no jump address";
+            }
+            return NULL;
+        default:
+            return "wrong command";
+    }
+    return NULL;
+}
+
+//! \brief Find decoded instruction by its bytecode offset
+//! \param [in] program Decoded program
+//! \param [in] offset Offset in bytecode
+//! \return Returns instruction index, program->size for offsets after the
+//! program end or -1, if there is no command on this offset
+int
+find_instruction(struct Program *program, int offset)
+{
+    assert(program);
+
+    if (offset < 0) {
+        return -1;
+    }
+    if (offset >= program->bytecode_size) {
+        return program->size;
+    }
+    int left = 0;
+    int right = program->size;
+    while (left < right) {
+        int middle = (left + right) / 2;
+        if (program->code[middle].offset < offset) {
+            left = middle + 1;
+        } else {
+            right = middle;
+        }
+    }
+    if (left < program->size && program->code[left].offset == offset) {
+        return left;
+    }
+    return -1;
+}
+
+//! \brief Decode bytecode into fixed size instructions. All operands are
+//! checked here, so cpu does not need to check them during execution.
+//! \param [in] bytecode Binary program, compact or wide one
+//! \param [in] bytecode_size Size of binary program
+//! \param [out] program Decoded program
+//! \return Returns true if bytecode is valid
+bool
+decode_program(char *bytecode, long bytecode_size, struct Program *program)
+{
+    assert(bytecode);
+    assert(program);
+    assert(bytecode_size > 0);
+
+    long header_size = 0;
+    int operand_size = bytecode_operand_size(bytecode, bytecode_size, &header_size);
+    if (!operand_size) {
+        fprintf(stderr, "CPU error: unknown version of wide bytecode\n");
+        return false;
+    }
+    // instruction indexes and offsets of decoded program are int
+    if (bytecode_size >= INT_MAX) {
+        fprintf(stderr, "CPU error: program has %ld bytes, decoded program can have less than %d\n",
+                bytecode_size, INT_MAX);
+        return false;
+    }
+    bytecode += header_size;
+    bytecode_size -= header_size;
+
+    // each command has at least one byte
+    program->code = (struct Instruction *)calloc(bytecode_size + 1, sizeof(struct Instruction));
+    if (!program->code) {
+        fprintf(stderr, "CPU error: can not allocate memory for program\n");
+        return false;
+    }
+    program->size = 0;
+    program->bytecode_size = bytecode_size;
+    program->regions = NULL;
+    program->regions_num = 0;
+    program->ir = NULL;
+    program->ir_num = 0;
+    program->max_stack = -1;
+    program->max_calls = -1;
+    program->pure = NULL;
+    program->pure_num = 0;
+    program->pure_index = NULL;
+    program->mapped = NULL;
+    program->mapped_size = 0;
+    program->jit = NULL;
+
+    char *commands = bytecode;
+    char *commands_end = bytecode + bytecode_size;
+    while (commands < commands_end) {
+        struct Instruction *instr = program->code + program->size;
+        instr->offset = commands - bytecode;
+        const char *err = decode_command(&commands, commands_end, operand_size, instr);
+        if (err) {
+            fprintf(stderr, "CPU error: %s at address %d\n", err, instr->offset);
+            destroy_program(program);
+            return false;
+        }
+        program->size++;
+    }
+    program->code[program->size].code = END_OF_PROGRAM;
+    program->code[program->size].offset = bytecode_size;
+
+    // jump addresses are bytecode offsets, make them instruction indexes
+    for (int i = 0; i < program->size; i++) {
+        struct Instruction *instr = program->code + i;
+        if (instr->code != JMP && instr->code != JMPL && instr->code != JMPG && instr->code != CALL &&
+            instr->code != SPAWN && instr->code != IJMPL && instr->code != IJMPG && instr->code != IJMPE) {
+            continue;
+        }
+        // all offsets after the program end go to its end
+        long long offset = instr->address < bytecode_size ? instr->address : bytecode_size;
+        int target = offset < 0 ? -1 : find_instruction(program, offset);
+        if (target < 0) {
+            fprintf(stderr, "CPU error: jump to address %lld, which is not a command, at address %d\n",
+                    instr->address, instr->offset);
+            destroy_program(program);
+            return false;
+        }
+        instr->arg = target;
+        instr->address = 0;
+    }
+    return true;
+}
+
+//! \brief Free decoded program or unmap its cache file
+//! \param [in] program Program to destroy
+void
+destroy_program(struct Program *program)
+{
+    assert(program);
+    jit_destroy(program->jit);
+    if (program->mapped) {
+        munmap(program->mapped, program->mapped_size);
+    } else {
+        free(program->code);
+        free(program->regions);
+        free(program->ir);
+        free(program->pure);
+        free(program->pure_index);
+    }
+    program->code = NULL;
+    program->size = 0;
+    program->regions = NULL;
+    program->regions_num = 0;
+    program->ir = NULL;
+    program->ir_num = 0;
+    program->pure = NULL;
+    program->pure_num = 0;
+    program->pure_index = NULL;
+    program->mapped = NULL;
+    program->mapped_size = 0;
+    program->jit = NULL;
+}
+
+//! \brief Find instructions, which can be executed not after the previous one
+//! \param [in] program Decoded program
+//! \return Returns array with program->size + 1 flags (must be freed) or NULL
+bool *
+find_jump_targets(struct Program *program)
+{
+    assert(program);
+
+    bool *is_target = (bool *)calloc(program->size + 1, sizeof(bool));
+    if (!is_target) {
+        fprintf(stderr, "CPU error: can not allocate memory for program\n");
+        return NULL;
+    }
+    for (int i = 0; i < program->size; i++) {
+        int code = program->code[i].code;
+        if (code == JMP || code == JMPL || code == JMPG || code == CALL || code == SPAWN || code == IJMPL ||
+            code == IJMPG || code == IJMPE) {
+            is_target[program->code[i].arg] = true;
+        }
+        if (code == CALL) {
+            is_target[i + 1] = true; // return address
+        }
+    }
+    return is_target;
+}
+
+//! Superinstruction and the sequence of commands it replaces
+struct Fusion
+{
+    int code;
+    int len;
+    int commands[3];
+};
+
+//! \brief Superinstructions, longer first. The set was chosen by the most
+//! often executed pairs of commands on Testing/Tests_Cpu (see 'cpu -f').
+static const struct Fusion fusions[] = {
+    {PUSH_REG_REG_JMPL, 3, {PUSH_REG, PUSH_REG, JMPL}},
+    {PUSH_REG_REG_JMPG, 3, {PUSH_REG, PUSH_REG, JMPG}},
+    {PUSH_REG_VAL_JMPL, 3, {PUSH_REG, PUSH_VAL, JMPL}},
+    {PUSH_REG_VAL_JMPG, 3, {PUSH_REG, PUSH_VAL, JMPG}},
+    {PUSH_REG_PUSH_REG, 2, {PUSH_REG, PUSH_REG}},
+    {PUSH_REG_PUSH_VAL, 2, {PUSH_REG, PUSH_VAL}},
+    {PUSH_VAL_JMPL, 2, {PUSH_VAL, JMPL}},
+    {PUSH_VAL_JMPG, 2, {PUSH_VAL, JMPG}},
+    {PUSH_VAL_ADD, 2, {PUSH_VAL, ADD}},
+    {PUSH_VAL_SUB, 2, {PUSH_VAL, SUB}},
+    {PUSH_VAL_MUL, 2, {PUSH_VAL, MUL}},
+    {PUSH_VAL_DIV, 2, {PUSH_VAL, DIV}},
+    {POP_REG_PUSH_REG, 2, {POP_REG, PUSH_REG}}
+};
+
+//! \brief Replace often sequences of commands with superinstructions.
+//! Sequence is not fused, if somebody can jump into its middle.
+//! \param [in] program Decoded program
+//! \return Returns number of created superinstructions or -1 on error
+int
+fuse_program(struct Program *program)
+{
+    assert(program);
+
+    bool *is_target = find_jump_targets(program);
+    if (!is_target) {
+        return -1;
+    }
+
+    int fused = 0;
+    int i = 0;
+    while (i < program->size) {
+        int len = 1;
+        for (unsigned f = 0; f < sizeof(fusions) / sizeof(fusions[0]); f++) {
+            bool match = i + fusions[f].len <= program->size;
+            for (int j = 0; match && j < fusions[f].len; j++) {
+                match = program->code[i + j].code == fusions[f].commands[j] &&
+                        (j == 0 || !is_target[i + j]);
+            }
+            if (match) {
+                program->code[i].code = fusions[f].code;
+                len = fusions[f].len;
+                fused++;
+                break;
+            }
+        }
+        i += len;
+    }
+    free(is_target);
+    return fused;
+}
@@ -0,0 +1,275 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cinttypes>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu.h"
+#include "program.h"
+#include "regir.h"
+#include "memo.h"
+#include "checkpoint.h"
+#include "program_cache.h"
+
+//! \brief Round offset up to PROGRAM_CACHE_ALIGN
+static long
+align_offset(long offset)
+{
+    return (offset + PROGRAM_CACHE_ALIGN - 1) / PROGRAM_CACHE_ALIGN * PROGRAM_CACHE_ALIGN;
+}
+
+//! \brief Make name of cache file
+//! \param [out] path Buffer of PROGRAM_CACHE_PATH_SIZE bytes
+//! \return Returns false, if name is too long
+static bool
+cache_path(char *path, const char *dir, uint64_t hash, long binary_size, int flags)
+{
+    return snprintf(path, PROGRAM_CACHE_PATH_SIZE, "%s/%016" PRIx64 "-%ld-%x.prog", dir, hash, binary_size,
+                    flags) < PROGRAM_CACHE_PATH_SIZE;
+}
+
+//! \brief Fill sizes of structures, which are kept in cache file
+static void
+set_struct_sizes(int32_t *struct_sizes)
+{
+    struct_sizes[CACHE_CODE] = sizeof(struct Instruction);
+    struct_sizes[CACHE_REGIONS] = sizeof(struct Region);
+    struct_sizes[CACHE_IR] = sizeof(struct Ir_Op);
+    struct_sizes[CACHE_PURE] = sizeof(struct Pure_Function);
+    struct_sizes[CACHE_PURE_INDEX] = sizeof(int);
+}
+
+//! \brief Hash header of cache file, header_hash is taken as 0
+static uint64_t
+cache_header_hash(const struct Program_Cache_Header *header)
+{
+    struct Program_Cache_Header copy;
+    memcpy(&copy, header, sizeof(copy));
+    copy.header_hash = 0;
+    return program_hash((const char *)&copy, sizeof(copy));
+}
+
+//! \brief Hash arrays of cache file. Four lanes take 64-bit words at once,
+//! so it is several times faster than program_hash() byte by byte and
+//! mapping stays much cheaper than preparing program again.
+//! \param [in] data Arrays after header, 8-byte aligned
+//! \param [in] size Size of arrays
+//! \return Returns hash
+static uint64_t
+cache_data_hash(const char *data, long size)
+{
+    const uint64_t prime = 0x100000001B3ull;
+    uint64_t lanes[4] = {0xCBF29CE484222325ull, 0x84222325CBF29CE4ull, 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full};
+    long words = size / sizeof(uint64_t);
+    long i = 0;
+    for (; i + 4 <= words; i += 4) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word = 0;
+            memcpy(&word, data + (i + lane) * sizeof(word), sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * prime;
+        }
+    }
+    for (; i < words; i++) {
+        uint64_t word = 0;
+        memcpy(&word, data + i * sizeof(word), sizeof(word));
+        lanes[0] = (lanes[0] ^ word) * prime;
+    }
+    for (long j = words * sizeof(uint64_t); j < size; j++) {
+        lanes[1] = (lanes[1] ^ (unsigned char)data[j]) * prime;
+    }
+    return program_hash((const char *)lanes, sizeof(lanes)) ^ (uint64_t)size;
+}
+
+//! \brief Find places of arrays in cache file
+//! \param [in] header Header with checked numbers of elements
+//! \param [out] offsets Offsets of arrays from the beginning of file
+//! \param [out] sizes Sizes of arrays in bytes
+//! \return Returns size of file
+static long
+cache_layout(const struct Program_Cache_Header *header, long *offsets, long *sizes)
+{
+    sizes[CACHE_CODE] = (header->size + 1L) * sizeof(struct Instruction);
+    sizes[CACHE_REGIONS] = (long)header->regions_num * sizeof(struct Region);
+    sizes[CACHE_IR] = (long)header->ir_num * sizeof(struct Ir_Op);
+    sizes[CACHE_PURE] = (long)header->pure_num * sizeof(struct Pure_Function);
+    sizes[CACHE_PURE_INDEX] = (long)header->pure_index_num * sizeof(int);
+    long offset = sizeof(*header);
+    for (int i = 0; i < CACHE_SECTIONS_NUM; i++) {
+        offsets[i] = offset = align_offset(offset);
+        offset += sizes[i];
+    }
+    return offset;
+}
+
+//! \brief Map prepared program from cache directory. Arrays of program
+//! point into private pages of the file, destroy_program() unmaps it.
+//! Missing file, file of another program, format or build and damaged file
+//! are not used, the caller prepares program again and saves it.
+//! \param [in] dir Cache directory
+//! \param [in] hash Hash of binary program, see program_hash()
+//! \param [in] binary_size Size of binary program
+//! \param [in] flags How program is prepared, see PROGRAM_CACHE_FLAGS
+//! \param [out] program Prepared program
+//! \return Returns true, if program is taken from cache
+bool
+map_program_cache(const char *dir, uint64_t hash, long binary_size, int flags, struct Program *program)
+{
+    assert(dir);
+    assert(program);
+
+    char path[PROGRAM_CACHE_PATH_SIZE];
+    if (!cache_path(path, dir, hash, binary_size, flags)) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || file_stat.st_size < (off_t)sizeof(struct Program_Cache_Header) ||
+        file_stat.st_size > INT_MAX) {
+        close(fd);
+        return false;
+    }
+    long file_size = file_stat.st_size;
+    void *data = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    char *file = (char *)data;
+    struct Program_Cache_Header *header = (struct Program_Cache_Header *)file;
+    int32_t struct_sizes[CACHE_SECTIONS_NUM];
+    set_struct_sizes(struct_sizes);
+    long offsets[CACHE_SECTIONS_NUM];
+    long sizes[CACHE_SECTIONS_NUM];
+    bool ok = !memcmp(header->magic, PROGRAM_CACHE_MAGIC, sizeof(header->magic)) &&
+              header->version == PROGRAM_CACHE_VERSION && header->flags == flags &&
+              !memcmp(header->struct_sizes, struct_sizes, sizeof(struct_sizes)) &&
+              header->program_hash == hash && header->file_size == binary_size &&
+              header->bytecode_size >= 0 && header->bytecode_size <= binary_size && header->size >= 0 &&
+              header->size <= header->bytecode_size && header->regions_num >= 0 &&
+              header->ir_num >= 0 && header->pure_num >= 0 &&
+              (header->pure_index_num == 0 || header->pure_index_num == header->size + 1) &&
+              cache_layout(header, offsets, sizes) == file_size &&
+              header->header_hash == cache_header_hash(header) &&
+              header->data_hash == cache_data_hash(file + sizeof(*header), file_size - sizeof(*header));
+    if (!ok) {
+        munmap(data, file_size);
+        return false;
+    }
+    program->code = (struct Instruction *)(file + offsets[CACHE_CODE]);
+    program->size = header->size;
+    program->bytecode_size = header->bytecode_size;
+    program->regions = (struct Region *)(file + offsets[CACHE_REGIONS]);
+    program->regions_num = header->regions_num;
+    program->ir = (struct Ir_Op *)(file + offsets[CACHE_IR]);
+    program->ir_num = header->ir_num;
+    program->max_stack = header->max_stack;
+    program->max_calls = header->max_calls;
+    program->pure = (struct Pure_Function *)(file + offsets[CACHE_PURE]);
+    program->pure_num = header->pure_num;
+    program->pure_index = header->pure_index_num ? (int *)(file + offsets[CACHE_PURE_INDEX]) : NULL;
+    program->mapped = file;
+    program->mapped_size = file_size;
+    program->jit = NULL;
+    return true;
+}
+
+//! \brief Save prepared program into cache directory, directory is created,
+//! if it does not exist. File is written under temporary name and renamed,
+//! so other processes see either the whole file or no file.
+//! \param [in] dir Cache directory
+//! \param [in] hash Hash of binary program, see program_hash()
+//! \param [in] binary_size Size of binary program
+//! \param [in] flags How program is prepared, see PROGRAM_CACHE_FLAGS
+//! \param [in] program Prepared program, which is not mapped from cache
+//! \return Returns true if program is saved
+bool
+save_program_cache(const char *dir, uint64_t hash, long binary_size, int flags, struct Program *program)
+{
+    assert(dir);
+    assert(program);
+
+    char path[PROGRAM_CACHE_PATH_SIZE];
+    char tmp_path[PROGRAM_CACHE_PATH_SIZE];
+    if (!cache_path(path, dir, hash, binary_size, flags) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "Program cache error: too long directory name %s\n", dir);
+        return false;
+    }
+
+    struct Program_Cache_Header header = {};
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PROGRAM_CACHE_VERSION;
+    header.flags = flags;
+    set_struct_sizes(header.struct_sizes);
+    header.program_hash = hash;
+    header.file_size = binary_size;
+    header.bytecode_size = program->bytecode_size;
+    header.size = program->size;
+    header.regions_num = program->regions_num;
+    header.ir_num = program->ir_num;
+    header.pure_num = program->pure_num;
+    header.pure_index_num = program->pure_index ? program->size + 1 : 0;
+    header.max_stack = program->max_stack;
+    header.max_calls = program->max_calls;
+    long offsets[CACHE_SECTIONS_NUM];
+    long sizes[CACHE_SECTIONS_NUM];
+    long file_size = cache_layout(&header, offsets, sizes);
+    if (file_size > INT_MAX) {
+        return false;
+    }
+    const void *arrays[CACHE_SECTIONS_NUM] = {program->code, program->regions, program->ir, program->pure,
+                                              program->pure_index};
+
+    // the whole file is made in memory to hash it
+    char *data = (char *)calloc(file_size, 1);
+    if (!data) {
+        fprintf(stderr, "Program cache error: can not allocate memory for file %s\n", path);
+        return false;
+    }
+    for (int i = 0; i < CACHE_SECTIONS_NUM; i++) {
+        if (sizes[i]) {
+            memcpy(data + offsets[i], arrays[i], sizes[i]);
+        }
+    }
+    header.data_hash = cache_data_hash(data + sizeof(header), file_size - sizeof(header));
+    memcpy(data, &header, sizeof(header));
+    uint64_t header_hash = cache_header_hash((struct Program_Cache_Header *)data);
+    memcpy(data + offsetof(struct Program_Cache_Header, header_hash), &header_hash, sizeof(header_hash));
+
+    if (mkdir(dir, 0777) && errno != EEXIST) {
+        fprintf(stderr, "Program cache error: can not create directory %s: %s\n", dir, strerror(errno));
+        free(data);
+        return false;
+    }
+    int fd = mkstemp(tmp_path);
+    FILE *out = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!out) {
+        fprintf(stderr, "Program cache error: can not open file %s: %s\n", tmp_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(data);
+        return false;
+    }
+    bool ok = fwrite(data, 1, file_size, out) == (size_t)file_size;
+    ok = !fclose(out) && ok;
+    free(data);
+    if (!ok || rename(tmp_path, path)) {
+        fprintf(stderr, "Program cache error: can not write file %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
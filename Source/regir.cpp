@@ -0,0 +1,264 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include "cpu.h"
+#include "program.h"
+#include "regir.h"
+
+//! \brief Translation context of one region: symbolic cpu stack and registers
+struct Translation
+{
+    struct Ir_Op ops[REGION_MAX_VREGS + REGION_MAX_LEN + REG_NUMBER + 1];
+    int ops_num;
+    int stack[REGION_MAX_LEN];  // virtual registers, which are on cpu stack
+    int stack_size;
+    int regs[REG_NUMBER];       // virtual register for each cpu register or -1
+    bool regs_changed[REG_NUMBER];
+    int need;                   // values taken from cpu stack
+    int vregs_num;
+};
+
+//! \brief Check, if command works only with cpu stack and registers and can
+//! not change the order of execution
+static bool
+is_region_command(int code)
+{
+    switch (code) {
+        case PUSH_REG:
+        case PUSH_VAL:
+        case POP_REG:
+        case POP_VAL:
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case SQRT:
+            return true;
+        default:
+            return false;
+    }
+    return false;
+}
+
+//! \brief Add operation into translation
+//! \return Returns operation index
+static int
+emit(struct Translation *tr, int op, int dst, int a, int b, double value)
+{
+    assert(tr->ops_num < (int)(sizeof(tr->ops) / sizeof(tr->ops[0])));
+    struct Ir_Op *ir_op = tr->ops + tr->ops_num;
+    ir_op->op = op;
+    ir_op->dst = dst;
+    ir_op->a = a;
+    ir_op->b = b;
+    ir_op->value = value;
+    return tr->ops_num++;
+}
+
+//! \brief Take value from symbolic stack. If it is empty, value comes from
+//! cpu stack, which was before the region.
+//! \return Returns virtual register with value
+static int
+pop_value(struct Translation *tr)
+{
+    if (tr->stack_size > 0) {
+        return tr->stack[--tr->stack_size];
+    }
+    int vreg = tr->vregs_num++;
+    emit(tr, IR_LOAD_STACK, vreg, tr->need, 0, 0);
+    tr->need++;
+    return vreg;
+}
+
+//! \brief Translate binary operation
+static void
+translate_binary(struct Translation *tr, int op)
+{
+    int a = pop_value(tr);
+    int b = pop_value(tr);
+    int vreg = tr->vregs_num++;
+    emit(tr, op, vreg, a, b, 0);
+    tr->stack[tr->stack_size++] = vreg;
+}
+
+//! \brief Translate commands into register IR
+//! \param [in] instr First command
+//! \param [in] len Number of region commands without final jump
+//! \param [in] branch Final jump command (JMPL, JMPG) or 0
+//! \param [out] tr Translation result
+static void
+translate(struct Instruction *instr, int len, int branch, struct Translation *tr)
+{
+    tr->ops_num = 0;
+    tr->stack_size = 0;
+    tr->need = 0;
+    tr->vregs_num = 0;
+    for (int r = 0; r < REG_NUMBER; r++) {
+        tr->regs[r] = -1;
+        tr->regs_changed[r] = false;
+    }
+
+    int vreg = 0;
+    for (int i = 0; i < len; i++, instr++) {
+        switch (instr->code) {
+            case PUSH_REG:
+                if (tr->regs[instr->reg1] < 0) {
+                    tr->regs[instr->reg1] = tr->vregs_num++;
+                    emit(tr, IR_LOAD_REG, tr->regs[instr->reg1], instr->reg1, 0, 0);
+                }
+                tr->stack[tr->stack_size++] = tr->regs[instr->reg1];
+                break;
+            case PUSH_VAL:
+                vreg = tr->vregs_num++;
+                emit(tr, IR_CONST, vreg, 0, 0, instr->value);
+                tr->stack[tr->stack_size++] = vreg;
+                break;
+            case POP_REG:
+                tr->regs[instr->reg1] = pop_value(tr);
+                tr->regs_changed[instr->reg1] = true;
+                break;
+            case POP_VAL:
+                if (tr->stack_size > 0) {
+                    tr->stack_size--;
+                } else {
+                    tr->need++;
+                }
+                break;
+            case ADD:
+                translate_binary(tr, IR_ADD);
+                break;
+            case SUB:
+                translate_binary(tr, IR_SUB);
+                break;
+            case MUL:
+                translate_binary(tr, IR_MUL);
+                break;
+            case DIV:
+                translate_binary(tr, IR_DIV);
+                break;
+            case SQRT:
+                vreg = tr->vregs_num++;
+                emit(tr, IR_SQRT, vreg, pop_value(tr), 0, 0);
+                tr->stack[tr->stack_size++] = vreg;
+                break;
+            default:
+                assert(0);
+                break;
+        }
+    }
+
+    int branch_a = 0, branch_b = 0;
+    if (branch) {
+        branch_a = pop_value(tr);
+        branch_b = pop_value(tr);
+    }
+    // commit part
+    for (int i = 0; i < tr->stack_size; i++) {
+        emit(tr, IR_PUSH, 0, tr->stack[i], 0, 0);
+    }
+    for (int r = 0; r < REG_NUMBER; r++) {
+        if (tr->regs_changed[r]) {
+            emit(tr, IR_SET_REG, r, tr->regs[r], 0, 0);
+        }
+    }
+    if (branch) {
+        emit(tr, branch == JMPL ? IR_JMPL : IR_JMPG, instr->arg, branch_a, branch_b, 0);
+    }
+}
+
+//! \brief Save translated region into program
+//! \return Returns true if success
+static bool
+add_region(struct Program *program, struct Translation *tr, struct Region *region)
+{
+    struct Region *regions = (struct Region *)realloc(program->regions,
+                                                       (program->regions_num + 1) * sizeof(struct Region));
+    if (!regions) {
+        return false;
+    }
+    program->regions = regions;
+    struct Ir_Op *ir = (struct Ir_Op *)realloc(program->ir, (program->ir_num + tr->ops_num) * sizeof(struct Ir_Op));
+    if (!ir) {
+        return false;
+    }
+    program->ir = ir;
+
+    region->ops_begin = program->ir_num;
+    region->compute_num = 0;
+    for (int i = 0; i < tr->ops_num; i++) {
+        if (tr->ops[i].op < IR_PUSH) {
+            region->compute_num++;
+        }
+        program->ir[program->ir_num++] = tr->ops[i];
+    }
+    region->commit_num = tr->ops_num - region->compute_num;
+    region->need = tr->need;
+    program->regions[program->regions_num++] = *region;
+    return true;
+}
+
+//! \brief Translate straight sequences of stack commands into register IR.
+//! Region has no jump targets inside, so it is always executed from the
+//! beginning, and may end with conditional jump.
+//! Must be called before fuse_program(), because it needs original commands.
+//! \param [in] program Decoded program
+//! \return Returns number of created regions or -1 on error
+int
+build_regions(struct Program *program)
+{
+    assert(program);
+
+    bool *is_target = find_jump_targets(program);
+    if (!is_target) {
+        return -1;
+    }
+    struct Translation *tr = (struct Translation *)calloc(1, sizeof(*tr));
+    if (!tr) {
+        free(is_target);
+        fprintf(stderr, "CPU error: can not allocate memory for program\n");
+        return -1;
+    }
+
+    int i = 0;
+    while (i < program->size) {
+        if (!is_region_command(program->code[i].code)) {
+            i++;
+            continue;
+        }
+        int len = 1;
+        while (len < REGION_MAX_LEN && i + len < program->size &&
+               is_region_command(program->code[i + len].code) && !is_target[i + len]) {
+            len++;
+        }
+        int branch = 0;
+        int end = i + len;
+        if (end < program->size && !is_target[end] &&
+            (program->code[end].code == JMPL || program->code[end].code == JMPG)) {
+            branch = program->code[end].code;
+            end++;
+        }
+        if (end - i < 2) {
+            i = end;
+            continue;
+        }
+
+        translate(program->code + i, len, branch, tr);
+        struct Region region;
+        region.code = program->code[i].code;
+        region.len = end - i;
+        region.next = end;
+        if (!add_region(program, tr, &region)) {
+            fprintf(stderr, "CPU error: can not allocate memory for program\n");
+            free(tr);
+            free(is_target);
+            return -1;
+        }
+        program->code[i].code = REGION;
+        program->code[i].arg = program->regions_num - 1;
+        i = end;
+    }
+    free(tr);
+    free(is_target);
+    return program->regions_num;
+}
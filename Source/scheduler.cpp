@@ -0,0 +1,255 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <climits>
+#include <ctime>
+#include <pthread.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "scheduler.h"
+#include "fork.h"
+
+//! \brief Run queue of virtual machines. Machine is taken from the head for
+//! one quantum and goes to the tail, if it is not finished, so every
+//! machine gets host thread after all the others got it once.
+struct Run_Queue
+{
+    int *tenants;       // ring of tenant indexes, every tenant is there at most once
+    int capacity;
+    int head;
+    int size;
+    int running;        // machines taken by host threads now
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+//! \brief Arguments of host thread
+struct Scheduler_Thread
+{
+    pthread_t thread;
+    struct Run_Queue *queue;
+    struct Tenant *tenants;
+    Tenant_Engine run;
+    const struct Tenant_Limits *limits;
+};
+
+//! \brief Init virtual machine with its own cpu and memory
+//! \param [in] tenant Machine to init
+//! \param [in] program Decoded program
+//! \param [in] name Name for report
+//! \param [in] memory_size Memory cells or 0 for memory bars of usual cpu
+//! \return Returns false, if memory can not be allocated
+bool
+init_tenant(struct Tenant *tenant, struct Program *program, const char *name, long long memory_size)
+{
+    assert(tenant);
+    assert(program);
+
+    init(&tenant->cpu);
+    tenant->program = program;
+    tenant->name = name;
+    tenant->quanta = 0;
+    tenant->seconds = 0;
+    tenant->limit = NULL;
+    tenant->failed = false;
+    init_memory_controller(&tenant->mc);
+    tenant->mem1.memory = NULL;
+    tenant->mem2.memory = NULL;
+    if (memory_size > 0) {
+        return !init_memory(&tenant->mem1, memory_size) && !add_memory(&tenant->mc, &tenant->mem1);
+    }
+    return !init_memory(&tenant->mem1, 10) && !init_memory(&tenant->mem2, 5) &&
+           !add_memory(&tenant->mc, &tenant->mem1) && !add_memory(&tenant->mc, &tenant->mem2);
+}
+
+//! \brief Free cpu and memory of virtual machine
+void
+destroy_tenant(struct Tenant *tenant)
+{
+    assert(tenant);
+
+    destroy_cpu(&tenant->cpu);
+    free(tenant->mem1.memory);
+    free(tenant->mem2.memory);
+    free(tenant->mc.memory);
+}
+
+//! \brief Host thread time in seconds
+static double
+get_thread_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! \brief Run virtual machine for one quantum, engine pauses cpu at the first
+//! jump, call or ret after quantum or command limit and after call, which
+//! exceeds call depth limit
+//! \return Returns true, if machine must be run again; machine, which is
+//! blocked at in command (see --listen), is not failed and goes on later
+bool
+run_quantum(struct Tenant *tenant, Tenant_Engine run, const struct Tenant_Limits *limits)
+{
+    struct Cpu *cpu = &tenant->cpu;
+    long long pause_at = limits->quantum > 0 ? cpu->executed + limits->quantum : LLONG_MAX;
+    if (limits->max_commands > 0 && pause_at > limits->max_commands) {
+        pause_at = limits->max_commands;
+    }
+    cpu->pause_at = pause_at;
+    cpu->max_calls = limits->max_calls > 0 ? limits->max_calls : INT_MAX;
+    double start = get_thread_time();
+    bool result = run(tenant->program, cpu, &tenant->mc);
+    if (cpu->state != PAUSED) {
+        // children without pool run in this host thread
+        result = fork_join_rest(cpu) && result;
+    }
+    tenant->seconds += get_thread_time() - start;
+    tenant->quanta++;
+    if (!result) {
+        tenant->failed = true;
+        return false;
+    }
+    if (cpu->state != PAUSED) {
+        return false;
+    }
+    // limits are checked, when machine yields, engine pauses it at once
+    // after call deeper than limit
+    int *ret = NULL;
+    if (limits->max_commands > 0 && cpu->executed >= limits->max_commands) {
+        tenant->limit = "commands";
+    } else if (limits->max_calls > 0 && get_ret_stack(cpu, &ret) > limits->max_calls) {
+        tenant->limit = "call depth";
+    }
+    if (tenant->limit) {
+        fprintf(stderr, "CPU error: %s limit is exceeded\n", tenant->limit);
+        cpu->state = WAIT;
+        tenant->failed = true;
+        return false;
+    }
+    return true;
+}
+
+//! \brief Host thread: take machines from run queue, until all are finished
+static void *
+run_scheduler_thread(void *arg)
+{
+    struct Scheduler_Thread *thread = (struct Scheduler_Thread *)arg;
+    struct Run_Queue *queue = thread->queue;
+    pthread_mutex_lock(&queue->lock);
+    while (true) {
+        while (!queue->size && queue->running) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        if (!queue->size) {
+            break;
+        }
+        int index = queue->tenants[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->size--;
+        queue->running++;
+        pthread_mutex_unlock(&queue->lock);
+
+        bool again = run_quantum(&thread->tenants[index], thread->run, thread->limits);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->running--;
+        if (again) {
+            queue->tenants[(queue->head + queue->size) % queue->capacity] = index;
+            queue->size++;
+        }
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+//! \brief Run virtual machines on host threads, every one for a quantum at a
+//! time, until all of them are finished
+//! \param [in] tenants Machines to run
+//! \param [in] tenants_num Number of machines
+//! \param [in] threads_num Number of host threads
+//! \param [in] run Interpreter loop
+//! \param [in] limits Limits of every machine
+//! \return Returns true, if all machines finished without errors
+bool
+run_scheduler(struct Tenant *tenants, int tenants_num, int threads_num, Tenant_Engine run,
+              const struct Tenant_Limits *limits)
+{
+    assert(tenants);
+    assert(run);
+    assert(limits);
+    assert(threads_num > 0);
+
+    struct Run_Queue queue;
+    queue.tenants = (int *)calloc(tenants_num + 1, sizeof(int));
+    struct Scheduler_Thread *threads = (struct Scheduler_Thread *)calloc(threads_num, sizeof(struct Scheduler_Thread));
+    if (!queue.tenants || !threads) {
+        fprintf(stderr, "Can not allocate memory for scheduler\n");
+        free(queue.tenants);
+        free(threads);
+        return false;
+    }
+    for (int i = 0; i < tenants_num; i++) {
+        queue.tenants[i] = i;
+    }
+    queue.capacity = tenants_num + 1;
+    queue.head = 0;
+    queue.size = tenants_num;
+    queue.running = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+
+    int started = 0;
+    for (int i = 0; i < threads_num; i++) {
+        threads[i].queue = &queue;
+        threads[i].tenants = tenants;
+        threads[i].run = run;
+        threads[i].limits = limits;
+        // the first thread is the calling one
+        if (i > 0 && pthread_create(&threads[i].thread, NULL, run_scheduler_thread, &threads[i])) {
+            fprintf(stderr, "Can not start host thread %d, %d threads are used\n", i, started + 1);
+            break;
+        }
+        started++;
+    }
+    run_scheduler_thread(&threads[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.changed);
+    free(queue.tenants);
+    free(threads);
+
+    bool ok = true;
+    for (int i = 0; i < tenants_num; i++) {
+        ok = ok && !tenants[i].failed;
+    }
+    return ok;
+}
+
+//! \brief Print accounting of every virtual machine into stderr
+//! \param [in] tenants Finished machines
+//! \param [in] tenants_num Number of machines
+void
+print_tenants(struct Tenant *tenants, int tenants_num)
+{
+    assert(tenants);
+
+    long long executed = 0;
+    double seconds = 0;
+    fprintf(stderr, "%6s %14s %10s %12s %-12s program\n", "vm", "commands", "quanta", "seconds", "state");
+    for (int i = 0; i < tenants_num; i++) {
+        struct Tenant *tenant = tenants + i;
+        const char *state = tenant->limit ? tenant->limit : tenant->failed ? "error" : "finished";
+        fprintf(stderr, "%6d %14lld %10lld %12.6lf %-12s %s\n", i, tenant->cpu.executed, tenant->quanta,
+                tenant->seconds, state, tenant->name);
+        executed += tenant->cpu.executed;
+        seconds += tenant->seconds;
+    }
+    fprintf(stderr, "%d virtual machines executed %lld commands in %lf s of host threads\n", tenants_num,
+            executed, seconds);
+}
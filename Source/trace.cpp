@@ -0,0 +1,65 @@
+#include <cstring>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+//! \brief Write the whole buffer into file descriptor
+//! \return Returns false, if write fails
+static bool
+write_all(int fd, const void *data, long size)
+{
+    const char *bytes = (const char *)data;
+    while (size > 0) {
+        ssize_t res = write(fd, bytes, size);
+        if (res <= 0) {
+            return false;
+        }
+        bytes += res;
+        size -= res;
+    }
+    return true;
+}
+
+//! \brief Write the last records of every cpu into file. It uses only
+//! async-signal-safe calls, so it can be called from signal handler while
+//! cpus are working.
+//! \param [in] file Trace file
+//! \param [in] traces Trace buffers of cpus
+//! \param [in] traces_num Number of cpus
+//! \param [in] bytecode_size Size of binary program
+//! \return Returns true if trace is written
+bool
+dump_traces(const char *file, struct Trace **traces, int traces_num, int bytecode_size)
+{
+    assert(file);
+    assert(traces);
+
+    struct Trace_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.bytecode_size = bytecode_size;
+    header.records_num = 0;
+
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // header is written again at the end, when number of records is known
+    bool ok = write_all(fd, &header, sizeof(header));
+    for (int i = 0; ok && i < traces_num; i++) {
+        int64_t head = __atomic_load_n(&traces[i]->head, __ATOMIC_ACQUIRE);
+        // the oldest record is at head, if buffer is full, its end goes first
+        int end = head & (TRACE_RECORDS_NUM - 1);
+        if (head >= TRACE_RECORDS_NUM) {
+            ok = write_all(fd, traces[i]->records + end, (TRACE_RECORDS_NUM - end) * sizeof(struct Trace_Record));
+            header.records_num += TRACE_RECORDS_NUM - end;
+        }
+        ok = ok && write_all(fd, traces[i]->records, end * sizeof(struct Trace_Record));
+        header.records_num += end;
+    }
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    return !close(fd) && ok;
+}
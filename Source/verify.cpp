@@ -0,0 +1,239 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cassert>
+
+#include "cpu.h"
+#include "program.h"
+#include "verify.h"
+
+//! \brief Call chain: return address and the chain of the caller
+struct Call
+{
+    int parent;     // index in calls, -1 for the program itself
+    int ret;        // return instruction
+    int depth;      // number of nested calls
+};
+
+//! \brief Abstract cpu state: instruction, cpu stack depth and call chain
+struct Verify_State
+{
+    int ip;
+    int depth;
+    int call;       // index in calls or -1
+};
+
+//! \brief Verification context
+struct Verifier
+{
+    struct Program *program;
+    struct Call *calls;
+    int calls_num;
+    uint64_t *visited;      // open addressing set of states, 0 - free cell
+    int visited_size;
+    int visited_num;
+    struct Verify_State *work;
+    int work_num;
+    int max_stack;
+    int max_calls;
+};
+
+//! Bits for each field of state key
+constexpr int STATE_KEY_BITS = 21;
+
+//! \brief Pack state into nonzero key
+static uint64_t
+state_key(struct Verify_State *state)
+{
+    return ((uint64_t)1 << 63) | ((uint64_t)state->ip << (2 * STATE_KEY_BITS)) |
+           ((uint64_t)state->depth << STATE_KEY_BITS) | (uint64_t)(state->call + 1);
+}
+
+//! \brief Add key into visited set
+//! \return Returns 1 if key is new, 0 if it was visited and -1 on error
+static int
+visit(struct Verifier *v, uint64_t key)
+{
+    if (2 * (v->visited_num + 1) > v->visited_size) {
+        int old_size = v->visited_size;
+        uint64_t *old = v->visited;
+        v->visited_size = old_size ? old_size * 2 : 1024;
+        v->visited = (uint64_t *)calloc(v->visited_size, sizeof(uint64_t));
+        if (!v->visited) {
+            v->visited = old;
+            v->visited_size = old_size;
+            return -1;
+        }
+        v->visited_num = 0;
+        for (int i = 0; i < old_size; i++) {
+            if (old[i]) {
+                visit(v, old[i]);
+            }
+        }
+        free(old);
+    }
+    int i = (int)((key * 0x9E3779B97F4A7C15ull) >> 40) & (v->visited_size - 1);
+    while (v->visited[i]) {
+        if (v->visited[i] == key) {
+            return 0;
+        }
+        i = (i + 1) & (v->visited_size - 1);
+    }
+    v->visited[i] = key;
+    v->visited_num++;
+    return 1;
+}
+
+//! \brief Add state to check, if it was not checked yet
+//! \return Returns false if there are too many states
+static bool
+add_state(struct Verifier *v, int ip, int depth, int call)
+{
+    if (depth > VERIFY_MAX_DEPTH || v->visited_num >= VERIFY_MAX_STATES) {
+        return false;
+    }
+    struct Verify_State state = {ip, depth, call};
+    int visited = visit(v, state_key(&state));
+    if (visited <= 0) {
+        return visited == 0;
+    }
+    if (depth > v->max_stack) {
+        v->max_stack = depth;
+    }
+    v->work[v->work_num++] = state;
+    return true;
+}
+
+//! \brief Find or create call chain
+//! \return Returns index in calls or -1, if calls are too deep
+static int
+enter_call(struct Verifier *v, int parent, int ret)
+{
+    for (int i = 0; i < v->calls_num; i++) {
+        if (v->calls[i].parent == parent && v->calls[i].ret == ret) {
+            return i;
+        }
+    }
+    int depth = parent < 0 ? 1 : v->calls[parent].depth + 1;
+    if (depth > VERIFY_MAX_CALL_DEPTH || v->calls_num >= VERIFY_MAX_CALLS) {
+        return -1;
+    }
+    v->calls[v->calls_num].parent = parent;
+    v->calls[v->calls_num].ret = ret;
+    v->calls[v->calls_num].depth = depth;
+    if (depth > v->max_calls) {
+        v->max_calls = depth;
+    }
+    return v->calls_num++;
+}
+
+//! \brief Check one state and add the next ones
+//! \return Returns false, if program can not be verified
+static bool
+step(struct Verifier *v, struct Verify_State *state)
+{
+    struct Instruction *instr = v->program->code + state->ip;
+    int next = state->ip + 1;
+    int depth = state->depth;
+    switch (instr->code) {
+        case HLT:
+        case END_OF_PROGRAM:
+            return true;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+            return depth >= 2 && add_state(v, next, depth - 1, state->call);
+        case SQRT:
+        case OUT:
+            return depth >= 1 && add_state(v, next, depth, state->call);
+        case PUSH_REG:
+        case PUSH_VAL:
+        case PUSH_IREG:
+        case IN:
+        case CAS:
+            return add_state(v, next, depth + 1, state->call);
+        case POP_REG:
+        case POP_VAL:
+        case POP_IREG:
+            return depth >= 1 && add_state(v, next, depth - 1, state->call);
+        case IN_REG:
+        case OUT_REG:
+        case READ_REG:
+        case READ_ADDR:
+        case WRITE_REG:
+        case WRITE_ADDR:
+        case XADD:
+        case FENCE:
+        case CPUID:
+        case CPUNUM:
+        case SNAP:
+        case READ_IREG:
+        case WRITE_IREG:
+        case IMOV_REG:
+        case IMOV_VAL:
+        case IADD_REG:
+        case IADD_VAL:
+        case ISUB_REG:
+        case ISUB_VAL:
+        case IMUL_REG:
+        case IMUL_VAL:
+            return add_state(v, next, depth, state->call);
+        case JMP:
+            return add_state(v, instr->arg, depth, state->call);
+        case JMPL:
+        case JMPG:
+            return depth >= 2 && add_state(v, instr->arg, depth - 2, state->call) &&
+                   add_state(v, next, depth - 2, state->call);
+        case IJMPL:
+        case IJMPG:
+        case IJMPE:
+            return add_state(v, instr->arg, depth, state->call) && add_state(v, next, depth, state->call);
+        case CALL: {
+            int call = enter_call(v, state->call, next);
+            return call >= 0 && add_state(v, instr->arg, depth, call);
+        }
+        case RET:
+            return state->call >= 0 &&
+                   add_state(v, v->calls[state->call].ret, depth, v->calls[state->call].parent);
+        default:
+            // superinstructions and regions are not verified
+            return false;
+    }
+    return false;
+}
+
+//! \brief Prove, that cpu stack and return stack never underflow and find
+//! their maximum depth. Every possible path is checked, so the program is
+//! not verified, if it has unbounded recursion or growing stack in a loop.
+//! Must be called before fuse_program() and build_regions().
+//! \param [in] program Decoded program, its max_stack and max_calls are set
+//! \return Returns true if program is verified
+bool
+verify_program(struct Program *program)
+{
+    assert(program);
+
+    program->max_stack = -1;
+    program->max_calls = -1;
+    if (program->size >= (1 << STATE_KEY_BITS)) {
+        return false;
+    }
+    struct Verifier v = {};
+    v.program = program;
+    v.calls = (struct Call *)calloc(VERIFY_MAX_CALLS, sizeof(struct Call));
+    v.work = (struct Verify_State *)calloc(VERIFY_MAX_STATES, sizeof(struct Verify_State));
+    bool verified = v.calls && v.work && add_state(&v, 0, 0, -1);
+    while (verified && v.work_num > 0) {
+        struct Verify_State state = v.work[--v.work_num];
+        verified = step(&v, &state);
+    }
+    free(v.calls);
+    free(v.work);
+    free(v.visited);
+    if (verified) {
+        program->max_stack = v.max_stack;
+        program->max_calls = v.max_calls;
+    }
+    return verified;
+}
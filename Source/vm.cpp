@@ -0,0 +1,288 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <climits>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "cpu_io.h"
+#include "fork.h"
+#include "cpu_main.h"
+#include "vm.h"
+
+//! \brief Allocate cpu, stacks and memory of virtual machine
+//! \param [in] vm Machine to init
+//! \param [in] memory_size Memory cells
+//! \param [in] stack_size Values of cpu stack, which are allocated beforehand
+//! \param [in] ret_size Return addresses, which are allocated beforehand
+//! \return Returns false, if memory can not be allocated
+bool
+init_vm(struct Vm *vm, long long memory_size, int stack_size, int ret_size)
+{
+    assert(vm);
+    assert(memory_size > 0);
+
+    init(&vm->cpu);
+    vm->program = NULL;
+    vm->loaded = false;
+    vm->io.in = NULL;
+    vm->io.out = NULL;
+    vm->io.context = NULL;
+    vm->run = work_threaded;
+    vm->memory.memory = NULL;
+    init_memory_controller(&vm->mc);
+    if (!vm->cpu.cpu_stack || !vm->cpu.ret_addr || !reserve_cpu_stacks(&vm->cpu, stack_size, ret_size) ||
+        init_memory(&vm->memory, memory_size) || add_memory(&vm->mc, &vm->memory)) {
+        destroy_vm(vm);
+        return false;
+    }
+    return true;
+}
+
+//! \brief Decode program for machine, it replaces the previous one
+//! \param [in] vm Machine
+//! \param [in] bytecode Binary program, it is not used after return
+//! \param [in] bytecode_size Size of binary program
+//! \return Returns false, if program can not be decoded
+bool
+load_vm(struct Vm *vm, const char *bytecode, long bytecode_size)
+{
+    assert(vm);
+    assert(bytecode);
+
+    if (vm->loaded) {
+        destroy_program(&vm->own);
+        vm->loaded = false;
+    }
+    vm->program = NULL;
+    // decoder only reads bytecode
+    if (!decode_program((char *)bytecode, bytecode_size, &vm->own)) {
+        return false;
+    }
+    if (fuse_program(&vm->own) < 0) {
+        destroy_program(&vm->own);
+        return false;
+    }
+    vm->loaded = true;
+    vm->program = &vm->own;
+    return true;
+}
+
+//! \brief Use program decoded by caller, it can be shared by several
+//! machines, but must not be changed, while they run
+//! \param [in] vm Machine
+//! \param [in] program Decoded program
+void
+attach_vm(struct Vm *vm, struct Program *program)
+{
+    assert(vm);
+    assert(program);
+
+    if (vm->loaded) {
+        destroy_program(&vm->own);
+        vm->loaded = false;
+    }
+    vm->program = program;
+}
+
+//! \brief Set functions for in and out commands
+//! \param [in] vm Machine
+//! \param [in] io Functions or NULL for no input and output
+void
+set_vm_io(struct Vm *vm, const struct Vm_Io *io)
+{
+    assert(vm);
+
+    if (io) {
+        vm->io = *io;
+    } else {
+        vm->io.in = NULL;
+        vm->io.out = NULL;
+        vm->io.context = NULL;
+    }
+}
+
+//! \brief In command of machine
+static int
+vm_in(void *context, double *value)
+{
+    struct Vm *vm = (struct Vm *)context;
+    return vm->io.in && vm->io.in(vm->io.context, value) ? CPU_IN_VALUE : CPU_IN_NONE;
+}
+
+//! \brief Out command of machine
+static void
+vm_out(void *context, double value)
+{
+    struct Vm *vm = (struct Vm *)context;
+    if (vm->io.out) {
+        vm->io.out(vm->io.context, value);
+    }
+}
+
+//! \brief Execute program from the beginning (or from the place, where the
+//! previous run stopped on limit) in the calling thread
+//! \param [in] vm Machine with program
+//! \param [in] limits Limits or NULL for no limits
+//! \return Returns result from VM_RESULTS
+int
+run_vm(struct Vm *vm, const struct Vm_Limits *limits)
+{
+    assert(vm);
+    assert(vm->program);
+
+    struct Cpu *cpu = &vm->cpu;
+    long long max_commands = limits && limits->max_commands > 0 ? limits->max_commands : LLONG_MAX;
+    int max_calls = limits ? limits->max_calls : 0;
+    int result = VM_FINISHED;
+    cpu_io_set_functions(vm_in, vm_out, vm);
+    // engine pauses cpu after call, which exceeds the limit
+    cpu->max_calls = max_calls > 0 ? max_calls : INT_MAX;
+    while (true) {
+        cpu->pause_at = max_commands;
+        if (!vm->run(vm->program, cpu, &vm->mc)) {
+            result = VM_ERROR;
+            break;
+        }
+        if (cpu->state != PAUSED) {
+            break;
+        }
+        int *ret = NULL;
+        if (cpu->executed >= max_commands) {
+            result = VM_COMMAND_LIMIT;
+            break;
+        }
+        if (max_calls > 0 && get_ret_stack(cpu, &ret) > max_calls) {
+            result = VM_CALL_LIMIT;
+            break;
+        }
+    }
+    // children without fork pool run here
+    if (!fork_join_rest(cpu) && result == VM_FINISHED) {
+        result = VM_ERROR;
+    }
+    cpu_io_set_functions(NULL, NULL, NULL);
+    return result;
+}
+
+//! \brief Prepare machine for the next run of the same program: cpu and
+//! memory are cleared, but keep their allocated memory
+//! \param [in] vm Machine
+void
+reset_vm(struct Vm *vm)
+{
+    assert(vm);
+
+    reset_cpu(&vm->cpu);
+    memset(vm->memory.memory, 0, vm->memory.size * sizeof(double));
+}
+
+//! \brief Free machine and its own program
+//! \param [in] vm Machine
+void
+destroy_vm(struct Vm *vm)
+{
+    assert(vm);
+
+    destroy_cpu(&vm->cpu);
+    if (vm->loaded) {
+        destroy_program(&vm->own);
+        vm->loaded = false;
+    }
+    vm->program = NULL;
+    free(vm->memory.memory);
+    free(vm->mc.memory);
+    vm->memory.memory = NULL;
+    vm->mc.memory = NULL;
+}
+
+//! \brief Allocate machines beforehand
+//! \param [in] pool Pool to init
+//! \param [in] size Number of machines
+//! \param [in] memory_size Memory cells of every machine
+//! \param [in] stack_size Values of cpu stack, which are allocated beforehand
+//! \param [in] ret_size Return addresses, which are allocated beforehand
+//! \return Returns false, if memory can not be allocated
+bool
+init_vm_pool(struct Vm_Pool *pool, int size, long long memory_size, int stack_size, int ret_size)
+{
+    assert(pool);
+    assert(size > 0);
+
+    pool->vms = (struct Vm *)calloc(size, sizeof(struct Vm));
+    pool->free = (int *)calloc(size, sizeof(int));
+    pool->size = 0;
+    pool->free_num = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    if (!pool->vms || !pool->free) {
+        destroy_vm_pool(pool);
+        return false;
+    }
+    for (; pool->size < size; pool->size++) {
+        if (!init_vm(&pool->vms[pool->size], memory_size, stack_size, ret_size)) {
+            destroy_vm_pool(pool);
+            return false;
+        }
+        pool->free[pool->free_num++] = pool->size;
+    }
+    return true;
+}
+
+//! \brief Take free machine, it has no program and no input and output
+//! \param [in] pool Pool
+//! \return Returns machine or NULL, if all machines are taken
+struct Vm *
+take_vm(struct Vm_Pool *pool)
+{
+    assert(pool);
+
+    struct Vm *vm = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_num) {
+        vm = &pool->vms[pool->free[--pool->free_num]];
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return vm;
+}
+
+//! \brief Give machine back to pool, it is reset for the next request
+//! \param [in] pool Pool
+//! \param [in] vm Machine taken from the pool
+void
+give_vm(struct Vm_Pool *pool, struct Vm *vm)
+{
+    assert(pool);
+    assert(vm >= pool->vms && vm < pool->vms + pool->size);
+
+    reset_vm(vm);
+    set_vm_io(vm, NULL);
+    if (vm->loaded) {
+        destroy_program(&vm->own);
+        vm->loaded = false;
+    }
+    vm->program = NULL;
+    pthread_mutex_lock(&pool->lock);
+    pool->free[pool->free_num++] = vm - pool->vms;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+//! \brief Free all machines of pool, they must be given back
+//! \param [in] pool Pool
+void
+destroy_vm_pool(struct Vm_Pool *pool)
+{
+    assert(pool);
+
+    for (int i = 0; pool->vms && i < pool->size; i++) {
+        destroy_vm(&pool->vms[i]);
+    }
+    free(pool->vms);
+    free(pool->free);
+    pool->vms = NULL;
+    pool->free = NULL;
+    pool->size = 0;
+    pool->free_num = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//! \brief Client of cpu --listen: opens several sessions, sends them the
+//! same input line by line, the last session first, and checks, that every
+//! session gives the same output. Output of the first session is printed.
+
+//! Pause between lines, so that server blocks sessions at in command
+constexpr long CLIENT_PAUSE_NS = 2000000;
+
+static char *
+read_all(int fd, int *size)
+{
+    int capacity = 4096;
+    char *text = (char *)malloc(capacity);
+    *size = 0;
+    while (text) {
+        ssize_t got = fd < 0 ? 0 : read(fd, text + *size, capacity - *size);
+        if (got <= 0) {
+            break;
+        }
+        *size += got;
+        if (*size == capacity) {
+            capacity *= 2;
+            text = (char *)realloc(text, capacity);
+        }
+    }
+    return text;
+}
+
+static int
+connect_session(const char *path)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    // server can bind socket before it listens
+    for (int attempt = 0; attempt < 100; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && !connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+            return fd;
+        }
+        close(fd);
+        struct timespec pause = {0, CLIENT_PAUSE_NS};
+        nanosleep(&pause, NULL);
+    }
+    perror("Can not connect");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 4 || atoi(argv[2]) < 1) {
+        fprintf(stderr, "Usage: %s socket sessions input_file\n", argv[0]);
+        return 1;
+    }
+    int sessions = atoi(argv[2]);
+    FILE *input = fopen(argv[3], "r");
+    if (!input) {
+        fprintf(stderr, "Can not open %s\n", argv[3]);
+        return 1;
+    }
+    int *fds = (int *)calloc(sessions, sizeof(int));
+    for (int i = 0; i < sessions; i++) {
+        fds[i] = connect_session(argv[1]);
+    }
+    char line[4096];
+    struct timespec pause = {0, CLIENT_PAUSE_NS};
+    while (fgets(line, sizeof(line), input)) {
+        for (int i = sessions - 1; i >= 0; i--) {
+            // session, which stopped, does not take input
+            send(fds[i], line, strlen(line), MSG_NOSIGNAL);
+        }
+        nanosleep(&pause, NULL);
+    }
+    fclose(input);
+    for (int i = 0; i < sessions; i++) {
+        shutdown(fds[i], SHUT_WR);
+    }
+    int first_size = 0;
+    char *first = read_all(fds[0], &first_size);
+    int result = 0;
+    for (int i = 1; i < sessions; i++) {
+        int size = 0;
+        char *output = read_all(fds[i], &size);
+        if (!output || !first || size != first_size || memcmp(output, first, size)) {
+            fprintf(stderr, "Session %d differs from the first one\n", i);
+            result = 1;
+        }
+        free(output);
+    }
+    if (first) {
+        fwrite(first, 1, first_size, stdout);
+    }
+    for (int i = 0; i < sessions; i++) {
+        close(fds[i]);
+    }
+    free(first);
+    free(fds);
+    return result;
+}
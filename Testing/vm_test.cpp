@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "program.h"
+#include "vm.h"
+
+//! \brief Runs program through libvm: every thread takes machine from pool,
+//! executes program several times with the same input and checks, that
+//! output is the same every time. Output of the first run is printed.
+
+//! Output of one run, values are formatted like cpu does
+struct Test_Output
+{
+    char *text;
+    int size;
+    int capacity;
+};
+
+//! Input and output of one run
+struct Test_Io
+{
+    const double *values;
+    int values_num;
+    int next;
+    struct Test_Output out;
+};
+
+//! Arguments of test thread
+struct Test_Thread
+{
+    struct Vm_Pool *pool;
+    const char *bytecode;
+    int bytecode_size;
+    const double *values;
+    int values_num;
+    int runs;
+    struct Vm_Limits limits;
+    struct Test_Output first;
+    int result;
+    bool ok;
+};
+
+static const char *results[] = {"finished", "error", "commands limit", "call depth limit"};
+
+static bool
+test_in(void *context, double *value)
+{
+    struct Test_Io *io = (struct Test_Io *)context;
+    if (io->next == io->values_num) {
+        return false;
+    }
+    *value = io->values[io->next++];
+    return true;
+}
+
+static void
+test_out(void *context, double value)
+{
+    struct Test_Output *out = &((struct Test_Io *)context)->out;
+    if (out->capacity - out->size < 64) {
+        out->capacity = 2 * out->capacity + 64;
+        out->text = (char *)realloc(out->text, out->capacity);
+        if (!out->text) {
+            fprintf(stderr, "Can not allocate memory for output\n");
+            exit(1);
+        }
+    }
+    out->size += snprintf(out->text + out->size, out->capacity - out->size, "%lf\n", value);
+}
+
+static void *
+run_test_thread(void *arg)
+{
+    struct Test_Thread *thread = (struct Test_Thread *)arg;
+    thread->ok = false;
+    struct Vm *vm = take_vm(thread->pool);
+    if (!vm) {
+        fprintf(stderr, "No free virtual machine\n");
+        return NULL;
+    }
+    if (!load_vm(vm, thread->bytecode, thread->bytecode_size)) {
+        fprintf(stderr, "Program can not be decoded\n");
+        give_vm(thread->pool, vm);
+        return NULL;
+    }
+    struct Test_Io test_io = {thread->values, thread->values_num, 0, {NULL, 0, 0}};
+    struct Vm_Io io = {test_in, test_out, &test_io};
+    set_vm_io(vm, &io);
+    thread->ok = true;
+    for (int i = 0; i < thread->runs; i++) {
+        test_io.next = 0;
+        test_io.out.size = 0;
+        int result = run_vm(vm, &thread->limits);
+        if (!i) {
+            thread->result = result;
+            thread->first = test_io.out;
+            test_io.out.text = NULL;
+            test_io.out.capacity = 0;
+        } else if (result != thread->result || test_io.out.size != thread->first.size ||
+                   (test_io.out.size && memcmp(test_io.out.text, thread->first.text, test_io.out.size))) {
+            fprintf(stderr, "Run %d differs from the first one\n", i);
+            thread->ok = false;
+        }
+        reset_vm(vm);
+    }
+    free(test_io.out.text);
+    give_vm(thread->pool, vm);
+    return NULL;
+}
+
+//! \brief Read whole file
+static char *
+read_whole_file(const char *name, int *size)
+{
+    FILE *file = fopen(name, "rb");
+    if (!file) {
+        return NULL;
+    }
+    char *data = NULL;
+    int capacity = 0;
+    *size = 0;
+    while (true) {
+        if (*size == capacity) {
+            capacity = 2 * capacity + 4096;
+            char *tmp = (char *)realloc(data, capacity);
+            if (!tmp) {
+                free(data);
+                fclose(file);
+                return NULL;
+            }
+            data = tmp;
+        }
+        int got = fread(data + *size, 1, capacity - *size, file);
+        if (got <= 0) {
+            break;
+        }
+        *size += got;
+    }
+    fclose(file);
+    return data;
+}
+
+int
+main(int argc, char **argv)
+{
+    int threads_num = 1;
+    int runs = 1;
+    struct Vm_Limits limits = {0, 0};
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:r:L:D:")) != -1) {
+        long long value = atoll(optarg);
+        if (value < 1 || value > INT_MAX) {
+            fprintf(stderr, "Wrong value %s of -%c option\n", optarg, opt);
+            return 1;
+        }
+        if (opt == 't') {
+            threads_num = value;
+        } else if (opt == 'r') {
+            runs = value;
+        } else if (opt == 'L') {
+            limits.max_commands = value;
+        } else if (opt == 'D') {
+            limits.max_calls = value;
+        } else {
+            fprintf(stderr, "Usage: %s [-t threads] [-r runs] [-L commands] [-D depth] file < input\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Specify program file\n");
+        return 1;
+    }
+    int bytecode_size = 0;
+    char *bytecode = read_whole_file(argv[optind], &bytecode_size);
+    if (!bytecode) {
+        fprintf(stderr, "Can not read file %s\n", argv[optind]);
+        return 1;
+    }
+    double *values = NULL;
+    int values_num = 0;
+    double value = 0;
+    while (scanf("%lf", &value) == 1) {
+        double *tmp = (double *)realloc(values, (values_num + 1) * sizeof(double));
+        if (!tmp) {
+            fprintf(stderr, "Can not allocate memory for input\n");
+            return 1;
+        }
+        values = tmp;
+        values[values_num++] = value;
+    }
+
+    struct Vm_Pool pool;
+    if (!init_vm_pool(&pool, threads_num, 1024, 64, 64)) {
+        fprintf(stderr, "Can not allocate virtual machines\n");
+        return 1;
+    }
+    struct Test_Thread *threads = (struct Test_Thread *)calloc(threads_num, sizeof(struct Test_Thread));
+    pthread_t *ids = (pthread_t *)calloc(threads_num, sizeof(pthread_t));
+    if (!threads || !ids) {
+        fprintf(stderr, "Can not allocate memory for threads\n");
+        return 1;
+    }
+    for (int i = 0; i < threads_num; i++) {
+        threads[i] = {&pool, bytecode, bytecode_size, values, values_num, runs, limits, {NULL, 0, 0}, VM_ERROR, false};
+        if (pthread_create(&ids[i], NULL, run_test_thread, &threads[i])) {
+            fprintf(stderr, "Can not start thread %d\n", i);
+            return 1;
+        }
+    }
+    int ret = 0;
+    for (int i = 0; i < threads_num; i++) {
+        pthread_join(ids[i], NULL);
+        if (!threads[i].ok) {
+            ret = 1;
+        } else if (threads[i].result != threads[0].result || threads[i].first.size != threads[0].first.size ||
+                   (threads[i].first.size &&
+                    memcmp(threads[i].first.text, threads[0].first.text, threads[i].first.size))) {
+            fprintf(stderr, "Thread %d differs from the first one\n", i);
+            ret = 1;
+        }
+    }
+    if (threads[0].ok) {
+        fwrite(threads[0].first.text, 1, threads[0].first.size, stdout);
+        fprintf(stderr, "Result: %s\n", results[threads[0].result]);
+    }
+    for (int i = 0; i < threads_num; i++) {
+        free(threads[i].first.text);
+    }
+    free(threads);
+    free(ids);
+    destroy_vm_pool(&pool);
+    free(values);
+    free(bytecode);
+    return ret;
+}